@@ -0,0 +1,374 @@
+#!/usr/bin/env python3
+
+"""Performance regression gate for the libSpace benchmarks.
+
+Runs space_benchmark with repetitions, computes a confidence interval
+of ns_per_op for each benchmark and compares it with a stored baseline.
+
+    $ ./bench_gate.py                       # compare with bench_baseline.json
+    $ ./bench_gate.py --update-baseline     # record a new baseline
+    $ ./bench_gate.py -f 'cross|rotate' -n 10 -t 0.10
+
+A benchmark regresses when the lower end of its confidence interval is
+more than --threshold above the baseline mean. Both the statistical
+and the practical margin must be exceeded. A baseline benchmark
+matching the filter that did not run is MISSING, which also fails, so
+a renamed, deleted or crashing benchmark does not pass. The exit
+status is 1 when anything regressed or is missing and 0 otherwise.
+2 means the gate could not run.
+Benchmarks the baseline does not have are listed as new and are not
+gated until --update-baseline records them.
+
+The benchmark is pinned to one cpu (--cpu, default the last one
+allowed), and the repetitions are randomly interleaved. Noise
+indicators are reported with the results:
+  - the cpu frequency governor and the frequency range seen during the
+    run,
+  - turbo boost,
+  - the load average before and after,
+  - each benchmark's coefficient of variation.
+A run that looks noisy is flagged, but the verdict is still given.
+
+A baseline is only meaningful on the machine that recorded it. The
+committed one documents the format. Record one with
+--update-baseline on the box that runs the gate. A baseline from
+another host exits 2 before running anything, unless --force is given.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# two sided 95% student t critical values by degrees of freedom.
+T_95 = {1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447,
+        7: 2.365, 8: 2.306, 9: 2.262, 10: 2.228, 12: 2.179, 15: 2.131,
+        20: 2.086, 30: 2.042}
+
+NOISY_CV = 0.05  # coefficient of variation that flags a benchmark
+
+
+# ======================
+# ===== statistics =====
+# ======================
+
+def t_critical(dof):
+    """95% t value, rounding dof down to the table, normal beyond it."""
+    if dof < 1:
+        return float('inf')
+    known = [k for k in sorted(T_95) if k <= dof]
+    if dof > max(T_95):
+        return 1.96
+    return T_95[known[-1]]
+
+
+def summarize(samples):
+    """Returns mean, half width of the 95% CI, cv and n of samples."""
+    n = len(samples)
+    mean = statistics.mean(samples)
+    stdev = statistics.stdev(samples) if n > 1 else 0.0
+    half = t_critical(n - 1) * stdev / math.sqrt(n) if n > 1 else float('inf')
+    return {'mean': mean,
+            'ci': half,
+            'cv': stdev / mean if mean else 0.0,
+            'median': statistics.median(samples),
+            'n': n}
+
+
+# ========================
+# ===== noise checks =====
+# ========================
+
+def read(path):
+    try:
+        with open(path) as f:
+            return f.read().strip()
+    except (IOError, OSError):
+        return None
+
+
+class FrequencyMonitor(threading.Thread):
+    """Samples the pinned cpu's scaling_cur_freq while the benchmark runs."""
+
+    def __init__(self, cpu, period=0.25):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.path = '/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq' % cpu
+        self.period = period
+        self.samples = []
+        self.done = threading.Event()
+
+    def run(self):
+        while not self.done.wait(self.period):
+            value = read(self.path)
+            if value is not None:
+                self.samples.append(int(value) / 1000.0)  # MHz
+
+    def stop(self):
+        self.done.set()
+        self.join()
+
+
+def system_noise(cpu):
+    """Static noise indicators for cpu, None where unknown."""
+
+    cpufreq = '/sys/devices/system/cpu/cpu%d/cpufreq/' % cpu
+
+    no_turbo = read('/sys/devices/system/cpu/intel_pstate/no_turbo')
+    boost = read('/sys/devices/system/cpu/cpufreq/boost')
+
+    if no_turbo is not None:
+        turbo = no_turbo == '0'
+    elif boost is not None:
+        turbo = boost == '1'
+    else:
+        turbo = None
+
+    return {'governor': read(cpufreq + 'scaling_governor'),
+            'min_mhz': read(cpufreq + 'scaling_min_freq'),
+            'max_mhz': read(cpufreq + 'scaling_max_freq'),
+            'turbo': turbo}
+
+
+def noise_warnings(noise, context):
+    """Returns human readable reasons the run may be noisy."""
+
+    warnings = []
+
+    if noise['governor'] not in (None, 'performance'):
+        warnings.append('cpu governor is %s, not performance' % noise['governor'])
+
+    if noise['turbo']:
+        warnings.append('turbo boost is on')
+
+    if context.get('cpu_scaling_enabled'):
+        warnings.append('google benchmark reports cpu scaling enabled')
+
+    mhz = noise.get('observed_mhz')
+    if mhz and mhz['max'] > 0 and (mhz['max'] - mhz['min']) / mhz['max'] > 0.05:
+        warnings.append('cpu frequency moved %.0f-%.0f MHz during the run' % (mhz['min'], mhz['max']))
+
+    if noise['load_before'] > 0.5 * noise['cpus'] or noise['load_after'] > 0.5 * noise['cpus']:
+        warnings.append('load average %.2f/%.2f on %d cpus' % (noise['load_before'],
+                                                               noise['load_after'], noise['cpus']))
+
+    if context.get('library_build_type') == 'debug':
+        warnings.append('google benchmark library is a debug build')
+
+    return warnings
+
+
+# ==========================
+# ===== benchmark runs =====
+# ==========================
+
+def run_benchmarks(args):
+    """Runs space_benchmark pinned to args.cpu, returns (samples, context, noise)."""
+
+    os.sched_setaffinity(0, {args.cpu})  # inherited by the child
+
+    noise = system_noise(args.cpu)
+    noise['cpu'] = args.cpu
+    noise['cpus'] = os.cpu_count()
+    noise['load_before'] = os.getloadavg()[0]
+
+    with tempfile.NamedTemporaryFile(suffix='.json') as out:
+
+        command = [args.benchmark,
+                   '--benchmark_filter=%s' % args.filter,
+                   '--benchmark_repetitions=%d' % args.repetitions,
+                   '--benchmark_enable_random_interleaving=true',
+                   '--benchmark_min_time=%g' % args.min_time,
+                   '--benchmark_out=%s' % out.name,
+                   '--benchmark_out_format=json']
+
+        monitor = FrequencyMonitor(args.cpu)
+        monitor.start()
+        try:
+            subprocess.check_call(command, stdout=subprocess.DEVNULL)
+        finally:
+            monitor.stop()
+
+        report = json.load(open(out.name))
+
+    noise['load_after'] = os.getloadavg()[0]
+    if monitor.samples:
+        noise['observed_mhz'] = {'min': min(monitor.samples), 'max': max(monitor.samples)}
+
+    samples = {}
+    for entry in report['benchmarks']:
+        if entry.get('run_type') == 'iteration':
+            samples.setdefault(entry['run_name'], []).append(entry['ns_per_op'])
+
+    return samples, report['context'], noise
+
+
+# ======================
+# ===== comparison =====
+# ======================
+
+def compare(current, baseline, threshold, pattern):
+    """Returns rows of (name, verdict, current, baseline, change).
+
+    Baseline benchmarks matching pattern that did not run are MISSING.
+    """
+
+    rows = []
+
+    for name in sorted(current):
+
+        now = current[name]
+        base = baseline.get(name)
+
+        if base is None:
+            rows.append((name, 'new', now, None, None))
+            continue
+
+        change = now['mean'] / base['mean'] - 1.0
+        limit = base['mean'] * (1.0 + threshold)
+
+        if now['mean'] - now['ci'] > limit:
+            verdict = 'REGRESSED'
+        elif now['mean'] + now['ci'] < base['mean'] * (1.0 - threshold):
+            verdict = 'improved'
+        else:
+            verdict = 'ok'
+
+        if now['cv'] > NOISY_CV and verdict == 'ok':
+            verdict = 'ok noisy'
+
+        rows.append((name, verdict, now, base, change))
+
+    for name in sorted(set(baseline) - set(current)):
+        if re.search(pattern, name):
+            rows.append((name, 'MISSING', None, baseline[name], None))
+
+    return rows
+
+
+def print_rows(rows, output):
+    output.write('%-28s %-10s %18s %10s %8s %6s\n' % ('benchmark', 'verdict', 'ns/op (95% CI)',
+                                                      'baseline', 'change', 'cv'))
+    for name, verdict, now, base, change in rows:
+        output.write('%-28s %-10s %18s %10s %8s %6s\n' % (
+            name, verdict,
+            '%.3f +- %.3f' % (now['mean'], now['ci']) if now else '-',
+            '%.3f' % base['mean'] if base else '-',
+            '%+.1f%%' % (100 * change) if change is not None else '-',
+            '%.1f%%' % (100 * now['cv']) if now else '-'))
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('-b', '--baseline', default=os.path.join(HERE, 'bench_baseline.json'),
+                        help='baseline json, default %(default)s')
+    parser.add_argument('--benchmark', default=os.path.join(HERE, 'space_benchmark'),
+                        help='benchmark executable, default %(default)s')
+    parser.add_argument('-f', '--filter', default='/(L1|L2)$',
+                        help='benchmark regex, default the cache resident sizes %(default)s')
+    parser.add_argument('-n', '--repetitions', type=int, default=5,
+                        help='repetitions per benchmark, default %(default)s')
+    parser.add_argument('-m', '--min-time', type=float, default=0.1,
+                        help='seconds per repetition, default %(default)s')
+    parser.add_argument('-t', '--threshold', type=float, default=0.05,
+                        help='allowed slowdown as a fraction, default %(default)s')
+    parser.add_argument('--cpu', type=int, default=max(os.sched_getaffinity(0)),
+                        help='cpu to pin to, default %(default)s')
+    parser.add_argument('-o', '--output', help='also write this run as json')
+    parser.add_argument('--update-baseline', action='store_true',
+                        help='write this run as the baseline and exit 0')
+    parser.add_argument('--force', action='store_true',
+                        help='compare with a baseline recorded on another host')
+    args = parser.parse_args()
+
+    if not os.path.exists(args.benchmark):
+        sys.stderr.write('%s not found, run make space_benchmark\n' % args.benchmark)
+        sys.exit(2)
+
+    if args.repetitions < 2:
+        sys.stderr.write('need at least 2 repetitions for a confidence interval\n')
+        sys.exit(2)
+
+    # checked before the run, which takes minutes.
+    if not args.update_baseline:
+        try:
+            baseline_run = json.load(open(args.baseline))
+        except (IOError, OSError, ValueError) as err:
+            sys.stderr.write('can not read baseline %s: %s\n' % (args.baseline, err))
+            sys.exit(2)
+
+        if baseline_run.get('host') != platform.node():
+            sys.stderr.write('baseline is from %s, this is %s. Record one here with'
+                             ' --update-baseline, or compare anyway with --force\n'
+                             % (baseline_run.get('host'), platform.node()))
+            if not args.force:
+                sys.exit(2)
+
+    samples, context, noise = run_benchmarks(args)
+
+    if not samples:
+        sys.stderr.write('no benchmarks matched %s\n' % args.filter)
+        sys.exit(2)
+
+    current = dict((name, summarize(values)) for name, values in samples.items())
+
+    warnings = noise_warnings(noise, context)
+
+    run = {'host': platform.node(),
+           'date': context.get('date'),
+           'mhz_per_cpu': context.get('mhz_per_cpu'),
+           'caches': context.get('caches'),
+           'filter': args.filter,
+           'repetitions': args.repetitions,
+           'noise': noise,
+           'warnings': warnings,
+           'benchmarks': current}
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(run, f, indent=2, sort_keys=True)
+
+    for warning in warnings:
+        sys.stderr.write('# noise: %s\n' % warning)
+
+    if args.update_baseline:
+        with open(args.baseline, 'w') as f:
+            json.dump(run, f, indent=2, sort_keys=True)
+            f.write('\n')
+        sys.stderr.write('# wrote %d benchmarks to %s\n' % (len(current), args.baseline))
+        sys.exit(0)
+
+    rows = compare(current, baseline_run['benchmarks'], args.threshold, args.filter)
+    print_rows(rows, sys.stdout)
+
+    ungated = [row[0] for row in rows if row[1] == 'new']
+
+    if ungated:
+        sys.stdout.write('\n%d not in the baseline, not gated: %s\n' % (len(ungated), ' '.join(ungated)))
+        sys.stdout.write('record them with --update-baseline\n')
+
+    regressed = [row[0] for row in rows if row[1] == 'REGRESSED']
+    missing = [row[0] for row in rows if row[1] == 'MISSING']
+
+    if regressed:
+        sys.stdout.write('\n%d regressed beyond %.0f%%: %s\n' % (len(regressed), 100 * args.threshold,
+                                                               ' '.join(regressed)))
+
+    if missing:
+        sys.stdout.write('\n%d in the baseline did not run: %s\n' % (len(missing), ' '.join(missing)))
+
+    if regressed or missing:
+        sys.exit(1)
+
+    sys.stdout.write('\nno regressions beyond %.0f%%\n' % (100 * args.threshold))
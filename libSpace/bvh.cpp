@@ -0,0 +1,338 @@
+// ==================================================================
+// Filename:    bvh.cpp
+// Description: Implements the BVH class.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <bvh.h>
+#include <parallel.h>
+
+// ---------------------
+// ----- class BVH -----
+// ---------------------
+
+const unsigned int Cartesian::BVH::leaf_size(2);
+
+namespace {
+
+  const unsigned int bvh_bins(16);      // per axis for the surface area heuristic
+  const unsigned int bvh_max_leaf(16);  // boxes, larger nodes always split
+  const unsigned int bvh_max_depth(40); // below it nodes split at the median
+  const unsigned int bvh_stack(128);    // bvh_max_depth plus log2 of any size, with room
+
+}
+
+Cartesian::BVH::BVH(const unsigned int& a_threads) :
+  m_threads(a_threads)
+{}
+
+void Cartesian::BVH::build(const Cartesian::aabb* boxes,
+			   const unsigned long& a_size) {
+
+  SPACE_TRACE("BVH build");
+
+  m_nodes.clear();
+  m_boxes.resize(a_size);
+  m_indices.resize(a_size);
+
+  if (a_size == 0)
+    return;
+
+  // the boxes are partitioned with their centers and indices, not
+  // through an index array, so each pass over a node is sequential.
+  std::vector<Item> items(a_size);
+  for (unsigned long k = 0; k < a_size; ++k) {
+    items[k].m_box = boxes[k];
+    items[k].m_center = boxes[k].center();
+    items[k].m_index = k;
+  }
+
+  m_nodes.reserve(2 * a_size / leaf_size + 1);
+  split(items, 0, a_size, 0);
+
+  for (unsigned long k = 0; k < a_size; ++k) {
+    m_boxes[k] = items[k].m_box;
+    m_indices[k] = items[k].m_index;
+  }
+}
+
+// The node for [a_begin, a_end) of items, then its children. A split
+// costs one box test to enter plus the children's boxes weighted by
+// their share of the parent's area, a leaf costs its boxes.
+unsigned long Cartesian::BVH::split(std::vector<Item>& items,
+				    const unsigned long& a_begin,
+				    const unsigned long& a_end,
+				    const unsigned int& a_depth) {
+
+  const unsigned long index(m_nodes.size());
+  m_nodes.push_back(Node());
+
+  Cartesian::aabb box, spread;
+  for (unsigned long k = a_begin; k < a_end; ++k) {
+    box.merge(items[k].m_box);
+    spread.merge(items[k].m_center);
+  }
+
+  const unsigned long count(a_end - a_begin);
+  const Cartesian::space width(spread.extent());
+  const double widths[3] = {width.x(), width.y(), width.z()};
+  const double lows[3] = {spread.lo().x(), spread.lo().y(), spread.lo().z()};
+  double scales[3];
+  for (unsigned int axis = 0; axis < 3; ++axis)
+    scales[axis] = widths[axis] > 0 ? bvh_bins / widths[axis] : 0;
+
+  auto bin = [&](const Cartesian::space& a_center, const unsigned int& an_axis) {
+    return std::min((unsigned int) ((coordinate(a_center, an_axis) - lows[an_axis]) * scales[an_axis]),
+		    bvh_bins - 1);
+  };
+
+  double best_cost(count * box.area());
+  unsigned int best_axis(3), best_bin(0);
+
+  if (count > leaf_size && a_depth < bvh_max_depth) {
+
+    Cartesian::aabb bin_boxes[3][bvh_bins];
+    unsigned long bin_counts[3][bvh_bins] = {{0}};
+    for (unsigned long k = a_begin; k < a_end; ++k)
+      for (unsigned int axis = 0; axis < 3; ++axis) {
+	const unsigned int b(bin(items[k].m_center, axis));
+	bin_boxes[axis][b].merge(items[k].m_box);
+	++bin_counts[axis][b];
+      }
+
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+
+      if (!(widths[axis] > 0))
+	continue;
+
+      // the right sides' costs from the top down, then the left sides'.
+      double right_costs[bvh_bins];
+      Cartesian::aabb right;
+      unsigned long right_count(0);
+      for (unsigned int b = bvh_bins - 1; b > 0; --b) {
+	right.merge(bin_boxes[axis][b]);
+	right_count += bin_counts[axis][b];
+	right_costs[b] = right_count * right.area();
+      }
+
+      Cartesian::aabb left;
+      unsigned long left_count(0);
+      for (unsigned int b = 0; b + 1 < bvh_bins; ++b) {
+	left.merge(bin_boxes[axis][b]);
+	left_count += bin_counts[axis][b];
+	const double cost(box.area() + left_count * left.area() + right_costs[b + 1]);
+	if (left_count > 0 && left_count < count && cost < best_cost) {
+	  best_cost = cost;
+	  best_axis = axis;
+	  best_bin = b;
+	}
+      }
+    }
+  }
+
+  unsigned long middle(a_begin);
+
+  if (best_axis < 3) {
+    middle = std::partition(items.begin() + a_begin, items.begin() + a_end,
+			    [&](const Item& an_item) {
+			      return bin(an_item.m_center, best_axis) <= best_bin;
+			    }) - items.begin();
+  } else if (count > bvh_max_leaf || (count > leaf_size && a_depth >= bvh_max_depth)) {
+    // the heuristic found nothing, the centers coincide, or the tree
+    // is too deep: the median of the widest spread.
+    const unsigned int axis(widths[0] >= widths[1] ? (widths[0] >= widths[2] ? 0 : 2) :
+			    (widths[1] >= widths[2] ? 1 : 2));
+    middle = a_begin + count / 2;
+    std::nth_element(items.begin() + a_begin, items.begin() + middle, items.begin() + a_end,
+		     [&](const Item& a, const Item& b) {
+		       return coordinate(a.m_center, axis) < coordinate(b.m_center, axis);
+		     });
+  }
+
+  if (middle == a_begin) {
+    m_nodes[index].m_box = box;
+    m_nodes[index].m_right = 0;
+    m_nodes[index].m_first = a_begin;
+    m_nodes[index].m_count = count;
+    return index;
+  }
+
+  split(items, a_begin, middle, a_depth + 1);
+  const unsigned long right(split(items, middle, a_end, a_depth + 1));
+
+  m_nodes[index].m_box = box;
+  m_nodes[index].m_right = right;
+  m_nodes[index].m_first = a_begin;
+  m_nodes[index].m_count = 0;
+  return index;
+}
+
+// Children follow their parents, so one pass from the last node up
+// sees every child before its parent.
+void Cartesian::BVH::refit(const Cartesian::aabb* boxes,
+			   const unsigned long& a_size) {
+
+  if (a_size != size()) {
+    build(boxes, a_size);
+    return;
+  }
+
+  SPACE_TRACE("BVH refit");
+
+  for (unsigned long k = 0; k < a_size; ++k)
+    m_boxes[k] = boxes[m_indices[k]];
+
+  for (unsigned long i = m_nodes.size(); i-- > 0;) {
+    Node& node(m_nodes[i]);
+    if (node.m_count) {
+      node.m_box = Cartesian::aabb();
+      for (unsigned long k = node.m_first; k < node.m_first + node.m_count; ++k)
+	node.m_box.merge(m_boxes[k]);
+    } else {
+      node.m_box = m_nodes[i + 1].m_box;
+      node.m_box.merge(m_nodes[node.m_right].m_box);
+    }
+  }
+}
+
+void Cartesian::BVH::overlaps(const Cartesian::aabb& a_box,
+			      std::vector<unsigned long>& a_results) const {
+
+  a_results.clear();
+
+  if (m_nodes.empty())
+    return;
+
+  unsigned int stack[bvh_stack];
+  unsigned int top(0);
+  stack[top++] = 0;
+
+  while (top > 0) {
+    const unsigned int i(stack[--top]);
+    const Node& node(m_nodes[i]);
+    if (!node.m_box.overlaps(a_box))
+      continue;
+    if (node.m_count) {
+      for (unsigned long k = node.m_first; k < node.m_first + node.m_count; ++k)
+	if (m_boxes[k].overlaps(a_box))
+	  a_results.push_back(m_indices[k]);
+    } else {
+      stack[top++] = node.m_right;
+      stack[top++] = i + 1;
+    }
+  }
+}
+
+void Cartesian::BVH::overlaps(const Cartesian::aabb* queries,
+			      const unsigned long& a_size,
+			      std::vector< std::pair<unsigned long, unsigned long> >& a_pairs) const {
+
+  SPACE_TRACE("BVH overlaps batch");
+
+  // each block of queries to its own list, joined in order.
+  const unsigned long block(256);
+  std::vector< std::vector< std::pair<unsigned long, unsigned long> > > parts((a_size + block - 1) / block);
+
+  parallel_blocks(worker_count(m_threads), a_size, block,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    std::vector< std::pair<unsigned long, unsigned long> >& part(parts[a_first / block]);
+		    std::vector<unsigned long> found;
+		    for (unsigned long q = a_first; q < a_last; ++q) {
+		      overlaps(queries[q], found);
+		      std::sort(found.begin(), found.end());
+		      for (unsigned long k = 0; k < found.size(); ++k)
+			part.push_back(std::make_pair(q, found[k]));
+		    }
+		  });
+
+  a_pairs.clear();
+  for (unsigned long p = 0; p < parts.size(); ++p)
+    a_pairs.insert(a_pairs.end(), parts[p].begin(), parts[p].end());
+}
+
+// Nearer child first, and a node is skipped when the ray enters it
+// after the nearest box hit so far.
+unsigned long Cartesian::BVH::ray(const Cartesian::space& a_origin,
+				  const Cartesian::space& a_direction,
+				  const double& a_t_max,
+				  double& a_t) const {
+
+  unsigned long hit(size());
+
+  if (m_nodes.empty())
+    return hit;
+
+  const Cartesian::space inverse(1 / a_direction.x(), 1 / a_direction.y(), 1 / a_direction.z());
+  double best(a_t_max), t;
+
+  unsigned int stack[bvh_stack];
+  unsigned int top(0);
+  if (m_nodes[0].m_box.ray(a_origin, inverse, best, t))
+    stack[top++] = 0;
+
+  while (top > 0) {
+    const unsigned int i(stack[--top]);
+    const Node& node(m_nodes[i]);
+    if (node.m_count) {
+      for (unsigned long k = node.m_first; k < node.m_first + node.m_count; ++k)
+	if (m_boxes[k].ray(a_origin, inverse, best, t) &&
+	    (t < best || hit == size() || m_indices[k] < hit)) {
+	  best = t;
+	  hit = m_indices[k];
+	}
+      continue;
+    }
+    double t_left, t_right;
+    const bool left(m_nodes[i + 1].m_box.ray(a_origin, inverse, best, t_left));
+    const bool right(m_nodes[node.m_right].m_box.ray(a_origin, inverse, best, t_right));
+    if (left && right) {
+      stack[top++] = t_left <= t_right ? node.m_right : i + 1;
+      stack[top++] = t_left <= t_right ? i + 1 : node.m_right;
+    } else if (left) {
+      stack[top++] = i + 1;
+    } else if (right) {
+      stack[top++] = node.m_right;
+    }
+  }
+
+  if (hit < size())
+    a_t = best;
+  return hit;
+}
+
+void Cartesian::BVH::rays(const Cartesian::space* origins,
+			  const Cartesian::space* directions,
+			  const double& a_t_max,
+			  const unsigned long& a_size,
+			  unsigned long* a_hits,
+			  double* a_ts) const {
+
+  SPACE_TRACE("BVH rays batch");
+
+  parallel_blocks(worker_count(m_threads), a_size, 256,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    for (unsigned long r = a_first; r < a_last; ++r) {
+		      a_ts[r] = a_t_max;
+		      a_hits[r] = ray(origins[r], directions[r], a_t_max, a_ts[r]);
+		    }
+		  });
+}
@@ -0,0 +1,215 @@
+// ================================================================
+// Filename:    bvh.h
+// Description: Axis aligned bounding boxes of space points and a
+//              bounding volume hierarchy over them.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // ----------------------
+  // ----- class aabb -----
+  // ----------------------
+
+  // Axis aligned box [lo, hi], for broad phase tests between objects
+  // placed with space. The default box is empty, lo +inf and hi -inf,
+  // so merging anything into it gives that thing's box.
+
+  class aabb {
+
+  public:
+
+    aabb() : m_lo(INFINITY, INFINITY, INFINITY), m_hi(-INFINITY, -INFINITY, -INFINITY) {}
+    explicit aabb(const space& a_point) : m_lo(a_point), m_hi(a_point) {}
+    aabb(const space& a_lo, const space& a_hi) : m_lo(a_lo), m_hi(a_hi) {}
+   ~aabb() {}; // dtor
+
+    const space& lo() const {return m_lo;}
+    const space& hi() const {return m_hi;}
+
+    bool  empty() const  {return !(m_lo.x() <= m_hi.x() && m_lo.y() <= m_hi.y() && m_lo.z() <= m_hi.z());}
+    space center() const {return (m_lo + m_hi) * 0.5;}
+    space extent() const {return m_hi - m_lo;}
+
+    inline double area() const;  // of the surface, 0 if empty
+
+    inline aabb& merge(const aabb& a_box);
+    inline aabb& merge(const space& a_point);
+
+    inline bool overlaps(const aabb& a_box) const;  // touching counts
+    inline bool contains(const space& a_point) const;
+
+    // the slab test of the ray a_origin + t * direction for t in
+    // [0, a_t_max], given an_inverse, 1 / direction by component. a_t is
+    // where it enters, 0 from inside.
+    inline bool ray(const space& a_origin, const space& an_inverse,
+		    const double& a_t_max, double& a_t) const;
+
+  private:
+
+    space m_lo;
+    space m_hi;
+
+  };
+
+  inline double aabb::area() const {
+    if (empty())
+      return 0;
+    const space e(extent());
+    return 2 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+  }
+
+  inline aabb& aabb::merge(const aabb& a_box) {
+    m_lo = space(std::min(m_lo.x(), a_box.m_lo.x()), std::min(m_lo.y(), a_box.m_lo.y()),
+		 std::min(m_lo.z(), a_box.m_lo.z()));
+    m_hi = space(std::max(m_hi.x(), a_box.m_hi.x()), std::max(m_hi.y(), a_box.m_hi.y()),
+		 std::max(m_hi.z(), a_box.m_hi.z()));
+    return *this;
+  }
+
+  inline aabb& aabb::merge(const space& a_point) {
+    return merge(aabb(a_point));
+  }
+
+  inline bool aabb::overlaps(const aabb& a_box) const {
+    return (m_lo.x() <= a_box.m_hi.x() && a_box.m_lo.x() <= m_hi.x() &&
+	    m_lo.y() <= a_box.m_hi.y() && a_box.m_lo.y() <= m_hi.y() &&
+	    m_lo.z() <= a_box.m_hi.z() && a_box.m_lo.z() <= m_hi.z());
+  }
+
+  inline bool aabb::contains(const space& a_point) const {
+    return (m_lo.x() <= a_point.x() && a_point.x() <= m_hi.x() &&
+	    m_lo.y() <= a_point.y() && a_point.y() <= m_hi.y() &&
+	    m_lo.z() <= a_point.z() && a_point.z() <= m_hi.z());
+  }
+
+  // A zero direction component has an infinite inverse, so its slab is
+  // all t or none. An origin exactly on one of those planes gives 0 *
+  // inf, a NaN, and may miss.
+  inline bool aabb::ray(const space& a_origin, const space& an_inverse,
+			const double& a_t_max, double& a_t) const {
+    double near(0), far(a_t_max);
+    const double lo[3] = {m_lo.x(), m_lo.y(), m_lo.z()};
+    const double hi[3] = {m_hi.x(), m_hi.y(), m_hi.z()};
+    const double origin[3] = {a_origin.x(), a_origin.y(), a_origin.z()};
+    const double inverse[3] = {an_inverse.x(), an_inverse.y(), an_inverse.z()};
+    for (int a = 0; a < 3; ++a) {
+      const double t0((lo[a] - origin[a]) * inverse[a]);
+      const double t1((hi[a] - origin[a]) * inverse[a]);
+      const double enter(t0 < t1 ? t0 : t1), leave(t0 < t1 ? t1 : t0);
+      near = enter > near ? enter : near;
+      far = leave < far ? leave : far;
+    }
+    a_t = near;
+    return near <= far;
+  }
+
+
+  // ---------------------
+  // ----- class BVH -----
+  // ---------------------
+
+  // Bounding volume hierarchy over aabbs, for broad phase overlap and
+  // ray queries. Results are indices into the array passed to build().
+  //
+  // build() splits each node where the surface area heuristic is least,
+  // over bvh_bins bins of the box centers on each axis, and makes a
+  // leaf at leaf_size or fewer boxes, or when no split is cheaper than
+  // testing every box and there are at most bvh_max_leaf. The nodes are one vector, depth first, so the
+  // left child follows its parent. refit() takes moved boxes of the
+  // same objects and recomputes the node boxes bottom up without
+  // changing the tree, which degrades as the objects move away from
+  // where they were built; build() again then. The batch queries run
+  // on a_threads threads, 0 is one per core.
+
+  class BVH {
+
+  public:
+
+    static const unsigned int leaf_size;  /// at most this many boxes always make a leaf
+
+    BVH(const unsigned int& a_threads=1);
+   ~BVH() {}; // dtor
+
+    const unsigned int& threads() const                  {return m_threads;}
+    void                threads(const unsigned int& a_n) {m_threads = a_n;}
+
+    unsigned long size() const  {return m_boxes.size();}  // objects
+    unsigned long nodes() const {return m_nodes.size();}
+    aabb          bounds() const {return m_nodes.empty() ? aabb() : m_nodes[0].m_box;}
+
+    void build(const aabb* boxes, const unsigned long& a_size);
+
+    // the same objects, moved. A different a_size is a build().
+    void refit(const aabb* boxes, const unsigned long& a_size);
+
+    // the boxes that overlap a_box, in no order.
+    void overlaps(const aabb& a_box, std::vector<unsigned long>& a_results) const;
+
+    // (query, box) for each of a_size query boxes and each box it
+    // overlaps, by query then box. With the built boxes as the queries
+    // that is every overlapping pair twice and each box with itself.
+    void overlaps(const aabb* queries, const unsigned long& a_size,
+		  std::vector< std::pair<unsigned long, unsigned long> >& a_pairs) const;
+
+    // the box the ray a_origin + t * a_direction, t in [0, a_t_max],
+    // enters first, and a_t where, or size() if none.
+    unsigned long ray(const space& a_origin, const space& a_direction,
+		      const double& a_t_max, double& a_t) const;
+
+    // ray() for a_size rays, the hits and entries to a_hits and a_ts.
+    void rays(const space* origins, const space* directions, const double& a_t_max,
+	      const unsigned long& a_size, unsigned long* a_hits, double* a_ts) const;
+
+  private:
+
+    struct Node {
+      aabb         m_box;
+      unsigned int m_right;  /// right child of an interior node, the left is the next node
+      unsigned int m_first;  /// first box of a leaf
+      unsigned int m_count;  /// boxes in a leaf, 0 for an interior node
+    };
+
+    struct Item {
+      aabb          m_box;
+      space         m_center;
+      unsigned long m_index;
+    };
+
+    unsigned long split(std::vector<Item>& items, const unsigned long& a_begin,
+			const unsigned long& a_end, const unsigned int& a_depth);
+
+    unsigned int               m_threads;
+
+    std::vector<Node>          m_nodes;
+    std::vector<aabb>          m_boxes;    /// in leaf order
+    std::vector<unsigned long> m_indices;  /// build() index of each, in leaf order
+
+  };
+
+} // end namespace Cartesian
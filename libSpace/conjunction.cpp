@@ -0,0 +1,212 @@
+// ==================================================================
+// Filename:    conjunction.cpp
+// Description: Implements the ConjunctionScreen class.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <conjunction.h>
+#include <bvh.h>
+#include <parallel.h>
+
+// -----------------------------------
+// ----- class ConjunctionScreen -----
+// -----------------------------------
+
+const unsigned int Cartesian::ConjunctionScreen::default_window(2);
+
+namespace {
+
+  // the closest approach over one interval of two tracks a distance r0
+  // apart at its start and r1 at its end: the fraction of the interval
+  // to a_s and the squared distance to a_d2.
+  inline void closest_approach(const Cartesian::space& r0, const Cartesian::space& r1,
+			       double& a_s, double& a_d2) {
+    const Cartesian::space v(r1 - r0);
+    const double vv(v.magnitude2());
+    a_s = vv > 0 ? std::min(std::max(-(r0 * v) / vv, 0.0), 1.0) : 0;
+    a_d2 = (r0 + a_s * v).magnitude2();
+  }
+
+}
+
+Cartesian::ConjunctionScreen::ConjunctionScreen(const double& a_threshold,
+						const double& a_dt,
+						const unsigned int& a_window,
+						const unsigned int& a_threads) :
+  m_threshold(a_threshold),
+  m_dt(a_dt),
+  m_window(a_window),
+  m_threads(a_threads)
+{
+  if (!(a_threshold >= 0))
+    throw Cartesian::SpaceError("ConjunctionScreen threshold must not be negative");
+  if (!(a_dt > 0))
+    throw Cartesian::SpaceError("ConjunctionScreen dt must be positive");
+  if (a_window == 0)
+    throw Cartesian::SpaceError("ConjunctionScreen window must be positive");
+}
+
+unsigned long Cartesian::ConjunctionScreen::screen(const Cartesian::SpaceRecorder* recorders,
+						   const unsigned long& a_size,
+						   std::vector<Conjunction>& a_results) const {
+
+  SPACE_TRACE("ConjunctionScreen screen");
+
+  a_results.clear();
+
+  if (a_size < 2)
+    return 0;
+
+  unsigned long samples(recorders[0].size());
+  for (unsigned long i = 1; i < a_size; ++i)
+    samples = std::min(samples, recorders[i].size());
+
+  if (samples == 0)
+    return 0;
+
+  // the newest samples line up, so each recorder skips its extra oldest.
+  std::vector<unsigned long> offsets(a_size);
+  for (unsigned long i = 0; i < a_size; ++i)
+    offsets[i] = recorders[i].size() - samples;
+
+  // window w is samples [w * m_window, w * m_window + m_window], the
+  // last one shared with the next window, clipped to the samples.
+  const unsigned long windows(samples > 1 ? (samples - 2) / m_window + 1 : 1);
+  auto first_sample = [&](const unsigned long& a_window) {return a_window * m_window;};
+  auto last_sample = [&](const unsigned long& a_window) {
+    return std::min(a_window * m_window + m_window, samples - 1);
+  };
+
+  const unsigned long threads(worker_count(m_threads));
+  const unsigned long block(std::max(windows / (4 * threads), 1ul));
+  std::vector< std::vector<KeyIndex> > parts((windows + block - 1) / block);
+
+  // the candidates, pair key then window, of each block of windows.
+  parallel_blocks(threads, windows, block,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    std::vector<KeyIndex>& part(parts[a_first / block]);
+		    std::vector<Cartesian::aabb> boxes(a_size);
+		    std::vector< std::pair<double, unsigned long> > order(a_size);
+		    std::vector<Cartesian::aabb> sorted(a_size);
+		    const Cartesian::space grow(0.5 * m_threshold, 0.5 * m_threshold, 0.5 * m_threshold);
+
+		    for (unsigned long w = a_first; w < a_last; ++w) {
+
+		      Cartesian::aabb all;
+		      for (unsigned long i = 0; i < a_size; ++i) {
+			Cartesian::aabb box;
+			for (unsigned long k = first_sample(w); k <= last_sample(w); ++k)
+			  box.merge(recorders[i].get(offsets[i] + k));
+			boxes[i] = Cartesian::aabb(box.lo() - grow, box.hi() + grow);
+			all.merge(box.center());
+		      }
+
+		      const Cartesian::space width(all.extent());
+		      const unsigned int axis(width.x() >= width.y() ? (width.x() >= width.z() ? 0 : 2) :
+					      (width.y() >= width.z() ? 1 : 2));
+		      for (unsigned long i = 0; i < a_size; ++i)
+			order[i] = std::make_pair(coordinate(boxes[i].lo(), axis), i);
+		      std::sort(order.begin(), order.end());
+
+		      // each box against the later ones that start before it ends.
+		      for (unsigned long o = 0; o < a_size; ++o)
+			sorted[o] = boxes[order[o].second];
+		      for (unsigned long o = 0; o < a_size; ++o) {
+			const double end(coordinate(sorted[o].hi(), axis));
+			for (unsigned long p = o + 1; p < a_size && order[p].first <= end; ++p)
+			  if (sorted[o].overlaps(sorted[p])) {
+			    const unsigned long i(order[o].second), j(order[p].second);
+			    part.push_back(KeyIndex((unsigned long long) std::min(i, j) * a_size + std::max(i, j), w));
+			  }
+		      }
+		    }
+		  });
+
+  std::vector<KeyIndex> candidates;
+  for (unsigned long p = 0; p < parts.size(); ++p) {
+    candidates.insert(candidates.end(), parts[p].begin(), parts[p].end());
+    std::vector<KeyIndex>().swap(parts[p]);
+  }
+
+  if (candidates.empty())
+    return 0;
+
+  // by pair, then window.
+  std::vector<KeyIndex> keys(candidates.size());
+  sort_keys(keys, threads,
+	    [&](const unsigned long& i) {return candidates[i].first;});
+
+  std::vector<unsigned long> starts;
+  for (unsigned long c = 0; c < keys.size(); ++c)
+    if (c == 0 || keys[c].first != keys[c - 1].first)
+      starts.push_back(c);
+  starts.push_back(keys.size());
+
+  const unsigned long pairs(starts.size() - 1);
+  std::vector<Conjunction> closest(pairs);
+  std::vector<char> found(pairs, 0);
+  const double threshold2(m_threshold * m_threshold);
+
+  parallel_blocks(threads, pairs, 64,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    for (unsigned long p = a_first; p < a_last; ++p) {
+
+		      const unsigned long i(keys[starts[p]].first / a_size);
+		      const unsigned long j(keys[starts[p]].first % a_size);
+		      const Cartesian::SpaceRecorder& a(recorders[i]);
+		      const Cartesian::SpaceRecorder& b(recorders[j]);
+
+		      double best(INFINITY), best_time(0);
+		      if (samples == 1)
+			best = (a.get(offsets[i]) - b.get(offsets[j])).magnitude2();
+
+		      for (unsigned long c = starts[p]; c < starts[p + 1]; ++c) {
+			const unsigned long w(candidates[keys[c].second].second);
+			Cartesian::space r0(a.get(offsets[i] + first_sample(w)) - b.get(offsets[j] + first_sample(w)));
+			for (unsigned long k = first_sample(w); k < last_sample(w); ++k) {
+			  const Cartesian::space r1(a.get(offsets[i] + k + 1) - b.get(offsets[j] + k + 1));
+			  double s, d2;
+			  closest_approach(r0, r1, s, d2);
+			  if (d2 < best) {
+			    best = d2;
+			    best_time = (k + s) * m_dt;
+			  }
+			  r0 = r1;
+			}
+		      }
+
+		      if (best <= threshold2) {
+			closest[p].m_first = i;
+			closest[p].m_second = j;
+			closest[p].m_time = best_time;
+			closest[p].m_distance = sqrt(best);
+			found[p] = 1;
+		      }
+		    }
+		  });
+
+  for (unsigned long p = 0; p < pairs; ++p)
+    if (found[p])
+      a_results.push_back(closest[p]);
+
+  return candidates.size();
+}
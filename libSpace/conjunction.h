@@ -0,0 +1,92 @@
+// ================================================================
+// Filename:    conjunction.h
+// Description: Screens SpaceRecorder tracks for close approaches.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // -----------------------------------
+  // ----- class ConjunctionScreen -----
+  // -----------------------------------
+
+  // Close approaches between objects recorded in SpaceRecorders. Every
+  // recorder is one object sampled at the same times a_dt apart, so
+  // they are aligned at their newest sample and screened over the
+  // samples all of them hold. An object moves in a straight line
+  // between its samples.
+  //
+  // screen() cuts the samples into windows of a_window intervals and
+  // boxes each object's samples in each window, grown by half of
+  // a_threshold. Objects whose boxes overlap in a window, found by
+  // sweep and prune along the widest axis, are candidates. Each
+  // candidate pair is then refined over the intervals of its windows
+  // to the time and distance of its closest approach. Both steps run
+  // on a_threads threads, 0 is one per core, over windows and then
+  // over pairs.
+
+  class ConjunctionScreen {
+
+  public:
+
+    static const unsigned int default_window;  /// sample intervals per window
+
+    struct Conjunction {
+      unsigned long m_first;     /// recorder index, less than m_second
+      unsigned long m_second;
+      double        m_time;      /// of the closest approach, from the oldest sample screened
+      double        m_distance;  /// at m_time
+    };
+
+    ConjunctionScreen(const double& a_threshold, const double& a_dt=1,
+		      const unsigned int& a_window=ConjunctionScreen::default_window,
+		      const unsigned int& a_threads=1);
+   ~ConjunctionScreen() {}; // dtor
+
+    const double&       threshold() const {return m_threshold;}
+    const double&       dt() const        {return m_dt;}
+    const unsigned int& window() const    {return m_window;}
+
+    const unsigned int& threads() const                  {return m_threads;}
+    void                threads(const unsigned int& a_n) {m_threads = a_n;}
+
+    // every pair of the a_size recorders that comes within threshold(),
+    // inclusive, once at its closest, by m_first then m_second. The
+    // earliest time on ties. Returns the (pair, window) candidates the
+    // boxes let through.
+    unsigned long screen(const SpaceRecorder* recorders, const unsigned long& a_size,
+			 std::vector<Conjunction>& a_results) const;
+
+  private:
+
+    double       m_threshold;
+    double       m_dt;
+    unsigned int m_window;
+    unsigned int m_threads;
+
+  };
+
+} // end namespace Cartesian
@@ -0,0 +1,494 @@
+// ==================================================================
+// Filename:    gravity.cpp
+// Description: Implements the gravity kernels and the BarnesHut class.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <gravity.h>
+#include <parallel.h>
+
+// -------------------
+// ----- gravity -----
+// -------------------
+
+// Each thread owns a contiguous range of bodies i and sums over all
+// bodies j, so no acceleration is written by two threads. j runs in
+// tiles that stay in L1 while every i of the range passes over them.
+// The sum over a tile is kept in gravity_lanes partial sums, so the
+// compiler vectorizes it without reordering a floating point sum.
+
+namespace {
+
+  const unsigned long gravity_tile(512);  // j positions and masses, 16 kB
+  const unsigned long gravity_lanes(8);
+
+  template <Cartesian::GravityMode MODE>
+  inline double gravity_pull(const double& dx, const double& dy, const double& dz,
+			     const double& a_mass, const double& a_softening2) {
+    const double r2(dx*dx + dy*dy + dz*dz + a_softening2);
+    double inverse(MODE == Cartesian::gravity_fast ? Cartesian::fast_rsqrt(r2) : 1.0 / sqrt(r2));
+    inverse = r2 > 0 ? inverse : 0.0;  // coincident, no softening
+    return a_mass * inverse * inverse * inverse;
+  }
+
+  template <Cartesian::GravityMode MODE>
+  void gravity_rows(const double* x, const double* y, const double* z, const double* mass,
+		    double* ax, double* ay, double* az, const unsigned long& a_size,
+		    const double& a_softening2, const unsigned long& a_first, const unsigned long& a_last) {
+
+    std::fill(ax + a_first, ax + a_last, 0.0);
+    std::fill(ay + a_first, ay + a_last, 0.0);
+    std::fill(az + a_first, az + a_last, 0.0);
+
+    for (unsigned long tile = 0; tile < a_size; tile += gravity_tile) {
+
+      const unsigned long tile_end(std::min(tile + gravity_tile, a_size));
+      const unsigned long lanes_end(tile + (tile_end - tile) / gravity_lanes * gravity_lanes);
+
+      for (unsigned long i = a_first; i < a_last; ++i) {
+
+	const double xi(x[i]), yi(y[i]), zi(z[i]);
+	double sx[gravity_lanes] = {0}, sy[gravity_lanes] = {0}, sz[gravity_lanes] = {0};
+
+	for (unsigned long j = tile; j < lanes_end; j += gravity_lanes) {
+	  for (unsigned long k = 0; k < gravity_lanes; ++k) {
+	    const double dx(x[j + k] - xi), dy(y[j + k] - yi), dz(z[j + k] - zi);
+	    const double pull(gravity_pull<MODE>(dx, dy, dz, mass[j + k], a_softening2));
+	    sx[k] += dx * pull;
+	    sy[k] += dy * pull;
+	    sz[k] += dz * pull;
+	  }
+	}
+
+	for (unsigned long j = lanes_end; j < tile_end; ++j) {
+	  const double dx(x[j] - xi), dy(y[j] - yi), dz(z[j] - zi);
+	  const double pull(gravity_pull<MODE>(dx, dy, dz, mass[j], a_softening2));
+	  sx[0] += dx * pull;
+	  sy[0] += dy * pull;
+	  sz[0] += dz * pull;
+	}
+
+	for (unsigned long k = 0; k < gravity_lanes; ++k) {
+	  ax[i] += sx[k];
+	  ay[i] += sy[k];
+	  az[i] += sz[k];
+	}
+      }
+    }
+  }
+
+}
+
+void Cartesian::gravity(const double* x,
+			const double* y,
+			const double* z,
+			const double* mass,
+			double* ax,
+			double* ay,
+			double* az,
+			const unsigned long& a_size,
+			const double& a_softening,
+			const unsigned int& a_threads,
+			const Cartesian::GravityMode& a_mode) {
+
+  SPACE_TRACE("gravity");
+
+  void (*rows)(const double*, const double*, const double*, const double*,
+	       double*, double*, double*, const unsigned long&,
+	       const double&, const unsigned long&, const unsigned long&);
+
+  rows = a_mode == gravity_fast ? gravity_rows<gravity_fast> : gravity_rows<gravity_precise>;
+
+  const double softening2(a_softening * a_softening);
+
+  // one range per thread, at least gravity_lanes bodies each.
+  const unsigned long threads(std::max(std::min(worker_count(a_threads), a_size / gravity_lanes), 1ul));
+
+  parallel_blocks(threads, a_size, (a_size + threads - 1) / threads,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    rows(x, y, z, mass, ax, ay, az, a_size, softening2, a_first, a_last);
+		  });
+}
+
+void Cartesian::gravity(const Cartesian::space* positions,
+			const double* mass,
+			Cartesian::space* accelerations,
+			const unsigned long& a_size,
+			const double& a_softening,
+			const unsigned int& a_threads,
+			const Cartesian::GravityMode& a_mode) {
+
+  if (a_size == 0)
+    return;
+
+  std::vector<double> soa(6 * a_size);
+  double* x(&soa[0]);
+  double* y(x + a_size);
+  double* z(y + a_size);
+  double* ax(z + a_size);
+  double* ay(ax + a_size);
+  double* az(ay + a_size);
+
+  for (unsigned long i = 0; i < a_size; ++i) {
+    x[i] = positions[i].x();
+    y[i] = positions[i].y();
+    z[i] = positions[i].z();
+  }
+
+  Cartesian::gravity(x, y, z, mass, ax, ay, az, a_size, a_softening, a_threads, a_mode);
+
+  for (unsigned long i = 0; i < a_size; ++i)
+    accelerations[i] = Cartesian::space(ax[i], ay[i], az[i]);
+}
+
+double Cartesian::gravity_energy(const Cartesian::space* positions,
+				 const Cartesian::space* velocities,
+				 const double* mass,
+				 const unsigned long& a_size,
+				 const double& a_softening) {
+
+  const double softening2(a_softening * a_softening);
+  double kinetic(0), potential(0);
+
+  for (unsigned long i = 0; i < a_size; ++i) {
+    kinetic += 0.5 * mass[i] * velocities[i].magnitude2();
+    double sum(0);
+    for (unsigned long j = i + 1; j < a_size; ++j) {
+      const double r2((positions[j] - positions[i]).magnitude2() + softening2);
+      sum += r2 > 0 ? mass[j] / sqrt(r2) : 0.0;  // coincident, no softening
+    }
+    potential -= mass[i] * sum;
+  }
+
+  return kinetic + potential;
+}
+
+
+// ---------------------------
+// ----- class BarnesHut -----
+// ---------------------------
+
+const unsigned int Cartesian::BarnesHut::leaf_size(8);
+
+namespace {
+
+  const unsigned int morton_levels(21);  // bits per axis, 63 bit keys
+  const unsigned int split_level(2);     // subtrees below it build in parallel
+
+  // spreads the low 21 bits of a_value to every third bit.
+  unsigned long long spread_bits(unsigned long long a_value) {
+    a_value &= 0x1fffff;
+    a_value = (a_value | a_value << 32) & 0x1f00000000ffffULL;
+    a_value = (a_value | a_value << 16) & 0x1f0000ff0000ffULL;
+    a_value = (a_value | a_value << 8)  & 0x100f00f00f00f00fULL;
+    a_value = (a_value | a_value << 4)  & 0x10c30c30c30c30c3ULL;
+    a_value = (a_value | a_value << 2)  & 0x1249249249249249ULL;
+    return a_value;
+  }
+
+  // the octant of a_key at a_level, 0 is the root's children.
+  inline unsigned int octant(const unsigned long long& a_key, const unsigned int& a_level) {
+    return (a_key >> (3 * (morton_levels - 1 - a_level))) & 7;
+  }
+
+}
+
+Cartesian::BarnesHut::BarnesHut(const double& a_theta,
+				const double& a_softening,
+				const unsigned int& a_threads) :
+  m_theta(a_theta),
+  m_softening(a_softening),
+  m_threads(a_threads)
+{}
+
+void Cartesian::BarnesHut::build(const Cartesian::space* positions,
+				 const double* masses,
+				 const unsigned long& a_size) {
+
+  SPACE_TRACE("BarnesHut build");
+
+  m_nodes.clear();
+  m_keys.resize(a_size);
+  m_positions.resize(a_size);
+  m_masses.resize(a_size);
+  m_order.resize(a_size);
+
+  if (a_size == 0)
+    return;
+
+  const unsigned long threads(worker_count(m_threads));
+
+  // ----- bounding cube -----
+
+  Cartesian::space lo(positions[0]), hi(positions[0]);
+  for (unsigned long i = 1; i < a_size; ++i) {
+    lo = Cartesian::space(std::min(lo.x(), positions[i].x()),
+			  std::min(lo.y(), positions[i].y()),
+			  std::min(lo.z(), positions[i].z()));
+    hi = Cartesian::space(std::max(hi.x(), positions[i].x()),
+			  std::max(hi.y(), positions[i].y()),
+			  std::max(hi.z(), positions[i].z()));
+  }
+
+  double width(std::max(hi.x() - lo.x(), std::max(hi.y() - lo.y(), hi.z() - lo.z())));
+  if (width == 0)
+    width = 1;  // one body, or all coincident
+
+  // ----- Morton keys, sorted in parallel chunks then merged -----
+
+  const double cells((1 << morton_levels) / width);
+  const unsigned long long last_cell((1 << morton_levels) - 1);
+  std::vector<KeyIndex> keys(a_size);
+
+  sort_keys(keys, threads,
+	    [&](const unsigned long& i) {
+	      const Cartesian::space cell((positions[i] - lo) * cells);
+	      return (spread_bits(std::min((unsigned long long) cell.x(), last_cell)) << 2 |
+		      spread_bits(std::min((unsigned long long) cell.y(), last_cell)) << 1 |
+		      spread_bits(std::min((unsigned long long) cell.z(), last_cell)));
+	    });
+
+  for (unsigned long k = 0; k < a_size; ++k) {
+    m_keys[k] = keys[k].first;
+    m_order[k] = keys[k].second;
+    m_positions[k] = positions[keys[k].second];
+    m_masses[k] = masses[keys[k].second];
+  }
+
+  // ----- nodes -----
+
+  if (threads == 1 || a_size <= 64 * leaf_size) {
+    build_subtree(m_nodes, 0, 0, a_size, width);
+    return;
+  }
+
+  // the subtrees at split_level in parallel, then the levels above
+  // them, which splice them in.
+  const unsigned long prefixes(1 << (3 * split_level));
+  const unsigned int prefix_shift(3 * (morton_levels - split_level));
+  std::vector< std::vector<Node> > subtrees(prefixes);
+
+  parallel_blocks(threads, prefixes, 1,
+		  [&](const unsigned long& a_prefix, const unsigned long&) {
+		    const unsigned long long first_key(a_prefix << prefix_shift);
+		    const unsigned long long next_key((a_prefix + 1) << prefix_shift);
+		    const unsigned long begin(std::lower_bound(m_keys.begin(), m_keys.end(), first_key) - m_keys.begin());
+		    const unsigned long end(std::lower_bound(m_keys.begin(), m_keys.end(), next_key) - m_keys.begin());
+		    if (begin < end)
+		      build_subtree(subtrees[a_prefix], split_level, begin, end, width / (1 << split_level));
+		  });
+
+  build_top(m_nodes, 0, 0, a_size, width, subtrees, 0);
+}
+
+// nodes for the bodies [a_begin, a_end), which share the key digits
+// above a_level.
+void Cartesian::BarnesHut::build_subtree(std::vector<Node>& nodes,
+					 const unsigned int& a_level,
+					 const unsigned long& a_begin,
+					 const unsigned long& a_end,
+					 const double& a_width) const {
+
+  const unsigned long index(nodes.size());
+
+  Node a_node;
+  a_node.m_mass = 0;
+  a_node.m_width = a_width;
+  a_node.m_next = 0;
+  a_node.m_first = a_begin;
+  a_node.m_count = a_end - a_begin;
+  nodes.push_back(a_node);
+
+  if (a_end - a_begin > leaf_size && a_level < morton_levels) {
+    unsigned long begin(a_begin);
+    for (unsigned int k = 0; k < 8; ++k) {
+      const unsigned long end(octant_end(a_level, begin, a_end, k));
+      if (begin < end)
+	build_subtree(nodes, a_level + 1, begin, end, a_width / 2);
+      begin = end;
+    }
+  }
+
+  finish(nodes, index);
+}
+
+// as build_subtree(), splicing in subtrees at split_level.
+void Cartesian::BarnesHut::build_top(std::vector<Node>& nodes,
+				     const unsigned int& a_level,
+				     const unsigned long& a_begin,
+				     const unsigned long& a_end,
+				     const double& a_width,
+				     const std::vector< std::vector<Node> >& subtrees,
+				     const unsigned long& a_prefix) const {
+
+  if (a_end - a_begin <= leaf_size) {
+    build_subtree(nodes, a_level, a_begin, a_end, a_width);
+    return;
+  }
+
+  if (a_level == split_level) {
+    const unsigned int offset(nodes.size());
+    const std::vector<Node>& a_subtree(subtrees[a_prefix]);
+    for (unsigned long k = 0; k < a_subtree.size(); ++k) {
+      nodes.push_back(a_subtree[k]);
+      nodes.back().m_next += offset;
+    }
+    return;
+  }
+
+  const unsigned long index(nodes.size());
+
+  Node a_node;
+  a_node.m_mass = 0;
+  a_node.m_width = a_width;
+  a_node.m_next = 0;
+  a_node.m_first = a_begin;
+  a_node.m_count = a_end - a_begin;
+  nodes.push_back(a_node);
+
+  unsigned long begin(a_begin);
+  for (unsigned int k = 0; k < 8; ++k) {
+    const unsigned long end(octant_end(a_level, begin, a_end, k));
+    if (begin < end)
+      build_top(nodes, a_level + 1, begin, end, a_width / 2, subtrees, 8 * a_prefix + k);
+    begin = end;
+  }
+
+  finish(nodes, index);
+}
+
+// the end of the bodies in [a_begin, a_end) in octants up to an_octant.
+unsigned long Cartesian::BarnesHut::octant_end(const unsigned int& a_level,
+					       const unsigned long& a_begin,
+					       const unsigned long& a_end,
+					       const unsigned int& an_octant) const {
+  unsigned long end(a_begin);
+  while (end < a_end && octant(m_keys[end], a_level) <= an_octant)
+    ++end;
+  return end;
+}
+
+// sets the mass, center of mass, box and next index of nodes[an_index],
+// from its children or, for a leaf, its bodies.
+void Cartesian::BarnesHut::finish(std::vector<Node>& nodes, const unsigned long& an_index) const {
+
+  Node& a_node(nodes[an_index]);
+  Cartesian::space moment;
+  double mass(0);
+  Cartesian::space lo(m_positions[a_node.m_first]), hi(lo);
+
+  a_node.m_next = nodes.size();
+
+  if (a_node.m_next == an_index + 1) {
+    for (unsigned long k = a_node.m_first; k < a_node.m_first + a_node.m_count; ++k) {
+      moment += m_positions[k] * m_masses[k];
+      mass += m_masses[k];
+      lo = Cartesian::space(std::min(lo.x(), m_positions[k].x()),
+			    std::min(lo.y(), m_positions[k].y()),
+			    std::min(lo.z(), m_positions[k].z()));
+      hi = Cartesian::space(std::max(hi.x(), m_positions[k].x()),
+			    std::max(hi.y(), m_positions[k].y()),
+			    std::max(hi.z(), m_positions[k].z()));
+    }
+  } else {
+    for (unsigned long k = an_index + 1; k < a_node.m_next; k = nodes[k].m_next) {
+      moment += nodes[k].m_center * nodes[k].m_mass;
+      mass += nodes[k].m_mass;
+      lo = Cartesian::space(std::min(lo.x(), nodes[k].m_lo.x()),
+			    std::min(lo.y(), nodes[k].m_lo.y()),
+			    std::min(lo.z(), nodes[k].m_lo.z()));
+      hi = Cartesian::space(std::max(hi.x(), nodes[k].m_hi.x()),
+			    std::max(hi.y(), nodes[k].m_hi.y()),
+			    std::max(hi.z(), nodes[k].m_hi.z()));
+    }
+  }
+
+  a_node.m_lo = lo;
+  a_node.m_hi = hi;
+
+  a_node.m_mass = mass;
+  a_node.m_center = mass > 0 ? Cartesian::unchecked_divide(moment, mass) : m_positions[a_node.m_first];
+}
+
+Cartesian::space Cartesian::BarnesHut::acceleration(const Cartesian::space& a_position) const {
+
+  const double theta2(m_theta * m_theta);
+  const bool check_inside(3 * theta2 > 1);
+  const double softening2(m_softening * m_softening);
+  double ax(0), ay(0), az(0);
+
+  for (unsigned long k = 0; k < m_nodes.size(); ) {
+
+    const Node& a_node(m_nodes[k]);
+    const double dx(a_node.m_center.x() - a_position.x());
+    const double dy(a_node.m_center.y() - a_position.y());
+    const double dz(a_node.m_center.z() - a_position.z());
+
+    // measured to the center of mass, so with theta above 1 / sqrt(3) a
+    // cell holding a_position can pass, which would count a body's own
+    // mass at the wrong place. Those cells are opened. At or below it a
+    // point in the box is never far enough, and the box is not read.
+    if (a_node.m_width * a_node.m_width < theta2 * (dx*dx + dy*dy + dz*dz) &&
+	!(check_inside &&
+	  a_node.m_lo.x() <= a_position.x() && a_position.x() <= a_node.m_hi.x() &&
+	  a_node.m_lo.y() <= a_position.y() && a_position.y() <= a_node.m_hi.y() &&
+	  a_node.m_lo.z() <= a_position.z() && a_position.z() <= a_node.m_hi.z())) {
+
+      // far enough, one point mass.
+      const double pull(gravity_pull<gravity_precise>(dx, dy, dz, a_node.m_mass, softening2));
+      ax += dx * pull;
+      ay += dy * pull;
+      az += dz * pull;
+      k = a_node.m_next;
+
+    } else if (a_node.m_next == k + 1) {
+
+      // a leaf to open, its bodies.
+      for (unsigned long j = a_node.m_first; j < a_node.m_first + a_node.m_count; ++j) {
+	const double bx(m_positions[j].x() - a_position.x());
+	const double by(m_positions[j].y() - a_position.y());
+	const double bz(m_positions[j].z() - a_position.z());
+	const double pull(gravity_pull<gravity_precise>(bx, by, bz, m_masses[j], softening2));
+	ax += bx * pull;
+	ay += by * pull;
+	az += bz * pull;
+      }
+      k = a_node.m_next;
+
+    } else {
+      ++k;  // first child
+    }
+  }
+
+  return Cartesian::space(ax, ay, az);
+}
+
+void Cartesian::BarnesHut::accelerations(Cartesian::space* a_results) const {
+
+  SPACE_TRACE("BarnesHut accelerations");
+
+  parallel_blocks(worker_count(m_threads), size(), 256,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    for (unsigned long k = a_first; k < a_last; ++k)
+		      a_results[m_order[k]] = acceleration(m_positions[k]);
+		  });
+}
@@ -0,0 +1,150 @@
+// ================================================================
+// Filename:    gravity.h
+// Description: N body gravity on space positions, by direct summation
+//              and with a Barnes-Hut octree.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // -------------------
+  // ----- gravity -----
+  // -------------------
+
+  // Softened direct summation over all pairs, O(N^2), with G = 1:
+  //   a_i = sum_j m_j (r_j - r_i) / (|r_j - r_i|^2 + softening^2)^(3/2)
+  // The bodies are a structure of arrays, a_size positions x, y, z and
+  // masses, and the accelerations are written to ax, ay and az. A body
+  // does not pull itself, nor does a coincident body without softening.
+  // a_threads splits the bodies across threads, 0 is one per core.
+  // gravity_fast uses fast_rsqrt(), which is faster only with wide
+  // vectors, e.g. -march=native on avx-512. See the README.
+
+  enum GravityMode {gravity_precise, gravity_fast};
+
+  void gravity(const double* x, const double* y, const double* z, const double* mass,
+	       double* ax, double* ay, double* az, const unsigned long& a_size,
+	       const double& a_softening, const unsigned int& a_threads=1,
+	       const GravityMode& a_mode=gravity_precise);
+
+  // the same for positions as spaces, copied to a structure of arrays.
+  void gravity(const space* positions, const double* mass, space* accelerations,
+	       const unsigned long& a_size, const double& a_softening,
+	       const unsigned int& a_threads=1, const GravityMode& a_mode=gravity_precise);
+
+  // kinetic plus softened potential energy of the bodies, the quantity
+  // the integrators of integrator.h conserve for gravity():
+  //   E = sum_i m_i v_i^2 / 2 - sum_i<j m_i m_j / (|r_j - r_i|^2 + softening^2)^(1/2)
+  double gravity_energy(const space* positions, const space* velocities, const double* mass,
+			const unsigned long& a_size, const double& a_softening);
+
+
+  // ---------------------------
+  // ----- class BarnesHut -----
+  // ---------------------------
+
+  // Barnes-Hut octree for gravity() in O(N log N), with G = 1 and the
+  // same softening. A cell is one point mass at its center of mass when
+  // width < theta * distance and the point is outside the box of the
+  // cell's bodies, otherwise it is opened, so a body's own cell is never
+  // one point mass. theta 0 opens every cell and is direct summation.
+  // Larger theta is faster and less accurate, see the README for the
+  // error against theta.
+  //
+  // build() sorts the bodies by Morton key and stores the nodes in one
+  // vector, depth first in Morton order. Each node has the index after
+  // its subtree, so the traversal walks forward without a stack. The
+  // key sort and the subtrees below the second level are built on
+  // a_threads threads, 0 is one per core.
+
+  class BarnesHut {
+
+  public:
+
+    static const unsigned int leaf_size;  /// most bodies in a leaf above the deepest level
+
+    BarnesHut(const double& a_theta=0.5, const double& a_softening=0,
+	      const unsigned int& a_threads=1);
+   ~BarnesHut() {}; // dtor
+
+    const double& theta() const                   {return m_theta;}
+    void          theta(const double& a_theta)     {m_theta = a_theta;}
+
+    const double& softening() const                {return m_softening;}
+    void          softening(const double& a_soft)  {m_softening = a_soft;}
+
+    const unsigned int& threads() const                  {return m_threads;}
+    void                threads(const unsigned int& a_n) {m_threads = a_n;}
+
+    unsigned long size() const  {return m_positions.size();}  // bodies
+    unsigned long nodes() const {return m_nodes.size();}
+
+    void build(const space* positions, const double* masses, const unsigned long& a_size);
+
+    // of the bodies, in the order passed to build(). Parallel over the
+    // bodies in Morton order, so neighbouring bodies share nodes in cache.
+    void accelerations(space* a_results) const;
+
+    // at any point.
+    space acceleration(const space& a_position) const;
+
+  private:
+
+    struct Node {
+      space        m_center;  /// center of mass
+      space        m_lo;      /// box of the bodies
+      space        m_hi;
+      double       m_mass;
+      double       m_width;   /// of the cube
+      unsigned int m_next;    /// index after this subtree, this + 1 for a leaf
+      unsigned int m_first;   /// first body in Morton order
+      unsigned int m_count;   /// bodies in the subtree
+    };
+
+    void build_subtree(std::vector<Node>& nodes, const unsigned int& a_level,
+		       const unsigned long& a_begin, const unsigned long& a_end,
+		       const double& a_width) const;
+    void build_top(std::vector<Node>& nodes, const unsigned int& a_level,
+		   const unsigned long& a_begin, const unsigned long& a_end,
+		   const double& a_width, const std::vector< std::vector<Node> >& subtrees,
+		   const unsigned long& a_prefix) const;
+    unsigned long octant_end(const unsigned int& a_level, const unsigned long& a_begin,
+			     const unsigned long& a_end, const unsigned int& an_octant) const;
+    void finish(std::vector<Node>& nodes, const unsigned long& an_index) const;
+
+    double                          m_theta;
+    double                          m_softening;
+    unsigned int                    m_threads;
+
+    std::vector<Node>               m_nodes;
+    std::vector<unsigned long long> m_keys;       /// Morton keys, sorted
+    std::vector<space>              m_positions;  /// in Morton order
+    std::vector<double>             m_masses;     /// in Morton order
+    std::vector<unsigned long>      m_order;      /// build() index of each body
+
+  };
+
+} // end namespace Cartesian
@@ -0,0 +1,388 @@
+// ==================================================================
+// Filename:    integrator.cpp
+// Description: Implements the Integrator and DormandPrince classes.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <integrator.h>
+
+// ----------------------------
+// ----- class Integrator -----
+// ----------------------------
+
+// The schemes are sequences of drifts x += c dt v and kicks
+// v += d dt a(x). The kernels fuse a kick with the drift after it, so
+// each stage is one pass over the positions, velocities and
+// accelerations.
+
+namespace {
+
+  void drift(Cartesian::space* x, const Cartesian::space* v,
+	     const unsigned long& a_size, const double& a_drift) {
+    for (unsigned long i = 0; i < a_size; ++i)
+      x[i] = Cartesian::space(x[i].x() + a_drift * v[i].x(),
+			      x[i].y() + a_drift * v[i].y(),
+			      x[i].z() + a_drift * v[i].z());
+  }
+
+  void kick(Cartesian::space* v, const Cartesian::space* a,
+	    const unsigned long& a_size, const double& a_kick) {
+    drift(v, a, a_size, a_kick);
+  }
+
+  void kick_drift(Cartesian::space* x, Cartesian::space* v, const Cartesian::space* a,
+		  const unsigned long& a_size, const double& a_kick, const double& a_drift) {
+    for (unsigned long i = 0; i < a_size; ++i) {
+      const double vx(v[i].x() + a_kick * a[i].x());
+      const double vy(v[i].y() + a_kick * a[i].y());
+      const double vz(v[i].z() + a_kick * a[i].z());
+      v[i] = Cartesian::space(vx, vy, vz);
+      x[i] = Cartesian::space(x[i].x() + a_drift * vx,
+			      x[i].y() + a_drift * vy,
+			      x[i].z() + a_drift * vz);
+    }
+  }
+
+  // drift-kick-drift schemes, a_stages kicks between a_stages + 1 drifts.
+  const double leapfrog_drifts[2] = {0.5, 0.5};
+  const double leapfrog_kicks[1]  = {1.0};
+
+  // Yoshida (1990), w1 = 1 / (2 - 2^(1/3)) and w0 = 1 - 2 w1.
+  const double yoshida_w1(1.0 / (2.0 - cbrt(2.0)));
+  const double yoshida_w0(1.0 - 2.0 * yoshida_w1);
+  const double yoshida_drifts[4] = {yoshida_w1 / 2, (yoshida_w0 + yoshida_w1) / 2,
+				    (yoshida_w0 + yoshida_w1) / 2, yoshida_w1 / 2};
+  const double yoshida_kicks[3]  = {yoshida_w1, yoshida_w0, yoshida_w1};
+
+}
+
+Cartesian::Integrator::Integrator(const Cartesian::IntegratorScheme& a_scheme,
+				  const Cartesian::Force& a_force,
+				  Cartesian::SpaceRecorder* a_recorder,
+				  const unsigned int& a_stride) :
+  m_scheme(a_scheme),
+  m_force(a_force),
+  m_recorder(a_recorder),
+  m_stride(a_stride),
+  m_steps(0),
+  m_forces(0)
+{}
+
+bool Cartesian::Integrator::recording(const unsigned long& a_step) const {
+  return m_recorder != NULL && m_stride != 0 && a_step % m_stride == 0;
+}
+
+void Cartesian::Integrator::force(const Cartesian::space* positions, const unsigned long& a_size) {
+  m_accelerations.resize(a_size);
+  m_force(positions, &m_accelerations[0], a_size);
+  ++m_forces;
+}
+
+void Cartesian::Integrator::advance(Cartesian::space* positions,
+				    Cartesian::space* velocities,
+				    const unsigned long& a_size,
+				    const double& a_dt,
+				    const unsigned long& a_steps) {
+
+  SPACE_TRACE("Integrator advance");
+
+  if (a_size == 0 || a_steps == 0)
+    return;
+
+  if (m_scheme == Cartesian::integrator_velocity_verlet) {
+
+    // The closing half kick of a step and the opening half kick of the
+    // next are one kick. The positions are whole steps throughout, only
+    // the velocities are half a kick ahead between steps.
+    force(positions, a_size);
+
+    for (unsigned long step = 0; step < a_steps; ++step) {
+      kick_drift(positions, velocities, &m_accelerations[0], a_size,
+		 step == 0 ? 0.5 * a_dt : a_dt, a_dt);
+      force(positions, a_size);
+      if (step + 1 == a_steps)
+	kick(velocities, &m_accelerations[0], a_size, 0.5 * a_dt);
+      if (recording(++m_steps))
+	m_recorder->push(positions, a_size);
+    }
+
+    return;
+  }
+
+  const bool is_leapfrog(m_scheme == Cartesian::integrator_leapfrog);
+  const double* drifts(is_leapfrog ? leapfrog_drifts : yoshida_drifts);
+  const double* kicks(is_leapfrog ? leapfrog_kicks : yoshida_kicks);
+  const unsigned int stages(is_leapfrog ? 1 : 3);
+
+  // The last drift of a step and the first of the next are one drift,
+  // unless the step is recorded, when the positions must be whole.
+  bool ahead(false);
+
+  for (unsigned long step = 0; step < a_steps; ++step) {
+
+    if (!ahead)
+      drift(positions, velocities, a_size, drifts[0] * a_dt);
+
+    for (unsigned int k = 0; k < stages; ++k) {
+      force(positions, a_size);
+      ahead = k + 1 == stages && step + 1 < a_steps && !recording(m_steps + 1);
+      kick_drift(positions, velocities, &m_accelerations[0], a_size, kicks[k] * a_dt,
+		 (drifts[k + 1] + (ahead ? drifts[0] : 0.0)) * a_dt);
+    }
+
+    if (recording(++m_steps))
+      m_recorder->push(positions, a_size);
+  }
+}
+
+
+// -------------------------------
+// ----- class DormandPrince -----
+// -------------------------------
+
+// A body's state is its position and velocity, so stage s has the
+// velocities V_s and accelerations A_s as its derivative, and
+//   X_s = x + h sum_j a_sj V_j,  V_s = v + h sum_j a_sj A_j,  A_s = F(X_s)
+// The stepping bodies are gathered into contiguous arrays each round,
+// and every stage is one pass over them and one force call.
+
+namespace {
+
+  const unsigned int dp_stages(7);
+
+  const double dp_a[dp_stages][dp_stages - 1] = {
+    {0},
+    {1.0/5},
+    {3.0/40, 9.0/40},
+    {44.0/45, -56.0/15, 32.0/9},
+    {19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729},
+    {9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656},
+    {35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84}};
+
+  // fifth less fourth order weights, the error estimate.
+  const double dp_e[dp_stages] = {71.0/57600, 0, -71.0/16695, 71.0/1920,
+				  -17253.0/339200, 22.0/525, -1.0/40};
+
+  // X_S into x and V_S into v[S]. The last stage is the solution.
+  template <unsigned int S>
+  void dp_stage(const double* h, const Cartesian::space* x0,
+		Cartesian::space* const* v, const Cartesian::space* const* a,
+		Cartesian::space* x, const unsigned long& a_size) {
+    for (unsigned long k = 0; k < a_size; ++k) {
+      double xx(0), xy(0), xz(0), vx(0), vy(0), vz(0);
+      for (unsigned int j = 0; j < S; ++j) {
+	xx += dp_a[S][j] * v[j][k].x();
+	xy += dp_a[S][j] * v[j][k].y();
+	xz += dp_a[S][j] * v[j][k].z();
+	vx += dp_a[S][j] * a[j][k].x();
+	vy += dp_a[S][j] * a[j][k].y();
+	vz += dp_a[S][j] * a[j][k].z();
+      }
+      x[k] = Cartesian::space(x0[k].x() + h[k] * xx, x0[k].y() + h[k] * xy, x0[k].z() + h[k] * xz);
+      v[S][k] = Cartesian::space(v[0][k].x() + h[k] * vx, v[0][k].y() + h[k] * vy, v[0][k].z() + h[k] * vz);
+    }
+  }
+
+  inline double dp_scaled2(const double& an_error, const double& a_start, const double& an_end,
+			   const double& an_absolute, const double& a_relative) {
+    const double scaled(an_error / (an_absolute + a_relative * std::max(std::abs(a_start), std::abs(an_end))));
+    return scaled * scaled;
+  }
+
+  // the sum of squared scaled errors of each body's six components.
+  void dp_error(const double* h, const Cartesian::space* x0, const Cartesian::space* x1,
+		const Cartesian::space* const* v, const Cartesian::space* const* a,
+		const double& an_absolute, const double& a_relative,
+		double* an_error, const unsigned long& a_size) {
+    for (unsigned long k = 0; k < a_size; ++k) {
+      double xx(0), xy(0), xz(0), vx(0), vy(0), vz(0);
+      for (unsigned int j = 0; j < dp_stages; ++j) {
+	xx += dp_e[j] * v[j][k].x();
+	xy += dp_e[j] * v[j][k].y();
+	xz += dp_e[j] * v[j][k].z();
+	vx += dp_e[j] * a[j][k].x();
+	vy += dp_e[j] * a[j][k].y();
+	vz += dp_e[j] * a[j][k].z();
+      }
+      const Cartesian::space& v0(v[0][k]);
+      const Cartesian::space& v1(v[dp_stages - 1][k]);
+      an_error[k] = (dp_scaled2(h[k] * xx, x0[k].x(), x1[k].x(), an_absolute, a_relative) +
+		     dp_scaled2(h[k] * xy, x0[k].y(), x1[k].y(), an_absolute, a_relative) +
+		     dp_scaled2(h[k] * xz, x0[k].z(), x1[k].z(), an_absolute, a_relative) +
+		     dp_scaled2(h[k] * vx, v0.x(), v1.x(), an_absolute, a_relative) +
+		     dp_scaled2(h[k] * vy, v0.y(), v1.y(), an_absolute, a_relative) +
+		     dp_scaled2(h[k] * vz, v0.z(), v1.z(), an_absolute, a_relative));
+    }
+  }
+
+  // the next step over this one for an error norm.
+  inline double dp_factor(const double& an_error) {
+    return an_error == 0 ? 5.0 : std::min(5.0, std::max(0.2, 0.9 * pow(an_error, -0.2)));
+  }
+
+}
+
+Cartesian::DormandPrince::DormandPrince(const Cartesian::Force& a_force,
+					const double& a_absolute,
+					const double& a_relative,
+					const bool& an_independent) :
+  m_force(a_force),
+  m_absolute(a_absolute),
+  m_relative(a_relative),
+  m_independent(an_independent),
+  m_steps(0),
+  m_rejected(0),
+  m_forces(0)
+{}
+
+void Cartesian::DormandPrince::force(const Cartesian::space* positions,
+				     Cartesian::space* accelerations,
+				     const unsigned long& a_size) {
+  m_force(positions, accelerations, a_size);
+  ++m_forces;
+}
+
+void Cartesian::DormandPrince::advance(Cartesian::space* positions,
+				       Cartesian::space* velocities,
+				       const unsigned long& a_size,
+				       const double& a_span,
+				       double* a_dt) {
+
+  SPACE_TRACE("DormandPrince advance");
+
+  if (a_size == 0 || a_span == 0)
+    return;
+
+  const double direction(a_span < 0 ? -1.0 : 1.0);
+  const double span(std::abs(a_span));
+
+  m_accelerations.resize(a_size);
+  force(positions, &m_accelerations[0], a_size);
+
+  m_remaining.assign(a_size, span);
+  m_dt.resize(a_size);
+  m_active.resize(a_size);
+  for (unsigned long i = 0; i < a_size; ++i) {
+    const double dt(std::abs(a_dt[m_independent ? i : 0]));
+    m_dt[i] = dt > 0 && dt <= span ? dt : span;
+    m_active[i] = i;
+  }
+
+  while (!m_active.empty()) {
+
+    const unsigned long active(m_active.size());
+
+    m_h.resize(active);
+    m_x0.resize(active);
+    m_x.resize(active);
+    m_x1.resize(active);
+    m_error.resize(active);
+
+    Cartesian::space* v[dp_stages];
+    Cartesian::space* a[dp_stages];
+    for (unsigned int s = 0; s < dp_stages; ++s) {
+      m_stage_v[s].resize(active);
+      m_stage_a[s].resize(active);
+      v[s] = &m_stage_v[s][0];
+      a[s] = &m_stage_a[s][0];
+    }
+
+    for (unsigned long k = 0; k < active; ++k) {
+      const unsigned long i(m_active[k]);
+      m_h[k] = direction * std::min(m_dt[i], m_remaining[i]);
+      m_x0[k] = positions[i];
+      v[0][k] = velocities[i];
+      a[0][k] = m_accelerations[i];
+    }
+
+    const double* h(&m_h[0]);
+    const Cartesian::space* x0(&m_x0[0]);
+    Cartesian::space* x(&m_x[0]);
+    Cartesian::space* x1(&m_x1[0]);
+
+    dp_stage<1>(h, x0, v, a, x, active);
+    force(x, a[1], active);
+    dp_stage<2>(h, x0, v, a, x, active);
+    force(x, a[2], active);
+    dp_stage<3>(h, x0, v, a, x, active);
+    force(x, a[3], active);
+    dp_stage<4>(h, x0, v, a, x, active);
+    force(x, a[4], active);
+    dp_stage<5>(h, x0, v, a, x, active);
+    force(x, a[5], active);
+    dp_stage<6>(h, x0, v, a, x1, active);
+    force(x1, a[6], active);
+
+    dp_error(h, x0, x1, v, a, m_absolute, m_relative, &m_error[0], active);
+
+    double shared(0);
+    if (!m_independent) {
+      for (unsigned long k = 0; k < active; ++k)
+	shared += m_error[k];
+      shared = sqrt(shared / (6 * active));
+      if (shared <= 1)
+	++m_steps;
+      else
+	++m_rejected;
+    }
+
+    unsigned long stepping(0);
+
+    for (unsigned long k = 0; k < active; ++k) {
+
+      const unsigned long i(m_active[k]);
+      const double error(m_independent ? sqrt(m_error[k] / 6) : shared);
+      const double taken(std::abs(m_h[k]));
+
+      if (error <= 1) {
+	positions[i] = x1[k];
+	velocities[i] = v[dp_stages - 1][k];
+	m_accelerations[i] = a[dp_stages - 1][k];
+	// the last step is cut to the span, keep the step to try next.
+	if (taken < m_remaining[i]) {
+	  m_remaining[i] -= taken;
+	  m_dt[i] = taken * dp_factor(error);
+	} else {
+	  m_remaining[i] = 0;
+	}
+	if (m_independent)
+	  ++m_steps;
+      } else {
+	m_dt[i] = taken * std::min(1.0, dp_factor(error));
+	if (m_independent)
+	  ++m_rejected;
+	if (m_dt[i] < span * Cartesian::space::epsilon)
+	  throw Cartesian::StepSizeError("DormandPrince step size underflow");
+      }
+
+      if (m_remaining[i] > 0)
+	m_active[stepping++] = i;
+    }
+
+    m_active.resize(stepping);
+  }
+
+  if (m_independent)
+    std::copy(m_dt.begin(), m_dt.end(), a_dt);
+  else
+    a_dt[0] = m_dt[0];
+}
@@ -0,0 +1,183 @@
+// ================================================================
+// Filename:    integrator.h
+// Description: Time steppers for N body systems: the symplectic
+//              Integrator and the adaptive DormandPrince.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  class StepSizeError : public SpaceError {
+  public:
+  StepSizeError(const std::string& msg) : SpaceError(msg) {}
+  };
+
+  // ----------------------------
+  // ----- class Integrator -----
+  // ----------------------------
+
+  // Symplectic integrators that advance a population of positions and
+  // velocities in place. The force is a callback that fills a_size
+  // accelerations from the positions, e.g. a lambda around gravity() or
+  // BarnesHut. Each drift and kick is one fused pass over the arrays,
+  // and the half drifts (or kicks) of consecutive steps are merged
+  // into one pass unless a step is recorded.
+  //
+  //   integrator_leapfrog         drift-kick-drift, 1 force per step, 2nd order
+  //   integrator_velocity_verlet  kick-drift-kick, 1 force per step and one
+  //                               more on each advance(), 2nd order
+  //   integrator_yoshida4         three leapfrogs of Yoshida's weights,
+  //                               3 forces per step, 4th order
+  //
+  // With a recorder, all a_size positions are pushed after every
+  // a_stride steps, counted across advance() calls. A stride of 0 never
+  // records.
+
+  enum IntegratorScheme {integrator_leapfrog, integrator_velocity_verlet, integrator_yoshida4};
+
+  typedef std::function<void (const space* positions, space* accelerations,
+			      const unsigned long& a_size)> Force;
+
+  class Integrator {
+
+  public:
+
+    Integrator(const IntegratorScheme& a_scheme, const Force& a_force,
+	       SpaceRecorder* a_recorder=NULL, const unsigned int& a_stride=1);
+   ~Integrator() {}; // dtor
+
+    const IntegratorScheme& scheme() const {return m_scheme;}
+
+    const unsigned int& stride() const                   {return m_stride;}
+    void                stride(const unsigned int& a_n)  {m_stride = a_n;}
+
+    SpaceRecorder* recorder() const                        {return m_recorder;}
+    void           recorder(SpaceRecorder* a_recorder)     {m_recorder = a_recorder;}
+
+    unsigned long steps() const  {return m_steps;}   // taken, all advance() calls
+    unsigned long forces() const {return m_forces;}  // force callbacks
+
+    void advance(space* positions, space* velocities, const unsigned long& a_size,
+		 const double& a_dt, const unsigned long& a_steps);
+
+  private:
+
+    bool recording(const unsigned long& a_step) const;
+    void force(const space* positions, const unsigned long& a_size);
+
+    IntegratorScheme   m_scheme;
+    Force              m_force;
+    SpaceRecorder*     m_recorder;
+    unsigned int       m_stride;
+
+    unsigned long      m_steps;
+    unsigned long      m_forces;
+    std::vector<space> m_accelerations;  /// force() results
+
+  };
+
+
+  // -------------------------------
+  // ----- class DormandPrince -----
+  // -------------------------------
+
+  // Adaptive Dormand-Prince 5(4) over arrays of positions and
+  // velocities, with the Force callback of Integrator. A step is
+  // accepted when the rms over components of
+  //   error / (absolute + relative * max(|y|, |y_new|))
+  // is at most 1, and the next step is scaled by 0.9 / error^(1/5),
+  // within [0.2, 5]. Each stage is one fused pass over all bodies and
+  // the error norm is summed in the pass that forms the solution. The
+  // last stage is the first of the next step (FSAL).
+  //
+  // Shared, all bodies take the same steps and the norm is over all of
+  // them. Independent, each body has its own step size and the force is
+  // called with only the bodies still stepping, so an easy orbit
+  // finishes in a few steps while a hard one takes many. That is only
+  // correct for forces where a body's acceleration depends on its own
+  // position alone, e.g. test particles in a fixed field.
+  //
+  // advance() throws StepSizeError if a step shrinks below epsilon times
+  // the span.
+
+  class DormandPrince {
+
+  public:
+
+    DormandPrince(const Force& a_force, const double& a_absolute=1e-9,
+		  const double& a_relative=1e-9, const bool& an_independent=false);
+   ~DormandPrince() {}; // dtor
+
+    const double& absolute() const                 {return m_absolute;}
+    void          absolute(const double& a_tol)    {m_absolute = a_tol;}
+
+    const double& relative() const                 {return m_relative;}
+    void          relative(const double& a_tol)    {m_relative = a_tol;}
+
+    const bool&   independent() const              {return m_independent;}
+    void          independent(const bool& a_is)    {m_independent = a_is;}
+
+    // accepted and rejected steps. Independent, a body step is one.
+    unsigned long steps() const    {return m_steps;}
+    unsigned long rejected() const {return m_rejected;}
+    unsigned long forces() const   {return m_forces;}  // force callbacks
+
+    // advances a_size bodies by a_span, which may be negative. a_dt is
+    // the first step to try, one shared or a_size independent, and on
+    // return the step to try next.
+    void advance(space* positions, space* velocities, const unsigned long& a_size,
+		 const double& a_span, double* a_dt);
+
+  private:
+
+    void force(const space* positions, space* accelerations, const unsigned long& a_size);
+
+    Force              m_force;
+    double             m_absolute;
+    double             m_relative;
+    bool               m_independent;
+
+    unsigned long      m_steps;
+    unsigned long      m_rejected;
+    unsigned long      m_forces;
+
+    // per body
+    std::vector<space>         m_accelerations;  /// at the positions, FSAL
+    std::vector<double>        m_remaining;      /// of the span
+    std::vector<double>        m_dt;             /// next step to try
+
+    // per stepping body, in the order of m_active
+    std::vector<unsigned long> m_active;
+    std::vector<double>        m_h;              /// this step
+    std::vector<space>         m_x0, m_x, m_x1;  /// start, a stage, the solution
+    std::vector<space>         m_stage_v[7];     /// velocities of the stages
+    std::vector<space>         m_stage_a[7];     /// accelerations of the stages
+    std::vector<double>        m_error;          /// scaled squared error
+
+  };
+
+} // end namespace Cartesian
@@ -1,6 +1,14 @@
 // ============================================================
 // Filename:    main.cpp
-// Description: An example of a test harness for space object
+// Description: A load generator and test harness for space objects.
+//
+//              By default it runs a mix of libSpace operations from
+//              one or more threads for a fixed time and reports the
+//              throughput, latency percentiles and memory use. -c
+//              runs the original pass/fail checks instead.
+//
+//                ./main -n 100000 -t 4 -d 10 -m cross=2,rotate=1
+//
 // Author:      L.R. McFarland lrm@starbug.com
 // Created:     05 Apr 2005
 //
@@ -20,49 +28,475 @@
 // ============================================================
 
 #include <getopt.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <thread>
+#include <vector>
+
 #include <space.h>
 
-int main(int argc, char* argv[]) {
 
-  // ------------------------------------------
-  // ----- process command line arguments -----
-  // ------------------------------------------
+// ==========================
+// ===== load generator =====
+// ==========================
 
-  int    opt;
-  bool   hasError(false);
+// Each request is one operation on a batch of vectors drawn from the
+// thread's own working set. export writes the thread's whole
+// SpaceRecorder with write2R, so its cost grows with -n. With more than
+// one thread each writes its own file, see export_path().
 
-  std::stringstream usage;
-  usage << "Usage: " << argv[0] << " ";
+enum Operation {op_add, op_cross, op_normalize, op_rotate, op_record, op_export, op_count};
 
-  while ((opt = getopt(argc, argv, "")) != -1) {
+const char* operation_names[op_count] = {"add", "cross", "normalize", "rotate", "record", "export"};
 
-    switch(opt) {
 
-    case ':':       /* -o without operand */
-      std::cerr << "Option -" << (char) optopt << " requires an operand."
-		<< std::endl;
-      hasError = true;
-      break;
+struct LoadOptions {
 
-    case '?':
-      std::cerr << "Unrecognized option: -" << (char) optopt << std::endl;
-      hasError = true;
-      break;
+  LoadOptions() :
+    vectors(100000), batch(64), threads(1), duration(5.0), seed(1),
+    export_file("/dev/null")
+  {
+    const double default_mix[op_count] = {4, 2, 2, 2, 1, 0};
+    for (int k = 0; k < op_count; ++k)
+      mix[k] = default_mix[k];
+  }
+
+  unsigned long vectors;   /// working set per thread
+  unsigned long batch;     /// vectors per request
+  unsigned int  threads;
+  double        duration;  /// seconds
+  unsigned long seed;      /// thread k uses seed + k
+  double        mix[op_count];  /// relative weights
+  std::string   export_file;
+  std::string   trace_file;     /// chrome trace of the run when set
+
+};
+
+// thread an_id's export file, export_file.an_id when there are several
+// threads so they do not write the same file. /dev/null is shared.
+std::string export_path(const LoadOptions& options, const unsigned int& an_id) {
+  if (options.threads == 1 || options.export_file == "/dev/null")
+    return options.export_file;
+  std::stringstream a_path;
+  a_path << options.export_file << "." << an_id;
+  return a_path.str();
+}
+
+
+// ----- latency histogram -----
 
+// Log linear histogram of nanoseconds: exact below 32 ns, then 16
+// buckets per power of two, so percentiles are within about 6%.
+
+class LatencyHistogram {
+
+public:
+
+  static const int sub_buckets = 16;
+  static const int linear = 32;
+  static const int size = linear + (64 - 5) * sub_buckets;
+
+  LatencyHistogram() : m_counts(size, 0), m_count(0), m_sum(0), m_max(0) {}
+
+  void record(const unsigned long& ns) {
+    ++m_counts[index(ns)];
+    ++m_count;
+    m_sum += ns;
+    if (ns > m_max)
+      m_max = ns;
+  }
+
+  void merge(const LatencyHistogram& a) {
+    for (int k = 0; k < size; ++k)
+      m_counts[k] += a.m_counts[k];
+    m_count += a.m_count;
+    m_sum += a.m_sum;
+    if (a.m_max > m_max)
+      m_max = a.m_max;
+  }
+
+  unsigned long count() const {return m_count;}
+  unsigned long max() const   {return m_max;}
+  double mean() const         {return m_count ? (double) m_sum / m_count : 0.0;}
+
+  // upper bound of the bucket holding the a_fraction quantile.
+  unsigned long percentile(const double& a_fraction) const {
+
+    unsigned long rank((unsigned long) (a_fraction * m_count + 0.5));
+    if (rank < 1)
+      rank = 1;
+
+    unsigned long seen(0);
+    for (int k = 0; k < size; ++k) {
+      seen += m_counts[k];
+      if (seen >= rank)
+	return std::min(upper(k), m_max);
     }
+    return m_max;
+  }
 
+private:
+
+  static int index(const unsigned long& ns) {
+    if (ns < (unsigned long) linear)
+      return ns;
+    const int e(63 - __builtin_clzl(ns)); // >= 5
+    return linear + (e - 5) * sub_buckets + ((ns >> (e - 4)) & (sub_buckets - 1));
   }
 
-  if (hasError) {
-    std::cerr << usage.str() << std::endl;
-    return -1;
+  static unsigned long upper(const int& k) {
+    if (k < linear)
+      return k;
+    const int e((k - linear) / sub_buckets + 5);
+    const unsigned long lower((sub_buckets + (k - linear) % sub_buckets) << (e - 4));
+    return lower + (1UL << (e - 4)) - 1;
   }
 
-  // --------------------
-  // ----- run test -----
-  // --------------------
+  std::vector<unsigned long> m_counts;
+  unsigned long              m_count;
+  unsigned long              m_sum;
+  unsigned long              m_max;
+
+};
+
+
+// ----- start line -----
+
+// Holds the workers until all have built their data, then releases
+// them together with a common deadline.
+
+class StartLine {
+
+public:
+
+  StartLine(const unsigned int& a_workers) : m_waiting(a_workers), m_started(false) {}
+
+  void ready() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    --m_waiting;
+    m_changed.notify_all();
+    m_changed.wait(lock, [this] {return m_started;});
+  }
+
+  // waits for all the workers, returns the start time.
+  std::chrono::steady_clock::time_point start(const double& a_duration) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this] {return m_waiting == 0;});
+    const std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+    m_deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+      (std::chrono::duration<double>(a_duration));
+    m_started = true;
+    m_changed.notify_all();
+    return now;
+  }
+
+  // only valid after ready() returns.
+  std::chrono::steady_clock::time_point deadline() const {return m_deadline;}
+
+private:
+
+  std::mutex                            m_mutex;
+  std::condition_variable               m_changed;
+  unsigned int                          m_waiting;
+  bool                                  m_started;
+  std::chrono::steady_clock::time_point m_deadline;
+
+};
+
+
+// ----- worker -----
+
+struct WorkerResult {
+
+  WorkerResult() : error(false) {
+    for (int k = 0; k < op_count; ++k)
+      vectors[k] = 0;
+  }
+
+  LatencyHistogram latency[op_count];
+  unsigned long    vectors[op_count];  /// vectors processed by each operation
+  bool             error;
+  std::string      message;
+
+};
+
+void worker(const LoadOptions& options, const unsigned int& an_id,
+	    StartLine& a_start, WorkerResult& a_result) {
+
+  std::mt19937 generator(options.seed + an_id);
+
+  // built here so the pages are local to the worker's cpu.
+  std::uniform_real_distribution<double> coordinate(-1.0, 1.0);
+  std::vector<Cartesian::space> a(options.vectors);
+  std::vector<Cartesian::space> b(options.vectors);
+  std::vector<Cartesian::space> results(options.batch);
+
+  for (unsigned long k = 0; k < options.vectors; ++k) {
+    a[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+    b[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+  }
+
+  Cartesian::rotator a_rotator(Cartesian::space(coordinate(generator),
+						coordinate(generator),
+						coordinate(generator)).normalized());
+  Cartesian::SpaceRecorder a_recorder(options.vectors);
+  a_recorder.clear();
+  const std::string export_file(export_path(options, an_id));
+
+  std::discrete_distribution<int> pick_op(options.mix, options.mix + op_count);
+  std::uniform_int_distribution<unsigned long> pick_offset(0, options.vectors - options.batch);
+  std::uniform_real_distribution<double> pick_angle(-M_PI, M_PI);
+
+  a_start.ready();
+
+  const std::chrono::steady_clock::time_point deadline(a_start.deadline());
+  std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+
+  try {
+
+    while (now < deadline) {
+
+      const int op(pick_op(generator));
+      const unsigned long offset(pick_offset(generator));
+      const double angle(pick_angle(generator));
+      unsigned long done(options.batch);
+
+      const std::chrono::steady_clock::time_point begin(std::chrono::steady_clock::now());
+
+      switch (op) {
+
+      case op_add:
+	for (unsigned long k = 0; k < options.batch; ++k)
+	  results[k] = a[offset + k] + b[offset + k];
+	break;
+
+      case op_cross:
+	Cartesian::cross(&a[offset], &b[offset], &results[0], options.batch);
+	break;
+
+      case op_normalize:
+	Cartesian::normalized(&a[offset], &results[0], options.batch);
+	break;
+
+      case op_rotate:
+	a_rotator.rotate(&a[offset], &results[0], options.batch, angle);
+	break;
+
+      case op_record:
+	a_recorder.push(&a[offset], options.batch);
+	break;
+
+      case op_export:
+	a_recorder.write2R(export_file);
+	done = a_recorder.size();
+	break;
+
+      }
+
+      now = std::chrono::steady_clock::now();
+
+      a_result.latency[op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - begin).count());
+      a_result.vectors[op] += done;
+
+    }
+
+  } catch (Cartesian::SpaceError& err) {
+    a_result.error = true;
+    a_result.message = err.what();
+  }
+
+}
+
+
+// ----- report -----
+
+// max resident set size in bytes.
+double max_rss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return usage.ru_maxrss * 1024.0;
+#endif
+}
+
+void report_row(const std::string& a_name, const LatencyHistogram& a_latency,
+		const unsigned long& a_vectors, const double& an_elapsed) {
+
+  std::cout << std::left << std::setw(10) << a_name << std::right
+	    << std::setw(12) << a_latency.count()
+	    << std::fixed << std::setprecision(0)
+	    << std::setw(12) << a_latency.count() / an_elapsed
+	    << std::setw(14) << a_vectors / an_elapsed
+	    << std::setprecision(3)
+	    << std::setw(10) << a_latency.mean() * 1e-3
+	    << std::setw(10) << a_latency.percentile(0.50) * 1e-3
+	    << std::setw(10) << a_latency.percentile(0.90) * 1e-3
+	    << std::setw(10) << a_latency.percentile(0.99) * 1e-3
+	    << std::setw(10) << a_latency.percentile(0.999) * 1e-3
+	    << std::setw(12) << a_latency.max() * 1e-3
+	    << std::endl;
+}
+
+int run_load(const LoadOptions& options) {
+
+  const double rss_before(max_rss());
+
+  std::vector<WorkerResult> results(options.threads);
+  std::vector<std::thread> threads;
+  StartLine start_line(options.threads);
+
+  for (unsigned int k = 0; k < options.threads; ++k)
+    threads.push_back(std::thread(worker, std::cref(options), k,
+				  std::ref(start_line), std::ref(results[k])));
+
+  if (!options.trace_file.empty())
+    Cartesian::trace::enable();
+
+  const std::chrono::steady_clock::time_point started(start_line.start(options.duration));
+
+  for (unsigned int k = 0; k < options.threads; ++k)
+    threads[k].join();
+
+  const double elapsed(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+
+  if (!options.trace_file.empty()) {
+    Cartesian::trace::enable(false);
+    std::ofstream trace_file(options.trace_file.c_str());
+    Cartesian::trace::write_chrome(trace_file);
+    if (!trace_file) {
+      std::cerr << "unable to write " << options.trace_file << std::endl;
+      return 1;
+    }
+  }
+
+  LatencyHistogram total;
+  unsigned long total_vectors(0);
+  int status(0);
+
+  std::cout << "# " << options.threads << " threads, " << options.vectors
+	    << " vectors per thread, batch " << options.batch
+	    << ", seed " << options.seed << ", " << std::fixed << std::setprecision(3)
+	    << elapsed << " s" << std::endl;
+
+  std::cout << std::left << std::setw(10) << "op" << std::right
+	    << std::setw(12) << "requests"
+	    << std::setw(12) << "req/s"
+	    << std::setw(14) << "vectors/s"
+	    << std::setw(10) << "mean us"
+	    << std::setw(10) << "p50 us"
+	    << std::setw(10) << "p90 us"
+	    << std::setw(10) << "p99 us"
+	    << std::setw(10) << "p99.9 us"
+	    << std::setw(12) << "max us"
+	    << std::endl;
+
+  for (int op = 0; op < op_count; ++op) {
+
+    LatencyHistogram latency;
+    unsigned long vectors(0);
+
+    for (unsigned int k = 0; k < options.threads; ++k) {
+      latency.merge(results[k].latency[op]);
+      vectors += results[k].vectors[op];
+    }
+
+    if (latency.count() == 0)
+      continue;
+
+    report_row(operation_names[op], latency, vectors, elapsed);
+
+    total.merge(latency);
+    total_vectors += vectors;
+  }
+
+  report_row("total", total, total_vectors, elapsed);
+
+  const double data_bytes(options.threads * (3.0 * options.vectors + options.batch)
+			  * sizeof(Cartesian::space));
+
+  std::cout << std::setprecision(1)
+	    << "# memory: max rss " << max_rss() / 1048576.0 << " MB, "
+	    << rss_before / 1048576.0 << " MB before the run, "
+	    << data_bytes / 1048576.0 << " MB of vectors and recorders" << std::endl;
+
+  if (!options.trace_file.empty())
+    std::cout << "# trace: " << options.trace_file << ", "
+	      << Cartesian::trace::dropped() << " spans dropped" << std::endl;
+
+  for (unsigned int k = 0; k < options.threads; ++k)
+    if (results[k].error) {
+      std::cerr << "thread " << k << " stopped: " << results[k].message << std::endl;
+      status = 1;
+    }
+
+  return status;
+}
+
+
+// ----- option parsing -----
+
+// name=weight[,name=weight...], a bare name has weight 1. Operations
+// not named get 0.
+bool parse_mix(const std::string& a_mix, double* a_weights) {
+
+  for (int k = 0; k < op_count; ++k)
+    a_weights[k] = 0;
+
+  std::stringstream items(a_mix);
+  std::string item;
+  double sum(0);
+
+  while (std::getline(items, item, ',')) {
+
+    const std::string::size_type equals(item.find('='));
+    const std::string name(item.substr(0, equals));
+    double weight(1);
+
+    if (equals != std::string::npos) {
+      char* end(NULL);
+      weight = strtod(item.c_str() + equals + 1, &end);
+      if (*end != '\0' || end == item.c_str() + equals + 1 || weight < 0)
+	return false;
+    }
+
+    int op(0);
+    while (op < op_count && name != operation_names[op])
+      ++op;
+    if (op == op_count)
+      return false;
+
+    a_weights[op] = weight;
+    sum += weight;
+  }
+
+  return sum > 0;
+}
+
+bool parse_number(const char* a_string, double& a_value) {
+  char* end(NULL);
+  a_value = strtod(a_string, &end);
+  return *a_string != '\0' && *end == '\0' && a_value >= 0;
+}
+
+
+// ========================
+// ===== test harness =====
+// ========================
+
+// the original pass/fail checks, run with -c.
+void run_checks() {
 
   const double a( 3.0);   // TBD use other numbers
   const double b(-4.0);   // TBD use other numbers
@@ -582,4 +1016,127 @@ int main(int argc, char* argv[]) {
 
 }
 
+
+int main(int argc, char* argv[]) {
+
+  // ------------------------------------------
+  // ----- process command line arguments -----
+  // ------------------------------------------
+
+  int    opt;
+  bool   hasError(false);
+  bool   runChecks(false);
+  double value;
+
+  LoadOptions options;
+
+  std::stringstream usage;
+  usage << "Usage: " << argv[0]
+	<< " [-c] [-n vectors] [-b batch] [-t threads] [-d seconds] [-s seed]"
+	<< " [-m op=weight,...] [-o export_file] [-T trace.json]" << std::endl
+	<< "  -c  run the pass/fail checks instead of the load" << std::endl
+	<< "  -n  working set per thread, default " << options.vectors << std::endl
+	<< "  -b  vectors per request, default " << options.batch << std::endl
+	<< "  -t  threads, default " << options.threads << std::endl
+	<< "  -d  duration in seconds, default " << options.duration << std::endl
+	<< "  -s  random seed, thread k uses seed + k, default " << options.seed << std::endl
+	<< "  -m  operation mix, default add=4,cross=2,normalize=2,rotate=2,record=1" << std::endl
+	<< "      operations are add, cross, normalize, rotate, record and export" << std::endl
+	<< "  -o  file export writes with write2R, default " << options.export_file << std::endl
+	<< "      with several threads thread k writes file.k" << std::endl
+	<< "  -T  write a chrome://tracing or Perfetto trace of the batch calls";
+
+  while ((opt = getopt(argc, argv, ":cn:b:t:d:s:m:o:T:h")) != -1) {
+
+    switch(opt) {
+
+    case 'c':
+      runChecks = true;
+      break;
+
+    case 'n':
+    case 'b':
+    case 't':
+    case 's':
+      if (!parse_number(optarg, value) || value != (unsigned long) value) {
+	std::cerr << "Option -" << (char) opt << " needs a whole number, not "
+		  << optarg << std::endl;
+	hasError = true;
+      } else if (opt == 'n') {
+	options.vectors = value;
+      } else if (opt == 'b') {
+	options.batch = value;
+      } else if (opt == 't') {
+	options.threads = value;
+      } else {
+	options.seed = value;
+      }
+      break;
+
+    case 'd':
+      if (!parse_number(optarg, value)) {
+	std::cerr << "Option -d needs a number of seconds, not " << optarg << std::endl;
+	hasError = true;
+      } else {
+	options.duration = value;
+      }
+      break;
+
+    case 'm':
+      if (!parse_mix(optarg, options.mix)) {
+	std::cerr << "Bad operation mix: " << optarg << std::endl;
+	hasError = true;
+      }
+      break;
+
+    case 'o':
+      options.export_file = optarg;
+      break;
+
+    case 'T':
+      options.trace_file = optarg;
+      break;
+
+    case 'h':
+      std::cout << usage.str() << std::endl;
+      return 0;
+
+    case ':':       /* -o without operand */
+      std::cerr << "Option -" << (char) optopt << " requires an operand."
+		<< std::endl;
+      hasError = true;
+      break;
+
+    case '?':
+      std::cerr << "Unrecognized option: -" << (char) optopt << std::endl;
+      hasError = true;
+      break;
+
+    }
+
+  }
+
+  if (options.threads < 1 || options.batch < 1 || options.vectors < options.batch) {
+    std::cerr << "Need at least one thread and 1 <= batch <= vectors." << std::endl;
+    hasError = true;
+  }
+
+  if (hasError) {
+    std::cerr << usage.str() << std::endl;
+    return -1;
+  }
+
+  // --------------------
+  // ----- run test -----
+  // --------------------
+
+  if (runChecks) {
+    run_checks();
+    return 0;
+  }
+
+  return run_load(options);
+
+}
+
 // EOF
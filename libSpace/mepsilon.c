@@ -2,45 +2,160 @@
 // Filename:    mepsilon.c
 // Description: Calculates macine epsilon.
 //              from http://en.wikipedia.org/wiki/Machine_epsilon
+//
+//              mepsilon                  prints the search
+//              mepsilon header [digits [instrument]]
+//                                        writes the build configuration
+//
+//              The header, space_config.h, is written by make and
+//              included by space.h, so libSpace and the bindings use
+//              the epsilon and precision of the machine they are built
+//              on. digits is the str() and repr() precision, default
+//              the decimal digits a double carries less 3 guard digits
+//              for rounding in the arithmetic, 12 for IEEE 754. 0 is
+//              also the default. instrument 1 defines SPACE_INSTRUMENT
+//              in the header, so the library and every client built
+//              against it agree on the event counters.
+//
 // Author:      L.R. McFarland, lrm@starbug.com
 // Created:     10 May 2009
 // Language:    C
-//
-// TODO:        use this to set string precision during build.
 // ================================================================
 
 #include <stdio.h>
- 
-int main( int argc, char **argv ) {
+#include <stdlib.h>
+
+// volatile keeps x87 excess precision out of the comparisons.
+
+static float float_epsilon(int verbose) {
 
   float machEps = 1.0f;
+  volatile float sum;
 
-  printf("current Epsilon, 1 + current Epsilon\n");
   do {
-     printf( "%G\t%.30f\n", machEps, (1.0f + machEps) );
-     machEps /= 2.0f;
-     // If next epsilon yields 1, then break, because current
-     // epsilon is the machine epsilon.
+    if (verbose)
+      printf( "%G\t%.30f\n", machEps, (1.0f + machEps) );
+    machEps /= 2.0f;
+    // If next epsilon yields 1, then break, because current
+    // epsilon is the machine epsilon.
+    sum = 1.0f + machEps / 2.0f;
   }
-  while ((float)(1.0 + (machEps/2.0)) != 1.0);
+  while (sum != 1.0f);
 
-  printf("\nCalculated float Machine epsilon: %G\n", machEps);
+  return machEps;
+}
 
-  printf("===== double =====");
+static double double_epsilon(int verbose) {
 
-  double machEpsl = 1.0l;
+  double machEpsl = 1.0;
+  volatile double sum;
 
-  printf("current Epsilon, 1 + current Epsilon\n");
   do {
-     printf( "%G\t%.60Lf\n", machEpsl, (1.0l + machEpsl) );
-     machEpsl /= 2.0l;
-     // If next epsilon yields 1, then break, because current
-     // epsilon is the machine epsilon.
+    if (verbose)
+      printf( "%G\t%.60f\n", machEpsl, (1.0 + machEpsl) );
+    machEpsl /= 2.0;
+    sum = 1.0 + machEpsl / 2.0;
   }
-  while ((double)(1.0 + (machEpsl/2.0)) != 1.0);
+  while (sum != 1.0);
+
+  return machEpsl;
+}
+
+// mantissa bits, counting the implicit one, from epsilon = 2^(1 - bits).
+static int mantissa_bits(double eps) {
+  int bits = 1;
+  for (; eps < 1.0; eps *= 2.0)
+    ++bits;
+  return bits;
+}
+
+// decimal digits that survive a round trip through the type, the
+// largest d with 10^-d >= eps. 6 for float, 15 for double.
+static int decimal_digits(double eps) {
+  int digits = 0;
+  double power = 0.1;
+  for (; power >= eps; power /= 10.0)
+    ++digits;
+  return digits;
+}
+
+// decimal digits that print any value exactly, the smallest d with
+// 10^(d - 1) > 2^bits. 9 for float, 17 for double.
+static int round_trip_digits(int bits) {
+  int digits = 1;
+  double power = 1.0;
+  for (; power <= (double) (1ULL << bits); power *= 10.0)
+    ++digits;
+  return digits;
+}
+
+static int write_header(const char* path, float feps, double deps, int precision,
+			int instrument) {
+
+  FILE* header = fopen(path, "w");
 
+  if (header == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  fprintf(header, "// ================================================================\n");
+  fprintf(header, "// Filename:    %s\n", path);
+  fprintf(header, "// Description: libSpace build configuration. Generated by make\n");
+  fprintf(header, "//              from mepsilon.c, do not edit.\n");
+  fprintf(header, "// ================================================================\n\n");
+  fprintf(header, "#pragma once\n\n");
+  fprintf(header, "#define SPACE_FLOAT_EPSILON %.9gf\n", feps);
+  fprintf(header, "#define SPACE_FLOAT_DIGITS %d\n\n", decimal_digits(feps));
+  fprintf(header, "#define SPACE_DOUBLE_EPSILON %.17g\n", deps);
+  fprintf(header, "#define SPACE_DOUBLE_MANTISSA_BITS %d\n", mantissa_bits(deps));
+  fprintf(header, "#define SPACE_DOUBLE_DIGITS %d\n", decimal_digits(deps));
+  fprintf(header, "#define SPACE_DOUBLE_ROUND_TRIP_DIGITS %d\n\n",
+	  round_trip_digits(mantissa_bits(deps)));
+  fprintf(header, "// significant digits of str() and repr() in the bindings.\n");
+  fprintf(header, "#define SPACE_PRINT_PRECISION %d\n\n", precision);
+  fprintf(header, "// event counters, see space.h. Set by make INSTRUMENT=1, not by\n");
+  fprintf(header, "// the client's flags, so the library and its clients agree.\n");
+  if (instrument) {
+    fprintf(header, "#ifndef SPACE_INSTRUMENT\n");
+    fprintf(header, "#define SPACE_INSTRUMENT 1\n");
+    fprintf(header, "#endif\n");
+  } else {
+    fprintf(header, "#undef SPACE_INSTRUMENT\n");
+  }
+
+  return fclose(header) != 0;
+}
+
+int main( int argc, char **argv ) {
+
+  if (argc > 1) {
+
+    double deps = double_epsilon(0);
+    int precision = argc > 2 ? atoi(argv[2]) : 0;
+    int instrument = argc > 3 ? atoi(argv[3]) : 0;
+
+    if (precision == 0)
+      precision = decimal_digits(deps) - 3;
+
+    if (precision < 1 || precision > round_trip_digits(mantissa_bits(deps))) {
+      fprintf(stderr, "print precision must be 1 to %d, not %s\n",
+	      round_trip_digits(mantissa_bits(deps)), argv[2]);
+      return 1;
+    }
+
+    return write_header(argv[1], float_epsilon(0), deps, precision, instrument);
+  }
+
+  printf("current Epsilon, 1 + current Epsilon\n");
+  float machEps = float_epsilon(1);
+  printf("\nCalculated float Machine epsilon: %G\n", machEps);
+
+  printf("===== double =====\n");
+
+  printf("current Epsilon, 1 + current Epsilon\n");
+  double machEpsl = double_epsilon(1);
   printf("\nCalculated double Machine epsilon: %G\n", machEpsl);
 
   return 0;
 }
-
@@ -0,0 +1,380 @@
+// ==================================================================
+// Filename:    orbit.cpp
+// Description: Implements the orbital elements functions.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <orbit.h>
+
+// ----------------------------
+// ----- orbital elements -----
+// ----------------------------
+
+// Kepler's equation is solved with the same work for every element, so
+// the loops have no data dependent branches. The hyperbolic anomaly
+// uses the exp below, a libm call would stop vectorization.
+
+namespace {
+
+  const double two_pi(6.28318530717958647693);
+
+  // e^x for |x| <= 708: x = k ln2 + r with |r| <= ln2 / 2, a degree 13
+  // Taylor polynomial of r, and 2^k put in the exponent bits.
+  inline double kepler_exp(const double& x) {
+    const double clamped(std::min(std::max(x, -708.0), 708.0));
+    const double shifted(clamped * 1.44269504088896338700e+00 + 6755399441055744.0);
+    const double k(shifted - 6755399441055744.0);
+    const double r((clamped - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10);
+    const double p(1 + r * (1 + r * (1.0/2 + r * (1.0/6 + r * (1.0/24 + r * (1.0/120 + r * (1.0/720 +
+		   r * (1.0/5040 + r * (1.0/40320 + r * (1.0/362880 + r * (1.0/3628800 +
+		   r * (1.0/39916800 + r * (1.0/479001600 + r * (1.0/6227020800.0))))))))))))));
+    unsigned long long bits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+  }
+
+  // log(x) for x > 0 within 0.06, the exponent plus the mantissa less
+  // one. Only a starting guess.
+  inline double rough_log(const double& x) {
+    unsigned long long bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const unsigned long long exponent_bits((bits >> 52) | 0x4330000000000000ULL);
+    const unsigned long long mantissa_bits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    double exponent, mantissa;
+    memcpy(&exponent, &exponent_bits, sizeof(exponent));
+    memcpy(&mantissa, &mantissa_bits, sizeof(mantissa));
+    return 6.93147180559945286227e-01 * ((exponent - 4503599627370496.0 - 1023) + (mantissa - 1));
+  }
+
+  // x^(1/3) for x >= 0, two Halley steps from rough_log().
+  inline double kepler_cbrt(const double& x) {
+    double y(kepler_exp(rough_log(x) / 3));
+    y = y * (y * y * y + 2 * x) / (2 * y * y * y + x);
+    return y * (y * y * y + 2 * x) / (2 * y * y * y + x);
+  }
+
+  // x - sin x (a_sign -1) or sinh x - x (a_sign 1) for |x| <= 1, a
+  // series to x^19 without the cancellation of the direct forms.
+  inline double odd_tail(const double& x, const double& a_sign) {
+    const double z(a_sign * x * x);
+    const double t(1.0/6 + z * (1.0/120 + z * (1.0/5040 + z * (1.0/362880 + z * (1.0/39916800 +
+		   z * (1.0/6227020800.0 + z * (1.0/1307674368000.0 + z * (1.0/355687428096000.0 +
+		   z * (1.0/121645100408832000.0)))))))));
+    return a_sign * z * x * t;
+  }
+
+  // E for e <= 1. Markley's starter is for M in [0, pi], so M is
+  // reduced by whole turns and reflected, then the turns are added back.
+  inline double elliptic_anomaly(const double& a_mean, const double& e) {
+
+    const double turns((a_mean / two_pi + 6755399441055744.0) - 6755399441055744.0);
+    const double reduced((a_mean - turns * 6.28318530717958623200e+00) - turns * 2.44929359829470635445e-16);
+    const double M(std::abs(reduced));
+
+    const double pi2(M_PI * M_PI);
+    const double alpha((3 * pi2 + 1.6 * M_PI * (M_PI - M) / (1 + e)) / (pi2 - 6));
+    const double d(3 * (1 - e) + alpha * e);
+    const double q(2 * alpha * d * (1 - e) - M * M);
+    const double r(3 * alpha * d * (d - 1 + e) * M + M * M * M);
+    const double root(kepler_cbrt(std::abs(r) + sqrt(q * q * q + r * r)));
+    const double w(root * root);
+    const double denominator(w * w + w * q + q * q);
+    const double E((2 * r * w / (denominator + (denominator == 0 ? 1.0 : 0.0)) + M) / d);
+
+    // one fifth order correction, E - e sin E = (1 - e) E + e (E - sin E).
+    double s, c;
+    Cartesian::fast_sincos(E, s, c);
+    const double f0((1 - e) * E + e * (E < 1 ? odd_tail(E, -1.0) : E - s) - M);
+    const double f1(1 - e * c);
+    const double f2(e * s);
+    const double f3(e * c);
+    const double d3(-f0 / (f1 - 0.5 * f0 * f2 / f1));
+    const double d4(-f0 / (f1 + 0.5 * d3 * f2 + d3 * d3 * f3 / 6));
+    const double d5(-f0 / (f1 + 0.5 * d4 * f2 + d4 * d4 * f3 / 6 - d4 * d4 * d4 * f2 / 24));
+
+    return std::copysign(E + d5, reduced) + turns * two_pi;
+  }
+
+  // a fourth order correction of H for e sinh H - H = M, M >= 0.
+  inline double hyperbolic_step(const double& H, const double& M, const double& e) {
+    const double grown(kepler_exp(H));
+    const double s(0.5 * (grown - 1 / grown));
+    const double c(0.5 * (grown + 1 / grown));
+    const double f0((e - 1) * H + e * (H < 1 ? odd_tail(H, 1.0) : s - H) - M);
+    const double f1(e * c - 1);
+    const double f2(e * s);
+    const double f3(e * c);
+    const double d3(-f0 / (f1 - 0.5 * f0 * f2 / f1));
+    const double d4(-f0 / (f1 + 0.5 * d3 * f2 + d3 * d3 * f3 / 6));
+    return H - f0 / (f1 + 0.5 * d4 * f2 + d4 * d4 * f3 / 6 + d4 * d4 * d4 * f2 / 24);
+  }
+
+  // H for e > 1, from the least of three upper bounds on it, the
+  // linear, cubic and exponential limits of e sinh H - H.
+  inline double hyperbolic_anomaly(const double& a_mean, const double& e) {
+
+    const double M(std::abs(a_mean));
+    double H(std::min(std::min(M / (e - 1), kepler_cbrt(6 * M / e)), rough_log(2 * M / e + 1.8)));
+
+    H = hyperbolic_step(H, M, e);
+    H = hyperbolic_step(H, M, e);
+    H = hyperbolic_step(H, M, e);
+
+    return std::copysign(H, a_mean);
+  }
+
+  bool any_hyperbolic(const double* e, const unsigned long& a_size) {
+    for (unsigned long k = 0; k < a_size; ++k)
+      if (e[k] > 1)
+	return true;
+    return false;
+  }
+
+  const unsigned long kepler_block(256);  // elements per block, in L1
+
+}
+
+void Cartesian::solve_kepler(const double* mean_anomaly,
+			     const double* e,
+			     double* anomaly,
+			     const unsigned long& a_size) {
+
+  SPACE_TRACE("solve_kepler batch");
+
+  for (unsigned long k = 0; k < a_size; ++k)
+    anomaly[k] = elliptic_anomaly(mean_anomaly[k], e[k]);
+
+  if (!any_hyperbolic(e, a_size))
+    return;
+
+  // the hyperbolic solution is four times the elliptic, so only the
+  // hyperbolic orbits of each block are gathered for it.
+  double block_mean[kepler_block], block_e[kepler_block], block_anomaly[kepler_block];
+  unsigned long index[kepler_block];
+
+  for (unsigned long first = 0; first < a_size; first += kepler_block) {
+
+    const unsigned long count(std::min(kepler_block, a_size - first));
+    unsigned long found(0);
+
+    for (unsigned long k = first; k < first + count; ++k)
+      if (e[k] > 1) {
+	index[found] = k;
+	block_mean[found] = mean_anomaly[k];
+	block_e[found] = e[k];
+	++found;
+      }
+
+    for (unsigned long j = 0; j < found; ++j)
+      block_anomaly[j] = hyperbolic_anomaly(block_mean[j], block_e[j]);
+
+    for (unsigned long j = 0; j < found; ++j)
+      anomaly[index[j]] = block_anomaly[j];
+  }
+}
+
+void Cartesian::to_elements(const Cartesian::space* positions,
+			    const Cartesian::space* velocities,
+			    const double& mu,
+			    double* a,
+			    double* e,
+			    double* inclination,
+			    double* node,
+			    double* periapsis,
+			    double* mean_anomaly,
+			    const unsigned long& a_size) {
+
+  SPACE_TRACE("to_elements batch");
+
+  // each block is written to the stack first, eight output arrays are
+  // too many alias checks for the vectorizer.
+  double block_a[kepler_block], block_e[kepler_block], block_inclination[kepler_block];
+  double block_node[kepler_block], block_periapsis[kepler_block], block_mean[kepler_block];
+
+  for (unsigned long first = 0; first < a_size; first += kepler_block) {
+
+    const unsigned long count(std::min(kepler_block, a_size - first));
+
+    for (unsigned long j = 0; j < count; ++j) {
+
+      const unsigned long k(first + j);
+      const double rx(positions[k].x()), ry(positions[k].y()), rz(positions[k].z());
+      const double vx(velocities[k].x()), vy(velocities[k].y()), vz(velocities[k].z());
+      const double r(sqrt(rx*rx + ry*ry + rz*rz));
+      const double v2(vx*vx + vy*vy + vz*vz);
+
+      // angular momentum, its unit vector and the node line (-hy, hx, 0).
+      const double hx(ry*vz - rz*vy), hy(rz*vx - rx*vz), hz(rx*vy - ry*vx);
+      const double h(sqrt(hx*hx + hy*hy + hz*hz));
+      const double ux(hx / h), uy(hy / h), uz(hz / h);
+      const double n(sqrt(hx*hx + hy*hy));
+      // equatorial orbits take x as the node line, no bool locals so the
+      // loop vectorizes.
+      const double flat(n <= Cartesian::space::epsilon * h ? 1.0 : 0.0);
+      const double nx(flat ? 1.0 : -hy / (n + flat));
+      const double ny(flat ? 0.0 : hx / (n + flat));
+
+      // the eccentricity vector, toward periapsis, or the node if circular.
+      const double radial((v2 - mu / r) / mu), along((rx*vx + ry*vy + rz*vz) / mu);
+      const double ex(radial * rx - along * vx), ey(radial * ry - along * vy), ez(radial * rz - along * vz);
+      const double ecc(sqrt(ex*ex + ey*ey + ez*ez));
+      const double round(ecc <= Cartesian::space::epsilon ? 1.0 : 0.0);
+      const double px(round ? nx : ex / (ecc + round));
+      const double py(round ? ny : ey / (ecc + round));
+      const double pz(round ? 0.0 : ez / (ecc + round));
+
+      block_a[j] = 1 / (2 / r - v2 / mu);
+      block_e[j] = ecc;
+      block_inclination[j] = Cartesian::fast_atan2(n, hz);
+      block_node[j] = flat ? 0.0 : Cartesian::fast_atan2(hx, -hy);
+      // angles about the angular momentum, node to p and p to r.
+      block_periapsis[j] = Cartesian::fast_atan2((ny*pz) * ux - (nx*pz) * uy + (nx*py - ny*px) * uz,
+						 nx*px + ny*py);
+      const double sin_true(((py*rz - pz*ry) * ux + (pz*rx - px*rz) * uy + (px*ry - py*rx) * uz) / r);
+      const double cos_true((px*rx + py*ry + pz*rz) / r);
+
+      // M = E - e sin E = (1 - e) E + e (E - sin E), or sinh H for the
+      // hyperbolic pass below.
+      const double root(sqrt(std::abs(1 - ecc*ecc)));
+      const double scaled_sin(root * sin_true / (1 + ecc * cos_true));
+      const double E(Cartesian::fast_atan2(root * sin_true, ecc + cos_true));
+      const double M((1 - ecc) * E + ecc * (std::abs(E) < 1 ? odd_tail(E, -1.0) : E - scaled_sin));
+      block_mean[j] = ecc > 1 ? scaled_sin : M;
+    }
+
+    std::copy(block_a, block_a + count, a + first);
+    std::copy(block_e, block_e + count, e + first);
+    std::copy(block_inclination, block_inclination + count, inclination + first);
+    std::copy(block_node, block_node + count, node + first);
+    std::copy(block_periapsis, block_periapsis + count, periapsis + first);
+    std::copy(block_mean, block_mean + count, mean_anomaly + first);
+  }
+
+  // M = e sinh H - H = (e - 1) H + e (sinh H - H).
+  if (any_hyperbolic(e, a_size))
+    for (unsigned long k = 0; k < a_size; ++k)
+      if (e[k] > 1) {
+	const double sinh_H(mean_anomaly[k]);
+	const double H(asinh(sinh_H));
+	mean_anomaly[k] = (e[k] - 1) * H + e[k] * (std::abs(H) < 1 ? odd_tail(H, 1.0) : sinh_H - H);
+      }
+}
+
+void Cartesian::from_elements(const double* a,
+			      const double* e,
+			      const double* inclination,
+			      const double* node,
+			      const double* periapsis,
+			      const double* mean_anomaly,
+			      const double& mu,
+			      Cartesian::space* positions,
+			      Cartesian::space* velocities,
+			      const unsigned long& a_size) {
+
+  SPACE_TRACE("from_elements batch");
+
+  // positions and velocities by component on the stack, then stored,
+  // as in to_elements.
+  double anomaly[kepler_block];
+  double block[6][kepler_block];
+
+  for (unsigned long first = 0; first < a_size; first += kepler_block) {
+
+    const unsigned long count(std::min(kepler_block, a_size - first));
+    Cartesian::solve_kepler(mean_anomaly + first, e + first, anomaly, count);
+
+    for (unsigned long j = 0; j < count; ++j) {
+
+      const unsigned long k(first + j);
+      const double ecc(e[k]), sma(a[k]), E(anomaly[j]);
+
+      // in the orbit plane, x toward periapsis, both conics computed
+      // and one selected.
+      double s, c;
+      Cartesian::fast_sincos(E, s, c);
+      const double grown(kepler_exp(E));
+      const double sh(0.5 * (grown - 1 / grown)), ch(0.5 * (grown + 1 / grown));
+      const double root(sqrt(std::abs(1 - ecc*ecc)));
+      const double speed(sqrt(mu * std::abs(sma)));
+      const double cosine(ecc > 1 ? ch : c);
+      const double sine(ecc > 1 ? -sh : s);
+      const double r(sma * (1 - ecc * cosine));
+      const double x(sma * (cosine - ecc));
+      const double y(sma * root * sine);
+      const double vx(-speed * (ecc > 1 ? sh : s) / r);
+      const double vy(speed * root * cosine / r);
+
+      // rotated by node about z, inclination about the node line and
+      // periapsis about the angular momentum.
+      double sin_node, cos_node, sin_peri, cos_peri, sin_inc, cos_inc;
+      Cartesian::fast_sincos(node[k], sin_node, cos_node);
+      Cartesian::fast_sincos(periapsis[k], sin_peri, cos_peri);
+      Cartesian::fast_sincos(inclination[k], sin_inc, cos_inc);
+      const double Px(cos_node * cos_peri - sin_node * sin_peri * cos_inc);
+      const double Py(sin_node * cos_peri + cos_node * sin_peri * cos_inc);
+      const double Pz(sin_peri * sin_inc);
+      const double Qx(-cos_node * sin_peri - sin_node * cos_peri * cos_inc);
+      const double Qy(-sin_node * sin_peri + cos_node * cos_peri * cos_inc);
+      const double Qz(cos_peri * sin_inc);
+
+      block[0][j] = x * Px + y * Qx;
+      block[1][j] = x * Py + y * Qy;
+      block[2][j] = x * Pz + y * Qz;
+      block[3][j] = vx * Px + vy * Qx;
+      block[4][j] = vx * Py + vy * Qy;
+      block[5][j] = vx * Pz + vy * Qz;
+    }
+
+    for (unsigned long j = 0; j < count; ++j) {
+      positions[first + j] = Cartesian::space(block[0][j], block[1][j], block[2][j]);
+      velocities[first + j] = Cartesian::space(block[3][j], block[4][j], block[5][j]);
+    }
+  }
+}
+
+void Cartesian::kepler_propagate(Cartesian::space* positions,
+				 Cartesian::space* velocities,
+				 const double& mu,
+				 const double& a_dt,
+				 const unsigned long& a_size) {
+
+  SPACE_TRACE("kepler_propagate batch");
+
+  double a[kepler_block], e[kepler_block], inclination[kepler_block];
+  double node[kepler_block], periapsis[kepler_block], mean_anomaly[kepler_block];
+
+  for (unsigned long first = 0; first < a_size; first += kepler_block) {
+
+    const unsigned long count(std::min(kepler_block, a_size - first));
+    Cartesian::to_elements(positions + first, velocities + first, mu,
+			   a, e, inclination, node, periapsis, mean_anomaly, count);
+
+    for (unsigned long j = 0; j < count; ++j)
+      mean_anomaly[j] += a_dt * sqrt(mu / std::abs(a[j] * a[j] * a[j]));
+
+    Cartesian::from_elements(a, e, inclination, node, periapsis, mean_anomaly, mu,
+			     positions + first, velocities + first, count);
+  }
+}
@@ -0,0 +1,66 @@
+// ================================================================
+// Filename:    orbit.h
+// Description: Two body orbits: Kepler's equation and the classical
+//              orbital elements of space positions and velocities.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // ----------------------------
+  // ----- orbital elements -----
+  // ----------------------------
+
+  // Two body orbits about a mass with gravitational parameter mu (G M).
+  // The classical elements are arrays: semi major axis a, negative for
+  // a hyperbola, eccentricity e, inclination, longitude of the
+  // ascending node, argument of periapsis and mean anomaly, the angles
+  // in radians. An equatorial orbit has node 0 and a circular one
+  // periapsis 0. Parabolas, e = 1, are not supported.
+  //
+  // The loops are branch free with the fast_ functions, so they
+  // vectorize like polar_fast. Hyperbolic orbits are a second pass,
+  // only when there are any.
+
+  // Kepler's equation for the eccentric anomaly E, M = E - e sin E, or
+  // for e > 1 the hyperbolic anomaly H, M = e sinh H - H. A fixed number
+  // of iterations: Markley's (1995) starter and one fifth order
+  // correction for e < 1, within 1e-15 relative, and three fourth order
+  // corrections for e > 1, within 1e-13.
+  void solve_kepler(const double* mean_anomaly, const double* e, double* anomaly,
+		    const unsigned long& a_size);
+
+  void to_elements(const space* positions, const space* velocities, const double& mu,
+		   double* a, double* e, double* inclination, double* node,
+		   double* periapsis, double* mean_anomaly, const unsigned long& a_size);
+  void from_elements(const double* a, const double* e, const double* inclination,
+		     const double* node, const double* periapsis, const double* mean_anomaly,
+		     const double& mu, space* positions, space* velocities,
+		     const unsigned long& a_size);
+
+  // advances two body orbits a_dt in place, through their elements.
+  void kepler_propagate(space* positions, space* velocities, const double& mu,
+			const double& a_dt, const unsigned long& a_size);
+
+} // end namespace Cartesian
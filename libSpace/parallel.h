@@ -0,0 +1,100 @@
+// ================================================================
+// Filename:    parallel.h
+// Description: Thread helpers shared by the libSpace sources. They
+//              are not part of the library's interface, clients do
+//              not include this file.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // a_threads, or one per core for 0.
+  inline unsigned long worker_count(const unsigned int& a_threads) {
+    return a_threads ? a_threads : std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  // calls a_function(first, last) for blocks of a_block indices of
+  // [0, a_size) on up to a_threads threads, each taking the next block
+  // when it finishes one. The calling thread is one of them.
+  template <typename Function>
+  void parallel_blocks(const unsigned long& a_threads, const unsigned long& a_size,
+		       const unsigned long& a_block, const Function& a_function) {
+
+    const unsigned long block(std::max(a_block, 1ul));
+    const unsigned long threads(std::max(std::min(a_threads, (a_size + block - 1) / block), 1ul));
+    std::atomic<unsigned long> next(0);
+
+    auto work = [&]() {
+      for (unsigned long first(next.fetch_add(block)); first < a_size; first = next.fetch_add(block))
+	a_function(first, std::min(first + block, a_size));
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned long t = 1; t < threads; ++t)
+      workers.push_back(std::thread(work));
+
+    work();
+
+    for (unsigned long t = 0; t < workers.size(); ++t)
+      workers[t].join();
+  }
+
+  typedef std::pair<unsigned long long, unsigned long> KeyIndex;
+
+  // keys[i] = (a_key(i), i) for [0, keys.size()), sorted. a_threads
+  // chunks are filled and sorted in parallel, then merged in pairs.
+  template <typename Key>
+  void sort_keys(std::vector<KeyIndex>& keys, const unsigned long& a_threads, const Key& a_key) {
+
+    const unsigned long size(keys.size());
+    const unsigned long chunk((size + a_threads - 1) / a_threads);
+
+    parallel_blocks(a_threads, size, chunk,
+		    [&](const unsigned long& a_first, const unsigned long& a_last) {
+		      for (unsigned long i = a_first; i < a_last; ++i)
+			keys[i] = KeyIndex(a_key(i), i);
+		      std::sort(keys.begin() + a_first, keys.begin() + a_last);
+		    });
+
+    for (unsigned long sorted = chunk; sorted < size; sorted *= 2)
+      parallel_blocks(a_threads, size, 2 * sorted,
+		      [&](const unsigned long& a_first, const unsigned long& a_last) {
+			if (a_first + sorted < a_last)
+			  std::inplace_merge(keys.begin() + a_first, keys.begin() + a_first + sorted,
+					     keys.begin() + a_last);
+		      });
+  }
+
+  // a_point's x, y or z for an_axis 0, 1 or 2.
+  inline double coordinate(const space& a_point, const unsigned int& an_axis) {
+    return an_axis == 0 ? a_point.x() : (an_axis == 1 ? a_point.y() : a_point.z());
+  }
+
+} // end namespace Cartesian
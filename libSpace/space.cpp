@@ -24,8 +24,306 @@
 
 
 #include <stdlib.h>  /* strtod */
+#include <unistd.h>  /* getpid */
+#include <algorithm> /* copy */
+#include <iomanip>   /* setw */
+#include <mutex>
 #include <space.h>
 
+// ====================
+// ===== counters =====
+// ====================
+
+#ifdef SPACE_INSTRUMENT
+const bool Cartesian::counters::enabled(true);
+#else
+const bool Cartesian::counters::enabled(false);
+#endif
+
+const char* const Cartesian::counters::names[event_count] = {
+  "rotator_cache_hits",
+  "rotator_cache_misses",
+  "recorder_evictions",
+  "divide_zero_errors"
+};
+
+const char* const Cartesian::counters::descriptions[event_count] = {
+  "rotations that reused the cached rotation matrix",
+  "rotations that rebuilt the rotation matrix",
+  "SpaceRecorder entries dropped to make room",
+  "DivideZeroError exceptions thrown"
+};
+
+namespace {
+
+  // The live threads' counters and the totals of the threads that
+  // have exited. reset() moves the baseline instead of writing to
+  // counters other threads own.
+  struct Registry {
+    std::mutex                                         mutex;
+    std::vector<Cartesian::counters::ThreadCounters*>  threads;
+    unsigned long long                                 retired[Cartesian::counters::event_count];
+    unsigned long long                                 baseline[Cartesian::counters::event_count];
+  };
+
+  // never destroyed, threads may exit after static destruction.
+  Registry& registry() {
+    static Registry* a_registry(new Registry());
+    return *a_registry;
+  }
+
+  // owns a thread's counters, folds them into retired on thread exit.
+  struct ThreadSlot {
+
+    ThreadSlot() {
+      for (int k = 0; k < Cartesian::counters::event_count; ++k)
+	counters.counts[k].store(0, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock(registry().mutex);
+      registry().threads.push_back(&counters);
+    }
+
+    ~ThreadSlot() {
+      Registry& a_registry(registry());
+      std::lock_guard<std::mutex> lock(a_registry.mutex);
+      for (int k = 0; k < Cartesian::counters::event_count; ++k)
+	a_registry.retired[k] += counters.counts[k].load(std::memory_order_relaxed);
+      a_registry.threads.erase(std::find(a_registry.threads.begin(),
+					 a_registry.threads.end(), &counters));
+    }
+
+    Cartesian::counters::ThreadCounters counters;
+
+  };
+
+  // totals since the start, mutex held.
+  void totals(const Registry& a_registry, unsigned long long* a_totals) {
+    for (int k = 0; k < Cartesian::counters::event_count; ++k)
+      a_totals[k] = a_registry.retired[k];
+    for (unsigned long t = 0; t < a_registry.threads.size(); ++t)
+      for (int k = 0; k < Cartesian::counters::event_count; ++k)
+	a_totals[k] += a_registry.threads[t]->counts[k].load(std::memory_order_relaxed);
+  }
+
+}
+
+Cartesian::counters::ThreadCounters* Cartesian::counters::register_thread() {
+  static thread_local ThreadSlot a_slot;
+  return &a_slot.counters;
+}
+
+Cartesian::counters::Snapshot Cartesian::counters::snapshot() {
+
+  Registry& a_registry(registry());
+  std::lock_guard<std::mutex> lock(a_registry.mutex);
+
+  Cartesian::counters::Snapshot a_snapshot;
+  totals(a_registry, a_snapshot.counts);
+  for (int k = 0; k < event_count; ++k)
+    a_snapshot.counts[k] -= a_registry.baseline[k];
+
+  return a_snapshot;
+}
+
+void Cartesian::counters::reset() {
+  Registry& a_registry(registry());
+  std::lock_guard<std::mutex> lock(a_registry.mutex);
+  totals(a_registry, a_registry.baseline);
+}
+
+// Prometheus text exposition format, one counter per event.
+void Cartesian::counters::write_prometheus(std::ostream& os,
+					   const Cartesian::counters::Snapshot& a_snapshot) {
+  for (int k = 0; k < event_count; ++k)
+    os << "# HELP space_" << names[k] << "_total " << descriptions[k] << ".\n"
+       << "# TYPE space_" << names[k] << "_total counter\n"
+       << "space_" << names[k] << "_total " << a_snapshot.counts[k] << "\n";
+}
+
+void Cartesian::counters::write_json(std::ostream& os,
+				     const Cartesian::counters::Snapshot& a_snapshot) {
+  os << "{\"enabled\": " << (enabled ? "true" : "false");
+  for (int k = 0; k < event_count; ++k)
+    os << ", \"" << names[k] << "\": " << a_snapshot.counts[k];
+  os << "}";
+}
+
+
+// =======================
+// ===== trace spans =====
+// =======================
+
+std::atomic<bool> Cartesian::trace::on(false);
+
+const unsigned long Cartesian::trace::buffer_size(1 << 15);
+
+namespace {
+
+  struct TraceEvent {
+    const char*        name;
+    unsigned long long start;
+    unsigned long long duration;
+  };
+
+  // single producer, single consumer ring. The owning thread advances
+  // head, write_chrome() advances tail under the registry mutex.
+  struct TraceBuffer {
+
+    TraceBuffer(const unsigned long& a_tid) :
+      events(Cartesian::trace::buffer_size), head(0), tail(0), tid(a_tid), retired(false) {}
+
+    std::vector<TraceEvent>    events;
+    std::atomic<unsigned long> head;  // next slot to write
+    std::atomic<unsigned long> tail;  // next slot to read
+    unsigned long              tid;   // 1, 2, ... in order of first span
+    bool                       retired;  // thread exited, mutex held
+  };
+
+  struct TraceRegistry {
+    std::mutex                          mutex;
+    std::vector<TraceBuffer*>           buffers;
+    unsigned long                       next_tid;
+    std::atomic<unsigned long long>     dropped;
+  };
+
+  // never destroyed, threads may exit after static destruction.
+  TraceRegistry& trace_registry() {
+    static TraceRegistry* a_registry(new TraceRegistry());
+    return *a_registry;
+  }
+
+  void erase_buffer(TraceRegistry& a_registry, TraceBuffer* a_buffer) {
+    a_registry.buffers.erase(std::find(a_registry.buffers.begin(),
+				       a_registry.buffers.end(), a_buffer));
+    delete a_buffer;
+  }
+
+  // registers the thread's ring on its first span. On thread exit an
+  // empty ring is freed, otherwise write_chrome() frees it once drained.
+  struct TraceSlot {
+
+    TraceSlot() {
+      TraceRegistry& a_registry(trace_registry());
+      std::lock_guard<std::mutex> lock(a_registry.mutex);
+      buffer = new TraceBuffer(++a_registry.next_tid);
+      a_registry.buffers.push_back(buffer);
+    }
+
+    ~TraceSlot() {
+      TraceRegistry& a_registry(trace_registry());
+      std::lock_guard<std::mutex> lock(a_registry.mutex);
+      if (buffer->head.load(std::memory_order_relaxed) == buffer->tail.load(std::memory_order_relaxed))
+	erase_buffer(a_registry, buffer);
+      else
+	buffer->retired = true;
+    }
+
+    TraceBuffer* buffer;
+
+  };
+
+  TraceBuffer& thread_trace_buffer() {
+    static thread_local TraceSlot a_slot;
+    return *a_slot.buffer;
+  }
+
+  // name as a JSON string.
+  void write_json_string(std::ostream& os, const char* a_name) {
+    os << '"';
+    for (const char* c = a_name; *c != '\0'; ++c) {
+      if (*c == '"' || *c == '\\')
+	os << '\\' << *c;
+      else if ((unsigned char) *c < 0x20)
+	os << ' ';
+      else
+	os << *c;
+    }
+    os << '"';
+  }
+
+}
+
+void Cartesian::trace::enable(const bool& a_flag) {
+  on.store(a_flag, std::memory_order_relaxed);
+}
+
+void Cartesian::trace::record(const char* a_name,
+			      const unsigned long long& a_start,
+			      const unsigned long long& an_end) {
+
+  TraceBuffer& a_buffer(thread_trace_buffer());
+
+  const unsigned long head(a_buffer.head.load(std::memory_order_relaxed));
+
+  if (head - a_buffer.tail.load(std::memory_order_acquire) >= buffer_size) {
+    trace_registry().dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  TraceEvent& an_event(a_buffer.events[head % buffer_size]);
+  an_event.name = a_name;
+  an_event.start = a_start;
+  an_event.duration = an_end - a_start;
+
+  a_buffer.head.store(head + 1, std::memory_order_release);
+}
+
+unsigned long long Cartesian::trace::dropped() {
+  return trace_registry().dropped.load(std::memory_order_relaxed);
+}
+
+void Cartesian::trace::clear() {
+  TraceRegistry& a_registry(trace_registry());
+  std::lock_guard<std::mutex> lock(a_registry.mutex);
+  for (unsigned long k = a_registry.buffers.size(); k-- > 0; ) {
+    TraceBuffer* a_buffer(a_registry.buffers[k]);
+    a_buffer->tail.store(a_buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+    if (a_buffer->retired)
+      erase_buffer(a_registry, a_buffer);
+  }
+}
+
+void Cartesian::trace::write_chrome(std::ostream& os) {
+
+  TraceRegistry& a_registry(trace_registry());
+  std::lock_guard<std::mutex> lock(a_registry.mutex);
+
+  const long pid(getpid());
+  bool first(true);
+
+  os << "{\"traceEvents\": [";
+
+  for (unsigned long k = a_registry.buffers.size(); k-- > 0; ) {
+
+    TraceBuffer* a_buffer(a_registry.buffers[k]);
+
+    const unsigned long head(a_buffer->head.load(std::memory_order_acquire));
+    unsigned long tail(a_buffer->tail.load(std::memory_order_relaxed));
+
+    for (; tail != head; ++tail) {
+
+      const TraceEvent& an_event(a_buffer->events[tail % buffer_size]);
+
+      os << (first ? "\n" : ",\n") << "{\"name\": ";
+      write_json_string(os, an_event.name);
+      os << ", \"cat\": \"space\", \"ph\": \"X\", \"pid\": " << pid
+	 << ", \"tid\": " << a_buffer->tid
+	 << ", \"ts\": " << an_event.start / 1000 << "." << std::setfill('0') << std::setw(3)
+	 << an_event.start % 1000
+	 << ", \"dur\": " << an_event.duration / 1000 << "." << std::setw(3)
+	 << an_event.duration % 1000 << std::setfill(' ') << "}";
+      first = false;
+    }
+
+    a_buffer->tail.store(head, std::memory_order_release);
+
+    if (a_buffer->retired)
+      erase_buffer(a_registry, a_buffer);
+  }
+
+  os << "\n], \"displayTimeUnit\": \"ns\"}\n";
+}
+
+
 // TODO stand-ins until c++ 11
 double Cartesian::stod(const std::string& a_string) {
   // doesn't catch syntax errors
@@ -66,7 +364,7 @@ int Cartesian::stoi(const std::string& a_string) {
 
 // ----- static data members -----
 
-const double Cartesian::space::epsilon(1e-16); // TODO from build
+const double Cartesian::space::epsilon(SPACE_DOUBLE_EPSILON);
 
 const Cartesian::space Cartesian::space::Uo(0,0,0);
 const Cartesian::space Cartesian::space::Ux(1,0,0);
@@ -119,16 +417,20 @@ Cartesian::space Cartesian::operator*(const Cartesian::space& lhs,
 Cartesian::space Cartesian::operator/(const Cartesian::space& lhs,
 				      const double& rhs)
   throw (DivideZeroError) {
-  if (rhs == 0)
+  if (rhs == 0) {
+    SPACE_COUNT(divide_zero_error, 1);
     throw DivideZeroError();
+  }
   return Cartesian::space(lhs.x() / rhs, lhs.y() / rhs, lhs.z() / rhs);
 }
 
 Cartesian::space Cartesian::operator/(const double& lhs,
 				      const Cartesian::space& rhs)
   throw (DivideZeroError) {
-  if (rhs.x() == 0 || rhs.y() == 0 || rhs.z() == 0)
+  if (rhs.x() == 0 || rhs.y() == 0 || rhs.z() == 0) {
+    SPACE_COUNT(divide_zero_error, 1);
     throw DivideZeroError();
+  }
   return Cartesian::space(lhs / rhs.x(), lhs / rhs.y(), lhs / rhs.z());
 }
 
@@ -153,6 +455,189 @@ Cartesian::space Cartesian::cross(const Cartesian::space& a,
   return tmp;
 }
 
+// ----- batch products -----
+
+void Cartesian::dot(const Cartesian::space* a,
+		    const Cartesian::space* b,
+		    double* a_results,
+		    const unsigned long& a_size) {
+
+  SPACE_TRACE("dot batch");
+
+  for (unsigned long i = 0; i < a_size; ++i)
+    a_results[i] = a[i].x()*b[i].x() + a[i].y()*b[i].y() + a[i].z()*b[i].z();
+}
+
+void Cartesian::cross(const Cartesian::space* a,
+		      const Cartesian::space* b,
+		      Cartesian::space* a_results,
+		      const unsigned long& a_size) {
+
+  SPACE_TRACE("cross batch");
+
+  // locals so a_results may alias a or b.
+  for (unsigned long i = 0; i < a_size; ++i) {
+    const double ax(a[i].x()), ay(a[i].y()), az(a[i].z());
+    const double bx(b[i].x()), by(b[i].y()), bz(b[i].z());
+    a_results[i].x(ay*bz - az*by);
+    a_results[i].y(az*bx - ax*bz);
+    a_results[i].z(ax*by - ay*bx);
+  }
+}
+
+void Cartesian::normalized(const Cartesian::space* a,
+			   Cartesian::space* a_results,
+			   const unsigned long& a_size) {
+
+  SPACE_TRACE("normalized batch");
+
+  for (unsigned long i = 0; i < a_size; ++i)
+    a_results[i] = a[i].normalized();
+}
+
+// The masked kernels work a 64 element word at a time. The flags are
+// or'ed into the word without branches and the loop has no throws.
+
+unsigned long Cartesian::divide(const Cartesian::space* a,
+				const double* b,
+				Cartesian::space* a_results,
+				unsigned long long* a_zero_mask,
+				const unsigned long& a_size) {
+
+  SPACE_TRACE("divide batch");
+
+  unsigned long zeros(0);
+
+  for (unsigned long word = 0; word < zero_mask_words(a_size); ++word) {
+
+    const unsigned long first(word * 64);
+    const unsigned long last(std::min(first + 64, a_size));
+    unsigned long long bits(0);
+
+    for (unsigned long i = first; i < last; ++i) {
+      const double d(b[i]);
+      a_results[i] = Cartesian::unchecked_divide(a[i], d);
+      bits |= (unsigned long long) (d == 0) << (i - first);
+    }
+
+    a_zero_mask[word] = bits;
+    zeros += __builtin_popcountll(bits);
+  }
+
+  return zeros;
+}
+
+unsigned long Cartesian::divide(const double* a,
+				const Cartesian::space* b,
+				Cartesian::space* a_results,
+				unsigned long long* a_zero_mask,
+				const unsigned long& a_size) {
+
+  SPACE_TRACE("divide batch");
+
+  unsigned long zeros(0);
+
+  for (unsigned long word = 0; word < zero_mask_words(a_size); ++word) {
+
+    const unsigned long first(word * 64);
+    const unsigned long last(std::min(first + 64, a_size));
+    unsigned long long bits(0);
+
+    for (unsigned long i = first; i < last; ++i) {
+      const Cartesian::space d(b[i]);
+      a_results[i] = Cartesian::unchecked_divide(a[i], d);
+      bits |= (unsigned long long) ((d.x() == 0) | (d.y() == 0) | (d.z() == 0)) << (i - first);
+    }
+
+    a_zero_mask[word] = bits;
+    zeros += __builtin_popcountll(bits);
+  }
+
+  return zeros;
+}
+
+unsigned long Cartesian::normalized(const Cartesian::space* a,
+				    Cartesian::space* a_results,
+				    unsigned long long* a_zero_mask,
+				    const unsigned long& a_size) {
+
+  SPACE_TRACE("normalized batch");
+
+  unsigned long zeros(0);
+
+  for (unsigned long word = 0; word < zero_mask_words(a_size); ++word) {
+
+    const unsigned long first(word * 64);
+    const unsigned long last(std::min(first + 64, a_size));
+    unsigned long long bits(0);
+
+    for (unsigned long i = first; i < last; ++i) {
+      const double h(a[i].magnitude());
+      a_results[i] = Cartesian::unchecked_divide(a[i], h);
+      bits |= (unsigned long long) (h == 0) << (i - first);
+    }
+
+    a_zero_mask[word] = bits;
+    zeros += __builtin_popcountll(bits);
+  }
+
+  return zeros;
+}
+
+unsigned long Cartesian::approx_equal(const Cartesian::space* a,
+				      const Cartesian::space* b,
+				      unsigned long long* a_equal_mask,
+				      const unsigned long& a_size,
+				      const double& a_absolute,
+				      const double& a_relative) {
+
+  unsigned long equal(0);
+
+  for (unsigned long word = 0; word < zero_mask_words(a_size); ++word) {
+
+    const unsigned long first(word * 64);
+    const unsigned long last(std::min(first + 64, a_size));
+    double same[64]; // 1 or 0, the comparisons vectorize as doubles, not as bits
+    unsigned long long bits(0);
+
+    for (unsigned long i = first; i < last; ++i)
+      same[i - first] = Cartesian::approx_equal(a[i], b[i], a_absolute, a_relative) ? 1.0 : 0.0;
+
+    for (unsigned long i = first; i < last; ++i)
+      bits |= (unsigned long long) same[i - first] << (i - first);
+
+    a_equal_mask[word] = bits;
+    equal += __builtin_popcountll(bits);
+  }
+
+  return equal;
+}
+
+unsigned long Cartesian::approx_equal_ulps(const Cartesian::space* a,
+					   const Cartesian::space* b,
+					   unsigned long long* a_equal_mask,
+					   const unsigned long& a_size,
+					   const unsigned long long& a_ulps) {
+
+  unsigned long equal(0);
+
+  for (unsigned long word = 0; word < zero_mask_words(a_size); ++word) {
+
+    const unsigned long first(word * 64);
+    const unsigned long last(std::min(first + 64, a_size));
+    unsigned long long bits(0);
+
+    // not vectorized, sse2 has no 64 bit integer compare.
+    for (unsigned long i = first; i < last; ++i)
+      bits |= (unsigned long long) Cartesian::approx_equal_ulps(a[i], b[i], a_ulps) << (i - first);
+
+    a_equal_mask[word] = bits;
+    equal += __builtin_popcountll(bits);
+  }
+
+  return equal;
+}
+
 // ----- set using polar coordinates -----
 
 void Cartesian::space::setUsingPolarCoords(double radius,
@@ -166,6 +651,78 @@ void Cartesian::space::setUsingPolarCoords(double radius,
   z(radius * cos(phi));
 }
 
+void Cartesian::space::getPolarCoords(double& radius,
+				      double& theta,
+				      double& phi) const {
+  // theta and phi as in setUsingPolarCoords(), zero for the origin.
+  const double rho(sqrt(m_x*m_x + m_y*m_y));
+  radius = sqrt(rho*rho + m_z*m_z);
+  theta = atan2(m_y, m_x);
+  phi = atan2(rho, m_z);
+}
+
+// ----- batch polar conversions -----
+
+// The fast loops are branch free and call no functions but sqrt, so
+// the compiler may vectorize them.
+
+void Cartesian::from_polar(const double* radius,
+			   const double* theta,
+			   const double* phi,
+			   Cartesian::space* a_results,
+			   const unsigned long& a_size,
+			   const Cartesian::PolarMode& a_mode) {
+
+  SPACE_TRACE("from_polar batch");
+
+  if (a_mode == polar_fast) {
+
+    for (unsigned long i = 0; i < a_size; ++i) {
+      double sin_theta, cos_theta, sin_phi, cos_phi;
+      Cartesian::fast_sincos(theta[i], sin_theta, cos_theta);
+      Cartesian::fast_sincos(phi[i], sin_phi, cos_phi);
+      a_results[i] = Cartesian::space(radius[i] * sin_phi * cos_theta,
+				      radius[i] * sin_phi * sin_theta,
+				      radius[i] * cos_phi);
+    }
+
+  } else {
+
+    for (unsigned long i = 0; i < a_size; ++i)
+      a_results[i].setUsingPolarCoords(radius[i], theta[i], phi[i]);
+
+  }
+
+}
+
+void Cartesian::to_polar(const Cartesian::space* a,
+			 double* radius,
+			 double* theta,
+			 double* phi,
+			 const unsigned long& a_size,
+			 const Cartesian::PolarMode& a_mode) {
+
+  SPACE_TRACE("to_polar batch");
+
+  if (a_mode == polar_fast) {
+
+    for (unsigned long i = 0; i < a_size; ++i) {
+      const double x(a[i].x()), y(a[i].y()), z(a[i].z());
+      const double rho(sqrt(x*x + y*y));
+      radius[i] = sqrt(rho*rho + z*z);
+      theta[i] = Cartesian::fast_atan2(y, x);
+      phi[i] = Cartesian::fast_atan2(rho, z);
+    }
+
+  } else {
+
+    for (unsigned long i = 0; i < a_size; ++i)
+      a[i].getPolarCoords(radius[i], theta[i], phi[i]);
+
+  }
+
+}
+
 // -------------------------
 // ----- class rotator -----
 // -------------------------
@@ -181,7 +738,8 @@ Cartesian::rotator::rotator(const Cartesian::space& a_axis) :
 Cartesian::rotator::rotator(const Cartesian::rotator& rhs) :
   m_axis(rhs.axis()),
   m_rotation_matrix(rhs.m_rotation_matrix),
-  m_is_new_axis(rhs.m_is_new_axis)
+  m_is_new_axis(rhs.m_is_new_axis),
+  m_old_radians(rhs.m_old_radians)
 {} // TBD test this
 
 Cartesian::rotator&
@@ -190,6 +748,7 @@ Cartesian::rotator::operator=(const Cartesian::rotator& rhs) {
   axis(rhs.axis());
   m_rotation_matrix = rhs.m_rotation_matrix;
   m_is_new_axis = rhs.m_is_new_axis;
+  m_old_radians = rhs.m_old_radians;
   return *this;
 } // TBD test this
 
@@ -202,11 +761,12 @@ void Cartesian::rotator::axis(const Cartesian::space& a_axis) {
   }
 }
 
-Cartesian::space Cartesian::rotator::rotate(const Cartesian::space& a_heading,
-					    const double& a_radians) {
+void Cartesian::rotator::update(const double& a_radians) {
 
   if (m_is_new_axis || m_old_radians != a_radians) {
 
+    SPACE_COUNT(rotator_cache_miss, 1);
+
     double c(cos(a_radians));
     double s(sin(a_radians));
 
@@ -239,8 +799,17 @@ Cartesian::space Cartesian::rotator::rotate(const Cartesian::space& a_heading,
     m_is_new_axis = false;
     m_old_radians = a_radians;
 
+  } else {
+    SPACE_COUNT(rotator_cache_hit, 1);
   }
 
+}
+
+Cartesian::space Cartesian::rotator::rotate(const Cartesian::space& a_heading,
+					    const double& a_radians) {
+
+  update(a_radians);
+
   Cartesian::space tmp(m_rotation_matrix[0][0]*a_heading.x() +
 	    m_rotation_matrix[0][1]*a_heading.y() +
 	    m_rotation_matrix[0][2]*a_heading.z(),
@@ -255,6 +824,38 @@ Cartesian::space Cartesian::rotator::rotate(const Cartesian::space& a_heading,
 
 }
 
+void Cartesian::rotator::rotate(const Cartesian::space* a_headings,
+				Cartesian::space* a_results,
+				const unsigned long& a_size,
+				const double& a_radians) {
+
+  SPACE_TRACE("rotator::rotate batch");
+
+  update(a_radians);
+
+  // hoist the matrix out of the vector of vectors for the loop.
+  const double r00(m_rotation_matrix[0][0]);
+  const double r01(m_rotation_matrix[0][1]);
+  const double r02(m_rotation_matrix[0][2]);
+  const double r10(m_rotation_matrix[1][0]);
+  const double r11(m_rotation_matrix[1][1]);
+  const double r12(m_rotation_matrix[1][2]);
+  const double r20(m_rotation_matrix[2][0]);
+  const double r21(m_rotation_matrix[2][1]);
+  const double r22(m_rotation_matrix[2][2]);
+
+  for (unsigned long k = 0; k < a_size; ++k) {
+    // copy first so a_results may alias a_headings.
+    const double x(a_headings[k].x());
+    const double y(a_headings[k].y());
+    const double z(a_headings[k].z());
+    a_results[k] = Cartesian::space(r00*x + r01*y + r02*z,
+				    r10*x + r11*y + r12*z,
+				    r20*x + r21*y + r22*z);
+  }
+
+}
+
 
 // =========================
 // ===== SpaceRecorder =====
@@ -262,34 +863,138 @@ Cartesian::space Cartesian::rotator::rotate(const Cartesian::space& a_heading,
 
 const unsigned int Cartesian::SpaceRecorder::default_size(1024);
 
+// starts full of Uo, write2R skips them by default.
 Cartesian::SpaceRecorder::SpaceRecorder(const unsigned int& a_size_limit) :
   m_size_limit(a_size_limit),
-  m_data(std::deque<Cartesian::space>(m_size_limit))
+  m_data(m_size_limit),
+  m_head(0),
+  m_size(m_size_limit)
 {}
 
 Cartesian::SpaceRecorder::SpaceRecorder(const Cartesian::SpaceRecorder& a):
   m_size_limit(a.sizeLimit()),
-  m_data(a.m_data)
+  m_data(a.m_data),
+  m_head(a.m_head),
+  m_size(a.m_size)
 {}
 
 Cartesian::SpaceRecorder&
 Cartesian::SpaceRecorder::operator=(const Cartesian::SpaceRecorder& rhs) {
   if (this == &rhs) return *this;
-  sizeLimit(rhs.sizeLimit());
+  m_size_limit = rhs.sizeLimit();
   m_data = rhs.m_data;
+  m_head = rhs.m_head;
+  m_size = rhs.m_size;
   return *this;
 }
 
+void Cartesian::SpaceRecorder::sizeLimit(const int& a) {
+
+  SPACE_TRACE("SpaceRecorder::sizeLimit");
+
+  // reallocates the ring, oldest first, dropping the oldest entries
+  // that no longer fit.
+  const unsigned int a_size_limit(a < 0 ? 0 : a);
+  const unsigned long kept(m_size < a_size_limit ? m_size : a_size_limit);
+
+  std::vector<Cartesian::space> a_data(a_size_limit);
+  for (unsigned long k = 0; k < kept; ++k)
+    a_data[k] = get(m_size - kept + k);
+
+  SPACE_COUNT(recorder_eviction, m_size - kept);
+
+  m_data.swap(a_data);
+  m_size_limit = a_size_limit;
+  m_head = 0;
+  m_size = kept;
+}
+
 void Cartesian::SpaceRecorder::push(Cartesian::space a) {
-  // even up the sizes to just under the limit.
-  while (m_data.size() > sizeLimit() - 1)
-    m_data.pop_front();
-  m_data.push_back(a);
+
+  if (m_size_limit == 0) {
+    SPACE_COUNT(recorder_eviction, 1);
+    return;
+  }
+
+  if (m_size < m_size_limit) {
+    unsigned long k(m_head + m_size);
+    if (k >= m_size_limit)
+      k -= m_size_limit;
+    m_data[k] = a;
+    ++m_size;
+  } else {
+    // full, overwrite the oldest.
+    SPACE_COUNT(recorder_eviction, 1);
+    m_data[m_head] = a;
+    if (++m_head == m_size_limit)
+      m_head = 0;
+  }
+
+}
+
+void Cartesian::SpaceRecorder::push(const Cartesian::space* a,
+				    const unsigned long& a_size) {
+
+  SPACE_TRACE("SpaceRecorder::push bulk");
+
+  if (m_size_limit == 0) {
+    SPACE_COUNT(recorder_eviction, a_size);
+    return;
+  }
+
+  // only the last m_size_limit survive. The overwritten oldest and
+  // the skipped are both evicted.
+  if (m_size + a_size > m_size_limit)
+    SPACE_COUNT(recorder_eviction, m_size + a_size - m_size_limit);
+
+  const unsigned long skip(a_size > m_size_limit ? a_size - m_size_limit : 0);
+  const unsigned long count(a_size - skip);
+
+  // copy in at most two runs starting at the tail.
+  unsigned long tail(m_head + m_size);
+  if (tail >= m_size_limit)
+    tail -= m_size_limit;
+
+  const unsigned long first_run(count < m_size_limit - tail ? count : m_size_limit - tail);
+
+  std::copy(a + skip, a + skip + first_run, m_data.begin() + tail);
+  std::copy(a + skip + first_run, a + a_size, m_data.begin());
+
+  // drop the oldest that were overwritten.
+  if (m_size + count > m_size_limit) {
+    m_head += m_size + count - m_size_limit;
+    if (m_head >= m_size_limit)
+      m_head -= m_size_limit;
+    m_size = m_size_limit;
+  } else {
+    m_size += count;
+  }
+
+}
+
+void Cartesian::SpaceRecorder::segments(const Cartesian::space*& a_first,
+					unsigned long& a_first_size,
+					const Cartesian::space*& a_second,
+					unsigned long& a_second_size) const {
+
+  a_first = m_data.empty() ? NULL : &m_data[m_head];
+  a_second = m_data.empty() ? NULL : &m_data[0];
+
+  if (m_head + m_size <= m_size_limit) {
+    a_first_size = m_size;
+    a_second_size = 0;
+  } else {
+    a_first_size = m_size_limit - m_head;
+    a_second_size = m_size - a_first_size;
+  }
+
 }
 
 // output compatible for R frames <- read.table(flnm)
 void Cartesian::SpaceRecorder::write2R(const std::string& flnm, bool skip_Uo) {
 
+  SPACE_TRACE("SpaceRecorder::write2R");
+
   std::ofstream ssfile(flnm.c_str());
 
   if (!ssfile.is_open()) {
@@ -302,16 +1007,18 @@ void Cartesian::SpaceRecorder::write2R(const std::string& flnm, bool skip_Uo) {
 	 << std::endl;
   ssfile << "x y z" << std::endl;
 
-  for (unsigned int k = 0; k < m_data.size(); ++k) {
+  for (unsigned int k = 0; k < size(); ++k) {
+
+    const Cartesian::space& a(get(k));
 
     // skip zero points from partially filled buffer.
-    if (skip_Uo and m_data[k] == Cartesian::space::Uo)
+    if (skip_Uo and a == Cartesian::space::Uo)
       continue;
 
     ssfile << k << " "
-	   << m_data[k].x() << " "
-	   << m_data[k].y() << " "
-	   << m_data[k].z() << std::endl;
+	   << a.x() << " "
+	   << a.y() << " "
+	   << a.z() << std::endl;
   }
 
   ssfile.close();
@@ -26,13 +26,19 @@
 
 #pragma once
 
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
 #include <cmath>
-#include <deque>
 #include <fstream>
+#include <ostream>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 
+#include "space_config.h" // written by make, see mepsilon.c
+
 namespace Cartesian {
 
   class SpaceError : public std::runtime_error {
@@ -50,6 +56,125 @@ namespace Cartesian {
   SpaceRecorderIOError(const std::string& msg) : SpaceError(msg) {}
   };
 
+  // ------------------------------------
+  // ----- instrumentation counters -----
+  // ------------------------------------
+
+  // Event counters for the hot paths, compiled in when space_config.h
+  // defines SPACE_INSTRUMENT (make INSTRUMENT=1). Without it
+  // SPACE_COUNT() is empty and the counters always read zero.
+  //
+  // Each thread counts into its own cache line, so counting is a
+  // thread local load and store and threads never share a line. The
+  // registry sums the live threads and those that have exited.
+
+  namespace counters {
+
+    enum Event {
+      rotator_cache_hit,   // rotate() reused the rotation matrix
+      rotator_cache_miss,  // rotate() rebuilt it for a new angle or axis
+      recorder_eviction,   // SpaceRecorder entries dropped to make room
+      divide_zero_error,   // DivideZeroError thrown
+      event_count
+    };
+
+    extern const bool enabled;  // the library was built with SPACE_INSTRUMENT
+    extern const char* const names[event_count];
+    extern const char* const descriptions[event_count];
+
+    struct alignas(64) ThreadCounters {
+      std::atomic<unsigned long long> counts[event_count];  // written only by the owner
+    };
+
+    // registers the calling thread on its first count.
+    ThreadCounters* register_thread();
+
+    inline ThreadCounters& thread_counters() {
+      static thread_local ThreadCounters* a_thread(NULL);
+      if (a_thread == NULL)
+	a_thread = register_thread();
+      return *a_thread;
+    }
+
+    inline void count(const Event& an_event, const unsigned long long& n=1) {
+      std::atomic<unsigned long long>& a_count(thread_counters().counts[an_event]);
+      a_count.store(a_count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+      unsigned long long counts[event_count];
+    };
+
+    Snapshot snapshot();  // totals since the last reset()
+    void     reset();
+
+    void write_prometheus(std::ostream& os, const Snapshot& a_snapshot);
+    void write_json(std::ostream& os, const Snapshot& a_snapshot);
+
+  } // end namespace counters
+
+#ifdef SPACE_INSTRUMENT
+#define SPACE_COUNT(an_event, n) Cartesian::counters::count(Cartesian::counters::an_event, n)
+#else
+#define SPACE_COUNT(an_event, n) ((void) 0)
+#endif
+
+  // -----------------------
+  // ----- trace spans -----
+  // -----------------------
+
+  // Scoped spans for the heavy entry points. They are switched at run
+  // time with trace::enable() and cost one relaxed load when off.
+  //
+  // Each thread appends its spans to its own lock free ring of
+  // buffer_size events. write_chrome() drains all of them as Chrome
+  // and Perfetto trace event JSON. A span that finds its ring full is
+  // dropped and counted. Span names must outlive the flush, usually
+  // string literals.
+
+  namespace trace {
+
+    extern std::atomic<bool> on;
+    extern const unsigned long buffer_size;  // events per thread
+
+    inline bool enabled() {return on.load(std::memory_order_relaxed);}
+    void enable(const bool& a_flag=true);
+
+    // CLOCK_MONOTONIC in nanoseconds.
+    inline unsigned long long now() {
+      struct timespec a_time;
+      clock_gettime(CLOCK_MONOTONIC, &a_time);
+      return a_time.tv_sec * 1000000000ULL + a_time.tv_nsec;
+    }
+
+    void record(const char* a_name, const unsigned long long& a_start,
+		const unsigned long long& an_end);
+
+    class Span {
+    public:
+      explicit Span(const char* a_name) :
+	m_name(enabled() ? a_name : NULL), m_start(m_name ? now() : 0) {}
+      ~Span() {if (m_name) record(m_name, m_start, now());}
+    private:
+      Span(const Span&);             // not copyable
+      Span& operator=(const Span&);
+      const char*        m_name;     // NULL when tracing was off at the start
+      unsigned long long m_start;
+    };
+
+    unsigned long long dropped();  // spans lost to full rings
+    void clear();                  // discards the buffered spans
+
+    // drains the buffered spans as {"traceEvents": [...]}, timestamps
+    // in microseconds since CLOCK_MONOTONIC's epoch.
+    void write_chrome(std::ostream& os);
+
+  } // end namespace trace
+
+#define SPACE_TRACE_JOIN(a, b) a ## b
+#define SPACE_TRACE_NAME(a, b) SPACE_TRACE_JOIN(a, b)
+#define SPACE_TRACE(a_name) Cartesian::trace::Span SPACE_TRACE_NAME(space_trace_span_, __LINE__)(a_name)
+
   // TODO stand-ins until c++ 11
   double stod(const std::string& a_string);
   int    stoi(const std::string& a_string);
@@ -63,7 +188,7 @@ namespace Cartesian {
 
     // ----- unit vectors -----
 
-    static const double epsilon; // machine epsilon for this build.
+    static const double epsilon; // machine epsilon for this build, SPACE_DOUBLE_EPSILON.
 
     static const space Uo; // zero
     static const space Ux;
@@ -120,10 +245,12 @@ namespace Cartesian {
     inline double magnitude()  const;
     inline double magnitude2() const;
 
-    inline space  normalized() const throw (DivideZeroError);
+    inline space  normalized() const throw (DivideZeroError); // zero gives nan, does not throw
+    inline space  normalized(bool& a_zero) const; // nothrow, a_zero set for the zero vector
 
     // TODO more
     void setUsingPolarCoords(double radius, double theta, double phi = M_PI/2);
+    void getPolarCoords(double& radius, double& theta, double& phi) const; // the inverse
 
   private:
 
@@ -187,8 +314,10 @@ namespace Cartesian {
   }
 
   inline space& space::operator/=(const double& rhs) throw (DivideZeroError) {
-    if (rhs == 0)
+    if (rhs == 0) {
+      SPACE_COUNT(divide_zero_error, 1);
       throw DivideZeroError();
+    }
     m_x /= rhs;
     m_y /= rhs;
     m_z /= rhs;
@@ -210,6 +339,12 @@ namespace Cartesian {
     return space(m_x/h, m_y/h, m_z/h);
   }
 
+  inline space space::normalized(bool& a_zero) const {
+    const double h(magnitude());
+    a_zero = h == 0;
+    return space(m_x/h, m_y/h, m_z/h);
+  }
+
   // ---------------------
   // ----- functions -----
   // ---------------------
@@ -231,6 +366,218 @@ namespace Cartesian {
   double dot(const space& a, const space& b);  // vector dot product
   space cross(const space& a, const space& b);  // vector cross product
 
+  // batch vector products over a_size element arrays. a_results may
+  // alias an input. Like space::normalized() zero vectors become nan.
+  void dot(const space* a, const space* b, double* a_results, const unsigned long& a_size);
+  void cross(const space* a, const space* b, space* a_results, const unsigned long& a_size);
+  void normalized(const space* a, space* a_results, const unsigned long& a_size);
+
+  // nothrow division, inf or nan for a zero divisor instead of
+  // DivideZeroError.
+  inline space unchecked_divide(const space& lhs, const double& rhs) {
+    return space(lhs.x() / rhs, lhs.y() / rhs, lhs.z() / rhs);
+  }
+
+  inline space unchecked_divide(const double& lhs, const space& rhs) {
+    return space(lhs / rhs.x(), lhs / rhs.y(), lhs / rhs.z());
+  }
+
+  // nothrow batch division and normalization, element k as
+  // unchecked_divide() or normalized(). Bit k % 64 of a_zero_mask[k / 64]
+  // is set where element k divided by zero, zero_mask_words(a_size)
+  // words are written. Returns the number of zero divisors, so the
+  // mask only needs reading when it is not 0.
+  inline unsigned long zero_mask_words(const unsigned long& a_size) {return (a_size + 63) / 64;}
+
+  unsigned long divide(const space* a, const double* b, space* a_results,
+		       unsigned long long* a_zero_mask, const unsigned long& a_size);
+  unsigned long divide(const double* a, const space* b, space* a_results,
+		       unsigned long long* a_zero_mask, const unsigned long& a_size);
+  unsigned long normalized(const space* a, space* a_results,
+			   unsigned long long* a_zero_mask, const unsigned long& a_size);
+
+  // --------------------------------
+  // ----- approximate equality -----
+  // --------------------------------
+
+  // |a - b| <= a_absolute + a_relative * max(|a|, |b|). a_absolute
+  // covers values near zero, where a relative tolerance vanishes. A few
+  // space::epsilon is a reasonable a_relative after a short computation.
+  // Equal infinities compare equal, nan never does.
+  inline bool approx_equal(const double& a, const double& b,
+			   const double& a_absolute, const double& a_relative) {
+    const double a_abs(std::fabs(a));
+    const double b_abs(std::fabs(b));
+    return (a == b) | (std::fabs(a - b) <= a_absolute + a_relative * (a_abs > b_abs ? a_abs : b_abs));
+  }
+
+  // the bits of a_value as an integer ordered like the doubles, adjacent
+  // doubles differ by 1 and -0 is +0. The magnitude bits, negated
+  // without a branch for negative values.
+  inline long long ulp_order(const double& a_value) {
+    long long bits;
+    memcpy(&bits, &a_value, sizeof(bits));
+    const long long sign(bits >> 63); // 0 or -1
+    return ((bits & 0x7fffffffffffffffLL) ^ sign) - sign;
+  }
+
+  // at most a_ulps representable doubles apart. Equal infinities compare
+  // equal, nan never does. No branches, random signs do not mispredict.
+  inline bool approx_equal_ulps(const double& a, const double& b, const unsigned long long& a_ulps) {
+    const unsigned long long difference((unsigned long long) ulp_order(a) - ulp_order(b));
+    const unsigned long long distance(difference < -difference ? difference : -difference);
+    return (a == a) & (b == b) & (distance <= a_ulps);
+  }
+
+  // componentwise, every one of x, y and z within tolerance.
+  inline bool approx_equal(const space& a, const space& b,
+			   const double& a_absolute, const double& a_relative) {
+    return (approx_equal(a.x(), b.x(), a_absolute, a_relative) &
+	    approx_equal(a.y(), b.y(), a_absolute, a_relative) &
+	    approx_equal(a.z(), b.z(), a_absolute, a_relative));
+  }
+
+  inline bool approx_equal_ulps(const space& a, const space& b, const unsigned long long& a_ulps) {
+    return (approx_equal_ulps(a.x(), b.x(), a_ulps) &
+	    approx_equal_ulps(a.y(), b.y(), a_ulps) &
+	    approx_equal_ulps(a.z(), b.z(), a_ulps));
+  }
+
+  // batch comparisons, for validating kernel output against a
+  // reference. Bit k % 64 of a_equal_mask[k / 64] is set where element k
+  // is approximately equal, zero_mask_words(a_size) words are written.
+  // Returns the number of equal elements, a_size when all are.
+  unsigned long approx_equal(const space* a, const space* b,
+			     unsigned long long* a_equal_mask, const unsigned long& a_size,
+			     const double& a_absolute, const double& a_relative);
+  unsigned long approx_equal_ulps(const space* a, const space* b,
+				  unsigned long long* a_equal_mask, const unsigned long& a_size,
+				  const unsigned long long& a_ulps);
+
+  // -----------------------------
+  // ----- fast trigonometry -----
+  // -----------------------------
+
+  // Branch free sin, cos and atan2 without libm calls, so loops over
+  // them vectorize. They use fdlibm's kernel polynomials. Against glibc,
+  // measured over 10^6 random arguments:
+  //   fast_sincos  |x| <= 10:   at most 1 ulp
+  //   fast_sincos  |x| <= 1e5:  at most 2 ulp
+  //   fast_atan2   finite y, x: at most 2 ulp
+  // Near a multiple of pi/2 the error is below 1e-30 absolute, not
+  // relative. Beyond 1e5 the three part pi/2 reduction loses accuracy.
+  // Infinities and nans give nan.
+
+  inline void fast_sincos(const double& x, double& a_sin, double& a_cos) {
+
+    // x = k pi/2 + r, |r| <= pi/4, pi/2 in three parts (fdlibm). Adding
+    // 1.5 2^52 rounds to an integer in the low bits, without a libm call.
+    const double shifted(x * 6.36619772367581382433e-01 + 6755399441055744.0);
+    const double k(shifted - 6755399441055744.0);
+    unsigned long long bits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    const double r(((x - k * 1.57079632673412561417e+00)
+		    - k * 6.07710050630396597660e-11)
+		   - k * 2.02226624871116645580e-21);
+    const double z(r * r);
+
+    const double s(r + r * z * (-1.66666666666666324348e-01 +
+				z * (8.33333333332248946124e-03 +
+				     z * (-1.98412698298579493134e-04 +
+					  z * (2.75573137070700676789e-06 +
+					       z * (-2.50507602534068634195e-08 +
+						    z * 1.58969099521155010221e-10))))));
+
+    const double hz(0.5 * z);
+    const double w(1.0 - hz);
+    const double c(w + (((1.0 - w) - hz) +
+			z * z * (4.16666666666666019037e-02 +
+				 z * (-1.38888888888741095749e-03 +
+				      z * (2.48015872894767294178e-05 +
+					   z * (-2.75573143513906633035e-07 +
+						z * (2.08757232129817482790e-09 +
+						     z * -1.13596475577881948265e-11)))))));
+
+    // quadrant: 0 (s, c), 1 (c, -s), 2 (-s, -c), 3 (-c, s)
+    const unsigned int q(bits & 3);
+    const double swapped_sin(q & 1 ? c : s);
+    const double swapped_cos(q & 1 ? s : c);
+    a_sin = q & 2 ? -swapped_sin : swapped_sin;
+    a_cos = (q + 1) & 2 ? -swapped_cos : swapped_cos;
+  }
+
+  inline double fast_atan2(const double& y, const double& x) {
+
+    const double ax(fabs(x));
+    const double ay(fabs(y));
+    const double big(ax > ay ? ax : ay);
+    const double small(ax > ay ? ay : ax);
+
+    // t = small / big in [0, 1], u in [-tan(pi/8), tan(pi/8)] with
+    // atan(t) = base + atan(u). Above tan(pi/8) u = (t - 1) / (t + 1).
+    // One division with selected operands, so there is no branch.
+    const bool upper(small > 4.14213562373095034e-01 * big);
+    const double numerator(upper ? small - big : small);
+    const double denominator(upper ? small + big : big);
+    const double u(numerator / (denominator + (denominator == 0 ? 1.0 : 0.0)));  // 0 / 1 at the origin
+    const double base_hi(upper ? 7.85398163397448278999e-01 : 0.0);
+    const double base_lo(upper ? 3.06161699786838301793e-17 : 0.0);
+
+    const double z(u * u);
+    const double w(z * z);
+    const double s1(z * (3.33333333333329318027e-01 +
+			 w * (1.42857142725034663711e-01 +
+			      w * (9.09088713343650656196e-02 +
+				   w * (6.66107313738753120669e-02 +
+					w * (4.97687799461593236017e-02 +
+					     w * 1.62858201153657823623e-02))))));
+    const double s2(w * (-1.99999999998764832476e-01 +
+			 w * (-1.11111104054623557880e-01 +
+			      w * (-7.69187620504482999495e-02 +
+				   w * (-5.83357013379057348645e-02 +
+					w * -3.65315727442169155270e-02)))));
+    double a(base_hi - ((u * (s1 + s2) - base_lo) - u));
+
+    // octants: swap for |y| > |x| then reflect for x < 0.
+    a = ay > ax ? (1.57079632679489655800e+00 - a) + 6.12323399573676603587e-17 : a;
+    a = std::copysign(1.0, x) < 0 ? (3.14159265358979311600e+00 - a) + 1.22464679914735317723e-16 : a;
+    return std::copysign(a, y);
+  }
+
+  // 1 / sqrt(x) for x > 0 without a division or sqrt: a bit trick seed,
+  // within 3.5%, and four Newton steps. At most 2 ulp from 1.0 / sqrt(x)
+  // over 10^6 random x in [1e-300, 1e300]. 0 gives a large finite
+  // value, not inf. Newton steps are multiplies, so this only beats the
+  // vector sqrt and division with wide vectors, see gravity() in gravity.h.
+  inline double fast_rsqrt(const double& x) {
+    long long bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5fe6eb50c7b537a9LL - (bits >> 1);
+    double y;
+    memcpy(&y, &bits, sizeof(y));
+    const double half(0.5 * x);
+    y = y * (1.5 - half * y * y);
+    y = y * (1.5 - half * y * y);
+    y = y * (1.5 - half * y * y);
+    return y + y * (0.5 - half * y * y);  // as a correction, rounds better
+  }
+
+  // ----- batch polar conversions -----
+
+  // Over arrays, with the angles of space::setUsingPolarCoords(): theta
+  // in the x-y plane from the x axis, phi from the z axis. to_polar()
+  // gives theta in [-pi, pi] and phi in [0, pi], a zero vector gives
+  // zeros. polar_precise calls libm, polar_fast uses the fast_ functions
+  // above and is a few times faster.
+
+  enum PolarMode {polar_precise, polar_fast};
+
+  void from_polar(const double* radius, const double* theta, const double* phi,
+		  space* a_results, const unsigned long& a_size,
+		  const PolarMode& a_mode=polar_precise);
+  void to_polar(const space* a, double* radius, double* theta, double* phi,
+		const unsigned long& a_size, const PolarMode& a_mode=polar_precise);
+
   // operator<<
   inline std::ostream& operator<< (std::ostream& os, const space& a) {
     os << "<space><x>" << a.x()
@@ -265,8 +612,14 @@ namespace Cartesian {
 
     space rotate(const space& a_heading, const double& a_radians);
 
+    // batch rotate a_size headings into a_results, which may be a_headings.
+    void rotate(const space* a_headings, space* a_results,
+		const unsigned long& a_size, const double& a_radians);
+
   private:
 
+    void update(const double& a_radians); // rotation matrix for a_radians
+
     space                              m_axis;
     std::vector< std::vector<double> > m_rotation_matrix;
 
@@ -281,15 +634,17 @@ namespace Cartesian {
   // ----- class SpaceRecorder -----
   // -------------------------------
 
-  // implements a simple deque to store three space data.
+  // implements a fixed size ring buffer to store three space data.
   // It is intended for use to store and later plotting positions and
-  // other three space data.
+  // other three space data. Once full each push overwrites the oldest
+  // entry. The storage is allocated once by the constructor (and
+  // sizeLimit()) so segments() can hand out pointers into it.
 
   class SpaceRecorder {
 
   public:
 
-    static const unsigned int default_size; /// default size limit for deque
+    static const unsigned int default_size; /// default size limit for the ring
 
     SpaceRecorder(const unsigned int& a_size_limit=SpaceRecorder::default_size);
    ~SpaceRecorder() {}; // dtor
@@ -298,23 +653,37 @@ namespace Cartesian {
     SpaceRecorder& operator=(const SpaceRecorder& a); // copy assignment
 
     const unsigned int& sizeLimit() const       {return m_size_limit;}
-    void                sizeLimit(const int& a) {m_size_limit = a;}
+    void                sizeLimit(const int& a); // keeps the newest entries
 
-    unsigned long size() const            {return m_data.size();}
-    const space& get(const unsigned int& idx) {return m_data[idx];}
+    unsigned long size() const            {return m_size;}
+    inline const space& get(const unsigned int& idx) const; // 0 is oldest
 
     void push(space a);
-    void clear() {m_data.clear();}
+    void push(const space* a, const unsigned long& a_size); // bulk push
+    void clear() {m_head = 0; m_size = 0;}
+
+    // the contents, oldest first, as at most two contiguous runs
+    // [a_first, a_first + a_first_size), [a_second, a_second + a_second_size)
+    void segments(const space*& a_first, unsigned long& a_first_size,
+		  const space*& a_second, unsigned long& a_second_size) const;
 
     void write2R(const std::string& flnm, bool skip_Uo=true);
 
   private:
 
-    unsigned int       m_size_limit; /// size limit of position deque
-
-    std::deque<space>  m_data;       /// data deque
+    unsigned int       m_size_limit; /// size limit of the ring
 
+    std::vector<space> m_data;       /// ring storage, m_size_limit long
+    unsigned long      m_head;       /// index of the oldest entry
+    unsigned long      m_size;       /// number of entries
 
   };
 
+  inline const space& SpaceRecorder::get(const unsigned int& idx) const {
+    unsigned long k(m_head + idx);
+    if (k >= m_size_limit)
+      k -= m_size_limit;
+    return m_data[k];
+  }
+
 } // end namespace Cartesian
@@ -0,0 +1,1708 @@
+// ================================================================
+// Filename:    space_benchmark.cpp
+// Description: google benchmark micro benchmarks of the space library.
+//
+//              Every operation runs over arrays of N spaces sized so
+//              its working set is about half of L1, L2, the last level
+//              cache, or a few times the LLC (DRAM). Benchmarks are
+//              named op/level, e.g. cross/L2, and report
+//                ns_per_op         time per space operated on
+//                items_per_second  spaces per second
+//                bytes_per_second  working set bytes per second
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+// See also: https://github.com/google/benchmark
+//
+// make bench writes space_benchmark.json. Any benchmark flag works,
+// e.g. to run only the cross products with five repetitions:
+// ./space_benchmark --benchmark_filter=cross --benchmark_repetitions=5
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#include <space.h>
+#include <bvh.h>
+#include <conjunction.h>
+#include <gravity.h>
+#include <integrator.h>
+#include <orbit.h>
+#include <spatial.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+
+namespace {
+
+  // ------------------------
+  // ----- working sets -----
+  // ------------------------
+
+  struct WorkingSet {
+    std::string m_name;
+    size_t      m_bytes;
+  };
+
+  // half of each data cache level and 4 x LLC for DRAM, with typical
+  // sizes if the cpu info has none. DRAM is at least 64 MB and at most
+  // 256 MB, some VMs report a very large LLC.
+  std::vector<WorkingSet> working_sets() {
+
+    size_t l1(32 * 1024);
+    size_t l2(256 * 1024);
+    size_t llc(8 * 1024 * 1024);
+
+    const std::vector<benchmark::CPUInfo::CacheInfo>& caches(benchmark::CPUInfo::Get().caches);
+
+    for (size_t i = 0; i < caches.size(); ++i) {
+      if (caches[i].type == "Instruction")
+	continue;
+      if (caches[i].level == 1)
+	l1 = caches[i].size;
+      else if (caches[i].level == 2)
+	l2 = caches[i].size;
+      if (caches[i].level >= 2)
+	llc = caches[i].size; // last one listed is the highest level
+    }
+
+    std::vector<WorkingSet> sets;
+    sets.push_back(WorkingSet{"L1", l1 / 2});
+    sets.push_back(WorkingSet{"L2", l2 / 2});
+    sets.push_back(WorkingSet{"LLC", llc / 2});
+    sets.push_back(WorkingSet{"DRAM", std::min(std::max(4 * llc, size_t(64) << 20), size_t(256) << 20)});
+
+    return sets;
+  }
+
+  // -----------------------
+  // ----- random data -----
+  // -----------------------
+
+  // a, b and results arrays of N random spaces, the same for every run.
+  struct Arrays {
+
+    Arrays(size_t a_size) :
+      m_a(a_size), m_b(a_size), m_results(a_size), m_doubles(a_size) {
+
+      std::mt19937 generator(20160312);
+      std::uniform_real_distribution<double> distribution(-1.0e3, 1.0e3);
+
+      for (size_t i = 0; i < a_size; ++i) {
+	m_a[i] = Cartesian::space(distribution(generator), distribution(generator), distribution(generator));
+	m_b[i] = Cartesian::space(distribution(generator), distribution(generator), distribution(generator));
+	m_doubles[i] = distribution(generator);
+      }
+    }
+
+    std::vector<Cartesian::space> m_a;
+    std::vector<Cartesian::space> m_b;
+    std::vector<Cartesian::space> m_results;
+    std::vector<double>           m_doubles;
+  };
+
+  // items, bytes and ns per space for a_size spaces of a_bytes each per iteration.
+  void set_counters(benchmark::State& state, size_t a_size, size_t a_bytes) {
+    state.SetItemsProcessed(state.iterations() * a_size);
+    state.SetBytesProcessed(state.iterations() * a_size * a_bytes);
+    state.counters["elements"] = a_size;
+    state.counters["ns_per_op"] = benchmark::Counter(a_size * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  // ----------------------------
+  // ----- space benchmarks -----
+  // ----------------------------
+
+  // Each benchmark takes the number of spaces and is registered once
+  // per working set in main(). The bytes passed to set_counters() are
+  // what one op reads and writes.
+
+  void BM_construct(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const double* d(&arrays.m_doubles[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = Cartesian::space(d[i], d[i], d[i]);
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, sizeof(double) + sizeof(Cartesian::space));
+  }
+
+  void BM_copy(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_equal(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    for (auto _ : state) {
+      size_t count(0);
+      for (size_t i = 0; i < a_size; ++i)
+	count += a[i] == b[i];
+      benchmark::DoNotOptimize(count);
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_add(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i] + b[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_subtract(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i] - b[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_negate(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = -a[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_inplace_add(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] += b[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_inplace_subtract(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] -= b[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_scale(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const double* d(&arrays.m_doubles[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i] * d[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_inplace_scale(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::space* r(&arrays.m_a[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] *= 1.0;
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, sizeof(Cartesian::space));
+  }
+
+  void BM_divide(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const double* d(&arrays.m_doubles[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i] / d[i];
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_inplace_divide(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::space* r(&arrays.m_a[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] /= 1.0;
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, sizeof(Cartesian::space));
+  }
+
+  void BM_dot(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    double* r(&arrays.m_doubles[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = Cartesian::dot(a[i], b[i]);
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_cross(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const Cartesian::space* b(&arrays.m_b[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = Cartesian::cross(a[i], b[i]);
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_magnitude(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    double* r(&arrays.m_doubles[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i].magnitude();
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_normalized(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a[i].normalized();
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_polar(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]); // as radius, theta, phi
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i].setUsingPolarCoords(a[i].x(), a[i].y(), a[i].z());
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_get_polar(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    Cartesian::space* r(&arrays.m_results[0]); // as radius, theta, phi
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i) {
+	double radius, theta, phi;
+	a[i].getPolarCoords(radius, theta, phi);
+	r[i] = Cartesian::space(radius, theta, phi);
+      }
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // ----- batch functions -----
+
+  void BM_dot_batch(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    for (auto _ : state) {
+      Cartesian::dot(&arrays.m_a[0], &arrays.m_b[0], &arrays.m_doubles[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_cross_batch(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    for (auto _ : state) {
+      Cartesian::cross(&arrays.m_a[0], &arrays.m_b[0], &arrays.m_results[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_normalized_batch(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    for (auto _ : state) {
+      Cartesian::normalized(&arrays.m_a[0], &arrays.m_results[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // every 16th divisor is zero.
+  void BM_divide_batch(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(a_size));
+    for (size_t i = 0; i < a_size; i += 16)
+      arrays.m_doubles[i] = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(Cartesian::divide(&arrays.m_a[0], &arrays.m_doubles[0],
+						 &arrays.m_results[0], &mask[0], a_size));
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_normalized_masked(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(a_size));
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(Cartesian::normalized(&arrays.m_a[0], &arrays.m_results[0],
+						     &mask[0], a_size));
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // a against a copy one ulp off in x, every element compares equal.
+  void BM_approx_equal_mode(benchmark::State& state, size_t a_size, bool an_ulps) {
+    Arrays arrays(a_size);
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(a_size));
+    for (size_t i = 0; i < a_size; ++i) {
+      arrays.m_results[i] = arrays.m_a[i];
+      arrays.m_results[i].x(nextafter(arrays.m_a[i].x(), 0.0));
+    }
+    for (auto _ : state) {
+      if (an_ulps)
+	benchmark::DoNotOptimize(Cartesian::approx_equal_ulps(&arrays.m_a[0], &arrays.m_results[0],
+							      &mask[0], a_size, 4));
+      else
+	benchmark::DoNotOptimize(Cartesian::approx_equal(&arrays.m_a[0], &arrays.m_results[0],
+							 &mask[0], a_size,
+							 0, 4 * Cartesian::space::epsilon));
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_approx_equal(benchmark::State& state, size_t a_size) {
+    BM_approx_equal_mode(state, a_size, false);
+  }
+
+  void BM_approx_equal_ulps(benchmark::State& state, size_t a_size) {
+    BM_approx_equal_mode(state, a_size, true);
+  }
+
+  // the a components as radius, theta and phi arrays.
+  struct PolarArrays : public Arrays {
+    PolarArrays(size_t a_size) : Arrays(a_size), m_radius(a_size), m_theta(a_size), m_phi(a_size) {
+      for (size_t i = 0; i < a_size; ++i) {
+	m_radius[i] = m_a[i].x();
+	m_theta[i] = m_a[i].y();
+	m_phi[i] = m_a[i].z();
+      }
+    }
+    std::vector<double> m_radius;
+    std::vector<double> m_theta;
+    std::vector<double> m_phi;
+  };
+
+  void BM_from_polar(benchmark::State& state, size_t a_size, Cartesian::PolarMode a_mode) {
+    PolarArrays arrays(a_size);
+    for (auto _ : state) {
+      Cartesian::from_polar(&arrays.m_radius[0], &arrays.m_theta[0], &arrays.m_phi[0],
+			    &arrays.m_results[0], a_size, a_mode);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_to_polar(benchmark::State& state, size_t a_size, Cartesian::PolarMode a_mode) {
+    PolarArrays arrays(a_size);
+    for (auto _ : state) {
+      Cartesian::to_polar(&arrays.m_a[0], &arrays.m_radius[0], &arrays.m_theta[0], &arrays.m_phi[0],
+			  a_size, a_mode);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_from_polar_precise(benchmark::State& state, size_t a_size) {
+    BM_from_polar(state, a_size, Cartesian::polar_precise);
+  }
+
+  void BM_from_polar_fast(benchmark::State& state, size_t a_size) {
+    BM_from_polar(state, a_size, Cartesian::polar_fast);
+  }
+
+  void BM_to_polar_precise(benchmark::State& state, size_t a_size) {
+    BM_to_polar(state, a_size, Cartesian::polar_precise);
+  }
+
+  void BM_to_polar_fast(benchmark::State& state, size_t a_size) {
+    BM_to_polar(state, a_size, Cartesian::polar_fast);
+  }
+
+  // ----- rotator -----
+
+  void BM_rotate(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::rotator a_rotator(Cartesian::space(1, 2, 3));
+    const Cartesian::space* a(&arrays.m_a[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a_rotator.rotate(a[i], 0.5);
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // a new angle every call so the rotation matrix is rebuilt.
+  void BM_rotate_new_angle(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::rotator a_rotator(Cartesian::space(1, 2, 3));
+    const Cartesian::space* a(&arrays.m_a[0]);
+    const double* d(&arrays.m_doubles[0]);
+    Cartesian::space* r(&arrays.m_results[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	r[i] = a_rotator.rotate(a[i], d[i]);
+      benchmark::DoNotOptimize(r);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space) + sizeof(double));
+  }
+
+  void BM_rotate_batch(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::rotator a_rotator(Cartesian::space(1, 2, 3));
+    for (auto _ : state) {
+      a_rotator.rotate(&arrays.m_a[0], &arrays.m_results[0], a_size, 0.5);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // ----- SpaceRecorder -----
+
+  void BM_recorder_push(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::SpaceRecorder a_recorder(a_size);
+    const Cartesian::space* a(&arrays.m_a[0]);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	a_recorder.push(a[i]);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_recorder_push_bulk(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::SpaceRecorder a_recorder(a_size);
+    for (auto _ : state) {
+      a_recorder.push(&arrays.m_a[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  void BM_recorder_get(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::SpaceRecorder a_recorder(a_size);
+    a_recorder.push(&arrays.m_a[0], a_size);
+    for (auto _ : state) {
+      double sum(0);
+      for (size_t i = 0; i < a_size; ++i)
+	sum += a_recorder.get(i).x();
+      benchmark::DoNotOptimize(sum);
+    }
+    set_counters(state, a_size, sizeof(Cartesian::space));
+  }
+
+  // formatting cost, the file is /dev/null.
+  void BM_write2R(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::SpaceRecorder a_recorder(a_size);
+    a_recorder.push(&arrays.m_a[0], a_size);
+    for (auto _ : state)
+      a_recorder.write2R("/dev/null", false);
+    set_counters(state, a_size, sizeof(Cartesian::space));
+  }
+
+  // ----- integrators -----
+
+  // a = -x, the cheapest force, so the time is the integrator's.
+  void harmonic(const Cartesian::space* positions, Cartesian::space* accelerations,
+		const unsigned long& a_size) {
+    for (unsigned long i = 0; i < a_size; ++i)
+      accelerations[i] = -positions[i];
+  }
+
+  const unsigned long sSteps(8);  // per iteration, so steps merge
+
+  // the hand written drift-kick-drift step Integrator replaces.
+  void BM_step_naive(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    std::vector<Cartesian::space> accelerations(a_size);
+    const double dt(1e-3);
+    for (auto _ : state) {
+      for (unsigned long step = 0; step < sSteps; ++step) {
+	for (size_t i = 0; i < a_size; ++i)
+	  arrays.m_a[i] += arrays.m_b[i] * (0.5 * dt);
+	harmonic(&arrays.m_a[0], &accelerations[0], a_size);
+	for (size_t i = 0; i < a_size; ++i) {
+	  arrays.m_b[i] += accelerations[i] * dt;
+	  arrays.m_a[i] += arrays.m_b[i] * (0.5 * dt);
+	}
+      }
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, sSteps * a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_step(benchmark::State& state, size_t a_size, Cartesian::IntegratorScheme a_scheme) {
+    Arrays arrays(a_size);
+    Cartesian::Integrator integrator(a_scheme, harmonic);
+    for (auto _ : state) {
+      integrator.advance(&arrays.m_a[0], &arrays.m_b[0], a_size, 1e-3, sSteps);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, sSteps * a_size, 3 * sizeof(Cartesian::space));
+  }
+
+  void BM_step_leapfrog(benchmark::State& state, size_t a_size) {
+    BM_step(state, a_size, Cartesian::integrator_leapfrog);
+  }
+
+  void BM_step_verlet(benchmark::State& state, size_t a_size) {
+    BM_step(state, a_size, Cartesian::integrator_velocity_verlet);
+  }
+
+  void BM_step_yoshida4(benchmark::State& state, size_t a_size) {
+    BM_step(state, a_size, Cartesian::integrator_yoshida4);
+  }
+
+  // shared Dormand-Prince steps, elements and ns_per_op are per body step.
+  void BM_dormand_prince(benchmark::State& state, size_t a_size) {
+    Arrays arrays(a_size);
+    Cartesian::DormandPrince solver(harmonic, 1e-6, 1e-6);
+    for (auto _ : state) {
+      double dt(0.1);
+      solver.advance(&arrays.m_a[0], &arrays.m_b[0], a_size, 0.5, &dt);
+      benchmark::ClobberMemory();
+    }
+    set_counters(state, solver.steps() / state.iterations() * a_size, 2 * sizeof(Cartesian::space));
+  }
+
+  // -------------------
+  // ----- gravity -----
+  // -------------------
+
+  // Registered per number of bodies, not per working set, the work is
+  // N^2. items_per_second is interactions per second and ns_per_op is
+  // per interaction.
+
+  struct Bodies {
+
+    Bodies(size_t a_size) : m_positions(a_size), m_masses(a_size), m_accelerations(a_size),
+			    m_x(a_size), m_y(a_size), m_z(a_size),
+			    m_ax(a_size), m_ay(a_size), m_az(a_size) {
+
+      std::mt19937 generator(20160312);
+      std::uniform_real_distribution<double> coordinate(-1, 1);
+      std::uniform_real_distribution<double> mass(0.5, 2);
+
+      for (size_t i = 0; i < a_size; ++i) {
+	m_positions[i] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+	m_masses[i] = mass(generator);
+	m_x[i] = m_positions[i].x();
+	m_y[i] = m_positions[i].y();
+	m_z[i] = m_positions[i].z();
+      }
+    }
+
+    std::vector<Cartesian::space> m_positions;
+    std::vector<double>           m_masses;
+    std::vector<Cartesian::space> m_accelerations;
+    std::vector<double>           m_x, m_y, m_z;
+    std::vector<double>           m_ax, m_ay, m_az;
+  };
+
+  const double sSoftening(1e-2);
+
+  void set_interactions(benchmark::State& state, size_t a_size) {
+    state.SetItemsProcessed(state.iterations() * a_size * a_size);
+    state.counters["bodies"] = a_size;
+    state.counters["ns_per_op"] = benchmark::Counter(a_size * a_size * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  // the scalar loop gravity() replaces.
+  void BM_gravity_naive(benchmark::State& state, size_t a_size) {
+    Bodies bodies(a_size);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i) {
+	Cartesian::space acceleration;
+	for (size_t j = 0; j < a_size; ++j) {
+	  if (i == j)
+	    continue;
+	  const Cartesian::space d(bodies.m_positions[j] - bodies.m_positions[i]);
+	  const double r(sqrt(d.magnitude2() + sSoftening * sSoftening));
+	  acceleration += d * bodies.m_masses[j] / (r * r * r);
+	}
+	bodies.m_accelerations[i] = acceleration;
+      }
+      benchmark::ClobberMemory();
+    }
+    set_interactions(state, a_size);
+  }
+
+  void BM_gravity_mode(benchmark::State& state, size_t a_size,
+		       unsigned int a_threads, Cartesian::GravityMode a_mode) {
+    Bodies bodies(a_size);
+    for (auto _ : state) {
+      Cartesian::gravity(&bodies.m_x[0], &bodies.m_y[0], &bodies.m_z[0], &bodies.m_masses[0],
+			 &bodies.m_ax[0], &bodies.m_ay[0], &bodies.m_az[0], a_size,
+			 sSoftening, a_threads, a_mode);
+      benchmark::ClobberMemory();
+    }
+    set_interactions(state, a_size);
+  }
+
+  void BM_gravity(benchmark::State& state, size_t a_size) {
+    BM_gravity_mode(state, a_size, 1, Cartesian::gravity_precise);
+  }
+
+  void BM_gravity_fast(benchmark::State& state, size_t a_size) {
+    BM_gravity_mode(state, a_size, 1, Cartesian::gravity_fast);
+  }
+
+  // one thread per core, real time since the work is in other threads.
+  void BM_gravity_threads(benchmark::State& state, size_t a_size) {
+    BM_gravity_mode(state, a_size, 0, Cartesian::gravity_precise);
+  }
+
+  // ----------------------
+  // ----- Barnes-Hut -----
+  // ----------------------
+
+  // Speed against N, build and traversal per step, so ns_per_op is per
+  // body. Compare with gravity/N times N for the direct sum.
+  void BM_barnes_hut(benchmark::State& state, size_t a_size, unsigned int a_threads, double a_theta) {
+    Bodies bodies(a_size);
+    Cartesian::BarnesHut tree(a_theta, sSoftening, a_threads);
+    for (auto _ : state) {
+      tree.build(&bodies.m_positions[0], &bodies.m_masses[0], a_size);
+      tree.accelerations(&bodies.m_accelerations[0]);
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * a_size);
+    state.counters["bodies"] = a_size;
+    state.counters["nodes"] = tree.nodes();
+    state.counters["ns_per_op"] = benchmark::Counter(a_size * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  // Accuracy against theta, the relative error of each body's
+  // acceleration against the direct sum, rms and max.
+  void BM_barnes_hut_theta(benchmark::State& state, size_t a_size, unsigned int a_threads, double a_theta) {
+    BM_barnes_hut(state, a_size, a_threads, a_theta);
+
+    Bodies bodies(a_size);
+    Cartesian::gravity(&bodies.m_positions[0], &bodies.m_masses[0], &bodies.m_accelerations[0],
+		       a_size, sSoftening, a_threads);
+    std::vector<Cartesian::space> approximate(a_size);
+    Cartesian::BarnesHut tree(a_theta, sSoftening, a_threads);
+    tree.build(&bodies.m_positions[0], &bodies.m_masses[0], a_size);
+    tree.accelerations(&approximate[0]);
+
+    double sum(0), most(0);
+    for (size_t k = 0; k < a_size; ++k) {
+      const double error((approximate[k] - bodies.m_accelerations[k]).magnitude() /
+			 bodies.m_accelerations[k].magnitude());
+      sum += error * error;
+      most = std::max(most, error);
+    }
+    state.counters["theta"] = a_theta;
+    state.counters["rms_error"] = sqrt(sum / a_size);
+    state.counters["max_error"] = most;
+  }
+
+  // -------------------------------
+  // ----- integrator accuracy -----
+  // -------------------------------
+
+  // Energy drift of a softened cluster under gravity(), |E - E0| / |E0|
+  // after sDriftSteps steps from the same start each iteration. ns_per_op
+  // is per body step, the force included.
+
+  const size_t sDriftBodies(256);
+  const unsigned long sDriftSteps(200);
+  const double sDriftSoftening(0.05);
+
+  void BM_drift(benchmark::State& state, Cartesian::IntegratorScheme a_scheme, double a_dt) {
+
+    // total mass about 1 and speeds about virial, a crossing time ~ 1.
+    Bodies bodies(sDriftBodies);
+    std::vector<Cartesian::space> velocities(sDriftBodies);
+    std::mt19937 generator(20160314);
+    std::normal_distribution<double> speed(0, 0.3);
+    for (size_t i = 0; i < sDriftBodies; ++i) {
+      bodies.m_masses[i] /= sDriftBodies;
+      velocities[i] = Cartesian::space(speed(generator), speed(generator), speed(generator));
+    }
+
+    const double* masses(&bodies.m_masses[0]);
+    Cartesian::Integrator integrator(a_scheme,
+				     [=](const Cartesian::space* p, Cartesian::space* a,
+					 const unsigned long& n) {
+				       Cartesian::gravity(p, masses, a, n, sDriftSoftening);
+				     });
+
+    const double energy(Cartesian::gravity_energy(&bodies.m_positions[0], &velocities[0],
+						   masses, sDriftBodies, sDriftSoftening));
+    std::vector<Cartesian::space> positions, speeds;
+
+    for (auto _ : state) {
+      positions = bodies.m_positions;
+      speeds = velocities;
+      integrator.advance(&positions[0], &speeds[0], sDriftBodies, a_dt, sDriftSteps);
+      benchmark::ClobberMemory();
+    }
+
+    const double drift(Cartesian::gravity_energy(&positions[0], &speeds[0], masses,
+						 sDriftBodies, sDriftSoftening) - energy);
+    state.SetItemsProcessed(state.iterations() * sDriftBodies * sDriftSteps);
+    state.counters["dt"] = a_dt;
+    state.counters["energy_drift"] = std::abs(drift / energy);
+    state.counters["ns_per_op"] = benchmark::Counter(sDriftBodies * sDriftSteps * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  // --------------------------------
+  // ----- adaptive step orbits -----
+  // --------------------------------
+
+  // Test particles about a unit mass, eccentricities 0 to 0.95 and
+  // semi major axes 0.5 to 2, from pericenter for one time unit.
+  // ns_per_op is per particle, body_steps the accepted steps per
+  // particle. per_body is the same solver called once per particle,
+  // shared and independent step them all together.
+
+  const size_t sOrbits(1024);
+
+  void kepler(const Cartesian::space* positions, Cartesian::space* accelerations,
+	      const unsigned long& a_size) {
+    for (unsigned long i = 0; i < a_size; ++i) {
+      const double r(positions[i].magnitude());
+      accelerations[i] = positions[i] * (-1.0 / (r * r * r));
+    }
+  }
+
+  enum OrbitMode {orbits_per_body, orbits_shared, orbits_independent};
+
+  void BM_orbits(benchmark::State& state, OrbitMode a_mode) {
+
+    std::mt19937 generator(20160315);
+    std::uniform_real_distribution<double> eccentricity(0, 0.95);
+    std::uniform_real_distribution<double> axis(0.5, 2);
+    std::vector<Cartesian::space> starts(sOrbits), speeds(sOrbits);
+    for (size_t i = 0; i < sOrbits; ++i) {
+      const double e(eccentricity(generator)), a(axis(generator));
+      starts[i] = Cartesian::space(a * (1 - e), 0, 0);
+      speeds[i] = Cartesian::space(0, sqrt((1 + e) / (a * (1 - e))), 0);
+    }
+
+    Cartesian::DormandPrince solver(kepler, 1e-10, 1e-10, a_mode == orbits_independent);
+    std::vector<Cartesian::space> positions, velocities;
+    std::vector<double> dt(sOrbits);
+
+    for (auto _ : state) {
+      positions = starts;
+      velocities = speeds;
+      std::fill(dt.begin(), dt.end(), 1e-3);
+      if (a_mode == orbits_per_body)
+	for (size_t i = 0; i < sOrbits; ++i)
+	  solver.advance(&positions[i], &velocities[i], 1, 1.0, &dt[i]);
+      else
+	solver.advance(&positions[0], &velocities[0], sOrbits, 1.0, &dt[0]);
+      benchmark::ClobberMemory();
+    }
+
+    const double body_steps(a_mode == orbits_shared ? solver.steps() * sOrbits : solver.steps());
+    state.SetItemsProcessed(state.iterations() * sOrbits);
+    state.counters["body_steps"] = body_steps / state.iterations() / sOrbits;
+    state.counters["rejected"] = double(solver.rejected()) / state.iterations();
+    state.counters["ns_per_op"] = benchmark::Counter(sOrbits * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  // ----------------------------
+  // ----- orbital elements -----
+  // ----------------------------
+
+  // sElements orbits about a unit mass, eccentricities 0 to 0.99 with
+  // one in sHyperbolic from 1.01 to 3, random orientations and mean
+  // anomalies. kepler_newton is the scalar Newton loop with libm
+  // solve_kepler replaces, iterated to 1e-15. ns_per_op is per orbit.
+
+  const size_t sElements(10000000);
+  const size_t sHyperbolic(10);
+
+  struct Orbits {
+    Orbits(size_t a_size)
+      : m_a(a_size), m_e(a_size), m_inclination(a_size), m_node(a_size),
+	m_periapsis(a_size), m_mean_anomaly(a_size), m_positions(a_size), m_velocities(a_size) {
+      std::mt19937 generator(20160316);
+      std::uniform_real_distribution<double> unit(0, 1);
+      for (size_t i = 0; i < a_size; ++i) {
+	const bool hyperbolic(i % sHyperbolic == 0);
+	m_e[i] = hyperbolic ? 1.01 + 1.99 * unit(generator) : 0.99 * unit(generator);
+	m_a[i] = (hyperbolic ? -1 : 1) * (0.5 + 1.5 * unit(generator));
+	m_inclination[i] = M_PI * unit(generator);
+	m_node[i] = 2 * M_PI * unit(generator);
+	m_periapsis[i] = 2 * M_PI * unit(generator);
+	m_mean_anomaly[i] = (hyperbolic ? 10 : 2 * M_PI) * (unit(generator) - 0.5);
+      }
+      Cartesian::from_elements(&m_a[0], &m_e[0], &m_inclination[0], &m_node[0], &m_periapsis[0],
+			       &m_mean_anomaly[0], 1.0, &m_positions[0], &m_velocities[0], a_size);
+    }
+    std::vector<double> m_a, m_e, m_inclination, m_node, m_periapsis, m_mean_anomaly;
+    std::vector<Cartesian::space> m_positions, m_velocities;
+  };
+
+  void set_orbit_counters(benchmark::State& state) {
+    state.SetItemsProcessed(state.iterations() * sElements);
+    state.counters["ns_per_op"] = benchmark::Counter(sElements * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  void BM_kepler_newton(benchmark::State& state) {
+    Orbits orbits(sElements);
+    std::vector<double> anomaly(sElements);
+    for (auto _ : state) {
+      for (size_t i = 0; i < sElements; ++i) {
+	const double e(orbits.m_e[i]), M(orbits.m_mean_anomaly[i]);
+	double E(e > 1 ? asinh(M / e) : M), step(1);
+	for (int k = 0; k < 50 && std::abs(step) > 1e-15 * (1 + std::abs(E)); ++k) {
+	  step = e > 1 ? (e * sinh(E) - E - M) / (e * cosh(E) - 1) : (E - e * sin(E) - M) / (1 - e * cos(E));
+	  E -= step;
+	}
+	anomaly[i] = E;
+      }
+      benchmark::ClobberMemory();
+    }
+    set_orbit_counters(state);
+  }
+
+  void BM_kepler(benchmark::State& state) {
+    Orbits orbits(sElements);
+    std::vector<double> anomaly(sElements);
+    for (auto _ : state) {
+      Cartesian::solve_kepler(&orbits.m_mean_anomaly[0], &orbits.m_e[0], &anomaly[0], sElements);
+      benchmark::ClobberMemory();
+    }
+    set_orbit_counters(state);
+  }
+
+  void BM_to_elements(benchmark::State& state) {
+    Orbits orbits(sElements);
+    for (auto _ : state) {
+      Cartesian::to_elements(&orbits.m_positions[0], &orbits.m_velocities[0], 1.0,
+			     &orbits.m_a[0], &orbits.m_e[0], &orbits.m_inclination[0], &orbits.m_node[0],
+			     &orbits.m_periapsis[0], &orbits.m_mean_anomaly[0], sElements);
+      benchmark::ClobberMemory();
+    }
+    set_orbit_counters(state);
+  }
+
+  void BM_from_elements(benchmark::State& state) {
+    Orbits orbits(sElements);
+    for (auto _ : state) {
+      Cartesian::from_elements(&orbits.m_a[0], &orbits.m_e[0], &orbits.m_inclination[0], &orbits.m_node[0],
+			       &orbits.m_periapsis[0], &orbits.m_mean_anomaly[0], 1.0,
+			       &orbits.m_positions[0], &orbits.m_velocities[0], sElements);
+      benchmark::ClobberMemory();
+    }
+    set_orbit_counters(state);
+  }
+
+  void BM_kepler_propagate(benchmark::State& state) {
+    Orbits orbits(sElements);
+    for (auto _ : state) {
+      Cartesian::kepler_propagate(&orbits.m_positions[0], &orbits.m_velocities[0], 1.0, 0.01, sElements);
+      benchmark::ClobberMemory();
+    }
+    set_orbit_counters(state);
+  }
+
+  // ------------------------
+  // ----- spatial hash -----
+  // ------------------------
+
+  // Uniform points in the unit cube, queried about sQueries random
+  // points with a radius that holds sNeighbours of them on average. The
+  // cells are the radius wide. ns_per_op is per query, or per point for
+  // build and update, and neighbours is the mean found. brute_radius
+  // tests every point, so it runs fewer queries at the larger sizes.
+
+  const unsigned long sNeighbours(32);
+  const unsigned long sQueries(1024);
+
+  struct Cloud {
+    Cloud(size_t a_size) : m_positions(a_size), m_centers(sQueries),
+			   m_radius(cbrt(3.0 * sNeighbours / (4 * M_PI * a_size))) {
+      std::mt19937 generator(20160319);
+      std::uniform_real_distribution<double> unit(0, 1);
+      for (size_t i = 0; i < a_size; ++i)
+	m_positions[i] = Cartesian::space(unit(generator), unit(generator), unit(generator));
+      for (size_t i = 0; i < sQueries; ++i)
+	m_centers[i] = Cartesian::space(unit(generator), unit(generator), unit(generator));
+    }
+    std::vector<Cartesian::space> m_positions;
+    std::vector<Cartesian::space> m_centers;
+    double                        m_radius;
+  };
+
+  void set_query_counters(benchmark::State& state, size_t a_queries, size_t a_found) {
+    state.SetItemsProcessed(state.iterations() * a_queries);
+    state.counters["neighbours"] = double(a_found) / a_queries / state.iterations();
+    state.counters["ns_per_op"] = benchmark::Counter(a_queries * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  void BM_hash_build(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SpatialHash grid(cloud.m_radius);
+    for (auto _ : state) {
+      grid.build(&cloud.m_positions[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_query_counters(state, a_size, 0);
+  }
+
+  // every point steps a tenth of a cell, back and forth.
+  void BM_hash_update(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SpatialHash grid(cloud.m_radius);
+    grid.build(&cloud.m_positions[0], a_size);
+    const Cartesian::space step(0.1 * cloud.m_radius, 0.1 * cloud.m_radius, 0.1 * cloud.m_radius);
+    size_t moved(0);
+    for (auto _ : state) {
+      const Cartesian::space delta(state.iterations() % 2 ? -step : step);
+      for (size_t i = 0; i < a_size; ++i)
+	cloud.m_positions[i] += delta;
+      moved += grid.update(&cloud.m_positions[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_query_counters(state, a_size, 0);
+    state.counters["moved"] = double(moved) / a_size / state.iterations();
+  }
+
+  void BM_hash_radius(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SpatialHash grid(cloud.m_radius);
+    grid.build(&cloud.m_positions[0], a_size);
+    std::vector<unsigned long> results;
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < sQueries; ++q) {
+	grid.radius(cloud.m_centers[q], cloud.m_radius, results);
+	found += results.size();
+      }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_hash_nearest(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SpatialHash grid(cloud.m_radius);
+    grid.build(&cloud.m_positions[0], a_size);
+    std::vector<unsigned long> results;
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < sQueries; ++q) {
+	grid.nearest(cloud.m_centers[q], sNeighbours, results);
+	found += results.size();
+      }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_brute_radius(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    const size_t queries(std::min(sQueries, std::max(size_t(100000000) / a_size, size_t(1))));
+    const double radius2(cloud.m_radius * cloud.m_radius);
+    std::vector<unsigned long> results;
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < queries; ++q) {
+	results.clear();
+	for (size_t i = 0; i < a_size; ++i) {
+	  const Cartesian::space d(cloud.m_positions[i] - cloud.m_centers[q]);
+	  if (d.x()*d.x() + d.y()*d.y() + d.z()*d.z() <= radius2)
+	    results.push_back(i);
+	}
+	found += results.size();
+      }
+    set_query_counters(state, queries, found);
+  }
+
+  // -------------------
+  // ----- k-d tree -----
+  // -------------------
+
+  // The same clouds. kd_nearest is the single nearest point, kd_knn the
+  // sNeighbours nearest. recorder_scan is the nearest by a scan of a
+  // SpaceRecorder with get() and magnitude2(), fewer queries at the
+  // larger sizes.
+
+  void BM_kd_build(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::KdTree tree;
+    for (auto _ : state) {
+      tree.build(&cloud.m_positions[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_query_counters(state, a_size, 0);
+  }
+
+  void BM_kd_nearest(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::KdTree tree;
+    tree.build(&cloud.m_positions[0], a_size);
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < sQueries; ++q)
+	found += tree.nearest(cloud.m_centers[q]) < a_size;
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_kd_knn(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::KdTree tree;
+    tree.build(&cloud.m_positions[0], a_size);
+    std::vector<unsigned long> results;
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < sQueries; ++q) {
+	tree.nearest(cloud.m_centers[q], sNeighbours, results);
+	found += results.size();
+      }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_kd_radius(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::KdTree tree;
+    tree.build(&cloud.m_positions[0], a_size);
+    std::vector<unsigned long> results;
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < sQueries; ++q) {
+	tree.radius(cloud.m_centers[q], cloud.m_radius, results);
+	found += results.size();
+      }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_recorder_scan(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SpaceRecorder recorder(a_size);
+    recorder.push(&cloud.m_positions[0], a_size);
+    const size_t queries(std::min(sQueries, std::max(size_t(100000000) / a_size, size_t(1))));
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < queries; ++q) {
+	unsigned int best(0);
+	double least((recorder.get(0) - cloud.m_centers[q]).magnitude2());
+	for (unsigned int i = 1; i < recorder.size(); ++i) {
+	  const double d((recorder.get(i) - cloud.m_centers[q]).magnitude2());
+	  if (d < least) {
+	    least = d;
+	    best = i;
+	  }
+	}
+	found += best < a_size;
+      }
+    set_query_counters(state, queries, found);
+  }
+
+  // -------------------------------------
+  // ----- bounding volume hierarchy -----
+  // -------------------------------------
+
+  // A box the radius wide about each point of the cloud, and query
+  // boxes the same about the centers, so a query overlaps about
+  // sNeighbours. bvh_refit steps every box a tenth of the radius, back
+  // and forth. bvh_rays are sQueries rays from the centers in random
+  // directions, to the first box. brute_overlaps tests every box, fewer
+  // queries at the larger sizes.
+
+  struct Boxes : public Cloud {
+    Boxes(size_t a_size) : Cloud(a_size), m_boxes(a_size), m_queries(sQueries), m_directions(sQueries) {
+      const Cartesian::space half(0.5 * m_radius, 0.5 * m_radius, 0.5 * m_radius);
+      for (size_t i = 0; i < a_size; ++i)
+	m_boxes[i] = Cartesian::aabb(m_positions[i] - half, m_positions[i] + half);
+      for (size_t i = 0; i < sQueries; ++i)
+	m_queries[i] = Cartesian::aabb(m_centers[i] - half, m_centers[i] + half);
+      std::mt19937 generator(20161018);
+      std::normal_distribution<double> normal(0, 1);
+      for (size_t i = 0; i < sQueries; ++i)
+	m_directions[i] = Cartesian::space(normal(generator), normal(generator), normal(generator));
+    }
+    std::vector<Cartesian::aabb>  m_boxes;
+    std::vector<Cartesian::aabb>  m_queries;
+    std::vector<Cartesian::space> m_directions;
+  };
+
+  void BM_bvh_build(benchmark::State& state, size_t a_size) {
+    Boxes boxes(a_size);
+    Cartesian::BVH bvh;
+    for (auto _ : state) {
+      bvh.build(&boxes.m_boxes[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_query_counters(state, a_size, 0);
+  }
+
+  void BM_bvh_refit(benchmark::State& state, size_t a_size) {
+    Boxes boxes(a_size);
+    Cartesian::BVH bvh;
+    bvh.build(&boxes.m_boxes[0], a_size);
+    const Cartesian::space step(0.1 * boxes.m_radius, 0.1 * boxes.m_radius, 0.1 * boxes.m_radius);
+    double sign(1);
+    for (auto _ : state) {
+      state.PauseTiming();
+      for (size_t i = 0; i < a_size; ++i)
+	boxes.m_boxes[i] = Cartesian::aabb(boxes.m_boxes[i].lo() + sign * step, boxes.m_boxes[i].hi() + sign * step);
+      sign = -sign;
+      state.ResumeTiming();
+      bvh.refit(&boxes.m_boxes[0], a_size);
+      benchmark::ClobberMemory();
+    }
+    set_query_counters(state, a_size, 0);
+  }
+
+  void BM_bvh_overlaps(benchmark::State& state, size_t a_size) {
+    Boxes boxes(a_size);
+    Cartesian::BVH bvh;
+    bvh.build(&boxes.m_boxes[0], a_size);
+    std::vector< std::pair<unsigned long, unsigned long> > pairs;
+    size_t found(0);
+    for (auto _ : state) {
+      bvh.overlaps(&boxes.m_queries[0], sQueries, pairs);
+      found += pairs.size();
+    }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_bvh_rays(benchmark::State& state, size_t a_size) {
+    Boxes boxes(a_size);
+    Cartesian::BVH bvh;
+    bvh.build(&boxes.m_boxes[0], a_size);
+    std::vector<unsigned long> hits(sQueries);
+    std::vector<double> ts(sQueries);
+    size_t found(0);
+    for (auto _ : state) {
+      bvh.rays(&boxes.m_centers[0], &boxes.m_directions[0], INFINITY, sQueries, &hits[0], &ts[0]);
+      for (size_t q = 0; q < sQueries; ++q)
+	found += hits[q] < a_size;
+    }
+    set_query_counters(state, sQueries, found);
+  }
+
+  void BM_brute_overlaps(benchmark::State& state, size_t a_size) {
+    Boxes boxes(a_size);
+    const size_t queries(std::min(sQueries, std::max(size_t(100000000) / a_size, size_t(1))));
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t q = 0; q < queries; ++q)
+	for (size_t i = 0; i < a_size; ++i)
+	  found += boxes.m_queries[q].overlaps(boxes.m_boxes[i]);
+    set_query_counters(state, queries, found);
+  }
+
+  // ---------------------------------
+  // ----- conjunction screening -----
+  // ---------------------------------
+
+  // Circular orbits of radius 0.95 to 1.05 in random planes,
+  // sScreenSamples samples sScreenDt apart, about eight revolutions,
+  // screened at sScreenThreshold. ns_per_op is per pair of objects,
+  // candidates the (pair, window) candidates the boxes let through and
+  // conjunctions the pairs found. brute_conjunctions refines every
+  // interval of every pair. conj_window is 1000 objects with windows
+  // of that many intervals.
+
+  const unsigned int sScreenSamples(1000);
+  const double sScreenDt(0.05);
+  const double sScreenThreshold(0.01);
+
+  std::vector<Cartesian::SpaceRecorder> tracks(size_t a_count) {
+    std::mt19937 generator(20161019);
+    std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+    std::uniform_real_distribution<double> radius(0.95, 1.05);
+    std::vector<Cartesian::SpaceRecorder> a_tracks(a_count, Cartesian::SpaceRecorder(sScreenSamples));
+    for (size_t i = 0; i < a_count; ++i) {
+      const double r(radius(generator)), phase(angle(generator));
+      const double node(angle(generator)), inclination(angle(generator) / 4);
+      const double n(1 / (r * sqrt(r)));
+      a_tracks[i].clear();
+      for (unsigned int k = 0; k < sScreenSamples; ++k) {
+	const double u(phase + n * k * sScreenDt);
+	const double x(r * cos(u)), y(r * sin(u) * cos(inclination)), z(r * sin(u) * sin(inclination));
+	a_tracks[i].push(Cartesian::space(x * cos(node) - y * sin(node), x * sin(node) + y * cos(node), z));
+      }
+    }
+    return a_tracks;
+  }
+
+  void set_screen_counters(benchmark::State& state, size_t a_size, size_t a_candidates, size_t a_found) {
+    const size_t pairs(a_size * (a_size - 1) / 2);
+    state.SetItemsProcessed(state.iterations() * pairs);
+    state.counters["candidates"] = double(a_candidates) / state.iterations();
+    state.counters["conjunctions"] = double(a_found) / state.iterations();
+    state.counters["ns_per_op"] = benchmark::Counter(pairs * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  void BM_conj_screen(benchmark::State& state, size_t a_size, unsigned int a_window, unsigned int a_threads) {
+    const std::vector<Cartesian::SpaceRecorder> recorders(tracks(a_size));
+    const Cartesian::ConjunctionScreen screen(sScreenThreshold, sScreenDt, a_window, a_threads);
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> results;
+    size_t candidates(0), found(0);
+    for (auto _ : state) {
+      candidates += screen.screen(&recorders[0], a_size, results);
+      found += results.size();
+    }
+    set_screen_counters(state, a_size, candidates, found);
+  }
+
+  void BM_brute_conjunctions(benchmark::State& state, size_t a_size, unsigned int, unsigned int) {
+    const std::vector<Cartesian::SpaceRecorder> recorders(tracks(a_size));
+    size_t found(0);
+    for (auto _ : state)
+      for (size_t i = 0; i < a_size; ++i)
+	for (size_t j = i + 1; j < a_size; ++j) {
+	  double best(INFINITY);
+	  Cartesian::space r0(recorders[i].get(0) - recorders[j].get(0));
+	  for (unsigned int k = 1; k < sScreenSamples; ++k) {
+	    const Cartesian::space r1(recorders[i].get(k) - recorders[j].get(k));
+	    const Cartesian::space v(r1 - r0);
+	    const double s(std::min(std::max(-(r0 * v) / v.magnitude2(), 0.0), 1.0));
+	    best = std::min(best, (r0 + s * v).magnitude2());
+	    r0 = r1;
+	  }
+	  found += best <= sScreenThreshold * sScreenThreshold;
+	}
+    set_screen_counters(state, a_size, 0, found);
+  }
+
+  // ------------------------------
+  // ----- pairwise distances -----
+  // ------------------------------
+
+  // The clouds of the spatial hash, every point against every other.
+  // ns_per_op is per pair, a_size^2 for the dense matrix and half that
+  // for the upper triangle. dist_naive is the nested loop of
+  // (a - b).magnitude() the kernels replace. dist_within is the upper
+  // triangle within the cloud's radius, about sNeighbours / 2 a row,
+  // and found is the pairs.
+
+  void set_pair_counters(benchmark::State& state, size_t a_pairs, size_t a_found) {
+    state.SetItemsProcessed(state.iterations() * a_pairs);
+    state.counters["found"] = double(a_found) / state.iterations();
+    state.counters["ns_per_op"] = benchmark::Counter(a_pairs * 1.0e-9,
+						     benchmark::Counter::kIsIterationInvariantRate |
+						     benchmark::Counter::kInvert);
+  }
+
+  void BM_dist_naive(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    std::vector<double> results(a_size * a_size);
+    for (auto _ : state) {
+      for (size_t i = 0; i < a_size; ++i)
+	for (size_t j = 0; j < a_size; ++j)
+	  results[i * a_size + j] = (cloud.m_positions[i] - cloud.m_positions[j]).magnitude();
+      benchmark::ClobberMemory();
+    }
+    set_pair_counters(state, a_size * a_size, 0);
+  }
+
+  void dense(benchmark::State& state, size_t a_size, Cartesian::DistanceMode a_mode, unsigned int a_threads) {
+    Cloud cloud(a_size);
+    std::vector<double> results(a_size * a_size);
+    for (auto _ : state) {
+      Cartesian::distance_matrix(&cloud.m_positions[0], a_size, &cloud.m_positions[0], a_size,
+				 &results[0], a_mode, a_threads);
+      benchmark::ClobberMemory();
+    }
+    set_pair_counters(state, a_size * a_size, 0);
+  }
+
+  void BM_dist_dense(benchmark::State& state, size_t a_size) {
+    dense(state, a_size, Cartesian::distance_euclidean, 1);
+  }
+
+  void BM_dist_dense_squared(benchmark::State& state, size_t a_size) {
+    dense(state, a_size, Cartesian::distance_squared, 1);
+  }
+
+  void BM_dist_dense_threads(benchmark::State& state, size_t a_size) {
+    dense(state, a_size, Cartesian::distance_euclidean, 0);
+  }
+
+  void BM_dist_upper(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    std::vector<double> results(a_size * (a_size - 1) / 2);
+    for (auto _ : state) {
+      Cartesian::distance_matrix(&cloud.m_positions[0], a_size, &results[0]);
+      benchmark::ClobberMemory();
+    }
+    set_pair_counters(state, a_size * (a_size - 1) / 2, 0);
+  }
+
+  void BM_dist_within(benchmark::State& state, size_t a_size) {
+    Cloud cloud(a_size);
+    Cartesian::SparseDistances results;
+    size_t found(0);
+    for (auto _ : state) {
+      Cartesian::distances_within(&cloud.m_positions[0], a_size, cloud.m_radius, results);
+      found += results.m_columns.size();
+    }
+    set_pair_counters(state, a_size * (a_size - 1) / 2, found);
+  }
+
+  // ------------------------
+  // ----- registration -----
+  // ------------------------
+
+  typedef void (*Benchmark)(benchmark::State&, size_t);
+
+  struct Operation {
+    const char* m_name;
+    Benchmark   m_benchmark;
+    size_t      m_bytes;   // per space, to size the working sets
+    bool        m_slow;    // write2R is ~1000x the others, L1 and L2 only
+  };
+
+  const Operation sOperations[] = {
+    {"construct",          BM_construct,          32, false},
+    {"copy",               BM_copy,               48, false},
+    {"equal",              BM_equal,              48, false},
+    {"add",                BM_add,                72, false},
+    {"subtract",           BM_subtract,           72, false},
+    {"negate",             BM_negate,             48, false},
+    {"inplace_add",        BM_inplace_add,        48, false},
+    {"inplace_subtract",   BM_inplace_subtract,   48, false},
+    {"scale",              BM_scale,              56, false},
+    {"inplace_scale",      BM_inplace_scale,      24, false},
+    {"divide",             BM_divide,             56, false},
+    {"inplace_divide",     BM_inplace_divide,     24, false},
+    {"dot",                BM_dot,                56, false},
+    {"cross",              BM_cross,              72, false},
+    {"magnitude",          BM_magnitude,          32, false},
+    {"normalized",         BM_normalized,         48, false},
+    {"polar",              BM_polar,              48, false},
+    {"get_polar",          BM_get_polar,          48, false},
+    {"dot_batch",          BM_dot_batch,          56, false},
+    {"cross_batch",        BM_cross_batch,        72, false},
+    {"normalized_batch",   BM_normalized_batch,   48, false},
+    {"divide_batch",       BM_divide_batch,       56, false},
+    {"normalized_masked",  BM_normalized_masked,  48, false},
+    {"approx_equal",       BM_approx_equal,       48, false},
+    {"approx_equal_ulps",  BM_approx_equal_ulps,  48, false},
+    {"from_polar_precise", BM_from_polar_precise, 72, false},
+    {"from_polar_fast",    BM_from_polar_fast,    72, false},
+    {"to_polar_precise",   BM_to_polar_precise,   72, false},
+    {"to_polar_fast",      BM_to_polar_fast,      72, false},
+    {"rotate",             BM_rotate,             48, false},
+    {"rotate_new_angle",   BM_rotate_new_angle,   56, false},
+    {"rotate_batch",       BM_rotate_batch,       48, false},
+    {"recorder_push",      BM_recorder_push,      48, false},
+    {"recorder_push_bulk", BM_recorder_push_bulk, 48, false},
+    {"recorder_get",       BM_recorder_get,       24, false},
+    {"step_naive",         BM_step_naive,         72, false},
+    {"step_leapfrog",      BM_step_leapfrog,      72, false},
+    {"step_verlet",        BM_step_verlet,        72, false},
+    {"step_yoshida4",      BM_step_yoshida4,      72, false},
+    {"dormand_prince",     BM_dormand_prince,     48, false},
+    {"write2R",            BM_write2R,            24, true},
+  };
+
+  struct NBody {
+    const char* m_name;
+    Benchmark   m_benchmark;
+    bool        m_real_time;
+  };
+
+  const NBody sNBodies[] = {
+    {"gravity_naive",   BM_gravity_naive,   false},
+    {"gravity",         BM_gravity,         false},
+    {"gravity_fast",    BM_gravity_fast,    false},
+    {"gravity_threads", BM_gravity_threads, true},
+  };
+
+  const size_t sBodyCounts[] = {1024, 4096, 16384};
+
+  struct Tree {
+    const char*  m_name;
+    void       (*m_benchmark)(benchmark::State&, size_t, unsigned int, double);
+    size_t       m_size;
+    unsigned int m_threads;
+    double       m_theta;
+  };
+
+  // speed against N at theta 0.5, then accuracy against theta. The
+  // direct sum is O(N^2), gravity/16384 is the largest worth running.
+  const Tree sTrees[] = {
+    {"barnes_hut/4096",           BM_barnes_hut,       4096,   1, 0.5},
+    {"barnes_hut/16384",          BM_barnes_hut,       16384,  1, 0.5},
+    {"barnes_hut/65536",          BM_barnes_hut,       65536,  1, 0.5},
+    {"barnes_hut/262144",         BM_barnes_hut,       262144, 1, 0.5},
+    {"barnes_hut_threads/262144", BM_barnes_hut,       262144, 0, 0.5},
+    {"barnes_hut_theta/0.2",      BM_barnes_hut_theta, 16384,  0, 0.2},
+    {"barnes_hut_theta/0.3",      BM_barnes_hut_theta, 16384,  0, 0.3},
+    {"barnes_hut_theta/0.5",      BM_barnes_hut_theta, 16384,  0, 0.5},
+    {"barnes_hut_theta/0.7",      BM_barnes_hut_theta, 16384,  0, 0.7},
+    {"barnes_hut_theta/1.0",      BM_barnes_hut_theta, 16384,  0, 1.0},
+  };
+
+  const NBody sGrids[] = {
+    {"hash_build",     BM_hash_build,     false},
+    {"hash_update",    BM_hash_update,    false},
+    {"hash_radius",    BM_hash_radius,    false},
+    {"hash_nearest",   BM_hash_nearest,   false},
+    {"brute_radius",   BM_brute_radius,   false},
+    {"kd_build",       BM_kd_build,       false},
+    {"kd_nearest",     BM_kd_nearest,     false},
+    {"kd_knn",         BM_kd_knn,         false},
+    {"kd_radius",      BM_kd_radius,      false},
+    {"recorder_scan",  BM_recorder_scan,  false},
+    {"bvh_build",      BM_bvh_build,      false},
+    {"bvh_refit",      BM_bvh_refit,      false},
+    {"bvh_overlaps",   BM_bvh_overlaps,   false},
+    {"bvh_rays",       BM_bvh_rays,       false},
+    {"brute_overlaps", BM_brute_overlaps, false},
+  };
+
+  const size_t sGridSizes[] = {10000, 100000, 1000000, 10000000};
+
+  const NBody sDistances[] = {
+    {"dist_naive",         BM_dist_naive,         false},
+    {"dist_dense",         BM_dist_dense,         false},
+    {"dist_dense_squared", BM_dist_dense_squared, false},
+    {"dist_dense_threads", BM_dist_dense_threads, true},
+    {"dist_upper",         BM_dist_upper,         false},
+    {"dist_within",        BM_dist_within,        false},
+  };
+
+  const size_t sDistanceSizes[] = {1000, 4000};
+
+  struct Screen {
+    const char*  m_name;
+    void       (*m_benchmark)(benchmark::State&, size_t, unsigned int, unsigned int);
+    size_t       m_size;
+    unsigned int m_window;
+    unsigned int m_threads;
+  };
+
+  // brute_conjunctions/1000 is about ten seconds.
+  const Screen sScreens[] = {
+    {"conj_screen/250",          BM_conj_screen,        250,  2,  1},
+    {"conj_screen/1000",         BM_conj_screen,        1000, 2,  1},
+    {"conj_screen/4000",         BM_conj_screen,        4000, 2,  1},
+    {"conj_screen_threads/4000", BM_conj_screen,        4000, 2,  0},
+    {"conj_window/1",            BM_conj_screen,        1000, 1,  1},
+    {"conj_window/4",            BM_conj_screen,        1000, 4,  1},
+    {"conj_window/16",           BM_conj_screen,        1000, 16, 1},
+    {"conj_window/64",           BM_conj_screen,        1000, 64, 1},
+    {"brute_conjunctions/250",   BM_brute_conjunctions, 250,  2,  1},
+    {"brute_conjunctions/1000",  BM_brute_conjunctions, 1000, 2,  1},
+  };
+
+  struct Drift {
+    const char*                 m_name;
+    Cartesian::IntegratorScheme m_scheme;
+    double                      m_dt;
+  };
+
+  // Yoshida at 0.03 takes as many forces per unit time as leapfrog at
+  // 0.01.
+  const Drift sDrifts[] = {
+    {"drift_leapfrog/0.01",  Cartesian::integrator_leapfrog,        0.01},
+    {"drift_verlet/0.01",    Cartesian::integrator_velocity_verlet, 0.01},
+    {"drift_yoshida4/0.01",  Cartesian::integrator_yoshida4,        0.01},
+    {"drift_leapfrog/0.03",  Cartesian::integrator_leapfrog,        0.03},
+    {"drift_yoshida4/0.03",  Cartesian::integrator_yoshida4,        0.03},
+  };
+
+} // end anonymous namespace
+
+
+int main(int argc, char** argv) {
+
+  benchmark::Initialize(&argc, argv);
+
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  const std::vector<WorkingSet> sets(working_sets());
+
+  for (size_t k = 0; k < sizeof(sOperations)/sizeof(sOperations[0]); ++k) {
+
+    const Operation& an_op(sOperations[k]);
+
+    for (size_t j = 0; j < sets.size(); ++j) {
+
+      if (an_op.m_slow && j > 1)
+	continue;
+
+      const size_t a_size(std::max(sets[j].m_bytes / an_op.m_bytes, size_t(16)));
+      const std::string a_name(std::string(an_op.m_name) + "/" + sets[j].m_name);
+
+      benchmark::RegisterBenchmark(a_name.c_str(), an_op.m_benchmark, a_size)
+	->Unit(benchmark::kMicrosecond);
+    }
+  }
+
+  for (size_t k = 0; k < sizeof(sNBodies)/sizeof(sNBodies[0]); ++k)
+    for (size_t j = 0; j < sizeof(sBodyCounts)/sizeof(sBodyCounts[0]); ++j) {
+
+      const std::string a_name(std::string(sNBodies[k].m_name) + "/" + std::to_string(sBodyCounts[j]));
+
+      benchmark::internal::Benchmark* a_benchmark(benchmark::RegisterBenchmark(a_name.c_str(),
+										sNBodies[k].m_benchmark,
+										sBodyCounts[j]));
+      a_benchmark->Unit(benchmark::kMicrosecond);
+      if (sNBodies[k].m_real_time)
+	a_benchmark->UseRealTime();
+    }
+
+  for (size_t k = 0; k < sizeof(sTrees)/sizeof(sTrees[0]); ++k) {
+    const Tree& a_tree(sTrees[k]);
+    benchmark::RegisterBenchmark(a_tree.m_name, a_tree.m_benchmark, a_tree.m_size,
+				 a_tree.m_threads, a_tree.m_theta)
+      ->Unit(benchmark::kMillisecond)->UseRealTime();
+  }
+
+  for (size_t k = 0; k < sizeof(sGrids)/sizeof(sGrids[0]); ++k)
+    for (size_t j = 0; j < sizeof(sGridSizes)/sizeof(sGridSizes[0]); ++j) {
+      const std::string a_name(std::string(sGrids[k].m_name) + "/" + std::to_string(sGridSizes[j]));
+      benchmark::RegisterBenchmark(a_name.c_str(), sGrids[k].m_benchmark, sGridSizes[j])
+	->Unit(benchmark::kMicrosecond);
+    }
+
+  for (size_t k = 0; k < sizeof(sDistances)/sizeof(sDistances[0]); ++k)
+    for (size_t j = 0; j < sizeof(sDistanceSizes)/sizeof(sDistanceSizes[0]); ++j) {
+      const std::string a_name(std::string(sDistances[k].m_name) + "/" + std::to_string(sDistanceSizes[j]));
+      benchmark::internal::Benchmark* a_benchmark(benchmark::RegisterBenchmark(a_name.c_str(),
+										sDistances[k].m_benchmark,
+										sDistanceSizes[j]));
+      a_benchmark->Unit(benchmark::kMicrosecond);
+      if (sDistances[k].m_real_time)
+	a_benchmark->UseRealTime();
+    }
+
+  for (size_t k = 0; k < sizeof(sScreens)/sizeof(sScreens[0]); ++k) {
+    const Screen& a_screen(sScreens[k]);
+    benchmark::RegisterBenchmark(a_screen.m_name, a_screen.m_benchmark, a_screen.m_size,
+				 a_screen.m_window, a_screen.m_threads)
+      ->Unit(benchmark::kMillisecond)->UseRealTime();
+  }
+
+  for (size_t k = 0; k < sizeof(sDrifts)/sizeof(sDrifts[0]); ++k)
+    benchmark::RegisterBenchmark(sDrifts[k].m_name, BM_drift, sDrifts[k].m_scheme, sDrifts[k].m_dt)
+      ->Unit(benchmark::kMillisecond);
+
+  benchmark::RegisterBenchmark("orbits_per_body", BM_orbits, orbits_per_body)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("orbits_shared", BM_orbits, orbits_shared)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("orbits_independent", BM_orbits, orbits_independent)->Unit(benchmark::kMillisecond);
+
+  benchmark::RegisterBenchmark("kepler_newton", BM_kepler_newton)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("kepler", BM_kepler)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("to_elements", BM_to_elements)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("from_elements", BM_from_elements)->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark("kepler_propagate", BM_kepler_propagate)->Unit(benchmark::kMillisecond);
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
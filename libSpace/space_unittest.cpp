@@ -27,17 +27,24 @@
 // ================================================================
 
 #include <space.h>
-
+#include <bvh.h>
+#include <conjunction.h>
+#include <gravity.h>
+#include <integrator.h>
+#include <orbit.h>
+#include <spatial.h>
+
+#include <algorithm>
+#include <cfloat>
 #include <chrono>
 #include <random>
 #include <sstream>
+#include <thread>
 
 #include <gtest/gtest.h>
 
 
-// TODO setUsingPolarCoords
 // TODO Rotation: more arbitrary rotations, copy and assign operators
-// TODO SpaceRecorder
 
 
 namespace {
@@ -389,6 +396,1570 @@ namespace {
     EXPECT_EQ(result, a);
   }
 
+  TEST_F(RandomSpace, BatchProducts) {
+
+    Cartesian::space lhs[3] = {p1, p2, Cartesian::space::Ux};
+    Cartesian::space rhs[3] = {p2, p1, Cartesian::space::Uy};
+
+    double dots[3];
+    Cartesian::space crosses[3];
+    Cartesian::space units[3];
+
+    Cartesian::dot(lhs, rhs, dots, 3);
+    Cartesian::cross(lhs, rhs, crosses, 3);
+    Cartesian::normalized(lhs, units, 3);
+
+    for (unsigned int k = 0; k < 3; ++k) {
+      EXPECT_EQ(Cartesian::dot(lhs[k], rhs[k]), dots[k]);
+      EXPECT_EQ(Cartesian::cross(lhs[k], rhs[k]), crosses[k]);
+      EXPECT_EQ(lhs[k].normalized(), units[k]);
+    }
+
+    // in place
+    Cartesian::cross(lhs, rhs, lhs, 3);
+    for (unsigned int k = 0; k < 3; ++k)
+      EXPECT_EQ(crosses[k], lhs[k]);
+
+  }
+
+  TEST_F(RandomSpace, BatchDivideMasks) {
+
+    // 70 elements spans two mask words, zeros at 3, 64 and 69.
+    const unsigned long n(70);
+    std::vector<Cartesian::space> vectors(n, p1);
+    std::vector<double> divisors(n, c);
+    std::vector<double> numerators(n, c);
+    std::vector<Cartesian::space> results(n);
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(n), ~0ULL);
+
+    ASSERT_EQ(2u, mask.size());
+
+    divisors[3] = divisors[64] = divisors[69] = 0;
+    vectors[3] = Cartesian::space::Uo;
+    vectors[64] = Cartesian::space(1, 0, 1);
+    vectors[69] = Cartesian::space(0, 0, 1);
+
+    EXPECT_EQ(3u, Cartesian::divide(&vectors[0], &divisors[0], &results[0], &mask[0], n));
+    EXPECT_EQ((1ULL << 3), mask[0]);
+    EXPECT_EQ((1ULL << 0) | (1ULL << 5), mask[1]);
+    EXPECT_EQ(p1 / c, results[0]);
+    EXPECT_TRUE(std::isinf(results[64].x()));
+
+    EXPECT_EQ(3u, Cartesian::divide(&numerators[0], &vectors[0], &results[0], &mask[0], n));
+    EXPECT_EQ((1ULL << 3), mask[0]);
+    EXPECT_EQ((1ULL << 0) | (1ULL << 5), mask[1]);
+    EXPECT_EQ(c / p1, results[0]);
+
+    EXPECT_EQ(1u, Cartesian::normalized(&vectors[0], &results[0], &mask[0], n));
+    EXPECT_EQ((1ULL << 3), mask[0]);
+    EXPECT_EQ(0u, mask[1]);
+    EXPECT_EQ(p1.normalized(), results[0]);
+    EXPECT_TRUE(std::isnan(results[3].x()));
+
+    // in place, no zeros
+    vectors.assign(n, p2);
+    EXPECT_EQ(0u, Cartesian::normalized(&vectors[0], &vectors[0], &mask[0], n));
+    EXPECT_EQ(p2.normalized(), vectors[n - 1]);
+
+    EXPECT_EQ(Cartesian::unchecked_divide(p1, c), p1 / c);
+    EXPECT_TRUE(std::isinf(Cartesian::unchecked_divide(p1, 0).x()));
+
+    bool zero(true);
+    EXPECT_EQ(p1.normalized(), p1.normalized(zero));
+    EXPECT_FALSE(zero);
+    EXPECT_TRUE(std::isnan(Cartesian::space::Uo.normalized(zero).x()));
+    EXPECT_TRUE(zero);
+  }
+
+  TEST(ApproxEqual, Scalars) {
+
+    const double one_up(nextafter(1.0, 2.0));
+
+    EXPECT_EQ(SPACE_DOUBLE_EPSILON, Cartesian::space::epsilon);
+    EXPECT_EQ(1.0 + Cartesian::space::epsilon, one_up);
+
+    EXPECT_TRUE(Cartesian::approx_equal_ulps(1.0, one_up, 1));
+    EXPECT_FALSE(Cartesian::approx_equal_ulps(1.0, nextafter(one_up, 2.0), 1));
+    EXPECT_TRUE(Cartesian::approx_equal_ulps(0.0, -0.0, 0));
+    EXPECT_TRUE(Cartesian::approx_equal_ulps(-DBL_MIN, DBL_MIN, 2 * (1ULL << 52)));
+    EXPECT_FALSE(Cartesian::approx_equal_ulps(-1.0, 1.0, 1000));
+    EXPECT_TRUE(Cartesian::approx_equal_ulps(INFINITY, INFINITY, 0));
+    EXPECT_FALSE(Cartesian::approx_equal_ulps(NAN, NAN, ~0ULL));
+
+    EXPECT_TRUE(Cartesian::approx_equal(1e-20, 0.0, 1e-15, 0));
+    EXPECT_FALSE(Cartesian::approx_equal(1e-20, 0.0, 0, Cartesian::space::epsilon));
+    EXPECT_TRUE(Cartesian::approx_equal(1e6, 1e6 + 5e-10, 0, 4 * Cartesian::space::epsilon));
+    EXPECT_FALSE(Cartesian::approx_equal(1e6, 1e6 + 1e-8, 0, 4 * Cartesian::space::epsilon));
+    EXPECT_TRUE(Cartesian::approx_equal(-INFINITY, -INFINITY, 0, 0));
+    EXPECT_FALSE(Cartesian::approx_equal(NAN, NAN, INFINITY, 0));
+  }
+
+  TEST_F(RandomSpace, BatchApproxEqual) {
+
+    // 70 elements spans two mask words, misses at 3, 64 and 69.
+    const unsigned long n(70);
+    std::vector<Cartesian::space> expected(n, p1);
+    std::vector<Cartesian::space> actual(n, p1);
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(n), 0);
+
+    for (unsigned long i = 0; i < n; ++i)
+      actual[i].y(nextafter(p1.y(), INFINITY));
+
+    actual[3].x(p1.x() + 1);
+    actual[64].z(NAN);
+    actual[69] = p2;
+
+    const unsigned long long misses[2] = {~(1ULL << 3), 0x1e}; // 64 .. 69 less 64 and 69
+
+    EXPECT_EQ(n - 3, Cartesian::approx_equal_ulps(&expected[0], &actual[0], &mask[0], n, 1));
+    EXPECT_EQ(misses[0], mask[0]);
+    EXPECT_EQ(misses[1], mask[1]);
+
+    EXPECT_EQ(0u, Cartesian::approx_equal_ulps(&expected[0], &actual[0], &mask[0], n, 0));
+
+    EXPECT_EQ(n - 3, Cartesian::approx_equal(&expected[0], &actual[0], &mask[0], n,
+					     DBL_MIN, 2 * Cartesian::space::epsilon));
+    EXPECT_EQ(misses[0], mask[0]);
+    EXPECT_EQ(misses[1], mask[1]);
+
+    EXPECT_EQ(n, Cartesian::approx_equal(&expected[0], &expected[0], &mask[0], n, 0, 0));
+  }
+
+  // -----------------
+  // ----- Polar -----
+  // -----------------
+
+  // distance in units in the last place of b.
+  double ulps(const double& a, const double& b) {
+    if (a == b)
+      return 0;
+    return fabs(a - b) / (nextafter(fabs(b), INFINITY) - fabs(b));
+  }
+
+  TEST(Polar, SetAndGet) {
+
+    Cartesian::space a;
+    a.setUsingPolarCoords(2, M_PI/2, M_PI/2);
+    EXPECT_NEAR(0, a.x(), 1e-15);
+    EXPECT_DOUBLE_EQ(2, a.y());
+    EXPECT_NEAR(0, a.z(), 1e-15);
+
+    double radius, theta, phi;
+    a.getPolarCoords(radius, theta, phi);
+    EXPECT_DOUBLE_EQ(2, radius);
+    EXPECT_DOUBLE_EQ(M_PI/2, theta);
+    EXPECT_DOUBLE_EQ(M_PI/2, phi);
+
+    Cartesian::space::Uo.getPolarCoords(radius, theta, phi);
+    EXPECT_EQ(0, radius);
+    EXPECT_EQ(0, theta);
+    EXPECT_EQ(0, phi);
+  }
+
+  // the documented fast_sincos and fast_atan2 bounds against libm.
+  TEST(Polar, FastFunctionErrors) {
+
+    std::mt19937 generator(20160312);
+    std::uniform_real_distribution<double> angle(-1e5, 1e5);
+    std::uniform_real_distribution<double> coordinate(-1.0, 1.0);
+    std::uniform_real_distribution<double> exponent(-30, 30);
+
+    double sincos_error(0), atan2_error(0);
+
+    for (int k = 0; k < 100000; ++k) {
+
+      const double x(angle(generator));
+      double s, c;
+      Cartesian::fast_sincos(x, s, c);
+      sincos_error = std::max(sincos_error, std::max(ulps(s, sin(x)), ulps(c, cos(x))));
+
+      const double u(coordinate(generator) * pow(10, exponent(generator)));
+      const double v(coordinate(generator) * pow(10, exponent(generator)));
+      atan2_error = std::max(atan2_error, ulps(Cartesian::fast_atan2(u, v), atan2(u, v)));
+    }
+
+    EXPECT_LE(sincos_error, 2);
+    EXPECT_LE(atan2_error, 2);
+
+    EXPECT_EQ(atan2(0.0, -0.0), Cartesian::fast_atan2(0.0, -0.0));
+    EXPECT_EQ(atan2(-0.0, 0.0), Cartesian::fast_atan2(-0.0, 0.0));
+    EXPECT_EQ(atan2(-1.0, 0.0), Cartesian::fast_atan2(-1.0, 0.0));
+    EXPECT_EQ(atan2(1.0, -1.0), Cartesian::fast_atan2(1.0, -1.0));
+  }
+
+  TEST(Polar, BatchRoundTrip) {
+
+    const unsigned long n(1000);
+    std::mt19937 generator(20160312);
+    std::uniform_real_distribution<double> coordinate(-1e3, 1e3);
+
+    std::vector<Cartesian::space> vectors(n);
+    for (unsigned long k = 0; k < n; ++k)
+      vectors[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+    vectors[0] = Cartesian::space::Uo;
+
+    const Cartesian::PolarMode modes[2] = {Cartesian::polar_precise, Cartesian::polar_fast};
+
+    for (int m = 0; m < 2; ++m) {
+
+      std::vector<double> radius(n), theta(n), phi(n);
+      std::vector<Cartesian::space> results(n);
+
+      Cartesian::to_polar(&vectors[0], &radius[0], &theta[0], &phi[0], n, modes[m]);
+      Cartesian::from_polar(&radius[0], &theta[0], &phi[0], &results[0], n, modes[m]);
+
+      EXPECT_EQ(Cartesian::space::Uo, results[0]);
+
+      for (unsigned long k = 1; k < n; ++k) {
+
+	double a_radius, a_theta, a_phi;
+	vectors[k].getPolarCoords(a_radius, a_theta, a_phi);
+	EXPECT_LE(ulps(radius[k], a_radius), 1);
+	EXPECT_LE(ulps(theta[k], a_theta), 2);
+	EXPECT_LE(ulps(phi[k], a_phi), 2);
+
+	EXPECT_NEAR(0, (results[k] - vectors[k]).magnitude(), 1e-12 * vectors[k].magnitude());
+      }
+    }
+  }
+
+  // ----------------------------
+  // ----- Orbital elements -----
+  // ----------------------------
+
+  // a unit mass fixed at the origin pulls test particles.
+  void kepler(const Cartesian::space* positions, Cartesian::space* accelerations,
+	      const unsigned long& a_size) {
+    for (unsigned long k = 0; k < a_size; ++k) {
+      const double r(positions[k].magnitude());
+      accelerations[k] = positions[k] * (-1.0 / (r * r * r));
+    }
+  }
+
+  TEST(Kepler, Elliptic) {
+
+    std::mt19937 generator(20160316);
+    std::uniform_real_distribution<double> mean(-10, 10);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    const unsigned long n(100000);
+    std::vector<double> M(n), e(n), E(n);
+    for (unsigned long k = 0; k < n; ++k) {
+      M[k] = mean(generator) * (k % 3 == 0 ? 1e-6 : 1);
+      e[k] = k % 2 == 0 ? 1 - pow(10, -8 * unit(generator)) : unit(generator);
+    }
+    e[0] = 0;
+    M[1] = 0;
+
+    Cartesian::solve_kepler(&M[0], &e[0], &E[0], n);
+    for (unsigned long k = 0; k < n; ++k) {
+      // the residual, without the cancellation of E - e sin E near 0.
+      const double residual(std::abs(E[k]) < 1e-2 ?
+			    (1 - e[k]) * E[k] + e[k] * pow(E[k], 3) / 6 * (1 - E[k] * E[k] / 20) - M[k] :
+			    E[k] - e[k] * sin(E[k]) - M[k]);
+      ASSERT_LE(std::abs(residual), 4e-16 * std::max(1.0, std::abs(M[k])) + 1e-15 * std::abs(M[k]))
+	<< M[k] << " " << e[k];
+    }
+  }
+
+  TEST(Kepler, Hyperbolic) {
+
+    std::mt19937 generator(20160317);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    // with elliptic ones mixed in.
+    const unsigned long n(100000);
+    std::vector<double> M(n), e(n), H(n);
+    for (unsigned long k = 0; k < n; ++k) {
+      M[k] = (unit(generator) < 0.5 ? -1 : 1) * pow(10, -8 + 11 * unit(generator));
+      e[k] = k % 5 == 0 ? unit(generator) : 1 + pow(10, -6 + 7 * unit(generator));
+    }
+
+    Cartesian::solve_kepler(&M[0], &e[0], &H[0], n);
+    for (unsigned long k = 0; k < n; ++k) {
+      const double f(e[k] > 1 ? e[k] * sinh(H[k]) - H[k] : H[k] - e[k] * sin(H[k]));
+      // relative to the terms, e sinh H and H.
+      ASSERT_LE(std::abs(f - M[k]), 1e-13 * (std::abs(M[k]) + std::abs(H[k])) + 1e-15)
+	<< M[k] << " " << e[k] << " " << H[k];
+    }
+  }
+
+  TEST(Kepler, KnownElements) {
+
+    // circular and equatorial, then the same tipped up about x.
+    const Cartesian::space positions[2] = {Cartesian::space::Ux, Cartesian::space::Ux};
+    const Cartesian::space velocities[2] = {Cartesian::space::Uy, Cartesian::space::Uz};
+    double a[2], e[2], inclination[2], node[2], periapsis[2], M[2];
+
+    Cartesian::to_elements(positions, velocities, 1, a, e, inclination, node, periapsis, M, 2);
+    for (int k = 0; k < 2; ++k) {
+      EXPECT_DOUBLE_EQ(1, a[k]);
+      EXPECT_NEAR(0, e[k], 1e-15);
+      EXPECT_NEAR(0, node[k], 1e-15);
+      EXPECT_NEAR(0, periapsis[k], 1e-15);
+      EXPECT_NEAR(0, M[k], 1e-15);
+    }
+    EXPECT_NEAR(0, inclination[0], 1e-15);
+    EXPECT_DOUBLE_EQ(M_PI / 2, inclination[1]);
+
+    // e = 0.5 at apoapsis, a quarter turn round the node.
+    const Cartesian::space apoapsis(0, 1.5, 0), slow(-sqrt(1.0 / 3), 0, 0);
+    Cartesian::to_elements(&apoapsis, &slow, 1, a, e, inclination, node, periapsis, M, 1);
+    EXPECT_DOUBLE_EQ(1, a[0]);
+    EXPECT_DOUBLE_EQ(0.5, e[0]);
+    EXPECT_NEAR(-M_PI / 2, periapsis[0], 1e-15);
+    EXPECT_DOUBLE_EQ(M_PI, std::abs(M[0]));
+  }
+
+  TEST(Kepler, RoundTrip) {
+
+    std::mt19937 generator(20160318);
+    std::uniform_real_distribution<double> coordinate(-2, 2);
+    std::uniform_real_distribution<double> speed(-1.5, 1.5);
+
+    // bound and unbound, mu 1.
+    const unsigned long n(10000);
+    std::vector<Cartesian::space> positions(n), velocities(n), p(n), v(n);
+    for (unsigned long k = 0; k < n; ++k) {
+      positions[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+      velocities[k] = Cartesian::space(speed(generator), speed(generator), speed(generator));
+    }
+
+    std::vector<double> a(n), e(n), inclination(n), node(n), periapsis(n), M(n);
+    Cartesian::to_elements(&positions[0], &velocities[0], 1, &a[0], &e[0], &inclination[0],
+			   &node[0], &periapsis[0], &M[0], n);
+    Cartesian::from_elements(&a[0], &e[0], &inclination[0], &node[0], &periapsis[0], &M[0], 1,
+			     &p[0], &v[0], n);
+
+    unsigned long hyperbolic(0);
+    for (unsigned long k = 0; k < n; ++k) {
+      hyperbolic += e[k] > 1;
+      EXPECT_LT((p[k] - positions[k]).magnitude(), 1e-10 * positions[k].magnitude()) << k << " " << e[k];
+      EXPECT_LT((v[k] - velocities[k]).magnitude(), 1e-10 * velocities[k].magnitude()) << k << " " << e[k];
+    }
+    EXPECT_GT(hyperbolic, n / 10);
+    EXPECT_LT(hyperbolic, n - n / 10);
+  }
+
+  TEST(Kepler, PropagateMatchesIntegration) {
+
+    // an eccentric and inclined ellipse and a hyperbola.
+    Cartesian::space positions[2] = {Cartesian::space(0.5, 0, 0.1), Cartesian::space(1, 0.2, 0)};
+    Cartesian::space velocities[2] = {Cartesian::space(0, 1.6, 0.3), Cartesian::space(0.1, 1.8, -0.2)};
+    Cartesian::space p[2] = {positions[0], positions[1]};
+    Cartesian::space v[2] = {velocities[0], velocities[1]};
+
+    Cartesian::kepler_propagate(positions, velocities, 1, 3.7, 2);
+
+    Cartesian::DormandPrince solver(kepler, 1e-13, 1e-13);
+    double dt(1e-3);
+    solver.advance(p, v, 2, 3.7, &dt);
+
+    for (int k = 0; k < 2; ++k) {
+      EXPECT_LT((p[k] - positions[k]).magnitude(), 1e-9) << k;
+      EXPECT_LT((v[k] - velocities[k]).magnitude(), 1e-9) << k;
+    }
+  }
+
+  // -------------------
+  // ----- Gravity -----
+  // -------------------
+
+  // the scalar version, with space differences, magnitude and operator/.
+  std::vector<Cartesian::space> naive_gravity(const std::vector<Cartesian::space>& positions,
+					      const std::vector<double>& masses,
+					      const double& a_softening) {
+    std::vector<Cartesian::space> accelerations(positions.size());
+    for (unsigned long i = 0; i < positions.size(); ++i)
+      for (unsigned long j = 0; j < positions.size(); ++j) {
+	if (i == j)
+	  continue;
+	const Cartesian::space d(positions[j] - positions[i]);
+	const double r(sqrt(d.magnitude2() + a_softening * a_softening));
+	accelerations[i] += d * (masses[j] / (r * r * r));
+      }
+    return accelerations;
+  }
+
+  TEST(Gravity, FastRsqrt) {
+
+    std::mt19937 generator(20160312);
+    std::uniform_real_distribution<double> exponent(-300, 300);
+
+    for (int k = 0; k < 100000; ++k) {
+      const double x(pow(10.0, exponent(generator)));
+      EXPECT_LE(ulps(Cartesian::fast_rsqrt(x), 1.0 / sqrt(x)), 2) << x;
+    }
+  }
+
+  TEST(Gravity, TwoBodies) {
+
+    const Cartesian::space positions[2] = {Cartesian::space::Uo, Cartesian::space(2, 0, 0)};
+    const double masses[2] = {1, 8};
+    Cartesian::space accelerations[2];
+
+    Cartesian::gravity(positions, masses, accelerations, 2, 0);
+    EXPECT_EQ(Cartesian::space(2, 0, 0), accelerations[0]);
+    EXPECT_EQ(Cartesian::space(-0.25, 0, 0), accelerations[1]);
+
+    // coincident bodies without softening do not pull.
+    const Cartesian::space together[2];
+    Cartesian::gravity(together, masses, accelerations, 2, 0, 1, Cartesian::gravity_fast);
+    EXPECT_EQ(Cartesian::space::Uo, accelerations[0]);
+    EXPECT_EQ(Cartesian::space::Uo, accelerations[1]);
+  }
+
+  TEST(Gravity, MatchesNaive) {
+
+    // not a multiple of the tile or the lanes.
+    const unsigned long n(1237);
+    const double softening(1e-2);
+    std::mt19937 generator(20160312);
+    std::uniform_real_distribution<double> coordinate(-1, 1);
+    std::uniform_real_distribution<double> mass(0.5, 2);
+
+    std::vector<Cartesian::space> positions(n);
+    std::vector<double> masses(n);
+    for (unsigned long k = 0; k < n; ++k) {
+      positions[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+      masses[k] = mass(generator);
+    }
+
+    const std::vector<Cartesian::space> expected(naive_gravity(positions, masses, softening));
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(n));
+
+    const Cartesian::GravityMode modes[2] = {Cartesian::gravity_precise, Cartesian::gravity_fast};
+    const unsigned int threads[3] = {1, 3, 0};
+
+    for (int m = 0; m < 2; ++m)
+      for (int t = 0; t < 3; ++t) {
+	std::vector<Cartesian::space> accelerations(n);
+	Cartesian::gravity(&positions[0], &masses[0], &accelerations[0], n, softening,
+			   threads[t], modes[m]);
+	// summation order differs, the sums cancel to ~1e3 below their terms.
+	EXPECT_EQ(n, Cartesian::approx_equal(&expected[0], &accelerations[0], &mask[0], n,
+					     1e-9, 1e-9)) << m << " " << threads[t];
+      }
+  }
+
+  // random bodies, with a dense clump so the tree is uneven.
+  void random_bodies(const unsigned long& a_size, std::vector<Cartesian::space>& positions,
+		     std::vector<double>& masses) {
+    std::mt19937 generator(20160313);
+    std::uniform_real_distribution<double> coordinate(-1, 1);
+    std::uniform_real_distribution<double> mass(0.5, 2);
+    positions.resize(a_size);
+    masses.resize(a_size);
+    for (unsigned long k = 0; k < a_size; ++k) {
+      const double scale(k % 4 == 0 ? 1e-3 : 1);
+      positions[k] = scale * Cartesian::space(coordinate(generator), coordinate(generator),
+					      coordinate(generator));
+      masses[k] = mass(generator);
+    }
+  }
+
+  // rms of |a - b| over rms of |b|.
+  double relative_rms(const std::vector<Cartesian::space>& a, const std::vector<Cartesian::space>& b) {
+    double error(0), norm(0);
+    for (unsigned long k = 0; k < a.size(); ++k) {
+      error += (a[k] - b[k]).magnitude2();
+      norm += b[k].magnitude2();
+    }
+    return sqrt(error / norm);
+  }
+
+  TEST(BarnesHut, EmptyAndOne) {
+
+    Cartesian::BarnesHut tree;
+    tree.build(0, 0, 0);
+    EXPECT_EQ(0, tree.size());
+    EXPECT_EQ(0, tree.nodes());
+    EXPECT_EQ(Cartesian::space::Uo, tree.acceleration(Cartesian::space::Ux));
+
+    const Cartesian::space position(1, 2, 3);
+    const double mass(4);
+    Cartesian::space acceleration(Cartesian::space::Ux);
+    tree.build(&position, &mass, 1);
+    tree.accelerations(&acceleration);
+    EXPECT_EQ(Cartesian::space::Uo, acceleration);
+    EXPECT_EQ(Cartesian::space(-1, 0, 0), tree.acceleration(Cartesian::space(3, 2, 3)));
+  }
+
+  TEST(BarnesHut, Coincident) {
+
+    // more than leaf_size at one point, they cannot be split.
+    const std::vector<Cartesian::space> positions(100, Cartesian::space(1, 1, 1));
+    const std::vector<double> masses(100, 1);
+    std::vector<Cartesian::space> accelerations(100, Cartesian::space::Ux);
+
+    Cartesian::BarnesHut tree(0.5);
+    tree.build(&positions[0], &masses[0], 100);
+    tree.accelerations(&accelerations[0]);
+    for (unsigned long k = 0; k < 100; ++k)
+      EXPECT_EQ(Cartesian::space::Uo, accelerations[k]);
+    EXPECT_DOUBLE_EQ(-100, tree.acceleration(Cartesian::space(2, 1, 1)).x());
+  }
+
+  TEST(BarnesHut, ThetaZeroMatchesDirect) {
+
+    const unsigned long n(1237);
+    const double softening(1e-2);
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(n, positions, masses);
+
+    std::vector<Cartesian::space> expected(n), accelerations(n);
+    Cartesian::gravity(&positions[0], &masses[0], &expected[0], n, softening);
+
+    // theta 0 opens every node, a direct sum in Morton order.
+    Cartesian::BarnesHut tree(0, softening);
+    tree.build(&positions[0], &masses[0], n);
+    tree.accelerations(&accelerations[0]);
+
+    std::vector<unsigned long long> mask(Cartesian::zero_mask_words(n));
+    EXPECT_EQ(n, Cartesian::approx_equal(&expected[0], &accelerations[0], &mask[0], n, 1e-9, 1e-9));
+  }
+
+  TEST(BarnesHut, ErrorShrinksWithTheta) {
+
+    const unsigned long n(4000);
+    const double softening(1e-3);
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(n, positions, masses);
+
+    std::vector<Cartesian::space> expected(n), accelerations(n);
+    Cartesian::gravity(&positions[0], &masses[0], &expected[0], n, softening);
+
+    const double thetas[3] = {1.0, 0.5, 0.25};
+    double last(1);
+    for (int t = 0; t < 3; ++t) {
+      Cartesian::BarnesHut tree(thetas[t], softening);
+      tree.build(&positions[0], &masses[0], n);
+      tree.accelerations(&accelerations[0]);
+      const double error(relative_rms(accelerations, expected));
+      EXPECT_LT(error, last) << thetas[t];
+      last = error;
+    }
+    // monopoles only, the clump makes it worse than the ~3e-4 of a uniform cube.
+    EXPECT_LT(last, 5e-3);
+  }
+
+  TEST(BarnesHut, OwnCellIsOpened) {
+
+    // a unit mass at the origin and a tight cluster of the same total
+    // mass at (1, 1, 1). With theta 1.5 the root's center of mass,
+    // (0.5, 0.5, 0.5), passes the width test from the origin, but the
+    // root holds the body itself so it must be opened.
+    const unsigned long n(41);
+    std::vector<Cartesian::space> positions(1, Cartesian::space::Uo);
+    std::vector<double> masses(1, 1);
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> offset(-0.005, 0.005);
+    for (unsigned long k = 1; k < n; ++k) {
+      positions.push_back(Cartesian::space(1 + offset(generator), 1 + offset(generator), 1 + offset(generator)));
+      masses.push_back(1.0 / (n - 1));
+    }
+
+    std::vector<Cartesian::space> expected(n), accelerations(n);
+    Cartesian::gravity(&positions[0], &masses[0], &expected[0], n, 0);
+
+    Cartesian::BarnesHut tree(1.5);
+    tree.build(&positions[0], &masses[0], n);
+    tree.accelerations(&accelerations[0]);
+    EXPECT_TRUE(Cartesian::approx_equal(expected[0], accelerations[0], 1e-2, 0)) << accelerations[0];
+    EXPECT_TRUE(Cartesian::approx_equal(expected[0], tree.acceleration(positions[0]), 1e-2, 0));
+  }
+
+  TEST(BarnesHut, ThreadsMatchSerial) {
+
+    // big enough for the parallel build.
+    const unsigned long n(10007);
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(n, positions, masses);
+
+    Cartesian::BarnesHut serial(0.5, 1e-3, 1);
+    serial.build(&positions[0], &masses[0], n);
+    std::vector<Cartesian::space> expected(n);
+    serial.accelerations(&expected[0]);
+
+    const unsigned int threads[2] = {3, 0};
+    for (int t = 0; t < 2; ++t) {
+      Cartesian::BarnesHut tree(0.5, 1e-3, threads[t]);
+      tree.build(&positions[0], &masses[0], n);
+      EXPECT_EQ(serial.nodes(), tree.nodes());
+      std::vector<Cartesian::space> accelerations(n);
+      tree.accelerations(&accelerations[0]);
+      for (unsigned long k = 0; k < n; ++k)
+	ASSERT_EQ(expected[k], accelerations[k]) << k << " " << threads[t];
+    }
+  }
+
+  // ------------------------------------
+  // ----- pairwise distances tests -----
+  // ------------------------------------
+
+  std::vector<Cartesian::space> random_points(const unsigned long& a_count, const unsigned int& a_seed) {
+    std::mt19937 generator(a_seed);
+    std::uniform_real_distribution<double> coordinate(-1, 1);
+    std::vector<Cartesian::space> points(a_count);
+    for (unsigned long k = 0; k < a_count; ++k)
+      points[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+    return points;
+  }
+
+  // with space differences and magnitude(), every pair, or i < j for
+  // the upper triangle.
+  Cartesian::SparseDistances brute_within(const std::vector<Cartesian::space>& a,
+					  const std::vector<Cartesian::space>& b,
+					  const double& threshold, const bool& upper,
+					  const Cartesian::DistanceMode& mode) {
+    Cartesian::SparseDistances results;
+    results.m_row_starts.push_back(0);
+    for (unsigned long i = 0; i < a.size(); ++i) {
+      for (unsigned long j = upper ? i + 1 : 0; j < b.size(); ++j)
+	if ((a[i] - b[j]).magnitude() <= threshold) {
+	  results.m_columns.push_back(j);
+	  results.m_values.push_back(mode == Cartesian::distance_squared ?
+				     (a[i] - b[j]).magnitude2() : (a[i] - b[j]).magnitude());
+	}
+      results.m_row_starts.push_back(results.m_columns.size());
+    }
+    return results;
+  }
+
+  void expect_sparse(const Cartesian::SparseDistances& expected, const Cartesian::SparseDistances& results) {
+    ASSERT_EQ(expected.m_row_starts, results.m_row_starts);
+    ASSERT_EQ(expected.m_columns, results.m_columns);
+    for (unsigned long k = 0; k < expected.m_values.size(); ++k)
+      ASSERT_DOUBLE_EQ(expected.m_values[k], results.m_values[k]) << k;
+  }
+
+  TEST(DistanceMatrix, Dense) {
+
+    // more columns than a tile, and not a multiple of the rows per block.
+    const std::vector<Cartesian::space> a(random_points(77, 20161019));
+    const std::vector<Cartesian::space> b(random_points(2500, 20161020));
+    std::vector<double> results(a.size() * b.size() + 1, -1);
+
+    Cartesian::distance_matrix(&a[0], a.size(), &b[0], b.size(), &results[0]);
+    for (unsigned long i = 0; i < a.size(); ++i)
+      for (unsigned long j = 0; j < b.size(); ++j)
+	ASSERT_DOUBLE_EQ((a[i] - b[j]).magnitude(), results[i * b.size() + j]) << i << " " << j;
+    EXPECT_EQ(-1, results.back());
+
+    Cartesian::distance_matrix(&a[0], a.size(), &b[0], b.size(), &results[0], Cartesian::distance_squared);
+    for (unsigned long i = 0; i < a.size(); ++i)
+      for (unsigned long j = 0; j < b.size(); ++j)
+	ASSERT_DOUBLE_EQ((a[i] - b[j]).magnitude2(), results[i * b.size() + j]) << i << " " << j;
+  }
+
+  TEST(DistanceMatrix, Upper) {
+
+    const unsigned long n(1100);
+    const std::vector<Cartesian::space> a(random_points(n, 20161019));
+    std::vector<double> results(n * (n - 1) / 2 + 1, -1);
+
+    EXPECT_EQ(0u, Cartesian::upper_index(0, 1, n));
+    EXPECT_EQ(n - 1, Cartesian::upper_index(1, 2, n));
+    EXPECT_EQ(n * (n - 1) / 2 - 1, Cartesian::upper_index(n - 2, n - 1, n));
+
+    Cartesian::distance_matrix(&a[0], n, &results[0]);
+    for (unsigned long i = 0; i < n; ++i)
+      for (unsigned long j = i + 1; j < n; ++j)
+	ASSERT_DOUBLE_EQ((a[i] - a[j]).magnitude(), results[Cartesian::upper_index(i, j, n)]) << i << " " << j;
+    EXPECT_EQ(-1, results.back());
+
+    // one point has no pairs, none writes nothing.
+    Cartesian::distance_matrix(&a[0], 1, &results[0], Cartesian::distance_squared);
+    Cartesian::distance_matrix(&a[0], 0, &results[0], Cartesian::distance_squared);
+    EXPECT_DOUBLE_EQ((a[0] - a[1]).magnitude(), results[0]);
+  }
+
+  TEST(DistanceMatrix, Within) {
+
+    // coincident points are within 0.
+    std::vector<Cartesian::space> a(random_points(300, 20161019));
+    const std::vector<Cartesian::space> b(random_points(1500, 20161020));
+    a[10] = a[20] = b[5];
+
+    const double thresholds[4] = {-1, 0, 0.1, 10};
+    const Cartesian::DistanceMode modes[2] = {Cartesian::distance_euclidean, Cartesian::distance_squared};
+    Cartesian::SparseDistances results;
+    for (int t = 0; t < 4; ++t)
+      for (int m = 0; m < 2; ++m) {
+	SCOPED_TRACE(thresholds[t]);
+	Cartesian::distances_within(&a[0], a.size(), &b[0], b.size(), thresholds[t], results, modes[m]);
+	expect_sparse(brute_within(a, b, thresholds[t], false, modes[m]), results);
+	Cartesian::distances_within(&a[0], a.size(), thresholds[t], results, modes[m]);
+	expect_sparse(brute_within(a, a, thresholds[t], true, modes[m]), results);
+      }
+
+    Cartesian::distances_within(&a[0], a.size(), 0, results);
+    EXPECT_EQ(1u, results.m_columns.size());
+    Cartesian::distances_within(&a[0], 0, 1, results);
+    EXPECT_EQ(std::vector<unsigned long>(1, 0), results.m_row_starts);
+    EXPECT_TRUE(results.m_columns.empty());
+  }
+
+  TEST(DistanceMatrix, ThreadsMatchSerial) {
+
+    const unsigned long n(2000);
+    const std::vector<Cartesian::space> a(random_points(n, 20161019));
+    std::vector<double> expected(n * (n - 1) / 2), results(n * (n - 1) / 2);
+    Cartesian::SparseDistances expected_within, within;
+    Cartesian::distance_matrix(&a[0], n, &expected[0]);
+    Cartesian::distances_within(&a[0], n, 0.2, expected_within);
+
+    const unsigned int threads[2] = {3, 0};
+    for (int t = 0; t < 2; ++t) {
+      SCOPED_TRACE(threads[t]);
+      Cartesian::distance_matrix(&a[0], n, &results[0], Cartesian::distance_euclidean, threads[t]);
+      EXPECT_EQ(expected, results);
+      Cartesian::distances_within(&a[0], n, 0.2, within, Cartesian::distance_euclidean, threads[t]);
+      expect_sparse(expected_within, within);
+    }
+  }
+
+  // ----------------------------
+  // ----- Integrator tests -----
+  // ----------------------------
+
+  // a = -x, from (1, 0, 0) at (0, 1, 0) the orbit is (cos t, sin t, 0).
+  void harmonic(const Cartesian::space* positions, Cartesian::space* accelerations,
+		const unsigned long& a_size) {
+    for (unsigned long k = 0; k < a_size; ++k)
+      accelerations[k] = -positions[k];
+  }
+
+  double harmonic_error(const Cartesian::IntegratorScheme& a_scheme, const unsigned long& a_steps) {
+    Cartesian::space position(Cartesian::space::Ux), velocity(Cartesian::space::Uy);
+    Cartesian::Integrator integrator(a_scheme, harmonic);
+    integrator.advance(&position, &velocity, 1, 2.0 / a_steps, a_steps);
+    return (position - Cartesian::space(cos(2.0), sin(2.0), 0)).magnitude();
+  }
+
+  TEST(Integrator, Order) {
+
+    // halving dt divides the error by 2^order.
+    EXPECT_NEAR(4, harmonic_error(Cartesian::integrator_leapfrog, 100) /
+		harmonic_error(Cartesian::integrator_leapfrog, 200), 0.1);
+    EXPECT_NEAR(4, harmonic_error(Cartesian::integrator_velocity_verlet, 100) /
+		harmonic_error(Cartesian::integrator_velocity_verlet, 200), 0.1);
+    EXPECT_NEAR(16, harmonic_error(Cartesian::integrator_yoshida4, 100) /
+		harmonic_error(Cartesian::integrator_yoshida4, 200), 0.5);
+  }
+
+  TEST(Integrator, Forces) {
+
+    Cartesian::space position(Cartesian::space::Ux), velocity(Cartesian::space::Uy);
+
+    Cartesian::Integrator leapfrog(Cartesian::integrator_leapfrog, harmonic);
+    leapfrog.advance(&position, &velocity, 1, 0.01, 10);
+    EXPECT_EQ(10, leapfrog.steps());
+    EXPECT_EQ(10, leapfrog.forces());
+
+    // one more per advance() for the first kick.
+    Cartesian::Integrator verlet(Cartesian::integrator_velocity_verlet, harmonic);
+    verlet.advance(&position, &velocity, 1, 0.01, 10);
+    verlet.advance(&position, &velocity, 1, 0.01, 10);
+    EXPECT_EQ(20, verlet.steps());
+    EXPECT_EQ(22, verlet.forces());
+
+    Cartesian::Integrator yoshida(Cartesian::integrator_yoshida4, harmonic);
+    yoshida.advance(&position, &velocity, 1, 0.01, 10);
+    yoshida.advance(&position, &velocity, 1, 0.01, 0);
+    EXPECT_EQ(30, yoshida.forces());
+  }
+
+  TEST(Integrator, Stride) {
+
+    const Cartesian::IntegratorScheme schemes[3] = {Cartesian::integrator_leapfrog,
+						     Cartesian::integrator_velocity_verlet,
+						     Cartesian::integrator_yoshida4};
+
+    for (int s = 0; s < 3; ++s) {
+
+      // two bodies, 10 steps in two calls, recorded after steps 3, 6 and 9.
+      Cartesian::space positions[2] = {Cartesian::space::Ux, Cartesian::space(0, 2, 0)};
+      Cartesian::space velocities[2] = {Cartesian::space::Uy, Cartesian::space(-2, 0, 0)};
+      Cartesian::SpaceRecorder recorder(100);
+      recorder.clear();
+      Cartesian::Integrator integrator(schemes[s], harmonic, &recorder, 3);
+      integrator.advance(positions, velocities, 2, 0.1, 4);
+      integrator.advance(positions, velocities, 2, 0.1, 6);
+      ASSERT_EQ(6, recorder.size());
+
+      // the same steps one at a time, without merged drifts or kicks.
+      Cartesian::space p[2] = {Cartesian::space::Ux, Cartesian::space(0, 2, 0)};
+      Cartesian::space v[2] = {Cartesian::space::Uy, Cartesian::space(-2, 0, 0)};
+      Cartesian::Integrator stepper(schemes[s], harmonic);
+      for (int step = 1; step <= 10; ++step) {
+	stepper.advance(p, v, 2, 0.1, 1);
+	if (step % 3 == 0) {
+	  for (int k = 0; k < 2; ++k) {
+	    EXPECT_TRUE(Cartesian::approx_equal(p[k], recorder.get(2 * (step / 3 - 1) + k), 1e-14, 1e-14))
+	      << s << " " << step;
+	  }
+	}
+      }
+      for (int k = 0; k < 2; ++k) {
+	EXPECT_TRUE(Cartesian::approx_equal(p[k], positions[k], 1e-14, 1e-14)) << s;
+	EXPECT_TRUE(Cartesian::approx_equal(v[k], velocities[k], 1e-14, 1e-14)) << s;
+      }
+    }
+  }
+
+  TEST(Integrator, Kepler) {
+
+    // a circular binary, period 2 pi.
+    Cartesian::space positions[2] = {Cartesian::space(0.5, 0, 0), Cartesian::space(-0.5, 0, 0)};
+    Cartesian::space velocities[2] = {Cartesian::space(0, 0.5, 0), Cartesian::space(0, -0.5, 0)};
+    const double masses[2] = {0.5, 0.5};
+    const Cartesian::space start(positions[0]);
+
+    const double energy(Cartesian::gravity_energy(positions, velocities, masses, 2, 0));
+    EXPECT_DOUBLE_EQ(2 * 0.5 * 0.5 * 0.25 - 0.25, energy);
+
+    Cartesian::Integrator integrator(Cartesian::integrator_yoshida4,
+				     [&](const Cartesian::space* p, Cartesian::space* a,
+					 const unsigned long& n) {
+				       Cartesian::gravity(p, masses, a, n, 0);
+				     });
+
+    // ten orbits, then back again, symplectic and time reversible.
+    integrator.advance(positions, velocities, 2, 2 * M_PI / 100, 1000);
+    EXPECT_NEAR(energy, Cartesian::gravity_energy(positions, velocities, masses, 2, 0), 1e-9);
+    EXPECT_LT((positions[0] - start).magnitude(), 1e-3);  // phase error
+
+    integrator.advance(positions, velocities, 2, -2 * M_PI / 100, 1000);
+    EXPECT_LT((positions[0] - start).magnitude(), 1e-12);
+  }
+
+  // -------------------------------
+  // ----- DormandPrince tests -----
+  // -------------------------------
+
+  TEST(DormandPrince, Harmonic) {
+
+    Cartesian::space position(Cartesian::space::Ux), velocity(Cartesian::space::Uy);
+    Cartesian::DormandPrince solver(harmonic, 1e-12, 1e-12);
+    double dt(0.1);
+    solver.advance(&position, &velocity, 1, 2.0, &dt);
+
+    EXPECT_LT((position - Cartesian::space(cos(2.0), sin(2.0), 0)).magnitude(), 1e-10);
+    EXPECT_LT((velocity - Cartesian::space(-sin(2.0), cos(2.0), 0)).magnitude(), 1e-10);
+    // FSAL, six forces a step and one to start.
+    EXPECT_EQ(6 * (solver.steps() + solver.rejected()) + 1, solver.forces());
+
+    // and back.
+    solver.advance(&position, &velocity, 1, -2.0, &dt);
+    EXPECT_LT((position - Cartesian::space::Ux).magnitude(), 1e-10);
+  }
+
+  TEST(DormandPrince, Eccentric) {
+
+    // e = 0.9 from pericenter, semi major axis 1 and period 2 pi.
+    const Cartesian::space start(0.1, 0, 0), speed(0, sqrt(19.0), 0);
+    Cartesian::space position(start), velocity(speed);
+    Cartesian::DormandPrince solver(kepler, 1e-12, 1e-12);
+    double dt(1e-3);
+    solver.advance(&position, &velocity, 1, 2 * M_PI, &dt);
+
+    EXPECT_LT((position - start).magnitude(), 1e-8);
+    EXPECT_LT((velocity - speed).magnitude(), 1e-6);
+    EXPECT_GT(solver.rejected(), 0);  // it shrinks into pericenter
+  }
+
+  TEST(DormandPrince, Independent) {
+
+    // a circular and an eccentric orbit, a period each.
+    const Cartesian::space starts[2] = {Cartesian::space::Ux, Cartesian::space(0.1, 0, 0)};
+    const Cartesian::space speeds[2] = {Cartesian::space::Uy, Cartesian::space(0, sqrt(19.0), 0)};
+
+    Cartesian::space positions[2] = {starts[0], starts[1]};
+    Cartesian::space velocities[2] = {speeds[0], speeds[1]};
+    Cartesian::DormandPrince shared(kepler, 1e-12, 1e-12);
+    double dt(1e-3);
+    shared.advance(positions, velocities, 2, 2 * M_PI, &dt);
+
+    Cartesian::space p[2] = {starts[0], starts[1]};
+    Cartesian::space v[2] = {speeds[0], speeds[1]};
+    Cartesian::DormandPrince independent(kepler, 1e-12, 1e-12, true);
+    double dts[2] = {1e-3, 1e-3};
+    independent.advance(p, v, 2, 2 * M_PI, dts);
+
+    for (int k = 0; k < 2; ++k) {
+      EXPECT_LT((p[k] - starts[k]).magnitude(), 1e-8) << k;
+      EXPECT_LT((positions[k] - starts[k]).magnitude(), 1e-8) << k;
+    }
+
+    // the circular orbit takes far fewer steps on its own.
+    EXPECT_LT(independent.steps(), 1.5 * shared.steps());
+    EXPECT_GT(dts[0], 10 * dts[1]);
+  }
+
+  TEST(DormandPrince, StepSizeUnderflow) {
+
+    Cartesian::space position(Cartesian::space::Ux), velocity(Cartesian::space::Uy);
+    Cartesian::DormandPrince solver([](const Cartesian::space*, Cartesian::space* a,
+				       const unsigned long& n) {
+				      for (unsigned long k = 0; k < n; ++k)
+					a[k] = Cartesian::space(NAN, 0, 0);
+				    });
+    double dt(0.1);
+    EXPECT_THROW(solver.advance(&position, &velocity, 1, 1.0, &dt), Cartesian::StepSizeError);
+  }
+
+  // -----------------------------
+  // ----- SpatialHash tests -----
+  // -----------------------------
+
+  std::vector<unsigned long> brute_radius(const std::vector<Cartesian::space>& positions,
+					  const Cartesian::space& a_center, const double& a_radius) {
+    std::vector<unsigned long> results;
+    for (unsigned long k = 0; k < positions.size(); ++k) {
+      const Cartesian::space d(positions[k] - a_center);
+      if (d.x()*d.x() + d.y()*d.y() + d.z()*d.z() <= a_radius * a_radius)
+	results.push_back(k);
+    }
+    return results;
+  }
+
+  std::vector<unsigned long> brute_nearest(const std::vector<Cartesian::space>& positions,
+					   const Cartesian::space& a_center, const unsigned long& a_k) {
+    std::vector< std::pair<double, unsigned long> > near;
+    for (unsigned long k = 0; k < positions.size(); ++k) {
+      const Cartesian::space d(positions[k] - a_center);
+      near.push_back(std::make_pair(d.x()*d.x() + d.y()*d.y() + d.z()*d.z(), k));
+    }
+    std::sort(near.begin(), near.end());
+    std::vector<unsigned long> results;
+    for (unsigned long k = 0; k < std::min(a_k, (unsigned long) near.size()); ++k)
+      results.push_back(near[k].second);
+    return results;
+  }
+
+  // random query points about the bodies, some well outside them.
+  std::vector<Cartesian::space> query_points() {
+    std::mt19937 generator(20160317);
+    std::uniform_real_distribution<double> coordinate(-1.5, 1.5);
+    std::vector<Cartesian::space> centers(40);
+    for (unsigned long k = 0; k < centers.size(); ++k)
+      centers[k] = Cartesian::space(coordinate(generator), coordinate(generator), coordinate(generator));
+    centers.push_back(Cartesian::space(10, -10, 10));
+    centers.push_back(Cartesian::space());
+    return centers;
+  }
+
+  TEST(SpatialHash, Empty) {
+    EXPECT_THROW(Cartesian::SpatialHash(0), Cartesian::SpaceError);
+
+    Cartesian::SpatialHash grid(0.1);
+    grid.build(NULL, 0);
+    std::vector<unsigned long> results(1, 7);
+    grid.radius(Cartesian::space(), 1, results);
+    EXPECT_TRUE(results.empty());
+    grid.nearest(Cartesian::space(), 3, results);
+    EXPECT_TRUE(results.empty());
+  }
+
+  TEST(SpatialHash, RadiusMatchesBruteForce) {
+
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(3001, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    // 0.001 puts many cells in a bucket, 5 reaches every point.
+    const double cells[2] = {0.001, 0.1};
+    const double radii[5] = {0, 0.002, 0.05, 0.3, 5};
+    std::vector<unsigned long> results;
+
+    for (int c = 0; c < 2; ++c) {
+      Cartesian::SpatialHash grid(cells[c]);
+      grid.build(&positions[0], positions.size());
+      EXPECT_EQ(4096u, grid.buckets());
+      for (unsigned long k = 0; k < centers.size(); ++k)
+	for (int r = 0; r < 5; ++r) {
+	  grid.radius(centers[k], radii[r], results);
+	  std::sort(results.begin(), results.end());
+	  ASSERT_EQ(brute_radius(positions, centers[k], radii[r]), results) << cells[c] << " " << k << " " << radii[r];
+	}
+      // a body itself at radius 0.
+      grid.radius(positions[17], 0, results);
+      EXPECT_NE(results.end(), std::find(results.begin(), results.end(), 17ul));
+    }
+  }
+
+  TEST(SpatialHash, NearestMatchesBruteForce) {
+
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(3001, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    const unsigned long ks[4] = {1, 10, 100, 5000};
+    std::vector<unsigned long> results;
+
+    Cartesian::SpatialHash grid(0.05);
+    grid.build(&positions[0], positions.size());
+    for (unsigned long k = 0; k < centers.size(); ++k)
+      for (int j = 0; j < 4; ++j) {
+	grid.nearest(centers[k], ks[j], results);
+	ASSERT_EQ(brute_nearest(positions, centers[k], ks[j]), results) << k << " " << ks[j];
+      }
+  }
+
+  TEST(SpatialHash, Update) {
+
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(3001, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    Cartesian::SpatialHash grid(0.1);
+    grid.build(&positions[0], positions.size());
+    EXPECT_EQ(0u, grid.update(&positions[0], positions.size()));
+
+    // small steps move a few points to other cells, the last one jumps.
+    std::mt19937 generator(20160318);
+    std::uniform_real_distribution<double> step(-0.01, 0.01);
+    for (unsigned long k = 0; k < positions.size(); ++k)
+      positions[k] += Cartesian::space(step(generator), step(generator), step(generator));
+    positions.back() = Cartesian::space(3, 3, 3);
+
+    const unsigned long moved(grid.update(&positions[0], positions.size()));
+    // about one in ten of the spread out bodies, most of the clump at
+    // the origin, which straddles eight cells.
+    EXPECT_LT(0u, moved);
+    EXPECT_GT(positions.size() / 2, moved);
+
+    std::vector<unsigned long> results;
+    for (unsigned long k = 0; k < centers.size(); ++k) {
+      grid.radius(centers[k], 0.2, results);
+      std::sort(results.begin(), results.end());
+      ASSERT_EQ(brute_radius(positions, centers[k], 0.2), results) << k;
+      grid.nearest(centers[k], 10, results);
+      ASSERT_EQ(brute_nearest(positions, centers[k], 10), results) << k;
+    }
+    grid.nearest(Cartesian::space(3, 3, 3), 1, results);
+    EXPECT_EQ(std::vector<unsigned long>(1, positions.size() - 1), results);
+
+    // another size is a build.
+    EXPECT_EQ(100u, grid.update(&positions[0], 100));
+    EXPECT_EQ(100u, grid.size());
+  }
+
+  TEST(SpatialHash, ThreadsMatchSerial) {
+
+    const unsigned long n(10007);
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(n, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    const unsigned int threads[2] = {3, 0};
+    std::vector<unsigned long> results;
+    for (int t = 0; t < 2; ++t) {
+      Cartesian::SpatialHash grid(0.05, threads[t]);
+      grid.build(&positions[0], n);
+      for (unsigned long k = 0; k < centers.size(); ++k) {
+	grid.radius(centers[k], 0.1, results);
+	std::sort(results.begin(), results.end());
+	ASSERT_EQ(brute_radius(positions, centers[k], 0.1), results) << k << " " << threads[t];
+      }
+    }
+  }
+
+  // ------------------------
+  // ----- KdTree tests -----
+  // ------------------------
+
+  TEST(KdTree, Empty) {
+    Cartesian::KdTree tree;
+    tree.build(NULL, 0);
+    EXPECT_EQ(0u, tree.nodes());
+    EXPECT_EQ(0u, tree.nearest(Cartesian::space()));
+    std::vector<unsigned long> results(1, 7);
+    tree.nearest(Cartesian::space(), 3, results);
+    EXPECT_TRUE(results.empty());
+    tree.radius(Cartesian::space(), 1, results);
+    EXPECT_TRUE(results.empty());
+    tree.box(Cartesian::space(-1, -1, -1), Cartesian::space(1, 1, 1), results);
+    EXPECT_TRUE(results.empty());
+  }
+
+  TEST(KdTree, NearestMatchesBruteForce) {
+
+    // the clump and a run of coincident points make ties.
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(3001, positions, masses);
+    for (unsigned long k = 100; k < 140; ++k)
+      positions[k] = Cartesian::space(0.5, 0.5, 0.5);
+    std::vector<Cartesian::space> centers(query_points());
+    centers.push_back(Cartesian::space(0.5, 0.5, 0.5));
+
+    Cartesian::KdTree tree;
+    tree.build(&positions[0], positions.size());
+    EXPECT_EQ(255u, tree.nodes());
+
+    const unsigned long ks[4] = {1, 10, 100, 5000};
+    std::vector<unsigned long> results;
+    for (unsigned long k = 0; k < centers.size(); ++k) {
+      EXPECT_EQ(brute_nearest(positions, centers[k], 1)[0], tree.nearest(centers[k])) << k;
+      for (int j = 0; j < 4; ++j) {
+	tree.nearest(centers[k], ks[j], results);
+	ASSERT_EQ(brute_nearest(positions, centers[k], ks[j]), results) << k << " " << ks[j];
+      }
+    }
+  }
+
+  TEST(KdTree, Ranges) {
+
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(3001, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    Cartesian::KdTree tree;
+    tree.build(&positions[0], positions.size());
+
+    const double radii[4] = {0, 0.002, 0.3, 5};
+    std::vector<unsigned long> results;
+    for (unsigned long k = 0; k < centers.size(); ++k)
+      for (int r = 0; r < 4; ++r) {
+	tree.radius(centers[k], radii[r], results);
+	std::sort(results.begin(), results.end());
+	ASSERT_EQ(brute_radius(positions, centers[k], radii[r]), results) << k << " " << radii[r];
+      }
+
+    const Cartesian::space lo(-0.2, 0, -1), hi(0.3, 0.4, 1);
+    std::vector<unsigned long> expected;
+    for (unsigned long k = 0; k < positions.size(); ++k)
+      if (lo.x() <= positions[k].x() && positions[k].x() <= hi.x() &&
+	  lo.y() <= positions[k].y() && positions[k].y() <= hi.y() &&
+	  lo.z() <= positions[k].z() && positions[k].z() <= hi.z())
+	expected.push_back(k);
+    tree.box(lo, hi, results);
+    std::sort(results.begin(), results.end());
+    EXPECT_EQ(expected, results);
+    EXPECT_LT(100u, results.size());
+  }
+
+  TEST(KdTree, Recorder) {
+
+    // wrapped, so the contents are two runs.
+    Cartesian::SpaceRecorder recorder(500);
+    recorder.clear();
+    for (int k = 0; k < 700; ++k)
+      recorder.push(Cartesian::space(cos(0.01 * k), sin(0.01 * k), 0.001 * k));
+
+    Cartesian::KdTree tree;
+    tree.build(recorder);
+    EXPECT_EQ(500u, tree.size());
+
+    for (unsigned int k = 0; k < recorder.size(); k += 37)
+      EXPECT_EQ(k, tree.nearest(recorder.get(k) + Cartesian::space(1e-4, 0, 0)));
+
+    // the closest approach to a point off the helix.
+    const Cartesian::space target(cos(5.0) * 1.1, sin(5.0) * 1.1, 0.5);
+    unsigned long best(0);
+    for (unsigned int k = 1; k < recorder.size(); ++k)
+      if ((recorder.get(k) - target).magnitude2() < (recorder.get(best) - target).magnitude2())
+	best = k;
+    EXPECT_EQ(best, tree.nearest(target));
+  }
+
+  TEST(KdTree, ThreadsMatchSerial) {
+
+    const unsigned long n(100003);
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(n, positions, masses);
+    const std::vector<Cartesian::space> centers(query_points());
+
+    Cartesian::KdTree serial;
+    serial.build(&positions[0], n);
+
+    const unsigned int threads[2] = {3, 0};
+    std::vector<unsigned long> expected, results;
+    for (int t = 0; t < 2; ++t) {
+      Cartesian::KdTree tree(threads[t]);
+      tree.build(&positions[0], n);
+      EXPECT_EQ(serial.nodes(), tree.nodes());
+      for (unsigned long k = 0; k < centers.size(); ++k) {
+	serial.nearest(centers[k], 20, expected);
+	tree.nearest(centers[k], 20, results);
+	ASSERT_EQ(expected, results) << k << " " << threads[t];
+      }
+    }
+  }
+
+  // ------------------------------
+  // ----- aabb and BVH tests -----
+  // ------------------------------
+
+  TEST(Aabb, Basics) {
+
+    Cartesian::aabb box;
+    EXPECT_TRUE(box.empty());
+    EXPECT_EQ(0, box.area());
+
+    box.merge(Cartesian::space(1, 2, 3)).merge(Cartesian::space(-1, 0, 4));
+    EXPECT_FALSE(box.empty());
+    EXPECT_EQ(Cartesian::space(-1, 0, 3), box.lo());
+    EXPECT_EQ(Cartesian::space(1, 2, 4), box.hi());
+    EXPECT_EQ(Cartesian::space(0, 1, 3.5), box.center());
+    EXPECT_DOUBLE_EQ(2 * (2 * 2 + 2 * 1 + 1 * 2), box.area());
+    EXPECT_TRUE(box.contains(Cartesian::space(1, 0, 3.5)));
+    EXPECT_FALSE(box.contains(Cartesian::space(1, 0, 4.5)));
+
+    // touching counts, an empty box overlaps nothing.
+    EXPECT_TRUE(box.overlaps(Cartesian::aabb(Cartesian::space(1, 2, 4), Cartesian::space(5, 5, 5))));
+    EXPECT_FALSE(box.overlaps(Cartesian::aabb(Cartesian::space(1.1, 0, 0), Cartesian::space(5, 5, 5))));
+    EXPECT_FALSE(box.overlaps(Cartesian::aabb()));
+
+    const Cartesian::aabb unit(Cartesian::space(0, 0, 0), Cartesian::space(1, 1, 1));
+    double t(-1);
+    EXPECT_TRUE(unit.ray(Cartesian::space(-2, 0.5, 0.5), Cartesian::space(1, INFINITY, INFINITY), 10, t));
+    EXPECT_DOUBLE_EQ(2, t);
+    EXPECT_FALSE(unit.ray(Cartesian::space(-2, 0.5, 0.5), Cartesian::space(1, INFINITY, INFINITY), 1.5, t));
+    EXPECT_FALSE(unit.ray(Cartesian::space(-2, 0.5, 0.5), Cartesian::space(-1, INFINITY, INFINITY), 10, t));
+    EXPECT_TRUE(unit.ray(Cartesian::space(0.5, 0.5, 0.5), Cartesian::space(1, 1, 1), 10, t));
+    EXPECT_EQ(0, t);
+  }
+
+  // (query, box) for every overlapping pair, by query then box.
+  std::vector< std::pair<unsigned long, unsigned long> > brute_overlaps(const std::vector<Cartesian::aabb>& queries,
+									 const std::vector<Cartesian::aabb>& boxes) {
+    std::vector< std::pair<unsigned long, unsigned long> > pairs;
+    for (unsigned long q = 0; q < queries.size(); ++q)
+      for (unsigned long k = 0; k < boxes.size(); ++k)
+	if (queries[q].overlaps(boxes[k]))
+	  pairs.push_back(std::make_pair(q, k));
+    return pairs;
+  }
+
+  // the first box entered, lowest index on ties, or boxes.size().
+  unsigned long brute_ray(const std::vector<Cartesian::aabb>& boxes, const Cartesian::space& origin,
+			  const Cartesian::space& direction, const double& t_max, double& t) {
+    const Cartesian::space inverse(1 / direction.x(), 1 / direction.y(), 1 / direction.z());
+    unsigned long hit(boxes.size());
+    double entry;
+    for (unsigned long k = 0; k < boxes.size(); ++k)
+      if (boxes[k].ray(origin, inverse, t_max, entry) && (hit == boxes.size() || entry < t)) {
+	hit = k;
+	t = entry;
+      }
+    return hit;
+  }
+
+  // boxes about random_bodies(), sized up to a_size, so the clump at
+  // the origin overlaps heavily and the rest sparsely.
+  std::vector<Cartesian::aabb> random_boxes(const unsigned long& a_count, const double& a_size) {
+    std::vector<Cartesian::space> positions;
+    std::vector<double> masses;
+    random_bodies(a_count, positions, masses);
+    std::vector<Cartesian::aabb> boxes(a_count);
+    for (unsigned long k = 0; k < a_count; ++k) {
+      const Cartesian::space half(a_size * masses[k] * Cartesian::space(0.5, 0.3, 0.2));
+      boxes[k] = Cartesian::aabb(positions[k] - half, positions[k] + half);
+    }
+    return boxes;
+  }
+
+  TEST(BVH, Empty) {
+    Cartesian::BVH bvh;
+    bvh.build(NULL, 0);
+    EXPECT_EQ(0u, bvh.nodes());
+    EXPECT_TRUE(bvh.bounds().empty());
+    std::vector<unsigned long> results(1, 7);
+    bvh.overlaps(Cartesian::aabb(Cartesian::space(-1, -1, -1), Cartesian::space(1, 1, 1)), results);
+    EXPECT_TRUE(results.empty());
+    double t(-1);
+    EXPECT_EQ(0u, bvh.ray(Cartesian::space(), Cartesian::space(1, 0, 0), 10, t));
+    EXPECT_EQ(-1, t);
+  }
+
+  TEST(BVH, OverlapsMatchBruteForce) {
+
+    // a run of identical boxes makes a node with coincident centers.
+    std::vector<Cartesian::aabb> boxes(random_boxes(3001, 0.05));
+    for (unsigned long k = 100; k < 140; ++k)
+      boxes[k] = Cartesian::aabb(Cartesian::space(0.5, 0.5, 0.5), Cartesian::space(0.51, 0.5, 0.52));
+
+    Cartesian::BVH bvh;
+    bvh.build(&boxes[0], boxes.size());
+    EXPECT_EQ(boxes.size(), bvh.size());
+    EXPECT_EQ(1u, bvh.nodes() % 2);  // every interior node has two children
+
+    Cartesian::aabb all;
+    for (unsigned long k = 0; k < boxes.size(); ++k)
+      all.merge(boxes[k]);
+    EXPECT_EQ(all.lo(), bvh.bounds().lo());
+    EXPECT_EQ(all.hi(), bvh.bounds().hi());
+
+    std::vector<Cartesian::aabb> queries(random_boxes(200, 0.3));
+    queries.push_back(all);
+    queries.push_back(Cartesian::aabb(Cartesian::space(5, 5, 5), Cartesian::space(6, 6, 6)));
+
+    std::vector< std::pair<unsigned long, unsigned long> > pairs;
+    bvh.overlaps(&queries[0], queries.size(), pairs);
+    EXPECT_EQ(brute_overlaps(queries, boxes), pairs);
+
+    std::vector<unsigned long> results;
+    bvh.overlaps(all, results);
+    EXPECT_EQ(boxes.size(), results.size());
+  }
+
+  TEST(BVH, RaysMatchBruteForce) {
+
+    const std::vector<Cartesian::aabb> boxes(random_boxes(3001, 0.05));
+    Cartesian::BVH bvh;
+    bvh.build(&boxes[0], boxes.size());
+
+    // from outside the cloud toward it, from inside, and along the
+    // axes with zero direction components.
+    std::mt19937 generator(20161018);
+    std::uniform_real_distribution<double> coordinate(-1, 1);
+    std::vector<Cartesian::space> origins, directions;
+    for (int k = 0; k < 300; ++k) {
+      const Cartesian::space from(coordinate(generator), coordinate(generator), coordinate(generator));
+      const Cartesian::space to(coordinate(generator), coordinate(generator), coordinate(generator));
+      origins.push_back(k % 2 ? 0.3 * from : 3 * from);
+      directions.push_back(to - origins.back());
+    }
+    origins.push_back(Cartesian::space(-2, 0.01, 0.02));
+    directions.push_back(Cartesian::space(1, 0, 0));
+    origins.push_back(Cartesian::space(0.2, 0.1, 3));
+    directions.push_back(Cartesian::space(0, 0, -1));
+
+    const double t_maxes[3] = {0.5, 2, INFINITY};
+    std::vector<unsigned long> hits(origins.size());
+    std::vector<double> ts(origins.size());
+    for (int m = 0; m < 3; ++m) {
+      bvh.rays(&origins[0], &directions[0], t_maxes[m], origins.size(), &hits[0], &ts[0]);
+      unsigned long found(0);
+      for (unsigned long k = 0; k < origins.size(); ++k) {
+	double t(t_maxes[m]);
+	const unsigned long hit(brute_ray(boxes, origins[k], directions[k], t_maxes[m], t));
+	ASSERT_EQ(hit, hits[k]) << k << " " << t_maxes[m];
+	EXPECT_EQ(t, ts[k]);
+	found += hit < boxes.size();
+      }
+      EXPECT_LT(origins.size() / (m == 0 ? 10 : 4), found) << t_maxes[m];
+    }
+  }
+
+  TEST(BVH, RefitMatchesBuild) {
+
+    std::vector<Cartesian::aabb> boxes(random_boxes(3001, 0.05));
+    Cartesian::BVH bvh;
+    bvh.build(&boxes[0], boxes.size());
+    const unsigned long nodes(bvh.nodes());
+
+    // every box moved and grown, the tree kept.
+    for (unsigned long k = 0; k < boxes.size(); ++k) {
+      const Cartesian::space shift(0.1 * sin(0.1 * k), 0.1 * cos(0.3 * k), 0.05);
+      boxes[k] = Cartesian::aabb(boxes[k].lo() + shift, boxes[k].hi() + shift + Cartesian::space(0.01, 0, 0.02));
+    }
+    bvh.refit(&boxes[0], boxes.size());
+    EXPECT_EQ(nodes, bvh.nodes());
+
+    const std::vector<Cartesian::aabb> queries(random_boxes(200, 0.3));
+    std::vector< std::pair<unsigned long, unsigned long> > pairs;
+    bvh.overlaps(&queries[0], queries.size(), pairs);
+    EXPECT_EQ(brute_overlaps(queries, boxes), pairs);
+
+    double t;
+    EXPECT_EQ(brute_ray(boxes, Cartesian::space(-3, 0, 0), Cartesian::space(1, 0.01, 0.02), INFINITY, t),
+	      bvh.ray(Cartesian::space(-3, 0, 0), Cartesian::space(1, 0.01, 0.02), INFINITY, t));
+
+    // a different size rebuilds.
+    boxes.resize(1000);
+    bvh.refit(&boxes[0], boxes.size());
+    EXPECT_EQ(1000u, bvh.size());
+    bvh.overlaps(&queries[0], queries.size(), pairs);
+    EXPECT_EQ(brute_overlaps(queries, boxes), pairs);
+  }
+
+  TEST(BVH, ThreadsMatchSerial) {
+
+    const std::vector<Cartesian::aabb> boxes(random_boxes(20003, 0.02));
+    const std::vector<Cartesian::aabb> queries(random_boxes(5000, 0.1));
+
+    Cartesian::BVH serial;
+    serial.build(&boxes[0], boxes.size());
+    std::vector< std::pair<unsigned long, unsigned long> > expected, pairs;
+    serial.overlaps(&queries[0], queries.size(), expected);
+
+    const unsigned int threads[2] = {3, 0};
+    for (int t = 0; t < 2; ++t) {
+      Cartesian::BVH bvh(threads[t]);
+      bvh.build(&boxes[0], boxes.size());
+      EXPECT_EQ(serial.nodes(), bvh.nodes());
+      bvh.overlaps(&queries[0], queries.size(), pairs);
+      EXPECT_EQ(expected, pairs) << threads[t];
+    }
+  }
+
+  // -----------------------------------
+  // ----- ConjunctionScreen tests -----
+  // -----------------------------------
+
+  // a_count circular orbits of radius near 1 in random planes, a_samples
+  // each, some of them crossing.
+  std::vector<Cartesian::SpaceRecorder> random_tracks(const unsigned long& a_count,
+						      const unsigned int& a_samples,
+						      const double& a_dt) {
+    std::mt19937 generator(20161018);
+    std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+    std::uniform_real_distribution<double> radius(0.95, 1.05);
+    std::vector<Cartesian::SpaceRecorder> tracks(a_count, Cartesian::SpaceRecorder(a_samples));
+    for (unsigned long i = 0; i < a_count; ++i) {
+      const double r(radius(generator)), phase(angle(generator));
+      const double node(angle(generator)), inclination(angle(generator) / 4);
+      const double n(1 / (r * sqrt(r)));
+      tracks[i].clear();
+      for (unsigned int k = 0; k < a_samples; ++k) {
+	const double u(phase + n * k * a_dt);
+	const double x(r * cos(u)), y(r * sin(u) * cos(inclination)), z(r * sin(u) * sin(inclination));
+	tracks[i].push(Cartesian::space(x * cos(node) - y * sin(node), x * sin(node) + y * cos(node), z));
+      }
+    }
+    return tracks;
+  }
+
+  // every pair and every interval.
+  std::vector<Cartesian::ConjunctionScreen::Conjunction>
+  brute_conjunctions(const std::vector<Cartesian::SpaceRecorder>& tracks,
+		     const double& threshold, const double& dt) {
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> results;
+    for (unsigned long i = 0; i < tracks.size(); ++i)
+      for (unsigned long j = i + 1; j < tracks.size(); ++j) {
+	double best(INFINITY), best_time(0);
+	for (unsigned int k = 0; k + 1 < tracks[i].size(); ++k) {
+	  const Cartesian::space r0(tracks[i].get(k) - tracks[j].get(k));
+	  const Cartesian::space v(tracks[i].get(k + 1) - tracks[j].get(k + 1) - r0);
+	  const double s(v.magnitude2() > 0 ? std::min(std::max(-(r0 * v) / v.magnitude2(), 0.0), 1.0) : 0);
+	  const double d2((r0 + s * v).magnitude2());
+	  if (d2 < best) {
+	    best = d2;
+	    best_time = (k + s) * dt;
+	  }
+	}
+	if (best <= threshold * threshold) {
+	  Cartesian::ConjunctionScreen::Conjunction found = {i, j, best_time, sqrt(best)};
+	  results.push_back(found);
+	}
+      }
+    return results;
+  }
+
+  void expect_conjunctions(const std::vector<Cartesian::ConjunctionScreen::Conjunction>& expected,
+			   const std::vector<Cartesian::ConjunctionScreen::Conjunction>& results) {
+    ASSERT_EQ(expected.size(), results.size());
+    for (unsigned long k = 0; k < expected.size(); ++k) {
+      EXPECT_EQ(expected[k].m_first, results[k].m_first) << k;
+      EXPECT_EQ(expected[k].m_second, results[k].m_second) << k;
+      EXPECT_NEAR(expected[k].m_time, results[k].m_time, 1e-9) << k;
+      EXPECT_NEAR(expected[k].m_distance, results[k].m_distance, 1e-12) << k;
+    }
+  }
+
+  TEST(ConjunctionScreen, Errors) {
+    EXPECT_THROW(Cartesian::ConjunctionScreen(-1), Cartesian::SpaceError);
+    EXPECT_THROW(Cartesian::ConjunctionScreen(1, 0), Cartesian::SpaceError);
+    EXPECT_THROW(Cartesian::ConjunctionScreen(1, 1, 0), Cartesian::SpaceError);
+  }
+
+  TEST(ConjunctionScreen, Crossing) {
+
+    // a passes b between samples 10 and 11, 1 away, and the third
+    // recorder is never near either.
+    std::vector<Cartesian::SpaceRecorder> tracks(3, Cartesian::SpaceRecorder(30));
+    for (int k = 0; k < 30; ++k) {
+      tracks[0].push(Cartesian::space(k - 10.25, 0, 0));
+      tracks[1].push(Cartesian::space(0, 0, 1));
+      tracks[2].push(Cartesian::space(0, 100, 0));
+    }
+
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> results;
+    Cartesian::ConjunctionScreen screen(1.5, 0.1, 4);
+    EXPECT_LT(0u, screen.screen(&tracks[0], tracks.size(), results));
+    ASSERT_EQ(1u, results.size());
+    EXPECT_EQ(0u, results[0].m_first);
+    EXPECT_EQ(1u, results[0].m_second);
+    EXPECT_DOUBLE_EQ(1.025, results[0].m_time);
+    EXPECT_DOUBLE_EQ(1, results[0].m_distance);
+
+    EXPECT_EQ(0u, Cartesian::ConjunctionScreen(0.5, 0.1, 4).screen(&tracks[0], tracks.size(), results));
+    EXPECT_TRUE(results.empty());
+    EXPECT_EQ(0u, screen.screen(&tracks[0], 1, results));
+    EXPECT_TRUE(results.empty());
+  }
+
+  TEST(ConjunctionScreen, MatchesBruteForce) {
+
+    const std::vector<Cartesian::SpaceRecorder> tracks(random_tracks(120, 301, 0.05));
+    const double thresholds[3] = {0, 0.02, 0.2};
+    const unsigned int windows[3] = {1, 16, 1000};
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> results;
+    for (int t = 0; t < 3; ++t) {
+      const std::vector<Cartesian::ConjunctionScreen::Conjunction> expected(brute_conjunctions(tracks, thresholds[t], 0.05));
+      if (t > 0) {
+	EXPECT_LT(5u, expected.size()) << thresholds[t];
+      }
+      for (int w = 0; w < 3; ++w) {
+	Cartesian::ConjunctionScreen screen(thresholds[t], 0.05, windows[w]);
+	screen.screen(&tracks[0], tracks.size(), results);
+	SCOPED_TRACE(windows[w]);
+	expect_conjunctions(expected, results);
+      }
+    }
+  }
+
+  TEST(ConjunctionScreen, AlignsNewest) {
+
+    // the longer recorder's extra oldest samples, and the wrapped
+    // ring's, are not screened.
+    std::vector<Cartesian::SpaceRecorder> tracks(random_tracks(40, 200, 0.05));
+    std::vector<Cartesian::SpaceRecorder> shorter(tracks);
+    for (unsigned long i = 0; i < shorter.size(); ++i)
+      shorter[i].sizeLimit(150);
+    tracks[7].clear();
+    for (int k = 0; k < 500; ++k)
+      tracks[7].push(Cartesian::space(5, 5, 5));
+    for (unsigned int k = 0; k < shorter[7].size(); ++k)
+      tracks[7].push(shorter[7].get(k));
+    tracks[3] = shorter[3];
+
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> expected, results;
+    Cartesian::ConjunctionScreen screen(0.1, 0.05);
+    screen.screen(&shorter[0], shorter.size(), expected);
+    screen.screen(&tracks[0], tracks.size(), results);
+    EXPECT_LT(0u, expected.size());
+    expect_conjunctions(expected, results);
+  }
+
+  TEST(ConjunctionScreen, ThreadsMatchSerial) {
+
+    const std::vector<Cartesian::SpaceRecorder> tracks(random_tracks(300, 401, 0.05));
+    std::vector<Cartesian::ConjunctionScreen::Conjunction> expected, results;
+    const unsigned long candidates(Cartesian::ConjunctionScreen(0.05, 0.05, 8).screen(&tracks[0], tracks.size(), expected));
+
+    const unsigned int threads[2] = {3, 0};
+    for (int t = 0; t < 2; ++t) {
+      Cartesian::ConjunctionScreen screen(0.05, 0.05, 8, threads[t]);
+      EXPECT_EQ(candidates, screen.screen(&tracks[0], tracks.size(), results));
+      SCOPED_TRACE(threads[t]);
+      expect_conjunctions(expected, results);
+    }
+  }
+
   // ----------------------------
   // ----- X Rotation tests -----
   // ----------------------------
@@ -480,6 +2051,288 @@ namespace {
 
   }
 
+  // ---------------------------
+  // ----- Batch Rotation ------
+  // ---------------------------
+
+  TEST_F(RandomSpace, BatchRotateMatchesRotate) {
+
+    Cartesian::rotator a_rotator(p2);
+    Cartesian::rotator b_rotator(p2);
+
+    Cartesian::space headings[3] = {p1, p2, Cartesian::space::Ux};
+    Cartesian::space results[3];
+
+    a_rotator.rotate(headings, results, 3, c);
+
+    for (unsigned int k = 0; k < 3; ++k)
+      EXPECT_EQ(b_rotator.rotate(headings[k], c), results[k]);
+
+  }
+
+  TEST(BatchRotation, InPlace) {
+
+    double angle(Cartesian::rotator::deg2rad(90));
+    Cartesian::rotator about_z(Cartesian::space::Uz);
+
+    Cartesian::space headings[2] = {Cartesian::space::Ux, Cartesian::space::Uy};
+
+    about_z.rotate(headings, headings, 2, angle);
+
+    EXPECT_NEAR(Cartesian::space::Uy.x(), headings[0].x(), Cartesian::space::epsilon);
+    EXPECT_DOUBLE_EQ(Cartesian::space::Uy.y(), headings[0].y());
+    EXPECT_DOUBLE_EQ(-1, headings[1].x());
+    EXPECT_NEAR(0, headings[1].y(), Cartesian::space::epsilon);
+
+  }
+
+  // --------------------------
+  // ----- Space Recorder -----
+  // --------------------------
+
+  TEST(SpaceRecorder, StartsFullOfZeros) {
+    Cartesian::SpaceRecorder a_recorder(4);
+    EXPECT_EQ(4u, a_recorder.sizeLimit());
+    EXPECT_EQ(4u, a_recorder.size());
+    for (unsigned int k = 0; k < a_recorder.size(); ++k)
+      EXPECT_EQ(Cartesian::space::Uo, a_recorder.get(k));
+  }
+
+  TEST(SpaceRecorder, PushEvictsOldest) {
+    Cartesian::SpaceRecorder a_recorder(3);
+    a_recorder.clear();
+    EXPECT_EQ(0u, a_recorder.size());
+
+    for (int k = 1; k <= 5; ++k)
+      a_recorder.push(Cartesian::space(k));
+
+    EXPECT_EQ(3u, a_recorder.size());
+    EXPECT_EQ(Cartesian::space(3), a_recorder.get(0));
+    EXPECT_EQ(Cartesian::space(4), a_recorder.get(1));
+    EXPECT_EQ(Cartesian::space(5), a_recorder.get(2));
+  }
+
+  TEST(SpaceRecorder, Segments) {
+    Cartesian::SpaceRecorder a_recorder(4);
+    a_recorder.clear();
+
+    for (int k = 1; k <= 6; ++k)
+      a_recorder.push(Cartesian::space(k));
+
+    const Cartesian::space* first(NULL);
+    const Cartesian::space* second(NULL);
+    unsigned long first_size(0);
+    unsigned long second_size(0);
+
+    a_recorder.segments(first, first_size, second, second_size);
+
+    ASSERT_EQ(2u, first_size);
+    ASSERT_EQ(2u, second_size);
+    EXPECT_EQ(Cartesian::space(3), first[0]);
+    EXPECT_EQ(Cartesian::space(4), first[1]);
+    EXPECT_EQ(Cartesian::space(5), second[0]);
+    EXPECT_EQ(Cartesian::space(6), second[1]);
+  }
+
+  TEST(SpaceRecorder, BulkPushMatchesPush) {
+    Cartesian::SpaceRecorder a_recorder(5);
+    Cartesian::SpaceRecorder b_recorder(5);
+
+    std::vector<Cartesian::space> some_data;
+    for (int k = 1; k <= 13; ++k)
+      some_data.push_back(Cartesian::space(k, -k));
+
+    // odd sized chunks so the ring wraps mid copy.
+    a_recorder.push(&some_data[0], 3);
+    a_recorder.push(&some_data[3], 1);
+    a_recorder.push(&some_data[4], 9);
+
+    for (unsigned int k = 0; k < some_data.size(); ++k)
+      b_recorder.push(some_data[k]);
+
+    ASSERT_EQ(b_recorder.size(), a_recorder.size());
+    for (unsigned int k = 0; k < a_recorder.size(); ++k)
+      EXPECT_EQ(b_recorder.get(k), a_recorder.get(k));
+  }
+
+  TEST(SpaceRecorder, SizeLimitKeepsNewest) {
+    Cartesian::SpaceRecorder a_recorder(4);
+
+    for (int k = 1; k <= 6; ++k)
+      a_recorder.push(Cartesian::space(k));
+
+    a_recorder.sizeLimit(2);
+    EXPECT_EQ(2u, a_recorder.size());
+    EXPECT_EQ(Cartesian::space(5), a_recorder.get(0));
+    EXPECT_EQ(Cartesian::space(6), a_recorder.get(1));
+
+    a_recorder.sizeLimit(3);
+    a_recorder.push(Cartesian::space(7));
+    EXPECT_EQ(3u, a_recorder.size());
+    EXPECT_EQ(Cartesian::space(5), a_recorder.get(0));
+    EXPECT_EQ(Cartesian::space(7), a_recorder.get(2));
+  }
+
+  TEST(SpaceRecorder, CopyConstructor) {
+    Cartesian::SpaceRecorder a_recorder(3);
+    for (int k = 1; k <= 4; ++k)
+      a_recorder.push(Cartesian::space(k));
+
+    Cartesian::SpaceRecorder b_recorder(a_recorder);
+    ASSERT_EQ(a_recorder.size(), b_recorder.size());
+    for (unsigned int k = 0; k < a_recorder.size(); ++k)
+      EXPECT_EQ(a_recorder.get(k), b_recorder.get(k));
+  }
+
+  // --------------------
+  // ----- Counters -----
+  // --------------------
+
+  // counts are expected only in a make INSTRUMENT=1 build.
+  unsigned long long expected(const unsigned long long& n) {
+    return Cartesian::counters::enabled ? n : 0;
+  }
+
+  TEST(Counters, CountEvents) {
+
+    Cartesian::counters::reset();
+
+    Cartesian::rotator a_rotator(Cartesian::space::Uz);
+    a_rotator.rotate(Cartesian::space::Ux, 0.5);
+    a_rotator.rotate(Cartesian::space::Ux, 0.5);
+    a_rotator.rotate(Cartesian::space::Ux, 0.25);
+
+    Cartesian::SpaceRecorder a_recorder(4); // starts full
+    for (int k = 1; k <= 6; ++k)
+      a_recorder.push(Cartesian::space(k));
+    a_recorder.sizeLimit(3);
+
+    Cartesian::space a(Cartesian::space::Ux);
+    EXPECT_THROW(a /= 0, Cartesian::DivideZeroError);
+
+    Cartesian::counters::Snapshot a_snapshot(Cartesian::counters::snapshot());
+
+    EXPECT_EQ(expected(1), a_snapshot.counts[Cartesian::counters::rotator_cache_hit]);
+    EXPECT_EQ(expected(2), a_snapshot.counts[Cartesian::counters::rotator_cache_miss]);
+    EXPECT_EQ(expected(7), a_snapshot.counts[Cartesian::counters::recorder_eviction]);
+    EXPECT_EQ(expected(1), a_snapshot.counts[Cartesian::counters::divide_zero_error]);
+
+    Cartesian::counters::reset();
+    a_snapshot = Cartesian::counters::snapshot();
+    for (int k = 0; k < Cartesian::counters::event_count; ++k)
+      EXPECT_EQ(0u, a_snapshot.counts[k]);
+  }
+
+  TEST(Counters, KeepsExitedThreads) {
+
+    Cartesian::counters::reset();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.push_back(std::thread([] {
+	    Cartesian::SpaceRecorder a_recorder(10);
+	    a_recorder.clear();
+	    std::vector<Cartesian::space> some_data(25);
+	    a_recorder.push(&some_data[0], some_data.size());
+	  }));
+    for (int t = 0; t < 4; ++t)
+      threads[t].join();
+
+    EXPECT_EQ(expected(4 * 15),
+	      Cartesian::counters::snapshot().counts[Cartesian::counters::recorder_eviction]);
+  }
+
+  TEST(Counters, Formats) {
+
+    Cartesian::counters::Snapshot a_snapshot = {{1, 2, 3, 4}};
+
+    std::stringstream prometheus;
+    Cartesian::counters::write_prometheus(prometheus, a_snapshot);
+    EXPECT_NE(std::string::npos, prometheus.str().find("# TYPE space_recorder_evictions_total counter\n"));
+    EXPECT_NE(std::string::npos, prometheus.str().find("\nspace_divide_zero_errors_total 4\n"));
+
+    std::stringstream json;
+    Cartesian::counters::write_json(json, a_snapshot);
+    EXPECT_NE(std::string::npos, json.str().find("\"rotator_cache_hits\": 1, \"rotator_cache_misses\": 2"));
+  }
+
+  // -----------------
+  // ----- Trace -----
+  // -----------------
+
+  // the trace events in a write_chrome() dump.
+  int count_spans(const std::string& a_dump, const std::string& a_name) {
+    int n(0);
+    const std::string key("{\"name\": \"" + a_name + "\"");
+    for (std::string::size_type k = a_dump.find(key); k != std::string::npos; k = a_dump.find(key, k + 1))
+      ++n;
+    return n;
+  }
+
+  TEST(Trace, OffByDefault) {
+
+    Cartesian::trace::clear();
+    EXPECT_FALSE(Cartesian::trace::enabled());
+
+    Cartesian::SpaceRecorder a_recorder(8);
+    a_recorder.push(&Cartesian::space::Ux, 1);
+
+    std::stringstream dump;
+    Cartesian::trace::write_chrome(dump);
+    EXPECT_EQ(0, count_spans(dump.str(), "SpaceRecorder::push bulk"));
+  }
+
+  TEST(Trace, RecordsSpans) {
+
+    Cartesian::trace::clear();
+    Cartesian::trace::enable();
+
+    std::vector<Cartesian::space> some_data(16, Cartesian::space::Ux);
+    Cartesian::rotator a_rotator(Cartesian::space::Uz);
+    a_rotator.rotate(&some_data[0], &some_data[0], some_data.size(), 0.5);
+
+    std::thread a_thread([] {
+	SPACE_TRACE("worker");
+	Cartesian::SpaceRecorder a_recorder(8);
+	a_recorder.push(&Cartesian::space::Uy, 1);
+      });
+    a_thread.join();
+
+    Cartesian::trace::enable(false);
+
+    std::stringstream dump;
+    Cartesian::trace::write_chrome(dump);
+
+    EXPECT_EQ(0u, dump.str().find("{\"traceEvents\": ["));
+    EXPECT_EQ(1, count_spans(dump.str(), "rotator::rotate batch"));
+    EXPECT_EQ(1, count_spans(dump.str(), "worker"));
+    EXPECT_EQ(1, count_spans(dump.str(), "SpaceRecorder::push bulk"));
+    EXPECT_NE(std::string::npos, dump.str().find("\"ph\": \"X\""));
+
+    // drained.
+    std::stringstream again;
+    Cartesian::trace::write_chrome(again);
+    EXPECT_EQ(0, count_spans(again.str(), "worker"));
+  }
+
+  TEST(Trace, DropsWhenFull) {
+
+    Cartesian::trace::clear();
+    Cartesian::trace::enable();
+
+    const unsigned long long before(Cartesian::trace::dropped());
+    for (unsigned long k = 0; k < Cartesian::trace::buffer_size + 10; ++k)
+      SPACE_TRACE("span");
+
+    Cartesian::trace::enable(false);
+
+    EXPECT_EQ(10u, Cartesian::trace::dropped() - before);
+
+    std::stringstream dump;
+    Cartesian::trace::write_chrome(dump);
+    EXPECT_EQ((int) Cartesian::trace::buffer_size, count_spans(dump.str(), "span"));
+  }
+
 } // end anonymous namespace
 
 
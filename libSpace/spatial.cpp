@@ -0,0 +1,885 @@
+// ==================================================================
+// Filename:    spatial.cpp
+// Description: Implements the distance matrices and the SpatialHash
+//              and KdTree classes.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================
+
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <spatial.h>
+#include <parallel.h>
+
+// ------------------------------
+// ----- pairwise distances -----
+// ------------------------------
+
+// Row blocks of a run over tiles of b, a tile at a time for the whole
+// block, so the tile is read from memory once per block rather than
+// once per row. A row of a tile is one loop over the structure of
+// arrays, with the sqrt in the loop for distance_euclidean, which
+// vectorizes without errno checks (see VECFLAGS).
+
+namespace {
+
+  const unsigned long distance_rows(32);    // per block, the unit of work for a thread
+  const unsigned long distance_tile(1024);  // columns, 24 kB of b
+
+  struct Columns {
+    Columns(const Cartesian::space* b, const unsigned long& b_size) :
+      m_x(b_size), m_y(b_size), m_z(b_size) {
+      for (unsigned long j = 0; j < b_size; ++j) {
+	m_x[j] = b[j].x();
+	m_y[j] = b[j].y();
+	m_z[j] = b[j].z();
+      }
+    }
+    std::vector<double> m_x, m_y, m_z;
+  };
+
+  // from a_point to columns [a_first, a_last) of b, to a_results.
+  template <Cartesian::DistanceMode MODE>
+  inline void distance_row(const Cartesian::space& a_point, const Columns& b,
+			   const unsigned long& a_first, const unsigned long& a_last,
+			   double* a_results) {
+    const double xi(a_point.x()), yi(a_point.y()), zi(a_point.z());
+    const double* x(&b.m_x[0]);
+    const double* y(&b.m_y[0]);
+    const double* z(&b.m_z[0]);
+    for (unsigned long j = a_first; j < a_last; ++j) {
+      const double dx(x[j] - xi), dy(y[j] - yi), dz(z[j] - zi);
+      const double d2(dx*dx + dy*dy + dz*dz);
+      a_results[j - a_first] = MODE == Cartesian::distance_squared ? d2 : sqrt(d2);
+    }
+  }
+
+  // calls a_row(i, first, last) for tiles of the columns from
+  // a_columns(i) to b_size, the rows of each block in turn for each
+  // tile, blocks in parallel.
+  template <typename Start, typename Row>
+  void distance_tiles(const unsigned long& a_size, const unsigned long& b_size,
+		      const unsigned int& a_threads, const Start& a_columns, const Row& a_row) {
+    Cartesian::parallel_blocks(Cartesian::worker_count(a_threads), a_size, distance_rows,
+			       [&](const unsigned long& a_first, const unsigned long& a_last) {
+				 for (unsigned long tile = a_columns(a_first); tile < b_size; tile += distance_tile)
+				   for (unsigned long i = a_first; i < a_last; ++i) {
+				     const unsigned long first(std::max(tile, a_columns(i)));
+				     const unsigned long last(std::min(tile + distance_tile, b_size));
+				     if (first < last)
+				       a_row(i, first, last);
+				   }
+			       });
+  }
+
+  template <Cartesian::DistanceMode MODE, typename Start, typename Offset>
+  void dense_distances(const Cartesian::space* a, const unsigned long& a_size, const Columns& b,
+		       const unsigned long& b_size, const unsigned int& a_threads,
+		       const Start& a_columns, const Offset& an_offset, double* a_results) {
+    distance_tiles(a_size, b_size, a_threads, a_columns,
+		   [&](const unsigned long& i, const unsigned long& a_first, const unsigned long& a_last) {
+		     distance_row<MODE>(a[i], b, a_first, a_last, a_results + (an_offset(i) + a_first));
+		   });
+  }
+
+  // each row to its own lists, joined in order.
+  template <typename Start>
+  void sparse_distances(const Cartesian::space* a, const unsigned long& a_size, const Columns& b,
+			const unsigned long& b_size, const double& a_threshold,
+			const Cartesian::DistanceMode& a_mode, const unsigned int& a_threads,
+			const Start& a_columns, Cartesian::SparseDistances& a_results) {
+
+    std::vector< std::vector<unsigned long> > columns(a_size);
+    std::vector< std::vector<double> > values(a_size);
+    const double threshold2(a_threshold < 0 ? -1 : a_threshold * a_threshold);
+
+    distance_tiles(a_size, b_size, a_threads, a_columns,
+		   [&](const unsigned long& i, const unsigned long& a_first, const unsigned long& a_last) {
+		     double d2[distance_tile];
+		     unsigned int hits[distance_tile];
+		     distance_row<Cartesian::distance_squared>(a[i], b, a_first, a_last, d2);
+		     // every column is written and only the hits kept, without a
+		     // branch to mispredict.
+		     unsigned long found(0);
+		     for (unsigned long j = 0; j < a_last - a_first; ++j) {
+		       hits[found] = j;
+		       found += d2[j] <= threshold2;
+		     }
+		     for (unsigned long k = 0; k < found; ++k) {
+		       columns[i].push_back(a_first + hits[k]);
+		       values[i].push_back(a_mode == Cartesian::distance_squared ? d2[hits[k]] : sqrt(d2[hits[k]]));
+		     }
+		   });
+
+    a_results.m_row_starts.assign(a_size + 1, 0);
+    for (unsigned long i = 0; i < a_size; ++i)
+      a_results.m_row_starts[i + 1] = a_results.m_row_starts[i] + columns[i].size();
+
+    a_results.m_columns.resize(a_results.m_row_starts[a_size]);
+    a_results.m_values.resize(a_results.m_row_starts[a_size]);
+    Cartesian::parallel_blocks(Cartesian::worker_count(a_threads), a_size, distance_rows,
+			       [&](const unsigned long& a_first, const unsigned long& a_last) {
+				 for (unsigned long i = a_first; i < a_last; ++i) {
+				   std::copy(columns[i].begin(), columns[i].end(),
+					     a_results.m_columns.begin() + a_results.m_row_starts[i]);
+				   std::copy(values[i].begin(), values[i].end(),
+					     a_results.m_values.begin() + a_results.m_row_starts[i]);
+				 }
+			       });
+  }
+
+}
+
+void Cartesian::distance_matrix(const Cartesian::space* a,
+				const unsigned long& a_size,
+				const Cartesian::space* b,
+				const unsigned long& b_size,
+				double* a_results,
+				const Cartesian::DistanceMode& a_mode,
+				const unsigned int& a_threads) {
+
+  SPACE_TRACE("distance_matrix");
+
+  const Columns columns(b, b_size);
+  auto start = [](const unsigned long&) {return 0ul;};
+  auto offset = [&](const unsigned long& i) {return i * b_size;};
+
+  if (a_mode == distance_squared)
+    dense_distances<distance_squared>(a, a_size, columns, b_size, a_threads, start, offset, a_results);
+  else
+    dense_distances<distance_euclidean>(a, a_size, columns, b_size, a_threads, start, offset, a_results);
+}
+
+void Cartesian::distance_matrix(const Cartesian::space* a,
+				const unsigned long& a_size,
+				double* a_results,
+				const Cartesian::DistanceMode& a_mode,
+				const unsigned int& a_threads) {
+
+  SPACE_TRACE("distance_matrix upper");
+
+  // row i holds columns i + 1 on, from upper_index(i, i + 1). The
+  // offset of column 0 can wrap, its sum with the column does not.
+  const Columns columns(a, a_size);
+  auto start = [](const unsigned long& i) {return i + 1;};
+  auto offset = [&](const unsigned long& i) {return upper_index(i, i + 1, a_size) - (i + 1);};
+
+  if (a_mode == distance_squared)
+    dense_distances<distance_squared>(a, a_size, columns, a_size, a_threads, start, offset, a_results);
+  else
+    dense_distances<distance_euclidean>(a, a_size, columns, a_size, a_threads, start, offset, a_results);
+}
+
+void Cartesian::distances_within(const Cartesian::space* a,
+				 const unsigned long& a_size,
+				 const Cartesian::space* b,
+				 const unsigned long& b_size,
+				 const double& a_threshold,
+				 Cartesian::SparseDistances& a_results,
+				 const Cartesian::DistanceMode& a_mode,
+				 const unsigned int& a_threads) {
+
+  SPACE_TRACE("distances_within");
+
+  const Columns columns(b, b_size);
+  sparse_distances(a, a_size, columns, b_size, a_threshold, a_mode, a_threads,
+		   [](const unsigned long&) {return 0ul;}, a_results);
+}
+
+void Cartesian::distances_within(const Cartesian::space* a,
+				 const unsigned long& a_size,
+				 const double& a_threshold,
+				 Cartesian::SparseDistances& a_results,
+				 const Cartesian::DistanceMode& a_mode,
+				 const unsigned int& a_threads) {
+
+  SPACE_TRACE("distances_within upper");
+
+  const Columns columns(a, a_size);
+  sparse_distances(a, a_size, columns, a_size, a_threshold, a_mode, a_threads,
+		   [](const unsigned long& i) {return i + 1;}, a_results);
+}
+
+
+// -----------------------------
+// ----- class SpatialHash -----
+// -----------------------------
+
+namespace {
+
+  // least and greatest cell on each axis, empty when lo > hi.
+  struct CellBox {
+
+    CellBox() {
+      for (unsigned int a = 0; a < 3; ++a) {
+	m_lo[a] = std::numeric_limits<long long>::max();
+	m_hi[a] = std::numeric_limits<long long>::min();
+      }
+    }
+
+    void include(const long long& x, const long long& y, const long long& z) {
+      const long long cell[3] = {x, y, z};
+      for (unsigned int a = 0; a < 3; ++a) {
+	m_lo[a] = std::min(m_lo[a], cell[a]);
+	m_hi[a] = std::max(m_hi[a], cell[a]);
+      }
+    }
+
+    void include(const CellBox& a_box) {
+      for (unsigned int a = 0; a < 3; ++a) {
+	m_lo[a] = std::min(m_lo[a], a_box.m_lo[a]);
+	m_hi[a] = std::max(m_hi[a], a_box.m_hi[a]);
+      }
+    }
+
+    long long m_lo[3];
+    long long m_hi[3];
+  };
+
+}
+
+Cartesian::SpatialHash::SpatialHash(const double& a_cell,
+				    const unsigned int& a_threads) :
+  m_cell(a_cell),
+  m_inverse(1 / a_cell),
+  m_threads(a_threads),
+  m_shift(63)
+{
+  if (!(a_cell > 0))
+    throw Cartesian::SpaceError("SpatialHash cell must be positive");
+  for (unsigned int a = 0; a < 3; ++a) {
+    m_lo[a] = 0;
+    m_hi[a] = -1;
+  }
+}
+
+// the cell coordinates mixed so the high bits, which pick the bucket,
+// depend on all of them.
+unsigned long Cartesian::SpatialHash::bucket(const long long& x,
+					     const long long& y,
+					     const long long& z) const {
+  unsigned long long h((unsigned long long) x * 0x9e3779b97f4a7c15ULL +
+		       (unsigned long long) y * 0xc2b2ae3d27d4eb4fULL +
+		       (unsigned long long) z * 0x165667b19e3779f9ULL);
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  return h >> m_shift;
+}
+
+template <typename Visit>
+void Cartesian::SpatialHash::visit_cell(const long long& x,
+					const long long& y,
+					const long long& z,
+					const Visit& a_visit) const {
+  const unsigned long b(bucket(x, y, z));
+  for (unsigned long slot = m_starts[b], last = m_starts[b + 1]; slot < last; ++slot)
+    a_visit(slot, x, y, z);
+}
+
+void Cartesian::SpatialHash::build(const Cartesian::space* positions,
+				   const unsigned long& a_size) {
+
+  SPACE_TRACE("SpatialHash build");
+
+  unsigned long buckets(2);
+  m_shift = 63;
+  for (; buckets < a_size; buckets *= 2)
+    --m_shift;
+
+  m_starts.assign(buckets + 1, 0);
+  m_positions.resize(a_size);
+  m_indices.resize(a_size);
+  m_buckets.resize(a_size);
+  m_slots.resize(a_size);
+  for (unsigned int a = 0; a < 3; ++a) {
+    m_lo[a] = 0;
+    m_hi[a] = -1;
+  }
+
+  if (a_size == 0)
+    return;
+
+  const unsigned long threads(worker_count(m_threads));
+  std::vector<KeyIndex> keys(a_size);
+
+  sort_keys(keys, threads,
+	    [&](const unsigned long& i) {
+	      return (unsigned long long) bucket(grid(positions[i].x()), grid(positions[i].y()),
+						 grid(positions[i].z()));
+	    });
+
+  // the slots in bucket order, and the cells the points span.
+  CellBox box;
+  std::mutex box_lock;
+
+  parallel_blocks(threads, a_size, (a_size + threads - 1) / threads,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    CellBox part;
+		    for (unsigned long k = a_first; k < a_last; ++k) {
+		      const unsigned long i(keys[k].second);
+		      m_positions[k] = positions[i];
+		      m_indices[k] = i;
+		      m_buckets[i] = keys[k].first;
+		      m_slots[i] = k;
+		      part.include(grid(positions[i].x()), grid(positions[i].y()), grid(positions[i].z()));
+		    }
+		    std::lock_guard<std::mutex> guard(box_lock);
+		    box.include(part);
+		  });
+
+  for (unsigned long k = 0; k < a_size; ++k)
+    ++m_starts[keys[k].first + 1];
+  for (unsigned long b = 0; b < buckets; ++b)
+    m_starts[b + 1] += m_starts[b];
+
+  std::copy(box.m_lo, box.m_lo + 3, m_lo);
+  std::copy(box.m_hi, box.m_hi + 3, m_hi);
+}
+
+// Positions are rewritten in their slots. The points that changed
+// bucket are then merged, sorted, with the rest in one pass over the
+// buckets, instead of sorting everything again.
+unsigned long Cartesian::SpatialHash::update(const Cartesian::space* positions,
+					     const unsigned long& a_size) {
+
+  if (a_size != size()) {
+    build(positions, a_size);
+    return a_size;
+  }
+
+  SPACE_TRACE("SpatialHash update");
+
+  const unsigned long threads(worker_count(m_threads));
+  std::vector<unsigned long> moved;
+  CellBox box;
+  std::mutex lock;
+
+  parallel_blocks(threads, a_size, (a_size + threads - 1) / threads,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    std::vector<unsigned long> part_moved;
+		    CellBox part;
+		    for (unsigned long i = a_first; i < a_last; ++i) {
+		      const long long x(grid(positions[i].x())), y(grid(positions[i].y())), z(grid(positions[i].z()));
+		      const unsigned long b(bucket(x, y, z));
+		      part.include(x, y, z);
+		      m_positions[m_slots[i]] = positions[i];
+		      if (b != m_buckets[i]) {
+			m_buckets[i] = b;
+			part_moved.push_back(i);
+		      }
+		    }
+		    std::lock_guard<std::mutex> guard(lock);
+		    box.include(part);
+		    moved.insert(moved.end(), part_moved.begin(), part_moved.end());
+		  });
+
+  std::copy(box.m_lo, box.m_lo + 3, m_lo);
+  std::copy(box.m_hi, box.m_hi + 3, m_hi);
+
+  if (moved.empty())
+    return 0;
+
+  std::sort(moved.begin(), moved.end(),
+	    [&](const unsigned long& a, const unsigned long& b) {
+	      return m_buckets[a] < m_buckets[b] || (m_buckets[a] == m_buckets[b] && a < b);
+	    });
+
+  m_merged_positions.resize(a_size);
+  m_merged_indices.resize(a_size);
+
+  // a slot stays when its point is still in the slot's bucket.
+  unsigned long next(0), merged(0);
+  for (unsigned long b = 0; b < buckets(); ++b) {
+    const unsigned long first(m_starts[b]), last(m_starts[b + 1]);
+    m_starts[b] = next;
+    for (unsigned long slot = first; slot < last; ++slot) {
+      const unsigned long i(m_indices[slot]);
+      if (m_buckets[i] == b) {
+	m_merged_positions[next] = m_positions[slot];
+	m_merged_indices[next] = i;
+	m_slots[i] = next++;
+      }
+    }
+    for (; merged < moved.size() && m_buckets[moved[merged]] == b; ++merged) {
+      const unsigned long i(moved[merged]);
+      m_merged_positions[next] = positions[i];
+      m_merged_indices[next] = i;
+      m_slots[i] = next++;
+    }
+  }
+
+  m_positions.swap(m_merged_positions);
+  m_indices.swap(m_merged_indices);
+
+  return moved.size();
+}
+
+// The cells that overlap the cube about the sphere, or every point
+// when there are more of those cells than points.
+void Cartesian::SpatialHash::radius(const Cartesian::space& a_center,
+				    const double& a_radius,
+				    std::vector<unsigned long>& a_results) const {
+
+  a_results.clear();
+
+  if (size() == 0 || !(a_radius >= 0))
+    return;
+
+  const double center[3] = {a_center.x(), a_center.y(), a_center.z()};
+  const double radius2(a_radius * a_radius);
+  long long lo[3], hi[3];
+  double cells(1);
+
+  for (unsigned int a = 0; a < 3; ++a) {
+    lo[a] = std::max(grid(center[a] - a_radius), m_lo[a]);
+    hi[a] = std::min(grid(center[a] + a_radius), m_hi[a]);
+    if (lo[a] > hi[a])
+      return;
+    cells *= double(hi[a] - lo[a] + 1);
+  }
+
+  auto distance2 = [&](const unsigned long& a_slot) {
+    const double dx(m_positions[a_slot].x() - center[0]);
+    const double dy(m_positions[a_slot].y() - center[1]);
+    const double dz(m_positions[a_slot].z() - center[2]);
+    return dx*dx + dy*dy + dz*dz;
+  };
+
+  auto within = [&](const unsigned long& a_slot,
+		    const long long& x, const long long& y, const long long& z) {
+    if (distance2(a_slot) <= radius2 && in_cell(a_slot, x, y, z))
+      a_results.push_back(m_indices[a_slot]);
+  };
+
+  if (cells > size()) {
+    for (unsigned long slot = 0; slot < size(); ++slot)
+      if (distance2(slot) <= radius2)
+	a_results.push_back(m_indices[slot]);
+    return;
+  }
+
+  for (long long x = lo[0]; x <= hi[0]; ++x)
+    for (long long y = lo[1]; y <= hi[1]; ++y)
+      for (long long z = lo[2]; z <= hi[2]; ++z)
+	visit_cell(x, y, z, within);
+}
+
+// Rings of cells, the cube of cells s from the query's less the cube
+// s - 1, outward from the query's cell. A point in ring s is at least
+// s - 1 cells and the query's distance to its own cell's faces away,
+// so the search stops when the kth nearest so far is closer than that.
+// A max heap of (squared distance, index) holds the nearest so far.
+void Cartesian::SpatialHash::nearest(const Cartesian::space& a_center,
+				     const unsigned long& a_k,
+				     std::vector<unsigned long>& a_results) const {
+
+  a_results.clear();
+
+  if (a_k == 0 || size() == 0)
+    return;
+
+  typedef std::pair<double, unsigned long> Near;
+  std::vector<Near> best;
+  best.reserve(std::min(a_k, size()));
+
+  auto keep = [&](const Near& a_candidate) {
+    if (best.size() < a_k) {
+      best.push_back(a_candidate);
+      std::push_heap(best.begin(), best.end());
+    } else if (a_candidate < best.front()) {
+      std::pop_heap(best.begin(), best.end());
+      best.back() = a_candidate;
+      std::push_heap(best.begin(), best.end());
+    }
+  };
+
+  auto candidate = [&](const unsigned long& a_slot) {
+    const double dx(m_positions[a_slot].x() - a_center.x());
+    const double dy(m_positions[a_slot].y() - a_center.y());
+    const double dz(m_positions[a_slot].z() - a_center.z());
+    return Near(dx*dx + dy*dy + dz*dz, m_indices[a_slot]);
+  };
+
+  auto consider = [&](const unsigned long& a_slot,
+		      const long long& x, const long long& y, const long long& z) {
+    const Near near(candidate(a_slot));
+    if ((best.size() < a_k || near < best.front()) && in_cell(a_slot, x, y, z))
+      keep(near);
+  };
+
+  const long long q[3] = {grid(a_center.x()), grid(a_center.y()), grid(a_center.z())};
+  const double center[3] = {a_center.x(), a_center.y(), a_center.z()};
+
+  // the query's least distance to a face of its cell, which ring s
+  // is that and s - 1 cells away.
+  double inner(m_cell);
+  for (unsigned int a = 0; a < 3; ++a) {
+    const double offset(center[a] - q[a] * m_cell);
+    inner = std::max(std::min(inner, std::min(offset, m_cell - offset)), 0.0);
+  }
+
+  // rings nearer than the points' cells are empty, and the last one
+  // needed reaches the farthest of them.
+  long long first(0), last(0);
+  for (unsigned int a = 0; a < 3; ++a) {
+    first = std::max(first, std::max(m_lo[a] - q[a], q[a] - m_hi[a]));
+    last = std::max(last, std::max(q[a] - m_lo[a], m_hi[a] - q[a]));
+  }
+
+  bool everything(a_k >= size());
+
+  for (long long s = first; !everything && s <= last; ++s) {
+
+    if (best.size() == a_k && s > 0) {
+      const double reach((s - 1) * m_cell + inner);
+      if (best.front().first <= reach * reach)
+	break;
+    }
+
+    long long lo[3], hi[3];
+    double cells(1);
+    for (unsigned int a = 0; a < 3; ++a) {
+      lo[a] = std::max(q[a] - s, m_lo[a]);
+      hi[a] = std::min(q[a] + s, m_hi[a]);
+      cells *= double(std::max(hi[a] - lo[a] + 1, 0LL));
+    }
+
+    if (cells > size()) {
+      everything = true;
+      break;
+    }
+
+    for (long long x = lo[0]; x <= hi[0]; ++x)
+      for (long long y = lo[1]; y <= hi[1]; ++y)
+	if (std::abs(x - q[0]) == s || std::abs(y - q[1]) == s) {
+	  for (long long z = lo[2]; z <= hi[2]; ++z)
+	    visit_cell(x, y, z, consider);
+	} else {
+	  if (q[2] - s >= lo[2] && q[2] - s <= hi[2])
+	    visit_cell(x, y, q[2] - s, consider);
+	  if (s > 0 && q[2] + s >= lo[2] && q[2] + s <= hi[2])
+	    visit_cell(x, y, q[2] + s, consider);
+	}
+  }
+
+  if (everything) {
+    best.clear();
+    for (unsigned long slot = 0; slot < size(); ++slot)
+      keep(candidate(slot));
+  }
+
+  std::sort_heap(best.begin(), best.end());
+  for (unsigned long k = 0; k < best.size(); ++k)
+    a_results.push_back(best[k].second);
+}
+
+
+// ------------------------
+// ----- class KdTree -----
+// ------------------------
+
+const unsigned int Cartesian::KdTree::leaf_size(16);
+
+namespace {
+
+  // the left subtree of n points, the right one gets the rest.
+  inline unsigned long left_size(const unsigned long& n) {
+    return (n + 1) / 2;
+  }
+
+}
+
+Cartesian::KdTree::KdTree(const unsigned int& a_threads) :
+  m_threads(a_threads),
+  m_levels(0)
+{}
+
+void Cartesian::KdTree::build(const Cartesian::space* positions,
+			      const unsigned long& a_size) {
+
+  SPACE_TRACE("KdTree build");
+
+  // the least depth at which every subtree fits in a leaf.
+  m_levels = 0;
+  while (((a_size + (1ul << m_levels) - 1) >> m_levels) > leaf_size)
+    ++m_levels;
+
+  const unsigned long nodes((1ul << m_levels) - 1);
+  m_splits.assign(nodes, 0);
+  m_axes.assign(nodes, 0);
+
+  // partitioned by value, an index permutation makes every comparison
+  // a cache miss.
+  std::vector<Point> points(a_size);
+  for (unsigned long k = 0; k < a_size; ++k)
+    points[k] = Point(positions[k], k);
+
+  // a few subtrees per thread below the serial levels.
+  const unsigned long threads(worker_count(m_threads));
+  unsigned int stop(0);
+  while (threads > 1 && (1ul << stop) < 4 * threads && stop < m_levels)
+    ++stop;
+
+  std::vector<Task> tasks;
+  split(points, 0, 0, 0, a_size, stop, tasks);
+
+  parallel_blocks(threads, tasks.size(), 1,
+		  [&](const unsigned long& a_task, const unsigned long&) {
+		    std::vector<Task> none;
+		    split(points, tasks[a_task].first, stop, tasks[a_task].second.first,
+			  tasks[a_task].second.second, m_levels, none);
+		  });
+
+  m_x.resize(a_size);
+  m_y.resize(a_size);
+  m_z.resize(a_size);
+  m_indices.resize(a_size);
+
+  parallel_blocks(threads, a_size, (a_size + threads - 1) / threads,
+		  [&](const unsigned long& a_first, const unsigned long& a_last) {
+		    for (unsigned long k = a_first; k < a_last; ++k) {
+		      m_x[k] = points[k].first.x();
+		      m_y[k] = points[k].first.y();
+		      m_z[k] = points[k].first.z();
+		      m_indices[k] = points[k].second;
+		    }
+		  });
+}
+
+void Cartesian::KdTree::build(const Cartesian::SpaceRecorder& a_recorder) {
+  const Cartesian::space* first;
+  const Cartesian::space* second;
+  unsigned long first_size, second_size;
+  a_recorder.segments(first, first_size, second, second_size);
+  std::vector<Cartesian::space> positions(first, first + first_size);
+  positions.insert(positions.end(), second, second + second_size);
+  build(positions.empty() ? NULL : &positions[0], positions.size());
+}
+
+// the median of the widest axis of [a_begin, a_end) to the node, then
+// its children, down to depth a_stop. The subtrees there are left in
+// a_tasks.
+void Cartesian::KdTree::split(std::vector<Point>& points,
+			      const unsigned long& a_node,
+			      const unsigned int& a_depth,
+			      const unsigned long& a_begin,
+			      const unsigned long& a_end,
+			      const unsigned int& a_stop,
+			      std::vector<Task>& a_tasks) {
+
+  if (a_depth == m_levels)
+    return;
+
+  if (a_depth == a_stop) {
+    a_tasks.push_back(Task(a_node, std::make_pair(a_begin, a_end)));
+    return;
+  }
+
+  Cartesian::space lo(points[a_begin].first), hi(lo);
+  for (unsigned long k = a_begin + 1; k < a_end; ++k) {
+    const Cartesian::space& p(points[k].first);
+    lo = Cartesian::space(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+    hi = Cartesian::space(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+  }
+  const Cartesian::space width(hi - lo);
+  const unsigned int axis(width.x() >= width.y() ? (width.x() >= width.z() ? 0 : 2) :
+			  (width.y() >= width.z() ? 1 : 2));
+
+  const unsigned long middle(a_begin + left_size(a_end - a_begin));
+  std::nth_element(points.begin() + a_begin, points.begin() + middle, points.begin() + a_end,
+		   [&](const Point& a, const Point& b) {
+		     return coordinate(a.first, axis) < coordinate(b.first, axis);
+		   });
+
+  m_axes[a_node] = axis;
+  m_splits[a_node] = coordinate(points[middle].first, axis);
+
+  split(points, 2 * a_node + 1, a_depth + 1, a_begin, middle, a_stop, a_tasks);
+  split(points, 2 * a_node + 2, a_depth + 1, middle, a_end, a_stop, a_tasks);
+}
+
+// The left subtree is at or below the plane and the right at or above
+// it, so the far side is at least the point's distance to the plane.
+template <typename Leaf>
+void Cartesian::KdTree::descend(const double* a_point,
+				const unsigned long& a_node,
+				const unsigned int& a_depth,
+				const unsigned long& a_begin,
+				const unsigned long& a_end,
+				const double& a_bound,
+				const Leaf& a_leaf) const {
+
+  if (a_depth == m_levels) {
+    a_leaf(a_begin, a_end);
+    return;
+  }
+
+  const unsigned long middle(a_begin + left_size(a_end - a_begin));
+  const double offset(a_point[m_axes[a_node]] - m_splits[a_node]);
+
+  if (offset < 0) {
+    descend(a_point, 2 * a_node + 1, a_depth + 1, a_begin, middle, a_bound, a_leaf);
+    if (offset * offset <= a_bound)
+      descend(a_point, 2 * a_node + 2, a_depth + 1, middle, a_end, a_bound, a_leaf);
+  } else {
+    descend(a_point, 2 * a_node + 2, a_depth + 1, middle, a_end, a_bound, a_leaf);
+    if (offset * offset <= a_bound)
+      descend(a_point, 2 * a_node + 1, a_depth + 1, a_begin, middle, a_bound, a_leaf);
+  }
+}
+
+void Cartesian::KdTree::leaf_distances(const double* a_point,
+				       const unsigned long& a_begin,
+				       const unsigned long& a_end,
+				       double* a_distances) const {
+  const double* x(m_x.data() + a_begin);
+  const double* y(m_y.data() + a_begin);
+  const double* z(m_z.data() + a_begin);
+  for (unsigned long k = 0; k < a_end - a_begin; ++k) {
+    const double dx(x[k] - a_point[0]), dy(y[k] - a_point[1]), dz(z[k] - a_point[2]);
+    a_distances[k] = dx*dx + dy*dy + dz*dz;
+  }
+}
+
+unsigned long Cartesian::KdTree::nearest(const Cartesian::space& a_point) const {
+
+  if (size() == 0)
+    return size();
+
+  const double point[3] = {a_point.x(), a_point.y(), a_point.z()};
+  double best(std::numeric_limits<double>::infinity());
+  unsigned long index(size());
+
+  descend(point, 0, 0, 0, size(), best,
+	  [&](const unsigned long& a_begin, const unsigned long& a_end) {
+	    double distances[leaf_size];
+	    leaf_distances(point, a_begin, a_end, distances);
+	    for (unsigned long k = a_begin; k < a_end; ++k) {
+	      const double d(distances[k - a_begin]);
+	      if (d < best || (d == best && m_indices[k] < index)) {
+		best = d;
+		index = m_indices[k];
+	      }
+	    }
+	  });
+
+  return index;
+}
+
+void Cartesian::KdTree::nearest(const Cartesian::space& a_point,
+				const unsigned long& a_k,
+				std::vector<unsigned long>& a_results) const {
+
+  a_results.clear();
+
+  if (a_k == 0 || size() == 0)
+    return;
+
+  // a max heap of (squared distance, index), the bound is its top once
+  // it holds a_k.
+  typedef std::pair<double, unsigned long> Near;
+  std::vector<Near> best;
+  best.reserve(std::min(a_k, size()));
+  double bound(std::numeric_limits<double>::infinity());
+  const double point[3] = {a_point.x(), a_point.y(), a_point.z()};
+
+  descend(point, 0, 0, 0, size(), bound,
+	  [&](const unsigned long& a_begin, const unsigned long& a_end) {
+	    double distances[leaf_size];
+	    leaf_distances(point, a_begin, a_end, distances);
+	    for (unsigned long k = a_begin; k < a_end; ++k) {
+	      if (distances[k - a_begin] > bound)
+		continue;
+	      const Near near(distances[k - a_begin], m_indices[k]);
+	      if (best.size() < a_k) {
+		best.push_back(near);
+		std::push_heap(best.begin(), best.end());
+	      } else if (near < best.front()) {
+		std::pop_heap(best.begin(), best.end());
+		best.back() = near;
+		std::push_heap(best.begin(), best.end());
+	      }
+	      if (best.size() == a_k)
+		bound = best.front().first;
+	    }
+	  });
+
+  std::sort_heap(best.begin(), best.end());
+  for (unsigned long k = 0; k < best.size(); ++k)
+    a_results.push_back(best[k].second);
+}
+
+void Cartesian::KdTree::radius(const Cartesian::space& a_center,
+			       const double& a_radius,
+			       std::vector<unsigned long>& a_results) const {
+
+  a_results.clear();
+
+  if (size() == 0 || !(a_radius >= 0))
+    return;
+
+  const double point[3] = {a_center.x(), a_center.y(), a_center.z()};
+  const double bound(a_radius * a_radius);
+
+  descend(point, 0, 0, 0, size(), bound,
+	  [&](const unsigned long& a_begin, const unsigned long& a_end) {
+	    double distances[leaf_size];
+	    leaf_distances(point, a_begin, a_end, distances);
+	    for (unsigned long k = a_begin; k < a_end; ++k)
+	      if (distances[k - a_begin] <= bound)
+		a_results.push_back(m_indices[k]);
+	  });
+}
+
+void Cartesian::KdTree::box(const Cartesian::space& a_lo,
+			    const Cartesian::space& a_hi,
+			    std::vector<unsigned long>& a_results) const {
+  a_results.clear();
+  const double lo[3] = {a_lo.x(), a_lo.y(), a_lo.z()};
+  const double hi[3] = {a_hi.x(), a_hi.y(), a_hi.z()};
+  box_descend(lo, hi, 0, 0, 0, size(), a_results);
+}
+
+void Cartesian::KdTree::box_descend(const double* a_lo,
+				    const double* a_hi,
+				    const unsigned long& a_node,
+				    const unsigned int& a_depth,
+				    const unsigned long& a_begin,
+				    const unsigned long& a_end,
+				    std::vector<unsigned long>& a_results) const {
+
+  if (a_depth == m_levels) {
+    for (unsigned long k = a_begin; k < a_end; ++k)
+      if (a_lo[0] <= m_x[k] && m_x[k] <= a_hi[0] &&
+	  a_lo[1] <= m_y[k] && m_y[k] <= a_hi[1] &&
+	  a_lo[2] <= m_z[k] && m_z[k] <= a_hi[2])
+	a_results.push_back(m_indices[k]);
+    return;
+  }
+
+  const unsigned long middle(a_begin + left_size(a_end - a_begin));
+  const unsigned int axis(m_axes[a_node]);
+
+  if (a_lo[axis] <= m_splits[a_node])
+    box_descend(a_lo, a_hi, 2 * a_node + 1, a_depth + 1, a_begin, middle, a_results);
+  if (a_hi[axis] >= m_splits[a_node])
+    box_descend(a_lo, a_hi, 2 * a_node + 2, a_depth + 1, middle, a_end, a_results);
+}
@@ -0,0 +1,261 @@
+// ================================================================
+// Filename:    spatial.h
+// Description: Neighbor queries on space points: pairwise distance
+//              matrices, the SpatialHash grid and the KdTree.
+//              This file is part of lrm's Orbits software library.
+//
+// Author:      L.R. McFarland, lrm@starbug.com
+// Created:     2016 Mar 12
+// Language:    C++
+//
+//  Orbits is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Orbits is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Orbits.  If not, see <http://www.gnu.org/licenses/>.
+// ================================================================
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "space.h"
+
+namespace Cartesian {
+
+  // ------------------------------
+  // ----- pairwise distances -----
+  // ------------------------------
+
+  // Distances between the a_size points a and the b_size points b,
+  // |a_i - b_j|, or squared with distance_squared. The points b are
+  // copied to a structure of arrays and taken in tiles that stay in
+  // cache while a block of rows runs over them, so the inner loop
+  // vectorizes. The rows are split across a_threads threads, 0 is one
+  // per core. The overloads without b are a with itself, upper
+  // triangle only, i < j.
+
+  enum DistanceMode {distance_euclidean, distance_squared};
+
+  // dense, a_size rows of b_size, a_results[i * b_size + j].
+  void distance_matrix(const space* a, const unsigned long& a_size,
+		       const space* b, const unsigned long& b_size, double* a_results,
+		       const DistanceMode& a_mode=distance_euclidean, const unsigned int& a_threads=1);
+
+  // packed by rows, a_size (a_size - 1) / 2 values, (i, j) at upper_index().
+  void distance_matrix(const space* a, const unsigned long& a_size, double* a_results,
+		       const DistanceMode& a_mode=distance_euclidean, const unsigned int& a_threads=1);
+
+  inline unsigned long upper_index(const unsigned long& i, const unsigned long& j,
+				   const unsigned long& a_size) {
+    return i * (2 * a_size - i - 1) / 2 + j - i - 1;
+  }
+
+  // Compressed sparse rows: the columns and values of row i are
+  // [m_row_starts[i], m_row_starts[i + 1]), by column.
+  struct SparseDistances {
+    std::vector<unsigned long> m_row_starts;  /// rows + 1
+    std::vector<unsigned long> m_columns;
+    std::vector<double>        m_values;
+  };
+
+  // the pairs at most a_threshold apart, inclusive, a distance whichever
+  // the mode.
+  void distances_within(const space* a, const unsigned long& a_size,
+			const space* b, const unsigned long& b_size,
+			const double& a_threshold, SparseDistances& a_results,
+			const DistanceMode& a_mode=distance_euclidean, const unsigned int& a_threads=1);
+  void distances_within(const space* a, const unsigned long& a_size,
+			const double& a_threshold, SparseDistances& a_results,
+			const DistanceMode& a_mode=distance_euclidean, const unsigned int& a_threads=1);
+
+
+  // -----------------------------
+  // ----- class SpatialHash -----
+  // -----------------------------
+
+  // Uniform grid of cubes a_cell wide for radius and nearest neighbour
+  // queries over a point set. The grid is unbounded: cells are hashed
+  // into a power of two buckets, at least one per point, and a query
+  // skips the points of other cells that share a bucket. Results are
+  // indices into the array passed to build().
+  //
+  // build() sorts the points by bucket on a_threads threads, 0 is one
+  // per core, and keeps a copy of the positions in that order, so a
+  // bucket is one contiguous run. A cell about the query radius is a
+  // good size. update() takes new positions of the same points and
+  // moves only the ones that changed bucket, which is few when they
+  // move less than a cell. The queries are const and may run on any
+  // number of threads at once.
+
+  class SpatialHash {
+
+  public:
+
+    SpatialHash(const double& a_cell=1, const unsigned int& a_threads=1);
+   ~SpatialHash() {}; // dtor
+
+    const double& cell() const {return m_cell;}
+
+    const unsigned int& threads() const                  {return m_threads;}
+    void                threads(const unsigned int& a_n) {m_threads = a_n;}
+
+    unsigned long size() const    {return m_positions.size();}  // points
+    unsigned long buckets() const {return m_starts.empty() ? 0 : m_starts.size() - 1;}
+
+    void build(const space* positions, const unsigned long& a_size);
+
+    // the same points, moved. Returns how many changed bucket. A
+    // different a_size is a build().
+    unsigned long update(const space* positions, const unsigned long& a_size);
+
+    // the points within a_radius of a_center, inclusive, in no order.
+    void radius(const space& a_center, const double& a_radius,
+		std::vector<unsigned long>& a_results) const;
+
+    // the a_k points nearest a_center, nearest first, ties by index.
+    // All of them if there are fewer.
+    void nearest(const space& a_center, const unsigned long& a_k,
+		 std::vector<unsigned long>& a_results) const;
+
+  private:
+
+    // the cell of a coordinate, clamped to +-2^52 cells. floor() is a
+    // libm call without SSE4.1, this truncates and steps down.
+    long long grid(const double& a_coordinate) const {
+      const double t(std::min(std::max(a_coordinate * m_inverse, -4503599627370496.0), 4503599627370496.0));
+      const long long truncated((long long) t);
+      return truncated - (t < truncated ? 1 : 0);
+    }
+    unsigned long bucket(const long long& x, const long long& y, const long long& z) const;
+
+    // calls a_visit(slot) for the points of bucket(x, y, z), which
+    // checks in_cell() when it would keep one, for a bucket can hold
+    // other cells.
+    template <typename Visit>
+    void visit_cell(const long long& x, const long long& y, const long long& z,
+		    const Visit& a_visit) const;
+    bool in_cell(const unsigned long& a_slot,
+		 const long long& x, const long long& y, const long long& z) const {
+      return (grid(m_positions[a_slot].x()) == x && grid(m_positions[a_slot].y()) == y &&
+	      grid(m_positions[a_slot].z()) == z);
+    }
+
+    double                     m_cell;
+    double                     m_inverse;  /// 1 / m_cell
+    unsigned int               m_threads;
+    unsigned int               m_shift;    /// 64 - log2(buckets)
+    long long                  m_lo[3];    /// least cell of the points on each axis
+    long long                  m_hi[3];    /// greatest
+
+    std::vector<unsigned long> m_starts;     /// first slot of each bucket, then size()
+    std::vector<space>         m_positions;  /// by slot, in bucket order
+    std::vector<unsigned long> m_indices;    /// build() index of each slot
+    std::vector<unsigned long> m_buckets;    /// of each point, by build() index
+    std::vector<unsigned long> m_slots;      /// of each point, by build() index
+
+    // update() merges into these and swaps them in
+    std::vector<space>         m_merged_positions;
+    std::vector<unsigned long> m_merged_indices;
+
+  };
+
+
+  // ------------------------
+  // ----- class KdTree -----
+  // ------------------------
+
+  // Static k-d tree for exact nearest neighbour and range queries over
+  // a point set, e.g. "when did the trajectory pass closest to here"
+  // over a SpaceRecorder. Results are indices into the array passed to
+  // build(), or get() indices of the recorder, oldest first.
+  //
+  // The tree is balanced and implicit: node i has children 2i + 1 and
+  // 2i + 2, each split at the median of its widest axis, and the leaves
+  // hold at most leaf_size points. Only the split planes are stored,
+  // the points are kept by component in leaf order so a leaf scan is a
+  // vectorized loop. build() splits the top levels one node at a time,
+  // then the subtrees below them on a_threads threads, 0 is one per
+  // core. The queries are const and may run on any number of threads.
+
+  class KdTree {
+
+  public:
+
+    static const unsigned int leaf_size;  /// most points in a leaf
+
+    KdTree(const unsigned int& a_threads=1);
+   ~KdTree() {}; // dtor
+
+    const unsigned int& threads() const                  {return m_threads;}
+    void                threads(const unsigned int& a_n) {m_threads = a_n;}
+
+    unsigned long size() const  {return m_indices.size();}  // points
+    unsigned long nodes() const {return m_splits.size();}   // split planes
+
+    void build(const space* positions, const unsigned long& a_size);
+    void build(const SpaceRecorder& a_recorder);
+
+    // the index of the point nearest a_point, the least index of ties,
+    // or size() if empty.
+    unsigned long nearest(const space& a_point) const;
+
+    // the a_k points nearest a_point, nearest first, ties by index. All
+    // of them if there are fewer.
+    void nearest(const space& a_point, const unsigned long& a_k,
+		 std::vector<unsigned long>& a_results) const;
+
+    // the points within a_radius of a_center, inclusive, in no order.
+    void radius(const space& a_center, const double& a_radius,
+		std::vector<unsigned long>& a_results) const;
+
+    // the points in the box [a_lo, a_hi], inclusive, in no order.
+    void box(const space& a_lo, const space& a_hi,
+	     std::vector<unsigned long>& a_results) const;
+
+  private:
+
+    typedef std::pair<space, unsigned long> Point;  /// position, build() index
+    typedef std::pair<unsigned long, std::pair<unsigned long, unsigned long> > Task; /// node, [begin, end)
+
+    void split(std::vector<Point>& points, const unsigned long& a_node, const unsigned int& a_depth,
+	       const unsigned long& a_begin, const unsigned long& a_end,
+	       const unsigned int& a_stop, std::vector<Task>& a_tasks);
+
+    // calls a_leaf(begin, end) for the leaves that may hold a point
+    // within sqrt(a_bound) of a_point, nearer leaves first. a_leaf may
+    // lower a_bound.
+    template <typename Leaf>
+    void descend(const double* a_point, const unsigned long& a_node, const unsigned int& a_depth,
+		 const unsigned long& a_begin, const unsigned long& a_end,
+		 const double& a_bound, const Leaf& a_leaf) const;
+
+    void box_descend(const double* a_lo, const double* a_hi, const unsigned long& a_node,
+		     const unsigned int& a_depth, const unsigned long& a_begin,
+		     const unsigned long& a_end, std::vector<unsigned long>& a_results) const;
+
+    // squared distances of the points [a_begin, a_end) to a_point.
+    void leaf_distances(const double* a_point, const unsigned long& a_begin,
+			const unsigned long& a_end, double* a_distances) const;
+
+    unsigned int               m_threads;
+    unsigned int               m_levels;   /// of splits, the leaves are at this depth
+
+    std::vector<double>        m_splits;   /// plane of each node
+    std::vector<unsigned char> m_axes;     /// 0, 1, 2 for x, y, z, of each node
+    std::vector<double>        m_x;        /// in leaf order
+    std::vector<double>        m_y;
+    std::vector<double>        m_z;
+    std::vector<unsigned long> m_indices;  /// build() index of each, in leaf order
+
+  };
+
+} // end namespace Cartesian
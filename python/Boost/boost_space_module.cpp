@@ -3,23 +3,276 @@
 // Description: Contains the python wrappers for the Cartesian::space objects
 //              using boost and python.
 //
+//              rotator and SpaceRecorder take and return N x 3 float64
+//              NumPy arrays for their batch methods. This uses the
+//              NumPy C API directly, not boost::python::numpy, so the
+//              module only depends on the numpy it is built against.
+//
 // Author:      L.R. McFarland
 // Created:     2013jun17
 // ==========================================================================
 
 #include <boost/python.hpp>
 
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
 #include "space.h"
 
 using namespace boost::python;
 
+// The batch methods treat arrays of Cartesian::space as N x 3 doubles.
+static_assert(sizeof(Cartesian::space) == 3 * sizeof(double),
+	      "Cartesian::space must be three packed doubles");
+
 // overload wrappers.
 void (Cartesian::space::*setx)(const double&) = &Cartesian::space::x;
 void (Cartesian::space::*sety)(const double&) = &Cartesian::space::y;
 void (Cartesian::space::*setz)(const double&) = &Cartesian::space::z;
+Cartesian::space (Cartesian::space::*normalized_one)() const = &Cartesian::space::normalized;
+
+Cartesian::space (Cartesian::rotator::*rotate_one)(const Cartesian::space&, const double&) =
+  &Cartesian::rotator::rotate;
+const Cartesian::space& (Cartesian::rotator::*get_axis)() const = &Cartesian::rotator::axis;
+void (Cartesian::rotator::*set_axis)(const Cartesian::space&) = &Cartesian::rotator::axis;
+
+const unsigned int& (Cartesian::SpaceRecorder::*get_size_limit)() const =
+  &Cartesian::SpaceRecorder::sizeLimit;
+void (Cartesian::SpaceRecorder::*push_one)(Cartesian::space) = &Cartesian::SpaceRecorder::push;
+
+Cartesian::space (*cross_one)(const Cartesian::space&, const Cartesian::space&) = &Cartesian::cross;
+double (*dot_one)(const Cartesian::space&, const Cartesian::space&) = &Cartesian::dot;
+
+
+// ========================
+// ===== numpy arrays =====
+// ========================
+
+// Releases the GIL for its scope around the C++ batch loops.
+class allow_threads {
+public:
+  allow_threads() : m_state(PyEval_SaveThread()) {}
+  ~allow_threads() {PyEval_RestoreThread(m_state);}
+private:
+  PyThreadState* m_state;
+};
+
+// Returns a C contiguous N x 3 float64 array for an_object, without a
+// copy if it already is one.
+static handle<> as_space_array(const object& an_object) {
+
+  PyObject* an_array(PyArray_FROMANY(an_object.ptr(), NPY_DOUBLE, 2, 2, NPY_ARRAY_IN_ARRAY));
+
+  if (an_array == NULL)
+    throw_error_already_set();
+
+  handle<> result(an_array);
+
+  if (PyArray_DIM((PyArrayObject*) an_array, 1) != 3) {
+    PyErr_SetString(PyExc_ValueError, "expected an N x 3 array of x, y, z");
+    throw_error_already_set();
+  }
+
+  return result;
+}
+
+static const Cartesian::space* space_data(const handle<>& an_array) {
+  return (const Cartesian::space*) PyArray_DATA((PyArrayObject*) an_array.get());
+}
+
+static npy_intp space_size(const handle<>& an_array) {
+  return PyArray_DIM((PyArrayObject*) an_array.get(), 0);
+}
+
+// A new N x 3 float64 array.
+static object new_space_array(npy_intp a_size) {
+  npy_intp dims[2] = {a_size, 3};
+  PyObject* an_array(PyArray_SimpleNew(2, dims, NPY_DOUBLE));
+  if (an_array == NULL)
+    throw_error_already_set();
+  return object(handle<>(an_array));
+}
+
+// A read only N x 3 view of a_data. an_owner is kept alive as the
+// array base, the data is not copied.
+static object space_view(const Cartesian::space* a_data, npy_intp a_size, const object& an_owner) {
+
+  npy_intp dims[2] = {a_size, 3};
+
+  PyObject* an_array(PyArray_New(&PyArray_Type, 2, dims, NPY_DOUBLE, NULL,
+				 (void*) a_data, 0,
+				 NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED, NULL));
+  if (an_array == NULL)
+    throw_error_already_set();
+
+  Py_INCREF(an_owner.ptr());
+  if (PyArray_SetBaseObject((PyArrayObject*) an_array, an_owner.ptr()) < 0) {
+    Py_DECREF(an_array);
+    throw_error_already_set();
+  }
+
+  return object(handle<>(an_array));
+}
+
+
+// =================
+// ===== space =====
+// =================
+
+// operator<<() with the precision from space_config.h, written by the
+// libSpace build.
+std::string space_str(const Cartesian::space& a_space) {
+  std::stringstream result;
+  result.precision(SPACE_PRINT_PRECISION);
+  result << a_space;
+  return result.str();
+}
+
+
+// ===================
+// ===== rotator =====
+// ===================
+
+// Rotates each row of an N x 3 array with the GIL released. rotate()
+// rebuilds the rotator's cached matrix for a new angle, so the loop
+// runs on a copy taken under the GIL, and threads sharing a rotator
+// never see each other's half written matrix.
+object rotator_rotate_many(const Cartesian::rotator& a_rotator,
+			   const object& headings,
+			   const double& a_radians) {
+
+  handle<> an_array(as_space_array(headings));
+  npy_intp a_size(space_size(an_array));
+
+  object results(new_space_array(a_size));
+  Cartesian::space* result_data((Cartesian::space*) PyArray_DATA((PyArrayObject*) results.ptr()));
+
+  Cartesian::rotator a_local(a_rotator);
+
+  {
+    allow_threads no_gil;
+    a_local.rotate(space_data(an_array), result_data, a_size, a_radians);
+  }
+
+  return results;
+}
+
+
+// =========================
+// ===== SpaceRecorder =====
+// =========================
+
+unsigned long recorder_len(const Cartesian::SpaceRecorder& a_recorder) {
+  return a_recorder.size();
+}
+
+Cartesian::space recorder_getitem(const Cartesian::SpaceRecorder& a_recorder, long idx) {
+  if (idx < 0)
+    idx += a_recorder.size();
+  if (idx < 0 || (unsigned long) idx >= a_recorder.size()) {
+    PyErr_SetString(PyExc_IndexError, "SpaceRecorder index out of range");
+    throw_error_already_set();
+  }
+  return a_recorder.get(idx);
+}
+
+// Keeps the GIL: other threads may read the ring, or segments() views
+// of it, while it is written.
+void recorder_push_many(Cartesian::SpaceRecorder& a_recorder, const object& some_data) {
+
+  handle<> an_array(as_space_array(some_data));
+
+  a_recorder.push(space_data(an_array), space_size(an_array));
+}
+
+// (first, second) read only views of the ring, oldest first. They
+// share memory with the recorder and see later pushes.
+tuple recorder_segments(const object& self) {
+
+  const Cartesian::SpaceRecorder& a_recorder = extract<const Cartesian::SpaceRecorder&>(self);
+
+  const Cartesian::space* first(NULL);
+  const Cartesian::space* second(NULL);
+  unsigned long first_size(0);
+  unsigned long second_size(0);
+
+  a_recorder.segments(first, first_size, second, second_size);
+
+  return make_tuple(space_view(first, first_size, self),
+		    space_view(second, second_size, self));
+}
+
+// A new N x 3 array of the contents, oldest first.
+object recorder_to_array(const Cartesian::SpaceRecorder& a_recorder) {
+
+  const Cartesian::space* first(NULL);
+  const Cartesian::space* second(NULL);
+  unsigned long first_size(0);
+  unsigned long second_size(0);
+
+  a_recorder.segments(first, first_size, second, second_size);
+
+  object results(new_space_array(first_size + second_size));
+  Cartesian::space* result_data((Cartesian::space*) PyArray_DATA((PyArrayObject*) results.ptr()));
+
+  std::copy(first, first + first_size, result_data);
+  std::copy(second, second + second_size, result_data + first_size);
+
+  return results;
+}
+
+
+// ==================
+// ===== pickle =====
+// ==================
+
+// space pickles as space(x, y, z).
+struct space_pickle_suite : pickle_suite {
+  static tuple getinitargs(const Cartesian::space& a_space) {
+    return make_tuple(a_space.x(), a_space.y(), a_space.z());
+  }
+};
+
+// SpaceRecorder pickles as SpaceRecorder(sizeLimit) and its contents,
+// oldest first, as one N x 3 array.
+struct recorder_pickle_suite : pickle_suite {
+
+  static tuple getinitargs(const Cartesian::SpaceRecorder& a_recorder) {
+    return make_tuple(a_recorder.sizeLimit());
+  }
+
+  static tuple getstate(const Cartesian::SpaceRecorder& a_recorder) {
+    return make_tuple(recorder_to_array(a_recorder));
+  }
+
+  static void setstate(Cartesian::SpaceRecorder& a_recorder, tuple state) {
+    a_recorder.clear();
+    recorder_push_many(a_recorder, state[0]);
+  }
+};
+
+
+// ==================
+// ===== module =====
+// ==================
+
+#if PY_MAJOR_VERSION >= 3
+static void* init_numpy() {
+  import_array();
+  return NULL;
+}
+#else
+static void init_numpy() {
+  import_array();
+}
+#endif
 
 BOOST_PYTHON_MODULE(space) {
 
+  init_numpy();
+  if (PyErr_Occurred())
+    throw_error_already_set();
+
   class_<Cartesian::space>("space")
 
     // static members
@@ -50,7 +303,7 @@ BOOST_PYTHON_MODULE(space) {
     .add_property("z", &Cartesian::space::getZ, setz)
 
     // operator<<(), str not repr
-    .def(self_ns::str(self_ns::self))
+    .def("__str__", space_str)
 
     // operators
     .def(self + Cartesian::space())
@@ -66,14 +319,59 @@ BOOST_PYTHON_MODULE(space) {
 
     // other methods
     .def("magnitude", &Cartesian::space::magnitude)
-    .def("normalized", &Cartesian::space::normalized)
+    .def("normalized", normalized_one)
+
+    .def_pickle(space_pickle_suite())
+
+
+    ; // end of class_
+
+  class_<Cartesian::rotator>("rotator", init<Cartesian::space>())
+
+    .add_property("axis",
+		  make_function(get_axis, return_value_policy<copy_const_reference>()),
+		  set_axis)
 
+    .def("rotate", rotate_one)
+    .def("rotate_many", rotator_rotate_many) // N x 3 array, releases the GIL
+
+    .def("deg2rad", &Cartesian::rotator::deg2rad).staticmethod("deg2rad")
+    .def("rad2deg", &Cartesian::rotator::rad2deg).staticmethod("rad2deg")
+
+    ; // end of class_
+
+  // sizeLimit is read only here so the views from segments() always
+  // point into live storage.
+  class_<Cartesian::SpaceRecorder>("SpaceRecorder", init<optional<unsigned int> >())
+
+    .add_property("sizeLimit",
+		  make_function(get_size_limit, return_value_policy<copy_const_reference>()))
+    .def("size", &Cartesian::SpaceRecorder::size)
+    .def("__len__", recorder_len)
+    .def("get", recorder_getitem)
+    .def("__getitem__", recorder_getitem)
+
+    .def("push", push_one)
+    .def("push_many", recorder_push_many) // N x 3 array
+    .def("clear", &Cartesian::SpaceRecorder::clear)
+
+    .def("segments", recorder_segments) // read only views, no copy
+    .def("to_array", recorder_to_array) // copy
+
+    .def("write2R", &Cartesian::SpaceRecorder::write2R,
+	 (arg("flnm"), arg("skip_Uo")=true))
+
+    .def_pickle(recorder_pickle_suite())
 
     ; // end of class_
 
   // functions
-  def("cross", Cartesian::cross);
-  def("dot", Cartesian::dot);
+  def("cross", cross_one);
+  def("dot", dot_one);
+
+  // build configuration
+  scope().attr("epsilon") = Cartesian::space::epsilon;
+  scope().attr("print_precision") = SPACE_PRINT_PRECISION;
 
 
 };
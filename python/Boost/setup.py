@@ -1,15 +1,22 @@
 """Creats python wrappers from boost macro
 
-ASSUMES: ../../libSpace exists and /usr/local/[include,lib] has boost installed.
+ASSUMES: ../../libSpace exists, /usr/local/[include,lib] has boost installed
+and numpy is importable for its headers.
 """
 
+import sys
+
+from ctypes.util import find_library
 from distutils.core import setup, Extension
 
+import numpy
+
 name = 'space'
 version = '1.0'
 
 include_dirs=['../../libSpace',
               '/usr/local/include', # for boost
+              numpy.get_include(),
               ]
 
 
@@ -17,7 +24,13 @@ library_dirs=['../../libSpace',
               '/usr/local/lib', # for boost
               ]
 
-libraries = ['boost_python', 'space']
+# boost names the library for the python it was built for, e.g.
+# boost_python311, older installs only have boost_python.
+boost_python = 'boost_python%d%d' % sys.version_info[:2]
+if find_library(boost_python) is None:
+    boost_python = 'boost_python'
+
+libraries = [boost_python, 'Space']
 
 sources = ['boost_space_module.cpp']
 
@@ -25,7 +38,8 @@ space_module = Extension(name,
                          include_dirs=include_dirs,
                          libraries=libraries,
                          library_dirs=library_dirs,
-                         sources=sources)
+                         sources=sources,
+                         extra_compile_args=['-std=c++11'])
 
 setup (name=name,
        version=version,
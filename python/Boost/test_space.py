@@ -3,10 +3,14 @@
 """Unit tests for space objects."""
 
 import math
+import pickle
 import random
+import threading
 import time
 import unittest
 
+import numpy
+
 import space
 
 
@@ -390,12 +394,180 @@ class TestSpace(unittest.TestCase):
         self.assertSpacesAreEqual(result, a)
 
 
+    def test_pickle(self):
+        """Test pickle round trip"""
+        for protocol in range(pickle.HIGHEST_PROTOCOL + 1):
+            a = pickle.loads(pickle.dumps(self.p1, protocol))
+            self.assertSpacesAreEqual(self.p1, a)
+
+
     def test_divide_by_zero(self):
         """Test space / 0"""
         a1 = self.p1
         self.assertRaises(RuntimeError, lambda a: a / 0, a1)
 
 
+class TestRotator(unittest.TestCase):
+
+    def setUp(self):
+        self.places = 7 # precision
+        self.headings = numpy.random.uniform(-1.0e3, 1.0e3, size=(100, 3))
+
+
+    def test_rotate_x_about_z(self):
+        """Test x rotated 90 degrees about z is y"""
+        a_rotator = space.rotator(space.space.Uz)
+        a = a_rotator.rotate(space.space.Ux, math.pi / 2)
+        self.assertAlmostEqual(0.0, a.x, places=self.places)
+        self.assertAlmostEqual(1.0, a.y, places=self.places)
+        self.assertAlmostEqual(0.0, a.z, places=self.places)
+
+
+    def test_rotate_many_matches_rotate(self):
+        """Test batch rotate matches rotating one at a time"""
+        a_rotator = space.rotator(space.space(1, 2, 3))
+        results = a_rotator.rotate_many(self.headings, 0.75)
+        self.assertEqual((100, 3), results.shape)
+        for heading, result in zip(self.headings, results):
+            a = a_rotator.rotate(space.space(*heading), 0.75)
+            self.assertAlmostEqual(a.x, result[0], places=self.places)
+            self.assertAlmostEqual(a.y, result[1], places=self.places)
+            self.assertAlmostEqual(a.z, result[2], places=self.places)
+
+
+    def test_rotate_many_does_not_modify_input(self):
+        """Test batch rotate returns a new array"""
+        headings = self.headings.copy()
+        space.rotator(space.space.Uz).rotate_many(headings, 1.0)
+        self.assertTrue(numpy.array_equal(self.headings, headings))
+
+
+    def test_rotate_many_converts_input(self):
+        """Test batch rotate accepts lists and non contiguous arrays"""
+        a_rotator = space.rotator(space.space.Uz)
+        expected = a_rotator.rotate_many(self.headings, 1.0)
+        self.assertTrue(numpy.allclose(expected, a_rotator.rotate_many(self.headings.tolist(), 1.0)))
+        strided = numpy.asfortranarray(self.headings)
+        self.assertTrue(numpy.allclose(expected, a_rotator.rotate_many(strided, 1.0)))
+
+
+    def test_rotate_many_threads(self):
+        """Test threads sharing a rotator with different angles"""
+        a_rotator = space.rotator(space.space(1, 2, 3))
+        headings = numpy.random.uniform(-1.0e3, 1.0e3, size=(8, 3))
+        angles = [0.1 * k for k in range(8)]
+        expected = [space.rotator(space.space(1, 2, 3)).rotate_many(headings, an_angle)
+                    for an_angle in angles]
+        failures = []
+
+        # many short calls, each releasing the GIL, so the threads
+        # interleave around the rotator's matrix updates.
+        def rotate(k):
+            for _ in range(5000):
+                if not numpy.array_equal(expected[k], a_rotator.rotate_many(headings, angles[k])):
+                    failures.append(k)
+
+        threads = [threading.Thread(target=rotate, args=(k,)) for k in range(len(angles))]
+        for a_thread in threads:
+            a_thread.start()
+        for a_thread in threads:
+            a_thread.join()
+        self.assertEqual([], failures)
+
+
+    def test_rotate_many_bad_shape(self):
+        """Test batch rotate rejects arrays that are not N x 3"""
+        a_rotator = space.rotator(space.space.Uz)
+        self.assertRaises(ValueError, a_rotator.rotate_many, numpy.zeros((4, 2)), 1.0)
+        self.assertRaises(ValueError, a_rotator.rotate_many, numpy.zeros(3), 1.0)
+
+
+class TestSpaceRecorder(unittest.TestCase):
+
+    def setUp(self):
+        self.some_data = numpy.arange(30, dtype=float).reshape(10, 3)
+
+
+    def assertRecorded(self, expected, a_recorder):
+        """Recorder contents, oldest first, equal expected."""
+        first, second = a_recorder.segments()
+        self.assertTrue(numpy.array_equal(expected, numpy.concatenate((first, second))))
+        self.assertTrue(numpy.array_equal(expected, a_recorder.to_array()))
+
+
+    def test_starts_full_of_zeros(self):
+        """Test a new recorder is sizeLimit Uo entries"""
+        a_recorder = space.SpaceRecorder(4)
+        self.assertEqual(4, a_recorder.sizeLimit)
+        self.assertEqual(4, len(a_recorder))
+        self.assertRecorded(numpy.zeros((4, 3)), a_recorder)
+
+
+    def test_push_many_matches_push(self):
+        """Test bulk push from an array matches pushing one at a time"""
+        a_recorder = space.SpaceRecorder(4)
+        b_recorder = space.SpaceRecorder(4)
+        a_recorder.push_many(self.some_data)
+        for row in self.some_data:
+            b_recorder.push(space.space(*row))
+        self.assertRecorded(self.some_data[-4:], a_recorder)
+        self.assertTrue(numpy.array_equal(a_recorder.to_array(), b_recorder.to_array()))
+
+
+    def test_getitem(self):
+        """Test indexing is oldest first and supports negative indices"""
+        a_recorder = space.SpaceRecorder(4)
+        a_recorder.push_many(self.some_data[:6])
+        self.assertEqual(6.0, a_recorder[0].x)
+        self.assertEqual(15.0, a_recorder[-1].x)
+        self.assertRaises(IndexError, lambda: a_recorder[4])
+        self.assertRaises(IndexError, lambda: a_recorder[-5])
+
+
+    def test_segments_are_read_only_views(self):
+        """Test segments share memory with the recorder and can not be written"""
+        a_recorder = space.SpaceRecorder(4)
+        first, second = a_recorder.segments()
+        self.assertFalse(first.flags.writeable)
+        self.assertFalse(first.flags.owndata)
+        self.assertRaises(ValueError, first.__setitem__, 0, 1.0)
+        a_recorder.push(space.space(1, 2, 3))
+        self.assertEqual(3.0, first[0, 2]) # the ring slot pushed into
+
+
+    def test_segments_keep_recorder_alive(self):
+        """Test a view outlives its recorder name"""
+        a_recorder = space.SpaceRecorder(4)
+        a_recorder.push_many(self.some_data[:4])
+        first, second = a_recorder.segments()
+        del a_recorder
+        self.assertTrue(numpy.array_equal(self.some_data[:4], first))
+
+
+    def test_pickle(self):
+        """Test a recorder pickles its size limit and contents"""
+        a_recorder = space.SpaceRecorder(4)
+        a_recorder.push_many(self.some_data[:6])
+        b_recorder = pickle.loads(pickle.dumps(a_recorder, 2))
+        self.assertEqual(4, b_recorder.sizeLimit)
+        self.assertRecorded(self.some_data[2:6], b_recorder)
+        a_recorder.clear()
+        a_recorder.push(space.space(1, 2, 3))
+        b_recorder = pickle.loads(pickle.dumps(a_recorder, 2))
+        self.assertEqual(1, len(b_recorder))
+
+
+    def test_clear(self):
+        """Test clear empties the recorder"""
+        a_recorder = space.SpaceRecorder(4)
+        a_recorder.clear()
+        self.assertEqual(0, len(a_recorder))
+        first, second = a_recorder.segments()
+        self.assertEqual((0, 3), first.shape)
+        self.assertEqual((0, 3), second.shape)
+
+
+
 if __name__ == '__main__':
     random.seed(time.time())
     unittest.main()
@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+
+"""Micro benchmarks for the manual space module.
+
+Run with ./pylaunch.sh bench_space.py or make bench.
+"""
+
+from __future__ import print_function
+
+import argparse
+import sys
+import timeit
+
+import space
+
+
+def count_new_objects(stmt, loops):
+    """Counts how many times stmt rebinds a to a different object."""
+    a = space.space(1, 2, 3)
+    b = space.space(0.5, 0.25, 0.125)
+    env = {'a': a, 'b': b}
+    code = compile(stmt, '<bench>', 'exec')
+    new_objects = 0
+    for i in range(loops):
+        previous = env['a']
+        exec(code, globals(), env)
+        if env['a'] is not previous:
+            new_objects += 1
+    return new_objects
+
+
+def time_stmt(stmt, loops, repeat):
+    """Returns the best time per loop in nano seconds."""
+    setup = 'import space; a = space.space(1, 2, 3); b = space.space(0.5, 0.25, 0.125)'
+    best = min(timeit.repeat(stmt, setup=setup, number=loops, repeat=repeat))
+    return best / loops * 1e9
+
+
+def bench_inplace(loops, repeat):
+    """Compares the in place operators with their out of place forms."""
+
+    cases = (
+        ('add',      'a += b',   'a = a + b'),
+        ('subtract', 'a -= b',   'a = a - b'),
+        ('scale',    'a *= 1.0', None),  # no space * double to compare
+        ('divide',   'a /= 1.0', 'a = a / 1.0'),
+    )
+
+    print('%-10s %14s %14s %10s %10s' % ('op', 'inplace ns', 'outplace ns',
+                                          'inplace new', 'outplace new'))
+
+    for name, inplace, outplace in cases:
+
+        inplace_ns = time_stmt(inplace, loops, repeat)
+        inplace_new = count_new_objects(inplace, loops)
+
+        if outplace is None:
+            print('%-10s %14.1f %14s %10d %10s' % (name, inplace_ns, '-', inplace_new, '-'))
+            continue
+
+        outplace_ns = time_stmt(outplace, loops, repeat)
+        outplace_new = count_new_objects(outplace, loops)
+
+        print('%-10s %14.1f %14.1f %10d %10d' % (name, inplace_ns, outplace_ns,
+                                                  inplace_new, outplace_new))
+
+
+def bench_calls(loops, repeat):
+    """Times the per call overhead of module functions, members and ctors."""
+
+    calls = (
+        ('cross',      'space.cross(a, b)'),
+        ('dot',        'space.dot(a, b)'),
+        ('magnitude',  'space.magnitude(a)'),
+        ('normalized', 'space.normalized(a)'),
+        ('get x',      'a.x'),
+        ('set x',      'a.x = 1.0'),
+        ('space()',    'space.space(1, 2, 3)'),
+        ('space(kw)',  'space.space(x=1, y=2, z=3)'),
+        ('pass',       'pass'),  # timeit loop overhead
+    )
+
+    print('%-12s %10s' % ('call', 'ns/call'))
+
+    for name, stmt in calls:
+        print('%-12s %10.1f' % (name, time_stmt(stmt, loops, repeat)))
+
+
+def bench_freelist(loops, repeat):
+    """Times short lived arithmetic chains with and without the free list."""
+
+    chains = (
+        ('add chain',   'c = a + b - a + b'),
+        ('cross/norm',  'c = space.normalized(space.cross(a, b) + a)'),
+        ('construct',   'c = space.space(1, 2, 3)'),
+    )
+
+    old_max = space.set_freelist_max(0)
+
+    print('%-12s %14s %14s %8s' % ('chain', 'freelist ns', 'no list ns', 'speedup'))
+
+    try:
+        for name, stmt in chains:
+
+            space.set_freelist_max(old_max)
+            with_list = time_stmt(stmt, loops, repeat)
+
+            space.set_freelist_max(0)
+            without_list = time_stmt(stmt, loops, repeat)
+
+            print('%-12s %14.1f %14.1f %8.2f' % (name, with_list, without_list,
+                                                  without_list / with_list))
+    finally:
+        space.set_freelist_max(old_max)
+
+    space.reset_freelist_stats()
+    time_stmt(chains[0][1], loops, 1)
+    print('# free list stats', space.freelist_stats())
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='space module benchmarks')
+    parser.add_argument('-n', '--loops', type=int, default=1000000,
+                        help='loops per timing run')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+                        help='timing runs, best is reported')
+    args = parser.parse_args()
+
+    print('# python', sys.version.split()[0])
+    bench_calls(args.loops, args.repeat)
+    print()
+    bench_inplace(args.loops, args.repeat)
+    print()
+    bench_freelist(args.loops, args.repeat)
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+"""Times moving N space vectors from one process to another.
+
+Run with ./pylaunch.sh bench_transfer.py or make bench-transfer.
+
+    pickle   a list of space objects sent over a multiprocessing Pipe,
+             i.e. what a Queue of space values costs.
+    ndarray  an N x 3 numpy array sent over the same Pipe, one buffer
+             pickled and copied through the pipe.
+    shared   a SharedSpaceArray, only its name is pickled and the
+             receiver attaches and views it with numpy.asarray.
+
+The worker is started before the data is built and is reused, so the
+times do not include process start up. A transfer is timed from the
+send until the worker has the data in a usable form, checked its
+length and last row, and replied.
+"""
+
+import argparse
+import multiprocessing
+import os
+import sys
+import time
+
+import numpy
+
+import space
+
+
+def worker(conn):
+    """Receives (method, payload) until None, replies with (len, last row)."""
+
+    while True:
+
+        message = conn.recv()
+
+        if message is None:
+            break
+
+        method, payload = message
+
+        if method == 'pickle':
+            last = payload[-1]
+            conn.send((len(payload), (last.x, last.y, last.z)))
+
+        elif method == 'ndarray':
+            conn.send((len(payload), tuple(payload[-1])))
+
+        elif method == 'shared':
+            view = numpy.asarray(payload)
+            conn.send((len(view), tuple(view[-1])))
+            del view
+            payload.close()
+
+        del payload
+
+
+def make_data(n):
+    """N x 3 doubles, row i is (i, 2i, 3i)."""
+    return numpy.arange(n, dtype=float)[:, None] * numpy.array([1.0, 2.0, 3.0])
+
+
+def transfer(conn, method, payload, n):
+    """Returns seconds for one round trip and checks the reply."""
+
+    start = time.perf_counter()
+    conn.send((method, payload))
+    size, last = conn.recv()
+    elapsed = time.perf_counter() - start
+
+    expected = (float(n - 1), 2.0 * (n - 1), 3.0 * (n - 1))
+    if size != n or tuple(last) != expected:
+        raise RuntimeError('%s transfer is wrong: %s %s' % (method, size, last))
+
+    return elapsed
+
+
+def bench(n, repeat, methods):
+
+    parent, child = multiprocessing.Pipe()
+    process = multiprocessing.Process(target=worker, args=(child,))
+    process.start()
+
+    data = make_data(n)
+    results = []
+
+    try:
+        for method in methods:
+
+            build_start = time.perf_counter()
+
+            if method == 'pickle':
+                payload = [space.space(*row) for row in data.tolist()]
+            elif method == 'ndarray':
+                payload = data
+            elif method == 'shared':
+                payload = space.SharedSpaceArray('bench_transfer_%d' % os.getpid(), n)
+                numpy.asarray(payload)[:] = data
+
+            build = time.perf_counter() - build_start
+
+            best = min(transfer(parent, method, payload, n) for i in range(repeat))
+
+            if method == 'shared':
+                payload.unlink()
+                payload.close()
+
+            del payload
+
+            results.append((method, build, best))
+            print('%-8s %12.4f %12.4f %12.1f' % (method, build, best,
+                                                   n * 24 / best / 1e6 if best > 0 else 0.0))
+            sys.stdout.flush()
+
+    finally:
+        parent.send(None)
+        process.join()
+
+    return results
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='space transfer between processes')
+    parser.add_argument('-n', '--size', type=int, default=10 ** 7,
+                        help='number of space vectors')
+    parser.add_argument('-r', '--repeat', type=int, default=3,
+                        help='transfers per method, best is reported')
+    parser.add_argument('-m', '--method', action='append',
+                        choices=('pickle', 'ndarray', 'shared'),
+                        help='method to run, repeat for more. Default all')
+    args = parser.parse_args()
+
+    print('# python %s, %d vectors, %.1f MB' % (sys.version.split()[0], args.size,
+                                                args.size * 24 / 1e6))
+    print('%-8s %12s %12s %12s' % ('method', 'build s', 'transfer s', 'MB/s'))
+
+    bench(args.size, args.repeat, args.method or ('pickle', 'ndarray', 'shared'))
@@ -5,6 +5,6 @@
 
 . ./setenv.sh
 
-python "$@"
+python3 "$@"
 
 # EoF
@@ -1,17 +1,22 @@
 # builds python orbits module
-# from http://docs.python.org/extending/building.html
+# from http://docs.python.org/3/extending/building.html
 
-from distutils.core import setup, Extension
+import sys
+
+from setuptools import setup, Extension
+
+libraries = ['Space']
+if sys.platform.startswith('linux'):
+    libraries.append('rt') # shm_open before glibc 2.34
 
 space_module = Extension('space',
                           include_dirs=['../../libSpace'], # TODO meh.
-                          libraries=['space'],
+                          libraries=libraries,
                           library_dirs=['../../libSpace'], # TODO meh**2.
+                          extra_compile_args=['-std=c++11'], # space.h throw() specs
                           sources=['space.cpp'])
 
 setup (name='space',
        version='1.0',
        description='space package',
        ext_modules=[space_module])
-
-
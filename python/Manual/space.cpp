@@ -16,10 +16,15 @@
 //              how to construct a new SpaceType before the definition
 //              SpaceType is complete. Similarlly for is_SpaceType().
 //
+//              Written to the Python 3 C API. The module functions
+//              use METH_FASTCALL so calls do not build an argument
+//              tuple, and x, y and z are PyMemberDef doubles read
+//              directly out of m_space.
 //
-// See also:    http://docs.python.org/extending/newtypes.html
-//              http://docs.python.org/c-api/complex.html
-//              https://docs.python.org/2/reference/datamodel.html
+// See also:    http://docs.python.org/3/extending/newtypes.html
+//              http://docs.python.org/3/c-api/complex.html
+//              https://docs.python.org/3/reference/datamodel.html
+//              https://docs.python.org/3/c-api/structures.html#METH_FASTCALL
 //
 // Author:      L.R. McFarland
 // Created:     2011aug14
@@ -28,24 +33,41 @@
 #include <Python.h> // must be first
 #include <structmember.h> // part of python
 
+#include <stddef.h> // offsetof
+#include <stdint.h> // uint64_t
+#include <string.h> // memcpy, memcmp
+
+#include <errno.h>
+#include <fcntl.h>    // O_* for shm_open
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // ftruncate, close
+
 #include <sstream>
+#include <string>
 
 #include <space.h>
 
+// Py_SET_TYPE() is new in 3.9
+#ifndef Py_SET_TYPE
+#define Py_SET_TYPE(ob, type) (Py_TYPE(ob) = (type))
+#endif
+
 
 // ===================
 // ===== statics =====
 // ===================
 
 static PyObject* sSpaceException; // exception holder
+static PyObject* sConstants[4];    // the module's Uo, Ux, Uy and Uz
 
 // char* kwlist[] init strings
 static char sXstr[] = "x";
 static char sYstr[] = "y";
 static char sZstr[] = "z";
 
-// TODO: make precision configuralble on build, not hardcoded.
-static const unsigned int sPrintPrecision(12); // matches defaut %s precision for unit test
+// str() and repr() digits, from space_config.h written by the libSpace build.
+static const unsigned int sPrintPrecision(SPACE_PRINT_PRECISION);
 
 
 // ========================
@@ -58,9 +80,78 @@ typedef struct {
   Cartesian::space m_space;
 } Space;
 
+// x, y and z are exposed as T_DOUBLE members at these offsets. This
+// relies on Cartesian::space being exactly its three doubles m_x, m_y
+// and m_z in that order.
+static_assert(sizeof(Cartesian::space) == 3 * sizeof(double),
+	      "Cartesian::space must be three packed doubles");
+
+static const Py_ssize_t sXoffset(offsetof(Space, m_space) + 0 * sizeof(double));
+static const Py_ssize_t sYoffset(offsetof(Space, m_space) + 1 * sizeof(double));
+static const Py_ssize_t sZoffset(offsetof(Space, m_space) + 2 * sizeof(double));
+
 // Forward declarations for as_number methods. Wraps SpaceType definition.
 static void new_SpaceType(Space** a_space);
 static int is_SpaceType(PyObject* a_space);
+static int is_exact_SpaceType(PyObject* a_space);
+PyObject* space_create(const Cartesian::space& a_space);
+
+// =====================
+// ===== free list =====
+// =====================
+
+// Like the CPython float free list, deallocated Space objects are
+// chained through ob_type and handed back out by new_SpaceType()
+// instead of going through tp_free and PyObject_New again. Only exact
+// SpaceType instances are kept, subclasses are freed normally.
+
+#ifndef SPACE_FREELIST_MAXSIZE
+#define SPACE_FREELIST_MAXSIZE 100
+#endif
+
+static Space* sFreeList(NULL);                   // head of the free list
+static int sFreeListSize(0);                     // objects on the list
+static int sFreeListMax(SPACE_FREELIST_MAXSIZE); // cap, see set_freelist_max()
+
+static unsigned long sFreeListHits(0);      // allocations from the list
+static unsigned long sFreeListMisses(0);    // allocations from PyObject_New
+static unsigned long sFreeListOverflows(0); // deallocs with the list full
+
+static Space* free_list_pop() {
+  if (sFreeList == NULL) {
+    ++sFreeListMisses;
+    return NULL;
+  }
+  Space* a_space(sFreeList);
+  sFreeList = (Space*) Py_TYPE(a_space);
+  --sFreeListSize;
+  ++sFreeListHits;
+  return a_space;
+}
+
+static bool free_list_push(Space* a_space) {
+  if (sFreeListSize >= sFreeListMax) {
+    ++sFreeListOverflows;
+    return false;
+  }
+  Py_SET_TYPE(a_space, (PyTypeObject*) sFreeList);
+  sFreeList = a_space;
+  ++sFreeListSize;
+  return true;
+}
+
+static int free_list_trim(int a_size) {
+  // frees objects until there are at most a_size on the list.
+  int freed(0);
+  while (sFreeListSize > a_size) {
+    Space* a_space(sFreeList);
+    sFreeList = (Space*) Py_TYPE(a_space);
+    --sFreeListSize;
+    PyObject_Del(a_space);
+    ++freed;
+  }
+  return freed;
+}
 
 static PyObject* Space_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
   Space* self(NULL);
@@ -87,7 +178,9 @@ static int Space_init(Space* self, PyObject* args, PyObject* kwds) {
 }
 
 static void Space_dealloc(Space* self) {
-  self->ob_type->tp_free((PyObject*)self);
+  if (is_exact_SpaceType((PyObject*)self) && free_list_push(self))
+    return;
+  Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
 // =================
@@ -98,7 +191,7 @@ PyObject* Space_str(PyObject* self) {
   std::stringstream result;
   result.precision(sPrintPrecision);
   result << ((Space*)self)->m_space;
-  return PyString_FromString(result.str().c_str());
+  return PyUnicode_FromString(result.str().c_str());
 }
 
 PyObject* Space_repr(PyObject* self) {
@@ -109,86 +202,7 @@ PyObject* Space_repr(PyObject* self) {
          << a_space.x() << ", "
          << a_space.y() << ", "
          << a_space.z() << ")";
-  return PyString_FromString(result.str().c_str());
-}
-
-// ===============================
-// ===== getters and setters =====
-// ===============================
-
-// -------------
-// ----- X -----
-// -------------
-
-static PyObject* Space_getx(Space* self, void* closure) {
-  return PyFloat_FromDouble(self->m_space.x());
-}
-
-static int Space_setx(Space* self, PyObject* value, void* closure) {
-
-  if (value == NULL) {
-    PyErr_SetString(sSpaceException, "Cannot delete x");
-    return 0;
-  }
-
-  if (!PyFloat_Check(value) && !PyInt_Check(value)) {
-    PyErr_SetString(sSpaceException, "x must be a float");
-    return 0;
-  }
-
-  self->m_space.x(PyFloat_AsDouble(value));
-
-  return 0;
-}
-
-// -------------
-// ----- Y -----
-// -------------
-
-static PyObject* Space_gety(Space* self, void* closure) {
-  return PyFloat_FromDouble(self->m_space.y());
-}
-
-static int Space_sety(Space* self, PyObject* value, void* closure) {
-
-  if (value == NULL) {
-    PyErr_SetString(sSpaceException, "Cannot delete y");
-    return 0;
-  }
-
-  if (!PyFloat_Check(value) && !PyInt_Check(value)) {
-    PyErr_SetString(sSpaceException, "y must be a float");
-    return 0;
-  }
-
-  self->m_space.y(PyFloat_AsDouble(value));
-
-  return 0;
-}
-
-// -------------
-// ----- Z -----
-// -------------
-
-static PyObject* Space_getz(Space* self, void* closure) {
-  return PyFloat_FromDouble(self->m_space.z());
-}
-
-static int Space_setz(Space* self, PyObject* value, void* closure) {
-
-  if (value == NULL) {
-    PyErr_SetString(sSpaceException, "Cannot delete z");
-    return 0;
-  }
-
-  if (!PyFloat_Check(value) && !PyInt_Check(value)) {
-    PyErr_SetString(sSpaceException, "z must be a float");
-    return 0;
-  }
-
-  self->m_space.z(PyFloat_AsDouble(value));
-
-  return 0;
+  return PyUnicode_FromString(result.str().c_str());
 }
 
 // ==========================
@@ -288,7 +302,7 @@ static PyObject* nb_multiply(PyObject* o1, PyObject* o2) {
 }
 
 
-static PyObject* nb_divide(PyObject* o1, PyObject* o2) {
+static PyObject* nb_true_divide(PyObject* o1, PyObject* o2) {
   // This returns a Space object scaled by the divisor.  o1 must be
   // SpaceType, o2 a float or int otherwise this will raise a
   // NotImplemented error.
@@ -301,7 +315,7 @@ static PyObject* nb_divide(PyObject* o1, PyObject* o2) {
     return NULL;
   }
 
-  if (is_SpaceType(o1) && (PyFloat_Check(o2) || PyInt_Check(o2))) {
+  if (is_SpaceType(o1) && (PyFloat_Check(o2) || PyLong_Check(o2))) {
 
     try {
       result_space->m_space = ((Space*)o1)->m_space / PyFloat_AsDouble(o2);
@@ -331,16 +345,16 @@ static PyObject* tp_richcompare(PyObject* o1, PyObject* o2, int op) {
   if (op == Py_EQ) {
 
     if (((Space*)o1)->m_space == ((Space*)o2)->m_space)
-      return Py_True;
+      Py_RETURN_TRUE;
     else
-      return Py_False;
+      Py_RETURN_FALSE;
 
   } else if (op == Py_NE) {
 
     if (((Space*)o1)->m_space != ((Space*)o2)->m_space)
-      return Py_True;
+      Py_RETURN_TRUE;
     else
-      return Py_False;
+      Py_RETURN_FALSE;
 
   } else {
 
@@ -351,29 +365,177 @@ static PyObject* tp_richcompare(PyObject* o1, PyObject* o2, int op) {
 
 }
 
+// ========================
+// ===== copy methods =====
+// ========================
+
+// Python 3 object.__reduce_ex__() will not copy a C type with extra
+// state, so copy.copy() and copy.deepcopy() need these.
+
+static PyObject* Space_copy(PyObject* self, PyObject* unused) {
+
+  Space* result_space(NULL);
+
+  new_SpaceType(&result_space);
+
+  if (result_space == NULL) {
+    PyErr_SetString(sSpaceException, "copy failed to create space");
+    return NULL;
+  }
+
+  result_space->m_space = ((Space*)self)->m_space;
+
+  return (PyObject*) result_space;
+}
+
+static PyObject* Space_deepcopy(PyObject* self, PyObject* memo) {
+  // no references to other objects so deep is the same as shallow.
+  return Space_copy(self, NULL);
+}
+
+// ==========================
+// ===== pickle methods =====
+// ==========================
+
+// Pickles as space(x, y, z). Protocol 2 and up store each double as
+// an 8 byte binary float, and the load goes through the vectorcall
+// constructor without a __setstate__ call. A subclass instance with
+// attributes also pickles its __dict__, which __setstate__ restores.
+
+static PyObject* Space_reduce(PyObject* self, PyObject* unused) {
+
+  const Cartesian::space& a_space(((Space*)self)->m_space);
+  PyObject* a_dict(NULL);
+
+  if (!is_exact_SpaceType(self)) {
+    a_dict = PyObject_GetAttrString(self, "__dict__");
+    if (a_dict == NULL)
+      PyErr_Clear(); // __slots__, no __dict__
+  }
+
+  PyObject* a_reduce(a_dict != NULL && PyDict_Check(a_dict) && PyDict_Size(a_dict) > 0
+		     ? Py_BuildValue("O(ddd)O", (PyObject*) Py_TYPE(self),
+				     a_space.x(), a_space.y(), a_space.z(), a_dict)
+		     : Py_BuildValue("O(ddd)", (PyObject*) Py_TYPE(self),
+				     a_space.x(), a_space.y(), a_space.z()));
+  Py_XDECREF(a_dict);
+  return a_reduce;
+}
+
+// (x, y, z) state for the copyreg protocol.
+static PyObject* Space_getstate(PyObject* self, PyObject* unused) {
+  const Cartesian::space& a_space(((Space*)self)->m_space);
+  return Py_BuildValue("(ddd)", a_space.x(), a_space.y(), a_space.z());
+}
+
+// Also takes the __dict__ Space_reduce() pickles for subclasses.
+static PyObject* Space_setstate(PyObject* self, PyObject* state) {
+
+  if (PyDict_Check(state)) {
+    Py_ssize_t a_position(0);
+    PyObject* a_key(NULL);
+    PyObject* a_value(NULL);
+    while (PyDict_Next(state, &a_position, &a_key, &a_value))
+      if (PyObject_SetAttr(self, a_key, a_value) < 0)
+	return NULL;
+    Py_RETURN_NONE;
+  }
+
+  double xyz[3] = {0.0, 0.0, 0.0};
+
+  if (!PyArg_ParseTuple(state, "ddd", &xyz[0], &xyz[1], &xyz[2]))
+    return NULL;
+
+  ((Space*)self)->m_space = Cartesian::space(xyz[0], xyz[1], xyz[2]);
+
+  Py_RETURN_NONE;
+}
+
 // ---------------------------
 // ----- inplace methods -----
 // ---------------------------
 
+// The module constants are shared by every caller, so u = space.Ux;
+// u += space.Uy must not change space.Ux. The inplace methods make a
+// new Space for them, as the binary operators do.
+static bool is_constant(PyObject* o1) {
+  for (unsigned int k = 0; k < sizeof(sConstants) / sizeof(sConstants[0]); ++k)
+    if (o1 == sConstants[k])
+      return true;
+  return false;
+}
+
 static PyObject* nb_inplace_add(PyObject* o1, PyObject* o2) {
-  // TODO can this be implement directly using space::operator+=()?
-  // problem with refence going out of scope, segfault.
-  return nb_add(o1, o2);
+  // Mutates o1 with space::operator+=() instead of allocating a new
+  // Space. The interpreter rebinds the target to the returned object
+  // and drops its reference to the old one, so we must hand back a new
+  // reference to o1 or it is freed out from under the caller.
+
+  if (is_constant(o1))
+    return nb_add(o1, o2);
+
+  if (!is_SpaceType(o1) || !is_SpaceType(o2)) {
+    Py_INCREF(Py_NotImplemented);
+    return Py_NotImplemented;
+  }
+
+  ((Space*)o1)->m_space += ((Space*)o2)->m_space;
+
+  Py_INCREF(o1);
+  return o1;
 }
 
 static PyObject* nb_inplace_subtract(PyObject* o1, PyObject* o2) {
-  // TOOD implement directly?
-  return nb_subtract(o1, o2);
+
+  if (is_constant(o1))
+    return nb_subtract(o1, o2);
+
+  if (!is_SpaceType(o1) || !is_SpaceType(o2)) {
+    Py_INCREF(Py_NotImplemented);
+    return Py_NotImplemented;
+  }
+
+  ((Space*)o1)->m_space -= ((Space*)o2)->m_space;
+
+  Py_INCREF(o1);
+  return o1;
 }
 
 static PyObject* nb_inplace_multiply(PyObject* o1, PyObject* o2) {
-  // TOOD implement directly?
+  // space *= double scales in place with space::operator*=().
+  // space *= space is still the dot product, a float, so it can not
+  // be done in place and falls back to nb_multiply.
+
+  if (is_SpaceType(o1) && (PyFloat_Check(o2) || PyLong_Check(o2))) {
+    if (is_constant(o1))
+      return space_create(((Space*)o1)->m_space * PyFloat_AsDouble(o2));
+    ((Space*)o1)->m_space *= PyFloat_AsDouble(o2);
+    Py_INCREF(o1);
+    return o1;
+  }
+
   return nb_multiply(o1, o2);
 }
 
-static PyObject* nb_inplace_divide(PyObject* o1, PyObject* o2) {
-  // TOOD implement directly?
-  return nb_divide(o1, o2);
+static PyObject* nb_inplace_true_divide(PyObject* o1, PyObject* o2) {
+
+  if (is_constant(o1))
+    return nb_true_divide(o1, o2);
+
+  if (!is_SpaceType(o1) || !(PyFloat_Check(o2) || PyLong_Check(o2))) {
+    Py_INCREF(Py_NotImplemented);
+    return Py_NotImplemented;
+  }
+
+  try {
+    ((Space*)o1)->m_space /= PyFloat_AsDouble(o2);
+  } catch (Cartesian::DivideZeroError& err) {
+    PyErr_SetString(sSpaceException, "divide attempted divide by zero");
+    return NULL;
+  }
+
+  Py_INCREF(o1);
+  return o1;
 }
 
 // ==========================
@@ -382,54 +544,52 @@ static PyObject* nb_inplace_divide(PyObject* o1, PyObject* o2) {
 
 
 static PyMethodDef Space_methods[] = {
+    {"__copy__", (PyCFunction) Space_copy, METH_NOARGS, "Returns a copy of the space"},
+    {"__deepcopy__", (PyCFunction) Space_deepcopy, METH_O, "Returns a copy of the space"},
+    {"__reduce__", (PyCFunction) Space_reduce, METH_NOARGS, "Pickles as space(x, y, z)"},
+    {"__getstate__", (PyCFunction) Space_getstate, METH_NOARGS, "Returns (x, y, z)"},
+    {"__setstate__", (PyCFunction) Space_setstate, METH_O, "Sets from (x, y, z)"},
     {NULL}  /* Sentinel */
 };
 
 
 static PyMemberDef Space_members[] = {
+    {sXstr, T_DOUBLE, sXoffset, 0, sXstr},
+    {sYstr, T_DOUBLE, sYoffset, 0, sYstr},
+    {sZstr, T_DOUBLE, sZoffset, 0, sZstr},
     {NULL}  /* Sentinel */
 };
 
 
 static PyGetSetDef Space_getseters[] = {
-    {sXstr, (getter)Space_getx, (setter)Space_setx, sXstr, NULL},
-    {sYstr, (getter)Space_gety, (setter)Space_sety, sYstr, NULL},
-    {sZstr, (getter)Space_getz, (setter)Space_setz, sZstr, NULL},
     {NULL}  /* Sentinel */
 };
 
-// see http://docs.python.org/c-api/typeobj.html
+// see http://docs.python.org/3/c-api/typeobj.html
 static PyNumberMethods space_as_number = {
   (binaryfunc) nb_add,
   (binaryfunc) nb_subtract,
   (binaryfunc) nb_multiply,
-  (binaryfunc) nb_divide,
   (binaryfunc) 0,  // nb_remainder
   (binaryfunc) 0,  // nb_divmod
   (ternaryfunc) 0, // nb_power
   (unaryfunc) nb_negative,
   (unaryfunc) 0,   // nb_positive
   (unaryfunc) 0,   // nb_absolute
-  (inquiry) 0,     // nb_nonzero. Used by PyObject_IsTrue.
+  (inquiry) 0,     // nb_bool. Used by PyObject_IsTrue.
   (unaryfunc) 0,   // nb_invert
   (binaryfunc) 0,  // nb_lshift
   (binaryfunc) 0,  // nb_rshift
   (binaryfunc) 0,  // nb_and
   (binaryfunc) 0,  // nb_xor
   (binaryfunc) 0,  // nb_or
-  (coercion) 0,    // Used by the coerce() function
   (unaryfunc) 0,   // nb_int
-  (unaryfunc) 0,   // nb_long
+  (void*) 0,       // nb_reserved
   (unaryfunc) 0,   // nb_float
-  (unaryfunc) 0,   // nb_oct
-  (unaryfunc) 0,   // nb_hex
-
-  // added in release 2.0
 
   (binaryfunc) nb_inplace_add,
   (binaryfunc) nb_inplace_subtract,
   (binaryfunc) nb_inplace_multiply,
-  (binaryfunc) nb_inplace_divide,
   (binaryfunc) 0,  // nb_inplace_remainder
   (ternaryfunc) 0, // nb_inplace_power
   (binaryfunc) 0,  // nb_inplace_lshift
@@ -438,26 +598,27 @@ static PyNumberMethods space_as_number = {
   (binaryfunc) 0,  // nb_inplace_xor
   (binaryfunc) 0,  // nb_inplace_or
 
-  // added in release 2.2
   (binaryfunc) 0,  // nb_floor_divide
-  (binaryfunc) 0,  // nb_true_divide
+  (binaryfunc) nb_true_divide,
   (binaryfunc) 0,  // nb_inplace_floor_divide
-  (binaryfunc) 0,  // nb_inplace_true_divide
+  (binaryfunc) nb_inplace_true_divide,
 
+  (unaryfunc) 0,   // nb_index
+  (binaryfunc) 0,  // nb_matrix_multiply
+  (binaryfunc) 0,  // nb_inplace_matrix_multiply
 };
 
 
 PyTypeObject SpaceType = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                        /* ob_size */
-  "space",                                  /* tp_name */
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "space.space",                            /* tp_name */
   sizeof(Space),                            /* tp_basicsize */
   0,                                        /* tp_itemsize */
   (destructor) Space_dealloc,               /* tp_dealloc */
-  0,                                        /* tp_print */
+  0,                                        /* tp_vectorcall_offset */
   0,                                        /* tp_getattr */
   0,                                        /* tp_setattr */
-  0,                                        /* tp_compare */
+  0,                                        /* tp_as_async */
   Space_repr,                               /* tp_repr */
   &space_as_number,                         /* tp_as_number */
   0,                                        /* tp_as_sequence */
@@ -468,7 +629,7 @@ PyTypeObject SpaceType = {
   0,                                        /* tp_getattro */
   0,                                        /* tp_setattro */
   0,                                        /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_CHECKTYPES, /* tp_flags */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
   "Space objects",                          /* tp_doc */
   0,                                        /* tp_traverse */
   0,                                        /* tp_clear */
@@ -491,9 +652,14 @@ PyTypeObject SpaceType = {
 
 
 // Create new objects with PyObject_New() for binary operators that
-// return a new instance of Space, like add.
+// return a new instance of Space, like add. Reuses an object from the
+// free list when there is one.
 static void new_SpaceType(Space** a_space) {
-  *a_space = PyObject_New(Space, &SpaceType); // alloc and inits?
+  *a_space = free_list_pop();
+  if (*a_space != NULL)
+    PyObject_INIT(*a_space, &SpaceType);
+  else
+    *a_space = PyObject_New(Space, &SpaceType); // alloc and inits?
 }
 
 static int is_SpaceType(PyObject* a_space) {
@@ -501,27 +667,523 @@ static int is_SpaceType(PyObject* a_space) {
   return PyObject_TypeCheck(a_space, &SpaceType);
 }
 
+static int is_exact_SpaceType(PyObject* a_space) {
+  // subclasses are not pooled on the free list.
+  return Py_TYPE(a_space) == &SpaceType;
+}
+
+// tp_alloc so space() from python also uses the free list.
+static PyObject* Space_alloc(PyTypeObject* type, Py_ssize_t nitems) {
+
+  if (type != &SpaceType)
+    return PyType_GenericAlloc(type, nitems);
+
+  Space* self(NULL);
+  new_SpaceType(&self);
+
+  if (self != NULL)
+    self->m_space.zero(); // PyType_GenericAlloc returns zeroed memory
+
+  return (PyObject*)self;
+}
+
+#if PY_VERSION_HEX >= 0x03090000
+// tp_vectorcall so space(x, y, z) skips building the argument tuple
+// and the tp_new, tp_init dispatch. Keyword calls, and subtypes, which
+// must get their own type, tp_new and __init__, go the long way
+// through PyType_Type.tp_call.
+static PyObject* Space_vectorcall(PyObject* type, PyObject* const* args,
+				  size_t nargsf, PyObject* kwnames) {
+
+  Py_ssize_t nargs(PyVectorcall_NARGS(nargsf));
+
+  if (kwnames != NULL || nargs > 3 || (PyTypeObject*) type != &SpaceType) {
+
+    PyObject* a_tuple(PyTuple_New(nargs));
+    if (a_tuple == NULL)
+      return NULL;
+
+    for (Py_ssize_t i(0); i < nargs; ++i) {
+      Py_INCREF(args[i]);
+      PyTuple_SET_ITEM(a_tuple, i, args[i]);
+    }
+
+    PyObject* a_dict(NULL);
+
+    if (kwnames != NULL) {
+      a_dict = PyDict_New();
+      for (Py_ssize_t i(0); a_dict != NULL && i < PyTuple_GET_SIZE(kwnames); ++i) {
+	if (PyDict_SetItem(a_dict, PyTuple_GET_ITEM(kwnames, i), args[nargs + i]) < 0)
+	  Py_CLEAR(a_dict);
+      }
+      if (a_dict == NULL) {
+	Py_DECREF(a_tuple);
+	return NULL;
+      }
+    }
+
+    PyObject* result(PyType_Type.tp_call(type, a_tuple, a_dict));
+    Py_DECREF(a_tuple);
+    Py_XDECREF(a_dict);
+    return result;
+  }
+
+  double xyz[3] = {0.0, 0.0, 0.0};
+
+  for (Py_ssize_t i(0); i < nargs; ++i) {
+    xyz[i] = PyFloat_AsDouble(args[i]);
+    if (xyz[i] == -1.0 && PyErr_Occurred())
+      return NULL;
+  }
+
+  Space* self(NULL);
+  new_SpaceType(&self);
+
+  if (self == NULL) {
+    PyErr_SetString(sSpaceException, "failed to create space.");
+    return NULL;
+  }
+
+  self->m_space = Cartesian::space(xyz[0], xyz[1], xyz[2]);
+
+  return (PyObject*)self;
+}
+#endif
+
+// ===============================
+// ===== shared space arrays =====
+// ===============================
+
+// SharedSpaceArray is a fixed size array of Cartesian::space in POSIX
+// shared memory, for trajectory buffers shared between processes.
+//
+//   a = space.SharedSpaceArray("traj", 1000)  # creates /traj
+//   b = space.SharedSpaceArray("traj")        # attaches, maybe in another process
+//
+// It pickles as its name, so passing one to a multiprocessing worker
+// attaches to the same memory instead of copying it. The contents are
+// also an N x 3 double buffer, numpy.asarray(a) is a writable view.
+//
+// Like multiprocessing.shared_memory the segment outlives the objects
+// that map it until one of them calls unlink().
+
+// at the start of the segment, 64 bytes so the data is cache line aligned.
+struct SharedSpaceHeader {
+  char     m_magic[8];
+  uint64_t m_size;      // number of spaces
+  char     m_pad[48];
+};
+
+static_assert(sizeof(SharedSpaceHeader) == 64, "SharedSpaceHeader must be 64 bytes");
+
+static const char sSharedSpaceMagic[8] = {'S', 'P', 'A', 'C', 'E', 'A', 'R', 'R'};
+
+typedef struct {
+  PyObject_HEAD
+  PyObject*         m_name;    // as given to the constructor
+  void*             m_map;     // NULL once closed
+  size_t            m_map_size;
+  Cartesian::space* m_data;
+  Py_ssize_t        m_shape[2];   // for the buffer protocol
+  Py_ssize_t        m_strides[2];
+  Py_ssize_t        m_exports;    // buffers handed out
+} SharedSpaceArray;
+
+extern PyTypeObject SharedSpaceArrayType;
+
+// shm_open() names are /name. Returns 0 with an exception set if
+// a_name will not encode.
+static int shm_name(PyObject* a_name, std::string& a_shm_name) {
+  const char* a_utf8(PyUnicode_AsUTF8(a_name));
+  if (a_utf8 == NULL)
+    return 0;
+  a_shm_name = a_utf8;
+  if (a_shm_name.empty() || a_shm_name[0] != '/')
+    a_shm_name.insert(0, "/");
+  return 1;
+}
+
+static int shared_is_open(SharedSpaceArray* self) {
+  if (self->m_map != NULL)
+    return 1;
+  PyErr_SetString(PyExc_ValueError, "operation on a closed SharedSpaceArray");
+  return 0;
+}
+
+// Unmaps, leaves the segment for other processes.
+static void shared_unmap(SharedSpaceArray* self) {
+  if (self->m_map != NULL)
+    munmap(self->m_map, self->m_map_size);
+  self->m_map = NULL;
+  self->m_map_size = 0;
+  self->m_data = NULL;
+  self->m_shape[0] = 0;
+}
+
+static int SharedSpaceArray_init(SharedSpaceArray* self, PyObject* args, PyObject* kwds) {
+
+  static char sNameStr[] = "name";
+  static char sSizeStr[] = "size";
+  static char* kwlist[] = {sNameStr, sSizeStr, NULL};
+
+  PyObject* a_name(NULL);
+  Py_ssize_t a_size(-1); // attach
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "U|n", kwlist, &a_name, &a_size))
+    return -1;
+
+  if (self->m_map != NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "SharedSpaceArray is already open");
+    return -1;
+  }
+
+  if (a_size < -1) {
+    PyErr_SetString(PyExc_ValueError, "SharedSpaceArray size must not be negative");
+    return -1;
+  }
+
+  // the header and a_size spaces must fit in a Py_ssize_t.
+  if (a_size > (Py_ssize_t) ((PY_SSIZE_T_MAX - sizeof(SharedSpaceHeader)) / sizeof(Cartesian::space))) {
+    PyErr_SetString(PyExc_OverflowError, "SharedSpaceArray size is too large");
+    return -1;
+  }
+
+  std::string a_shm_name;
+  if (!shm_name(a_name, a_shm_name))
+    return -1;
+
+  bool create(a_size >= 0);
+
+  int fd(shm_open(a_shm_name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600));
+
+  if (fd < 0) {
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, a_name);
+    return -1;
+  }
+
+  size_t a_map_size(0);
+
+  if (create) {
+    a_map_size = sizeof(SharedSpaceHeader) + a_size * sizeof(Cartesian::space);
+    if (ftruncate(fd, a_map_size) < 0) {
+      PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, a_name);
+      close(fd);
+      shm_unlink(a_shm_name.c_str());
+      return -1;
+    }
+  } else {
+    struct stat a_stat;
+    if (fstat(fd, &a_stat) < 0) {
+      PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, a_name);
+      close(fd);
+      return -1;
+    }
+    a_map_size = a_stat.st_size;
+  }
+
+  void* a_map(a_map_size >= sizeof(SharedSpaceHeader)
+	      ? mmap(NULL, a_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+	      : MAP_FAILED);
+  int an_errno(a_map_size >= sizeof(SharedSpaceHeader) ? errno : EINVAL);
+
+  close(fd); // the mapping keeps the segment
+
+  if (a_map == MAP_FAILED) {
+    errno = an_errno;
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, a_name);
+    if (create)
+      shm_unlink(a_shm_name.c_str());
+    return -1;
+  }
+
+  SharedSpaceHeader* a_header((SharedSpaceHeader*)a_map);
+
+  if (create) {
+    // ftruncate zero fills, so the data starts as Uo.
+    a_header->m_size = a_size;
+    memcpy(a_header->m_magic, sSharedSpaceMagic, sizeof(sSharedSpaceMagic));
+  } else if (memcmp(a_header->m_magic, sSharedSpaceMagic, sizeof(sSharedSpaceMagic)) != 0 ||
+	     a_header->m_size > (a_map_size - sizeof(SharedSpaceHeader)) / sizeof(Cartesian::space)) {
+    // divides rather than multiplies, so a corrupt m_size can not wrap.
+    munmap(a_map, a_map_size);
+    PyErr_Format(PyExc_ValueError, "%U is not a SharedSpaceArray", a_name);
+    return -1;
+  }
+
+  Py_INCREF(a_name);
+  Py_XSETREF(self->m_name, a_name);
+  self->m_map = a_map;
+  self->m_map_size = a_map_size;
+  self->m_data = (Cartesian::space*)(a_header + 1);
+  self->m_shape[0] = a_header->m_size;
+  self->m_shape[1] = 3;
+  self->m_strides[0] = sizeof(Cartesian::space);
+  self->m_strides[1] = sizeof(double);
+
+  return 0;
+}
+
+static void SharedSpaceArray_dealloc(SharedSpaceArray* self) {
+  shared_unmap(self);
+  Py_XDECREF(self->m_name);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* SharedSpaceArray_repr(SharedSpaceArray* self) {
+  return PyUnicode_FromFormat("SharedSpaceArray(%R, %zd)%s", self->m_name, self->m_shape[0],
+			      self->m_map == NULL ? " closed" : "");
+}
+
+// ----- sequence methods -----
+
+static Py_ssize_t SharedSpaceArray_length(SharedSpaceArray* self) {
+  return self->m_shape[0];
+}
+
+static PyObject* SharedSpaceArray_item(SharedSpaceArray* self, Py_ssize_t idx) {
+
+  if (!shared_is_open(self))
+    return NULL;
+
+  if (idx < 0 || idx >= self->m_shape[0]) {
+    PyErr_SetString(PyExc_IndexError, "SharedSpaceArray index out of range");
+    return NULL;
+  }
+
+  return space_create(self->m_data[idx]);
+}
+
+static int SharedSpaceArray_ass_item(SharedSpaceArray* self, Py_ssize_t idx, PyObject* value) {
+
+  if (!shared_is_open(self))
+    return -1;
+
+  if (idx < 0 || idx >= self->m_shape[0]) {
+    PyErr_SetString(PyExc_IndexError, "SharedSpaceArray index out of range");
+    return -1;
+  }
+
+  if (value == NULL || !is_SpaceType(value)) {
+    PyErr_SetString(PyExc_TypeError, "SharedSpaceArray items must be space");
+    return -1;
+  }
+
+  self->m_data[idx] = ((Space*)value)->m_space;
+
+  return 0;
+}
+
+// ----- buffer protocol -----
+
+static int SharedSpaceArray_getbuffer(SharedSpaceArray* self, Py_buffer* view, int flags) {
+
+  if (!shared_is_open(self)) {
+    view->obj = NULL;
+    return -1;
+  }
+
+  Py_INCREF(self);
+  view->obj = (PyObject*)self;
+  view->buf = self->m_data;
+  view->len = self->m_shape[0] * sizeof(Cartesian::space);
+  view->readonly = 0;
+  view->itemsize = sizeof(double);
+  view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? (char*)"d" : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  if ((flags & PyBUF_ND) == PyBUF_ND) {
+    view->ndim = 2;
+    view->shape = self->m_shape;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->m_strides : NULL;
+  } else {
+    view->ndim = 1;
+    view->shape = NULL;
+    view->strides = NULL;
+  }
+
+  ++self->m_exports;
+
+  return 0;
+}
+
+static void SharedSpaceArray_releasebuffer(SharedSpaceArray* self, Py_buffer* view) {
+  --self->m_exports;
+}
+
+// ----- methods -----
+
+static PyObject* SharedSpaceArray_close(SharedSpaceArray* self, PyObject* unused) {
+
+  if (self->m_exports > 0) {
+    PyErr_SetString(PyExc_BufferError, "cannot close a SharedSpaceArray with views into it");
+    return NULL;
+  }
+
+  shared_unmap(self);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject* SharedSpaceArray_unlink(SharedSpaceArray* self, PyObject* unused) {
+
+  if (self->m_name == NULL) {
+    PyErr_SetString(PyExc_ValueError, "SharedSpaceArray was never opened");
+    return NULL;
+  }
+
+  std::string a_shm_name;
+  if (!shm_name(self->m_name, a_shm_name))
+    return NULL;
+
+  if (shm_unlink(a_shm_name.c_str()) < 0)
+    return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->m_name);
+
+  Py_RETURN_NONE;
+}
+
+// pickles as its name so unpickling attaches.
+static PyObject* SharedSpaceArray_reduce(SharedSpaceArray* self, PyObject* unused) {
+  if (self->m_name == NULL) {
+    PyErr_SetString(PyExc_ValueError, "SharedSpaceArray was never opened");
+    return NULL;
+  }
+  return Py_BuildValue("O(O)", (PyObject*) Py_TYPE(self), self->m_name);
+}
+
+static PyObject* SharedSpaceArray_get_name(SharedSpaceArray* self, void* closure) {
+  if (self->m_name == NULL)
+    Py_RETURN_NONE;
+  Py_INCREF(self->m_name);
+  return self->m_name;
+}
+
+static PyObject* SharedSpaceArray_get_closed(SharedSpaceArray* self, void* closure) {
+  return PyBool_FromLong(self->m_map == NULL);
+}
+
+static PyMethodDef SharedSpaceArray_methods[] = {
+  {"close", (PyCFunction) SharedSpaceArray_close, METH_NOARGS,
+   "Unmaps the array. The segment stays until unlink()"},
+  {"unlink", (PyCFunction) SharedSpaceArray_unlink, METH_NOARGS,
+   "Removes the segment name. Mappings stay valid until closed"},
+  {"__reduce__", (PyCFunction) SharedSpaceArray_reduce, METH_NOARGS,
+   "Pickles as the name, unpickling attaches"},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef SharedSpaceArray_getseters[] = {
+  {(char*)"name", (getter) SharedSpaceArray_get_name, NULL, (char*)"shared memory name", NULL},
+  {(char*)"closed", (getter) SharedSpaceArray_get_closed, NULL, (char*)"True once closed", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods SharedSpaceArray_as_sequence = {
+  (lenfunc) SharedSpaceArray_length,        /* sq_length */
+  0,                                        /* sq_concat */
+  0,                                        /* sq_repeat */
+  (ssizeargfunc) SharedSpaceArray_item,     /* sq_item */
+  0,                                        /* was_sq_slice */
+  (ssizeobjargproc) SharedSpaceArray_ass_item, /* sq_ass_item */
+  0,                                        /* was_sq_ass_slice */
+  0,                                        /* sq_contains */
+  0,                                        /* sq_inplace_concat */
+  0,                                        /* sq_inplace_repeat */
+};
+
+static PyBufferProcs SharedSpaceArray_as_buffer = {
+  (getbufferproc) SharedSpaceArray_getbuffer,
+  (releasebufferproc) SharedSpaceArray_releasebuffer,
+};
+
+PyTypeObject SharedSpaceArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "space.SharedSpaceArray",                 /* tp_name */
+  sizeof(SharedSpaceArray),                 /* tp_basicsize */
+  0,                                        /* tp_itemsize */
+  (destructor) SharedSpaceArray_dealloc,    /* tp_dealloc */
+  0,                                        /* tp_vectorcall_offset */
+  0,                                        /* tp_getattr */
+  0,                                        /* tp_setattr */
+  0,                                        /* tp_as_async */
+  (reprfunc) SharedSpaceArray_repr,         /* tp_repr */
+  0,                                        /* tp_as_number */
+  &SharedSpaceArray_as_sequence,            /* tp_as_sequence */
+  0,                                        /* tp_as_mapping */
+  0,                                        /* tp_hash */
+  0,                                        /* tp_call */
+  0,                                        /* tp_str */
+  0,                                        /* tp_getattro */
+  0,                                        /* tp_setattro */
+  &SharedSpaceArray_as_buffer,              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+  "SharedSpaceArray(name[, size]) creates with size, otherwise attaches", /* tp_doc */
+  0,                                        /* tp_traverse */
+  0,                                        /* tp_clear */
+  0,                                        /* tp_richcompare */
+  0,                                        /* tp_weaklistoffset */
+  0,                                        /* tp_iter */
+  0,                                        /* tp_iternext */
+  SharedSpaceArray_methods,                 /* tp_methods */
+  0,                                        /* tp_members */
+  SharedSpaceArray_getseters,               /* tp_getset */
+  0,                                        /* tp_base */
+  0,                                        /* tp_dict */
+  0,                                        /* tp_descr_get */
+  0,                                        /* tp_descr_set */
+  0,                                        /* tp_dictoffset */
+  (initproc) SharedSpaceArray_init,         /* tp_init */
+  0,                                        /* tp_alloc */
+  PyType_GenericNew,                        /* tp_new */
+};
+
 // ==========================
 // ===== module methods =====
 // ==========================
 
+// The module functions are METH_FASTCALL, they get their arguments as
+// a C array instead of a tuple to unpack with PyArg_ParseTuple().
+// check_space_args() stands in for the "OO" format and also checks
+// the type, which the old "O" did not.
+
+static int check_space_args(const char* a_name,
+			    PyObject* const* args, Py_ssize_t nargs,
+			    Py_ssize_t an_expected) {
+
+  if (nargs != an_expected) {
+    PyErr_Format(PyExc_TypeError, "%s() takes exactly %zd argument%s (%zd given)",
+		 a_name, an_expected, an_expected == 1 ? "" : "s", nargs);
+    return 0;
+  }
+
+  for (Py_ssize_t i(0); i < nargs; ++i) {
+    if (!is_SpaceType(args[i])) {
+      PyErr_Format(PyExc_TypeError, "%s() argument %zd must be space, not %.200s",
+		   a_name, i + 1, Py_TYPE(args[i])->tp_name);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 // -------------------------
 // ----- cross product -----
 // -------------------------
 
 PyDoc_STRVAR(space_cross__doc__, "Returns the cross product of two space objects");
 
-static PyObject* cross(PyObject* self, PyObject *args) {
-
-  Space* first_space(NULL);
-  Space* second_space(NULL);
-  Space* result_space(NULL);
+static PyObject* cross(PyObject* self, PyObject* const* args, Py_ssize_t nargs) {
 
-  // O is borrowed reference
-  if (!PyArg_ParseTuple(args, "OO", &first_space, &second_space))
+  if (!check_space_args("cross", args, nargs, 2))
     return NULL;
 
-  result_space = PyObject_New(Space, &SpaceType); // alloc and inits
+  // borrowed references
+  Space* first_space((Space*)args[0]);
+  Space* second_space((Space*)args[1]);
+  Space* result_space(NULL);
+
+  new_SpaceType(&result_space);
 
   if (result_space == NULL) {
     PyErr_SetString(sSpaceException, "cross failed to create space.");
@@ -543,20 +1205,19 @@ static PyObject* cross(PyObject* self, PyObject *args) {
 
 PyDoc_STRVAR(space_dot__doc__, "Returns the dot product of two space objects");
 
-static PyObject* dot(PyObject* self, PyObject *args) {
+static PyObject* dot(PyObject* self, PyObject* const* args, Py_ssize_t nargs) {
 
-  Space* first_space(NULL);
-  Space* second_space(NULL);
-
-  // O is borrowed reference
-  if (!PyArg_ParseTuple(args, "OO", &first_space, &second_space))
+  if (!check_space_args("dot", args, nargs, 2))
     return NULL;
 
+  // borrowed references
+  Space* first_space((Space*)args[0]);
+  Space* second_space((Space*)args[1]);
 
   double a_dot_product(Cartesian::dot(first_space->m_space,
 		                      second_space->m_space));
 
-  return (PyObject*) Py_BuildValue("d", a_dot_product);
+  return PyFloat_FromDouble(a_dot_product);
 
 }
 
@@ -566,17 +1227,16 @@ static PyObject* dot(PyObject* self, PyObject *args) {
 
 PyDoc_STRVAR(space_magnitude__doc__, "Returns the magnitude of the space object");
 
-static PyObject* magnitude(PyObject* self, PyObject *args) {
-
-  Space* a_space(NULL);
+static PyObject* magnitude(PyObject* self, PyObject* const* args, Py_ssize_t nargs) {
 
-  // O is borrowed reference
-  if (!PyArg_ParseTuple(args, "O", &a_space))
+  if (!check_space_args("magnitude", args, nargs, 1))
     return NULL;
 
+  Space* a_space((Space*)args[0]); // borrowed reference
+
   double a_magnitude(a_space->m_space.magnitude());
 
-  return (PyObject*)  Py_BuildValue("d", a_magnitude);
+  return PyFloat_FromDouble(a_magnitude);
 
 }
 
@@ -586,16 +1246,15 @@ static PyObject* magnitude(PyObject* self, PyObject *args) {
 
 PyDoc_STRVAR(space_normalized__doc__, "Returns the normalized version of the space object");
 
-static PyObject* normalized(PyObject* self, PyObject *args) {
+static PyObject* normalized(PyObject* self, PyObject* const* args, Py_ssize_t nargs) {
 
-  Space* a_space(NULL);
-  Space* result_space(NULL);
-
-  // O is borrowed reference
-  if (!PyArg_ParseTuple(args, "O", &a_space))
+  if (!check_space_args("normalized", args, nargs, 1))
     return NULL;
 
-  result_space = PyObject_New(Space, &SpaceType); // alloc and inits
+  Space* a_space((Space*)args[0]); // borrowed reference
+  Space* result_space(NULL);
+
+  new_SpaceType(&result_space);
 
   if (result_space == NULL) {
     PyErr_SetString(sSpaceException, "normalized failed to create space.");
@@ -611,15 +1270,76 @@ static PyObject* normalized(PyObject* self, PyObject *args) {
 }
 
 
+// ---------------------
+// ----- free list -----
+// ---------------------
+
+PyDoc_STRVAR(space_freelist_stats__doc__,
+	     "Returns a dict of the Space free list size, max, hits, misses and overflows");
+
+static PyObject* freelist_stats(PyObject* self, PyObject* unused) {
+  return Py_BuildValue("{s:i,s:i,s:k,s:k,s:k}",
+		       "size", sFreeListSize,
+		       "max", sFreeListMax,
+		       "hits", sFreeListHits,
+		       "misses", sFreeListMisses,
+		       "overflows", sFreeListOverflows);
+}
+
+PyDoc_STRVAR(space_reset_freelist_stats__doc__,
+	     "Zeros the Space free list hits, misses and overflows counters");
+
+static PyObject* reset_freelist_stats(PyObject* self, PyObject* unused) {
+  sFreeListHits = 0;
+  sFreeListMisses = 0;
+  sFreeListOverflows = 0;
+  Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(space_set_freelist_max__doc__,
+	     "Sets the Space free list cap, 0 disables it. Returns the old cap");
+
+static PyObject* set_freelist_max(PyObject* self, PyObject* args) {
+
+  int a_max(0);
+
+  if (!PyArg_ParseTuple(args, "i", &a_max))
+    return NULL;
+
+  if (a_max < 0) {
+    PyErr_SetString(PyExc_ValueError, "free list max must be >= 0");
+    return NULL;
+  }
+
+  int old_max(sFreeListMax);
+  sFreeListMax = a_max;
+  free_list_trim(sFreeListMax);
+
+  return Py_BuildValue("i", old_max);
+}
+
+PyDoc_STRVAR(space_clear_freelist__doc__,
+	     "Frees all Space objects on the free list. Returns the number freed");
+
+static PyObject* clear_freelist(PyObject* self, PyObject* unused) {
+  return Py_BuildValue("i", free_list_trim(0));
+}
+
+
 // -----------------------
 // ----- method list -----
 // -----------------------
 
+// _PyCFunctionFast is cast through void(*)(void) to quiet -Wcast-function-type
 PyMethodDef space_module_methods[] = {
-  {"cross", (PyCFunction) cross, METH_VARARGS, space_cross__doc__},
-  {"dot", (PyCFunction) dot, METH_VARARGS, space_dot__doc__},
-  {"magnitude", (PyCFunction) magnitude, METH_VARARGS, space_magnitude__doc__},
-  {"normalized", (PyCFunction) normalized, METH_VARARGS, space_normalized__doc__},
+  {"cross", (PyCFunction)(void(*)(void)) cross, METH_FASTCALL, space_cross__doc__},
+  {"dot", (PyCFunction)(void(*)(void)) dot, METH_FASTCALL, space_dot__doc__},
+  {"magnitude", (PyCFunction)(void(*)(void)) magnitude, METH_FASTCALL, space_magnitude__doc__},
+  {"normalized", (PyCFunction)(void(*)(void)) normalized, METH_FASTCALL, space_normalized__doc__},
+  {"freelist_stats", (PyCFunction) freelist_stats, METH_NOARGS, space_freelist_stats__doc__},
+  {"reset_freelist_stats", (PyCFunction) reset_freelist_stats, METH_NOARGS, space_reset_freelist_stats__doc__},
+  {"set_freelist_max", (PyCFunction) set_freelist_max, METH_VARARGS, space_set_freelist_max__doc__},
+  {"clear_freelist", (PyCFunction) clear_freelist, METH_NOARGS, space_clear_freelist__doc__},
   {NULL, NULL}  /* Sentinel */
 };
 
@@ -636,7 +1356,7 @@ PyObject* space_create(const Cartesian::space& a_space) {
   // TODO borrowed reference?
   Space* py_space(NULL);
 
-  py_space = PyObject_New(Space, &SpaceType); // alloc and inits
+  new_SpaceType(&py_space);
 
   // TODO exception handle this
   if (py_space == NULL){
@@ -656,19 +1376,39 @@ PyObject* space_create(const Cartesian::space& a_space) {
 // ===== init =====
 // ================
 
-// PyMODINIT_FUNC declares extern "C" too.
-PyMODINIT_FUNC initspace(void) {
-
-  PyObject* m(Py_InitModule3("space", space_module_methods, "python wrappers for space objects."));
+static struct PyModuleDef space_module = {
+  PyModuleDef_HEAD_INIT,
+  "space",                               /* m_name */
+  "python wrappers for space objects.",  /* m_doc */
+  -1,                                    /* m_size */
+  space_module_methods,                  /* m_methods */
+};
 
+// PyMODINIT_FUNC declares extern "C" too.
+PyMODINIT_FUNC PyInit_space(void) {
 
   SpaceType.tp_new = PyType_GenericNew;
+  SpaceType.tp_alloc = Space_alloc;
+#if PY_VERSION_HEX >= 0x03090000
+  SpaceType.tp_vectorcall = Space_vectorcall;
+#endif
   if (PyType_Ready(&SpaceType) < 0)
-    return;
+    return NULL;
+
+  if (PyType_Ready(&SharedSpaceArrayType) < 0)
+    return NULL;
+
+  PyObject* m(PyModule_Create(&space_module));
+
+  if (m == NULL)
+    return NULL;
 
   Py_INCREF(&SpaceType);
   PyModule_AddObject(m, "space", (PyObject *)&SpaceType);
 
+  Py_INCREF(&SharedSpaceArrayType);
+  PyModule_AddObject(m, "SharedSpaceArray", (PyObject *)&SharedSpaceArrayType);
+
 
   // errors
   char eMsgStr[] = "space.Error";
@@ -680,21 +1420,30 @@ PyMODINIT_FUNC initspace(void) {
   PyObject* space_Uo(NULL);
   space_Uo = space_create(Cartesian::space::Uo);
   Py_INCREF(space_Uo);
+  sConstants[0] = space_Uo;
   PyModule_AddObject(m, "Uo", (PyObject*)space_Uo);
 
   PyObject* space_Ux(NULL);
   space_Ux = space_create(Cartesian::space::Ux);
   Py_INCREF(space_Ux);
+  sConstants[1] = space_Ux;
   PyModule_AddObject(m, "Ux", (PyObject*)space_Ux);
 
   PyObject* space_Uy(NULL);
   space_Uy = space_create(Cartesian::space::Uy);
   Py_INCREF(space_Uy);
+  sConstants[2] = space_Uy;
   PyModule_AddObject(m, "Uy", (PyObject*)space_Uy);
 
   PyObject* space_Uz(NULL);
   space_Uz = space_create(Cartesian::space::Uz);
   Py_INCREF(space_Uz);
+  sConstants[3] = space_Uz;
   PyModule_AddObject(m, "Uz", (PyObject*)space_Uz);
 
+  // build configuration
+  PyModule_AddObject(m, "epsilon", PyFloat_FromDouble(Cartesian::space::epsilon));
+  PyModule_AddIntConstant(m, "print_precision", SPACE_PRINT_PRECISION);
+
+  return m;
 }
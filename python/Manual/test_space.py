@@ -1,9 +1,14 @@
-#!/usr/bin/env python
+#!/usr/bin/env python3
 
 """Unit tests for space objects."""
 
 import math
+import multiprocessing
+import os
+import pickle
 import random
+import struct
+import sys
 import time
 import unittest
 
@@ -130,6 +135,44 @@ class TestSpace(unittest.TestCase):
         self.assertRaises(TypeError, self.p1.y, 'some_string')
         self.assertRaises(TypeError, self.p1.z, 'some_string')
 
+    def test_too_many_args_constructor_exception(self):
+        """Test constructor with more than x, y, z"""
+        self.assertRaises(TypeError, space.space, 1, 2, 3, 4)
+
+
+    def test_mixed_keyword_constructor(self):
+        """Test positional and keyword constructor"""
+        a = space.space(1, z=3)
+        self.assertTrue(space.space(1, 0, 3) == a)
+
+
+    def test_member_assignment_exception(self):
+        """Test x, y, z members only take numbers"""
+        a = space.space()
+        def assign(value):
+            a.x = value
+        self.assertRaises(TypeError, assign, 'some_string')
+        a.x = 4 # ints convert
+        self.assertEqual(4.0, a.x)
+
+
+    def test_member_delete_exception(self):
+        """Test x, y, z members can not be deleted"""
+        a = space.space()
+        def delete():
+            del a.y
+        self.assertRaises(TypeError, delete)
+
+
+    def test_function_argument_exceptions(self):
+        """Test module function argument count and type checks"""
+        self.assertRaises(TypeError, space.cross, self.p1)
+        self.assertRaises(TypeError, space.cross, self.p1, self.p2, self.p1)
+        self.assertRaises(TypeError, space.dot, self.p1, 1.0)
+        self.assertRaises(TypeError, space.magnitude)
+        self.assertRaises(TypeError, space.normalized, 'some_string')
+
+
     # --------------------------------
     # ----- test unitary methods -----
     # --------------------------------
@@ -138,23 +181,29 @@ class TestSpace(unittest.TestCase):
     def test_str(self):
         """Test str"""
 
-        # %s precision is controlled by space.cpp and designed to match this test
-        a_str = '<space><x>%(x)s</x><y>%(y)s</y><z>%(z)s</z></space>' % {'x':self.p1.x,
-                                                                         'y':self.p1.y,
-                                                                         'z':self.p1.z}
+        # precision is set by the libSpace build, see mepsilon.c
+        digits = space.print_precision
+        a_str = '<space><x>%.*g</x><y>%.*g</y><z>%.*g</z></space>' % (digits, self.p1.x,
+                                                                      digits, self.p1.y,
+                                                                      digits, self.p1.z)
         self.assertEqual(a_str, str(self.p1))
 
 
     def test_repr(self):
         """Test repr"""
 
-        # %s precision is controlled by space.cpp and designed to match this test
-        a_repr = '(%(x)s, %(y)s, %(z)s)' % {'x':self.p1.x,
-                                            'y':self.p1.y,
-                                            'z':self.p1.z}
+        # precision is set by the libSpace build, see mepsilon.c
+        digits = space.print_precision
+        a_repr = '(%.*g, %.*g, %.*g)' % (digits, self.p1.x, digits, self.p1.y, digits, self.p1.z)
         self.assertEqual(a_repr, repr(self.p1))
 
 
+    def test_build_configuration(self):
+        """Test epsilon and print precision from the libSpace build"""
+        self.assertEqual(sys.float_info.epsilon, space.epsilon)
+        self.assertTrue(1 <= space.print_precision <= sys.float_info.dig + 2)
+
+
     def test_magnitude(self):
         """Test space magnitude"""
         root_sum_square = math.sqrt(self.p1.x*self.p1.x + self.p1.y*self.p1.y + self.p1.z*self.p1.z)
@@ -369,6 +418,180 @@ class TestSpace(unittest.TestCase):
         self.assertTrue(result == a)
 
 
+    def test_inplace_add_is_inplace(self):
+        """Test space += mutates and keeps the same object"""
+        a = space.space(1, 2, 3)
+        b = a
+        a += space.space(1, 1, 1)
+        self.assertTrue(a is b)
+        self.assertTrue(space.space(2, 3, 4) == b)
+
+
+    def test_inplace_subtract_is_inplace(self):
+        """Test space -= mutates and keeps the same object"""
+        a = space.space(1, 2, 3)
+        b = a
+        a -= space.space(1, 1, 1)
+        self.assertTrue(a is b)
+        self.assertTrue(space.space(0, 1, 2) == b)
+
+
+    def test_inplace_scale(self):
+        """Test space *= double (scale) in place"""
+        result = space.space(self.p1.x * 0.5,
+                             self.p1.y * 0.5,
+                             self.p1.z * 0.5)
+        a = self.p1
+        a *= 0.5
+        self.assertTrue(a is self.p1)
+        self.assertTrue(result == a)
+
+
+    def test_inplace_divide_is_inplace(self):
+        """Test space /= keeps the same object"""
+        a = space.space(2, 4, 6)
+        b = a
+        a /= 2
+        self.assertTrue(a is b)
+        self.assertTrue(space.space(1, 2, 3) == b)
+
+
+    def test_inplace_divide_by_zero(self):
+        """Test space /= 0"""
+        a = space.space(1, 2, 3)
+        def divide_zero():
+            b = a
+            b /= 0
+        self.assertRaises(space.Error, divide_zero)
+        self.assertTrue(space.space(1, 2, 3) == a)
+
+
+    def test_inplace_refcount(self):
+        """Test repeated space += does not leak or free the target"""
+        import sys
+        a = space.space()
+        before = sys.getrefcount(a)
+        for i in range(1000):
+            a += space.Ux
+        self.assertEqual(before, sys.getrefcount(a))
+        self.assertEqual(1000, a.x)
+
+
+    def test_inplace_constants(self):
+        """Test in place operators do not change the module constants"""
+        u = space.Ux
+        u += space.Uy
+        self.assertTrue(space.space(1, 1, 0) == u)
+        u = space.Uy
+        u -= space.Uz
+        u = space.Uz
+        u *= 2
+        u = space.Uo
+        u /= 2
+        self.assertTrue(space.space(1, 0, 0) == space.Ux)
+        self.assertTrue(space.space(0, 1, 0) == space.Uy)
+        self.assertTrue(space.space(0, 0, 1) == space.Uz)
+        self.assertTrue(space.space() == space.Uo)
+
+
+    # -------------------------
+    # ----- test free list -----
+    # -------------------------
+
+    def test_freelist_reuse(self):
+        """Test freed spaces are reused from the free list"""
+        space.set_freelist_max(100)
+        space.reset_freelist_stats()
+        for i in range(10):
+            a = self.p1 + self.p2
+            del a
+        stats = space.freelist_stats()
+        self.assertEqual(100, stats['max'])
+        self.assertTrue(stats['hits'] >= 9)
+
+
+    def test_freelist_disabled(self):
+        """Test set_freelist_max(0) disables the free list"""
+        old_max = space.set_freelist_max(0)
+        try:
+            space.reset_freelist_stats()
+            for i in range(10):
+                a = space.cross(self.p1, self.p2)
+                del a
+            stats = space.freelist_stats()
+            self.assertEqual(0, stats['size'])
+            self.assertEqual(0, stats['hits'])
+            self.assertEqual(10, stats['misses'])
+        finally:
+            space.set_freelist_max(old_max)
+
+
+    def test_freelist_clear(self):
+        """Test clear_freelist empties the free list"""
+        space.set_freelist_max(100)
+        a = [space.space(i) for i in range(20)]
+        del a
+        self.assertTrue(space.freelist_stats()['size'] >= 20)
+        space.clear_freelist()
+        self.assertEqual(0, space.freelist_stats()['size'])
+
+
+    def test_freelist_bad_max(self):
+        """Test negative free list max"""
+        self.assertRaises(ValueError, space.set_freelist_max, -1)
+
+
+    def test_freelist_subclass(self):
+        """Test subclasses are not pooled"""
+        class SubSpace(space.space):
+            pass
+        space.clear_freelist()
+        a = SubSpace(1, 2, 3)
+        del a
+        self.assertEqual(0, space.freelist_stats()['size'])
+        b = SubSpace(4, 5, 6)
+        self.assertEqual(4, b.x)
+
+
+    def test_pickle(self):
+        """Test pickle round trip at every protocol"""
+        for protocol in range(pickle.HIGHEST_PROTOCOL + 1):
+            a = pickle.loads(pickle.dumps(self.p1, protocol))
+            self.assertTrue(self.p1 == a)
+            self.assertEqual(space.space, type(a))
+
+
+    def test_subclass_construct(self):
+        """Test calling a subclass makes the subclass and runs its __init__"""
+        a = _Named(1, 2, 3, name='p')
+        self.assertEqual(_Named, type(a))
+        self.assertTrue(space.space(1, 2, 3) == a)
+        self.assertEqual('p', a.name)
+
+
+    def test_pickle_subclass(self):
+        """Test pickle keeps a subclass and its attributes"""
+        for protocol in range(pickle.HIGHEST_PROTOCOL + 1):
+            a = pickle.loads(pickle.dumps(_Named(1, 2, 3, 'p'), protocol))
+            self.assertEqual(_Named, type(a))
+            self.assertTrue(space.space(1, 2, 3) == a)
+            self.assertEqual('p', a.name)
+
+
+    def test_pickle_is_compact(self):
+        """Test a pickled space is about its three doubles"""
+        self.assertLess(len(pickle.dumps(self.p1, 2)), 64)
+
+
+    def test_getstate_setstate(self):
+        """Test __getstate__ and __setstate__ are (x, y, z)"""
+        self.assertEqual((self.p1.x, self.p1.y, self.p1.z), self.p1.__getstate__())
+        a = space.space()
+        a.__setstate__(self.p1.__getstate__())
+        self.assertTrue(self.p1 == a)
+        self.assertRaises(TypeError, a.__setstate__, (1.0, 2.0))
+
+
     def test_divide_by_zero1(self):
         """Test space / 0"""
         a1 = self.p1
@@ -379,8 +602,129 @@ class TestSpace(unittest.TestCase):
         """Test space / 0"""
         try:
             a1 = self.p1 / 0
-        except space.Error, err:
-            print type(err), err
+        except space.Error as err:
+            print(type(err), err)
+
+
+class _Named(space.space):
+    """space subclass with an attribute, module level so it pickles."""
+    def __init__(self, x=0, y=0, z=0, name=None):
+        space.space.__init__(self, x, y, z)
+        self.name = name
+
+
+def _fill_shared(a_shared, start, stop):
+    """multiprocessing worker, a_shared arrives attached by name."""
+    for i in range(start, stop):
+        a_shared[i] = space.space(i, 2 * i, 3 * i)
+    a_shared.close()
+
+
+class TestSharedSpaceArray(unittest.TestCase):
+
+    def setUp(self):
+        self.name = 'test_space_%d' % os.getpid()
+        self.shared = space.SharedSpaceArray(self.name, 10)
+
+
+    def tearDown(self):
+        self.shared.unlink()
+
+
+    def test_starts_zero(self):
+        """Test a new shared array is Uo"""
+        self.assertEqual(10, len(self.shared))
+        for i in range(10):
+            self.assertTrue(space.Uo == self.shared[i])
+
+
+    def test_set_get(self):
+        """Test item assignment and index errors"""
+        self.shared[3] = space.space(1, 2, 3)
+        self.assertTrue(space.space(1, 2, 3) == self.shared[3])
+        self.assertTrue(space.space(1, 2, 3) == self.shared[-7])
+        self.assertRaises(IndexError, lambda: self.shared[10])
+        self.assertRaises(TypeError, self.shared.__setitem__, 0, 1.0)
+
+
+    def test_attach_shares_memory(self):
+        """Test a second array with the same name sees the same data"""
+        other = space.SharedSpaceArray(self.name)
+        self.assertEqual(10, len(other))
+        self.shared[5] = space.space(4, 5, 6)
+        self.assertTrue(space.space(4, 5, 6) == other[5])
+        other.close()
+
+
+    def test_buffer(self):
+        """Test the buffer is a writable N x 3 double view"""
+        view = memoryview(self.shared)
+        self.assertEqual((10, 3), view.shape)
+        self.assertEqual('d', view.format)
+        self.assertFalse(view.readonly)
+        view.cast('B').cast('d')[3] = 7.0  # row 1 x
+        self.assertEqual(7.0, self.shared[1].x)
+        self.assertRaises(BufferError, self.shared.close)
+        view.release()
+        self.shared.close()
+        self.assertTrue(self.shared.closed)
+        self.assertRaises(ValueError, lambda: self.shared[0])
+
+
+    def test_pickle_attaches(self):
+        """Test unpickling attaches to the segment instead of copying"""
+        other = pickle.loads(pickle.dumps(self.shared))
+        self.assertLess(len(pickle.dumps(self.shared)), 100)
+        other[0] = space.space(1, 1, 1)
+        self.assertTrue(space.space(1, 1, 1) == self.shared[0])
+        other.close()
+
+
+    def test_workers(self):
+        """Test multiprocessing workers write into the same array"""
+        workers = [multiprocessing.Process(target=_fill_shared, args=(self.shared, i, i + 5))
+                   for i in (0, 5)]
+        for worker in workers:
+            worker.start()
+        for worker in workers:
+            worker.join()
+            self.assertEqual(0, worker.exitcode)
+        for i in range(10):
+            self.assertTrue(space.space(i, 2 * i, 3 * i) == self.shared[i])
+
+
+    def test_create_exists(self):
+        """Test creating an existing name fails"""
+        self.assertRaises(OSError, space.SharedSpaceArray, self.name, 10)
+
+
+    def test_attach_missing(self):
+        """Test attaching to a missing name fails"""
+        self.assertRaises(OSError, space.SharedSpaceArray, self.name + '_missing')
+
+
+    def test_size_overflow(self):
+        """Test a size too large to map fails before creating anything"""
+        name = self.name + '_huge'
+        self.assertRaises(OverflowError, space.SharedSpaceArray, name, sys.maxsize // 24 + 1)
+        self.assertRaises(OSError, space.SharedSpaceArray, name)
+
+
+    def test_negative_size(self):
+        """Test sizes below -1, the attach default, are rejected"""
+        self.assertRaises(ValueError, space.SharedSpaceArray, self.name + '_negative', -2)
+
+
+    @unittest.skipUnless(os.path.isdir('/dev/shm'), 'needs the segments in /dev/shm')
+    def test_bad_header_size(self):
+        """Test attaching fails when the header size is past the segment"""
+        self.shared.close()
+        for a_size in (11, 2**64 // 24 + 1, 2**63):
+            with open('/dev/shm/' + self.name, 'r+b') as segment:
+                segment.seek(8)
+                segment.write(struct.pack('=Q', a_size))
+            self.assertRaises(ValueError, space.SharedSpaceArray, self.name)
+
 
 
 if __name__ == '__main__':
@@ -4,6 +4,6 @@
 
 . ./setenv.sh
 
-python ./test_space.py "$@"
+python3 ./test_space.py "$@"
 
 # EoF
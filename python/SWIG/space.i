@@ -29,14 +29,107 @@
 // TODOs
 // 1) wrappers for static consts Ux, Uy, Uz, Uo
 // 2) make accessors look like properties, e.g. space a.x not a.x(), a.x = 4.0 not a.x(4.0)
-// 3) mixed operators like space * double
 //
+// Batch functions take and return N x 3 float64 NumPy arrays, one
+// x, y, z row per space, so a call over N spaces is one wrapper call
+// with no per element proxy objects. Inputs that already are C
+// contiguous float64 arrays are used in place, others are converted
+// once.
 
 %module space
 %{
+#define SWIG_FILE_WITH_INIT
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
 #include "space.h"
+
+// the batch typemaps treat arrays of Cartesian::space as N x 3 doubles.
+static_assert(sizeof(Cartesian::space) == 3 * sizeof(double),
+	      "Cartesian::space must be three packed doubles");
+
+// Returns a new reference to a C contiguous N x 3 float64 array for
+// an_object, without a copy if it already is one. NULL on error.
+static PyArrayObject* space_array_in(PyObject* an_object) {
+
+  PyObject* an_array(PyArray_FROMANY(an_object, NPY_DOUBLE, 2, 2, NPY_ARRAY_IN_ARRAY));
+
+  if (an_array == NULL)
+    return NULL;
+
+  if (PyArray_DIM((PyArrayObject*) an_array, 1) != 3) {
+    Py_DECREF(an_array);
+    PyErr_SetString(PyExc_ValueError, "expected an N x 3 array of x, y, z");
+    return NULL;
+  }
+
+  return (PyArrayObject*) an_array;
+}
+
+// new N x 3 float64 array. NULL on error.
+static PyObject* space_array_new(unsigned long a_size, Cartesian::space** a_data) {
+  npy_intp dims[2] = {(npy_intp) a_size, 3};
+  PyObject* an_array(PyArray_SimpleNew(2, dims, NPY_DOUBLE));
+  if (an_array != NULL)
+    *a_data = (Cartesian::space*) PyArray_DATA((PyArrayObject*) an_array);
+  return an_array;
+}
+
+static bool same_size(unsigned long a_size, unsigned long b_size) {
+  if (a_size == b_size)
+    return true;
+  PyErr_SetString(PyExc_ValueError, "arrays must have the same number of rows");
+  return false;
+}
 %}
 
+%init %{
+  import_array();
+%}
+
+// build configuration, from space_config.h written by the libSpace build.
+%constant double epsilon = SPACE_DOUBLE_EPSILON;
+%constant int print_precision = SPACE_PRINT_PRECISION;
+
+%include "exception.i"
+
+%exception {
+  try {
+    $action
+  } catch (Cartesian::SpaceError& err) {
+    SWIG_exception(SWIG_RuntimeError, err.what());
+  }
+}
+
+// ----- N x 3 array typemaps -----
+
+// (const Cartesian::space* SPACE_ARRAY, unsigned long SPACE_SIZE) is
+// filled from any N x 3 array like object.
+
+%typemap(in) (const Cartesian::space* SPACE_ARRAY, unsigned long SPACE_SIZE)
+  (PyArrayObject* an_array = NULL) {
+  an_array = space_array_in($input);
+  if (an_array == NULL)
+    SWIG_fail;
+  $1 = (const Cartesian::space*) PyArray_DATA(an_array);
+  $2 = (unsigned long) PyArray_DIM(an_array, 0);
+}
+
+%typemap(freearg) (const Cartesian::space* SPACE_ARRAY, unsigned long SPACE_SIZE) {
+  Py_XDECREF(an_array$argnum);
+}
+
+%typemap(typecheck, precedence=SWIG_TYPECHECK_DOUBLE_ARRAY)
+  (const Cartesian::space* SPACE_ARRAY, unsigned long SPACE_SIZE) {
+  $1 = PyArray_Check($input) || PySequence_Check($input);
+}
+
+%apply (const Cartesian::space* SPACE_ARRAY, unsigned long SPACE_SIZE) {
+  (const Cartesian::space* a, unsigned long a_size),
+  (const Cartesian::space* b, unsigned long b_size),
+  (const Cartesian::space* headings, unsigned long headings_size)
+};
+
 namespace Cartesian {
 
   class space{
@@ -70,17 +163,22 @@ namespace Cartesian {
       char* __str__() {
 	static const int bsz(128);
 	static char temp[bsz];
-	// hardcoded precision
-	snprintf(temp, bsz, "<space><x>%.12g</x><y>%.12g</y><z>%.12g</z></space>",
-		 $self->x(), $self->y(), $self->z());
+	// precision from space_config.h, written by the libSpace build
+	snprintf(temp, bsz, "<space><x>%.*g</x><y>%.*g</y><z>%.*g</z></space>",
+		 SPACE_PRINT_PRECISION, $self->x(),
+		 SPACE_PRINT_PRECISION, $self->y(),
+		 SPACE_PRINT_PRECISION, $self->z());
 	return &temp[0];
       }
 
       char* __repr__() {
-	static const int bsz(64);
+	static const int bsz(96);
 	static char temp[bsz];
-	// hardcoded precision
-	snprintf(temp, bsz, "(%.12g, %.12g, %.12g)", $self->x(), $self->y(), $self->z());
+	// precision from space_config.h, written by the libSpace build
+	snprintf(temp, bsz, "(%.*g, %.*g, %.*g)",
+		 SPACE_PRINT_PRECISION, $self->x(),
+		 SPACE_PRINT_PRECISION, $self->y(),
+		 SPACE_PRINT_PRECISION, $self->z());
 	return &temp[0];
       }
     }
@@ -96,8 +194,6 @@ namespace Cartesian {
     %rename(__sub__) operator-;
     %rename(__isub__) operator-=;
 
-    // TODO multiply and divide by doubles
-
     // other methods
     double magnitude();
     double magnitude2();
@@ -110,6 +206,42 @@ namespace Cartesian {
   space cross(const space& a, const space& b);
   double dot(const space& a, const space& b);
 
+  // ----- rotator -----
+
+  class rotator {
+  public:
+
+    static double deg2rad(const double& deg);
+    static double rad2deg(const double& rad);
+
+    rotator(const space& a_axis);
+    ~rotator();
+
+    const space& axis() const;
+    void axis(const space& a_axis);
+
+    space rotate(const space& a_heading, const double& a_radians);
+
+    %extend {
+      // one N x 3 array in, one out. rotate() rewrites the cached
+      // matrix, so it runs on a copy taken under the GIL, then
+      // releases the GIL while rotating.
+      PyObject* rotate_many(const Cartesian::space* headings, unsigned long headings_size,
+			    double a_radians) {
+	Cartesian::space* results(NULL);
+	PyObject* an_array(space_array_new(headings_size, &results));
+	if (an_array == NULL)
+	  return NULL;
+	Cartesian::rotator a_local(*$self);
+	Py_BEGIN_ALLOW_THREADS
+	a_local.rotate(headings, results, headings_size, a_radians);
+	Py_END_ALLOW_THREADS
+	return an_array;
+      }
+    }
+
+  };
+
   // extensions
 
   %extend space {
@@ -143,9 +275,85 @@ namespace Cartesian {
       return *$self;
     }
 
+    double __mul__(const space& rhs) {
+      return *$self * rhs; // dot product
+    }
+
+    space __mul__(double rhs) {
+      return *$self * rhs; // scale
+    }
+
+    space __rmul__(double lhs) {
+      return lhs * *$self;
+    }
+
+    space __truediv__(double rhs) {
+      return *$self / rhs;
+    }
+
+    space __div__(double rhs) { // python 2
+      return *$self / rhs;
+    }
+
+    %pythoncode %{
+      def __reduce__(self):
+          # pickles as space(x, y, z), not the SWIG pointer
+          return (space, (self.x(), self.y(), self.z()))
+    %}
+
 
   } // end extend space
 
 
 
 } // end namespace Cartesian
+
+
+// ----- batch functions -----
+
+%inline %{
+
+  // row by row cross products of two N x 3 arrays.
+  PyObject* cross_many(const Cartesian::space* a, unsigned long a_size,
+		       const Cartesian::space* b, unsigned long b_size) {
+    if (!same_size(a_size, b_size))
+      return NULL;
+    Cartesian::space* results(NULL);
+    PyObject* an_array(space_array_new(a_size, &results));
+    if (an_array == NULL)
+      return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Cartesian::cross(a, b, results, a_size);
+    Py_END_ALLOW_THREADS
+    return an_array;
+  }
+
+  // row by row dot products of two N x 3 arrays, length N.
+  PyObject* dot_many(const Cartesian::space* a, unsigned long a_size,
+		     const Cartesian::space* b, unsigned long b_size) {
+    if (!same_size(a_size, b_size))
+      return NULL;
+    npy_intp dims[1] = {(npy_intp) a_size};
+    PyObject* an_array(PyArray_SimpleNew(1, dims, NPY_DOUBLE));
+    if (an_array == NULL)
+      return NULL;
+    double* results((double*) PyArray_DATA((PyArrayObject*) an_array));
+    Py_BEGIN_ALLOW_THREADS
+    Cartesian::dot(a, b, results, a_size);
+    Py_END_ALLOW_THREADS
+    return an_array;
+  }
+
+  // each row of an N x 3 array normalized, zero rows become nan.
+  PyObject* normalized_many(const Cartesian::space* a, unsigned long a_size) {
+    Cartesian::space* results(NULL);
+    PyObject* an_array(space_array_new(a_size, &results));
+    if (an_array == NULL)
+      return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Cartesian::normalized(a, results, a_size);
+    Py_END_ALLOW_THREADS
+    return an_array;
+  }
+
+%}
@@ -0,0 +1 @@
+../../libSpace/space_config.h
\ No newline at end of file
@@ -3,12 +3,21 @@
 """Unit tests for space objects."""
 
 import math
+import pickle
 import random
+import threading
 import time
 import unittest
 
+import numpy
+
 import space
 
+# The space.i operators, pickle and batch functions have not yet been
+# run against a swig build of the module. Drop this skip once make test
+# passes with them.
+unbuilt = unittest.skip('TODO space.i additions not yet run against a swig build')
+
 
 class TestSpace(unittest.TestCase):
 
@@ -303,16 +312,16 @@ class TestSpace(unittest.TestCase):
         self.assertRaises(TypeError, lambda a: self.p1 - self.p2.x)
 
 
-    @unittest.skip('TODO implicit conversion constructor to make double space(x)?')
+    @unbuilt
     def test_space_times_double(self):
         """Test space * double (scale)"""
         scale = 0.5
-        result = self.p1.x * scale + self.p1.y * scale + self.p1.z * scale
-        a = self.p1 * scale
-        self.assertAlmostEqual(result, a, self.places)
+        result = space.space(self.p1.x() * scale, self.p1.y() * scale, self.p1.z() * scale)
+        self.assertTrue(result == self.p1 * scale)
+        self.assertTrue(result == scale * self.p1)
 
 
-    @unittest.skip('TODO needs space.i wrapper')
+    @unbuilt
     def test_space_times_space(self):
         """Test space * space dot product"""
         result = self.p1.x() * self.p2.x() + self.p1.y() * self.p2.y() + self.p1.z() * self.p2.z()
@@ -320,7 +329,7 @@ class TestSpace(unittest.TestCase):
         self.assertAlmostEqual(result, a, self.places)
 
 
-    @unittest.skip('TODO needs space.i wrapper')
+    @unbuilt
     def test_inplace_multiply(self):
         """Test space *= dot product"""
         result = self.p1.x() * self.p2.x() + self.p1.y() * self.p2.y() + self.p1.z() * self.p2.z()
@@ -363,34 +372,119 @@ class TestSpace(unittest.TestCase):
         c = space.cross(a, b)
         self.assertTrue(space.space(0.5, -0.5, 0) == c)
 
-    @unittest.skip('TODO needs space.i wrapper')
+    @unbuilt
     def test_divide(self):
         """Test divide (scale)"""
-        result = space.space(self.p1.x / 2.0,
-                             self.p1.y / 2.0,
-                             self.p1.z / 2.0)
+        result = space.space(self.p1.x() / 2.0,
+                             self.p1.y() / 2.0,
+                             self.p1.z() / 2.0)
         a = self.p1 / 2.0
         self.assertTrue(result == a)
 
 
-    @unittest.skip('TODO needs space.i wrapper')
+    @unbuilt
     def test_inplace_divide(self):
         """Test inplace divide (scale)"""
-        result = space.space(self.p1.x / 2.0,
-                             self.p1.y / 2.0,
-                             self.p1.z / 2.0)
+        result = space.space(self.p1.x() / 2.0,
+                             self.p1.y() / 2.0,
+                             self.p1.z() / 2.0)
         a = self.p1
         a /= 2.0
         self.assertTrue(result == a)
 
 
-    @unittest.skip('TODO TypeError?')
+    @unbuilt
+    def test_pickle(self):
+        """Test pickle round trip"""
+        for protocol in range(pickle.HIGHEST_PROTOCOL + 1):
+            a = pickle.loads(pickle.dumps(self.p1, protocol))
+            self.assertTrue(self.p1 == a)
+
+
+    @unbuilt
     def test_divide_by_zero(self):
         """Test space / 0"""
         a1 = self.p1
         self.assertRaises(RuntimeError, lambda a: a / 0.0, a1)
 
 
+@unbuilt
+class TestBatch(unittest.TestCase):
+
+    def setUp(self):
+        self.a = numpy.random.uniform(-1.0e3, 1.0e3, size=(100, 3))
+        self.b = numpy.random.uniform(-1.0e3, 1.0e3, size=(100, 3))
+
+
+    def test_cross_many(self):
+        """Test batch cross matches numpy"""
+        self.assertTrue(numpy.allclose(numpy.cross(self.a, self.b),
+                                       space.cross_many(self.a, self.b)))
+
+
+    def test_dot_many(self):
+        """Test batch dot matches numpy"""
+        results = space.dot_many(self.a, self.b)
+        self.assertEqual((100,), results.shape)
+        self.assertTrue(numpy.allclose((self.a * self.b).sum(axis=1), results))
+
+
+    def test_normalized_many(self):
+        """Test batch normalized matches normalized"""
+        results = space.normalized_many(self.a)
+        for row, result in zip(self.a, results):
+            a = space.space(*row).normalized()
+            self.assertTrue(numpy.allclose([a.x(), a.y(), a.z()], result))
+
+
+    def test_rotate_many(self):
+        """Test batch rotate matches rotate"""
+        a_rotator = space.rotator(space.space(1, 2, 3))
+        results = a_rotator.rotate_many(self.a, 0.75)
+        for row, result in zip(self.a, results):
+            a = a_rotator.rotate(space.space(*row), 0.75)
+            self.assertTrue(numpy.allclose([a.x(), a.y(), a.z()], result))
+
+
+    def test_rotate_many_threads(self):
+        """Test threads sharing a rotator with different angles"""
+        a_rotator = space.rotator(space.space(1, 2, 3))
+        headings = numpy.random.uniform(-1.0e3, 1.0e3, size=(8, 3))
+        angles = [0.1 * k for k in range(8)]
+        expected = [space.rotator(space.space(1, 2, 3)).rotate_many(headings, an_angle)
+                    for an_angle in angles]
+        failures = []
+
+        # many short calls, each releasing the GIL, so the threads
+        # interleave around the rotator's matrix updates.
+        def rotate(k):
+            for _ in range(5000):
+                if not numpy.array_equal(expected[k], a_rotator.rotate_many(headings, angles[k])):
+                    failures.append(k)
+
+        threads = [threading.Thread(target=rotate, args=(k,)) for k in range(len(angles))]
+        for a_thread in threads:
+            a_thread.start()
+        for a_thread in threads:
+            a_thread.join()
+        self.assertEqual([], failures)
+
+
+    def test_converts_input(self):
+        """Test batch functions accept lists and non contiguous arrays"""
+        expected = space.cross_many(self.a, self.b)
+        self.assertTrue(numpy.allclose(expected, space.cross_many(self.a.tolist(), self.b)))
+        self.assertTrue(numpy.allclose(expected, space.cross_many(numpy.asfortranarray(self.a), self.b)))
+
+
+    def test_bad_shapes(self):
+        """Test batch functions reject arrays that are not N x 3 or differ in N"""
+        self.assertRaises(ValueError, space.cross_many, self.a[:, :2], self.b[:, :2])
+        self.assertRaises(ValueError, space.dot_many, self.a, self.b[:10])
+        self.assertRaises(ValueError, space.normalized_many, numpy.zeros(3))
+
+
+
 if __name__ == '__main__':
     random.seed(time.time())
     unittest.main()
@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+
+"""Compares the call overhead of the Manual, Boost and SWIG space modules.
+
+All three modules are named space, so each one is timed in its own
+child process with its build directory first on sys.path. The parent
+collects the child reports and writes them as JSON or CSV.
+
+    $ ./bench_bindings.py                       # all built bindings, JSON
+    $ ./bench_bindings.py -b Manual -b SWIG -f csv -o bindings.csv
+
+For each operation the report has
+    ns_per_op      best of --repeat timing runs
+    blocks_per_op  python heap blocks still allocated per kept result
+    bytes_per_op   tracemalloc bytes still allocated per kept result
+and for each binding the peak RSS of its child process.
+
+The allocation counts only see the python allocator, e.g. SWIG's
+C++ new of the wrapped space is not counted, but its proxy object is.
+Operations a binding does not support are reported as unsupported.
+
+The SWIG path is unverified: it has not yet been run against a swig
+build of the module.
+"""
+
+import argparse
+import csv
+import glob
+import json
+import os
+import platform
+import resource
+import subprocess
+import sys
+import timeit
+
+
+BINDINGS = ('Manual', 'Boost', 'SWIG')
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+# ===========================
+# ===== binding helpers =====
+# ===========================
+
+def module_dir(binding):
+    """Returns the directory holding the built space module, or None."""
+
+    if binding == 'SWIG':
+        # swig builds _space.so and space.py in place.
+        found = glob.glob(os.path.join(HERE, 'SWIG', '_space*.so'))
+    else:
+        found = glob.glob(os.path.join(HERE, binding, 'build', 'lib*', 'space*.so'))
+
+    if not found:
+        return None
+
+    return os.path.dirname(found[0])
+
+
+def operations(binding):
+    """Returns (name, setup, statement) for each timed operation.
+
+    The bindings differ in spelling, e.g. SWIG x is a method and
+    normalized is a module function only in Manual.
+    """
+
+    if binding == 'SWIG':
+        get_x = 'a.x()'
+    else:
+        get_x = 'a.x'
+
+    if binding == 'Manual':
+        normalized = 'space.normalized(a)'
+    else:
+        normalized = 'a.normalized()'
+
+    return (
+        ('construct',  'space.space(1.0, 2.0, 3.0)'),
+        ('get x',      get_x),
+        ('add',        'a + b'),
+        ('subtract',   'a - b'),
+        ('multiply',   'a * b'),     # space * space dot product
+        ('scale',      'a * 2.0'),
+        ('divide',     'a / 2.0'),
+        ('cross',      'space.cross(a, b)'),
+        ('dot',        'space.dot(a, b)'),
+        ('normalized', normalized),
+        ('iadd',       'c += b'),
+        ('isub',       'c -= b'),
+        ('imul',       'c *= 1.0'),
+        ('idiv',       'c /= 1.0'),
+    )
+
+
+SETUP = ('import space\n'
+         'a = space.space(1.0, 2.0, 3.0)\n'
+         'b = space.space(0.5, 0.25, 0.125)\n'
+         'c = space.space(1.0, 2.0, 3.0)\n')
+
+
+# ========================
+# ===== child side =====
+# ========================
+
+def time_op(statement, loops, repeat):
+    """Returns the best ns per op or None if the binding does not support it."""
+    env = {}
+    exec(SETUP, env)
+    try:
+        exec(statement, env)
+    except Exception:
+        return None
+    best = min(timeit.repeat(statement, setup=SETUP, number=loops, repeat=repeat))
+    return best / loops * 1e9
+
+
+def allocations_op(statement, loops):
+    """Returns python heap (blocks, bytes) per op for results that are kept."""
+
+    import tracemalloc
+
+    env = {}
+    exec(SETUP, env)
+
+    # keep every result alive so its allocation is still counted.
+    code = compile('results[i] = ' + statement if '=' not in statement
+                   else statement + '\nresults[i] = c', '<bench>', 'exec')
+    env['results'] = [None] * loops
+
+    tracemalloc.start()
+    blocks_before = sys.getallocatedblocks()
+    bytes_before = tracemalloc.get_traced_memory()[0]
+
+    for i in range(loops):
+        env['i'] = i
+        exec(code, env)
+
+    bytes_after = tracemalloc.get_traced_memory()[0]
+    blocks_after = sys.getallocatedblocks()
+    tracemalloc.stop()
+
+    # the loop index int and the exec frame are noise, well under one block per op.
+    return ((blocks_after - blocks_before) / float(loops),
+            (bytes_after - bytes_before) / float(loops))
+
+
+def run_child(binding, loops, repeat):
+    """Runs in the child with the bindings space module on sys.path."""
+
+    import space
+
+    report = {'binding': binding,
+              'module': getattr(space, '__file__', None),
+              'python': platform.python_version(),
+              'ops': []}
+
+    for name, statement in operations(binding):
+
+        ns = time_op(statement, loops, repeat)
+
+        entry = {'op': name, 'statement': statement}
+
+        if ns is None:
+            entry['supported'] = False
+        else:
+            blocks, nbytes = allocations_op(statement, min(loops, 100000))
+            entry.update({'supported': True,
+                          'ns_per_op': round(ns, 2),
+                          'blocks_per_op': round(blocks, 3),
+                          'bytes_per_op': round(nbytes, 1)})
+
+        report['ops'].append(entry)
+
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if sys.platform != 'darwin':
+        rss *= 1024  # linux reports KiB, OS X bytes
+    report['peak_rss_bytes'] = rss
+
+    json.dump(report, sys.stdout)
+
+
+# =======================
+# ===== parent side =====
+# =======================
+
+def run_binding(binding, args):
+    """Runs one binding in a child process and returns its report."""
+
+    directory = module_dir(binding)
+
+    if directory is None:
+        return {'binding': binding, 'error': 'not built'}
+
+    env = dict(os.environ)
+    env['PYTHONPATH'] = os.pathsep.join([directory, env.get('PYTHONPATH', '')])
+
+    for library_path in ('LD_LIBRARY_PATH', 'DYLD_LIBRARY_PATH'):
+        env[library_path] = os.pathsep.join([os.path.join(HERE, '..', 'libSpace'),
+                                             env.get(library_path, '')])
+
+    command = [args.python, os.path.abspath(__file__),
+               '--child', binding,
+               '--loops', str(args.loops),
+               '--repeat', str(args.repeat)]
+
+    child = subprocess.run(command, env=env, cwd=directory,
+                           stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                           universal_newlines=True)
+
+    if child.returncode != 0:
+        return {'binding': binding, 'error': child.stderr.strip().splitlines()[-1:]}
+
+    return json.loads(child.stdout)
+
+
+def write_json(reports, output):
+    json.dump({'host': platform.node(),
+               'machine': platform.machine(),
+               'bindings': reports},
+              output, indent=2)
+    output.write('\n')
+
+
+def write_csv(reports, output):
+    writer = csv.writer(output)
+    writer.writerow(['binding', 'op', 'supported', 'ns_per_op',
+                     'blocks_per_op', 'bytes_per_op', 'peak_rss_bytes'])
+    for report in reports:
+        if 'error' in report:
+            writer.writerow([report['binding'], '', 'error', '', '', '', ''])
+            continue
+        for op in report['ops']:
+            writer.writerow([report['binding'], op['op'], op['supported'],
+                             op.get('ns_per_op', ''),
+                             op.get('blocks_per_op', ''),
+                             op.get('bytes_per_op', ''),
+                             report['peak_rss_bytes']])
+
+
+def print_table(reports):
+    """Human readable summary on stderr, ns per op side by side."""
+
+    reports = [r for r in reports if 'error' not in r]
+    if not reports:
+        return
+
+    header = '%-12s' % 'op' + ''.join('%14s' % r['binding'] for r in reports)
+    sys.stderr.write(header + '\n')
+
+    for k, (name, statement) in enumerate(operations('Manual')):
+        row = '%-12s' % name
+        for report in reports:
+            op = report['ops'][k]
+            row += '%14s' % ('%.1f ns' % op['ns_per_op'] if op['supported'] else '-')
+        sys.stderr.write(row + '\n')
+
+    sys.stderr.write('%-12s' % 'peak rss' +
+                     ''.join('%11.1f MB' % (r['peak_rss_bytes'] / 1e6) for r in reports) + '\n')
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('-b', '--binding', action='append', choices=BINDINGS,
+                        help='binding to run, repeat for more. Default all')
+    parser.add_argument('-n', '--loops', type=int, default=200000,
+                        help='loops per timing run')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+                        help='timing runs, best is reported')
+    parser.add_argument('-f', '--format', choices=('json', 'csv'), default='json')
+    parser.add_argument('-o', '--output', help='report file, default stdout')
+    parser.add_argument('--python', default=sys.executable,
+                        help='interpreter the bindings were built for')
+    parser.add_argument('--child', choices=BINDINGS, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.child:
+        run_child(args.child, args.loops, args.repeat)
+        sys.exit(0)
+
+    reports = [run_binding(binding, args) for binding in (args.binding or BINDINGS)]
+
+    print_table(reports)
+
+    output = open(args.output, 'w') if args.output else sys.stdout
+    try:
+        if args.format == 'csv':
+            write_csv(reports, output)
+        else:
+            write_json(reports, output)
+    finally:
+        if args.output:
+            output.close()